@@ -1,606 +1,710 @@
 #include <avr/interrupt.h>
 #include <avr/io.h>
-#include <stdio.h>
-#include <stdlib.h>
+#include <util/delay.h>
 #include <string.h>
 
 #include "gps.h"
 #include "statevars.h"
+#include "timebase.h"
 #include "uwrite.h"
 
-typedef struct {
-  uint8_t ready;
-  char sentence[GPS_SENTENCE_BUFF_SZ];
-} gps_buffer_t;
-
-static int8_t buffer_index;
-static uint8_t sentence_index;
-
-static gps_buffer_t gps_buffers[NUM_GPS_SENTENCE_BUFFS];
-
-static volatile uint8_t gps_no_buff_avail = 0;
-static volatile uint8_t gps_buff_overflow = 0;
-static volatile uint8_t gps_unexpected_start = 0;
-
-static uint8_t hexchar_to_dec(char c);
+#if GPS_PROTOCOL_UBX
+#include "ubx.h"
+#else
+#include "nmea.h"
+#endif
+
+#define GPS_RX_RING_MASK        (GPS_RX_RING_SZ - 1)
+
+#define GPS_STAMP_RING_MASK     (GPS_STAMP_RING_SZ - 1)
+
+#if (GPS_RX_RING_SZ & GPS_RX_RING_MASK) != 0
+#error "GPS_RX_RING_SZ must be a power of two"
+#endif
+
+#if (GPS_STAMP_RING_SZ & GPS_STAMP_RING_MASK) != 0
+#error "GPS_STAMP_RING_SZ must be a power of two"
+#endif
+
+// Whether c starts a sentence (or packet), given the char before it; the
+// arrival time of each start is latched. A UBX packet starts with a pair of
+// sync chars, as no single byte can be told apart from its payload; it's
+// stamped with the arrival of the first.
+#if GPS_PROTOCOL_UBX
+#define GPS_IS_PACKET_START(c, previous) \
+  ((c) == (char) UBX_SYNC_CHAR_2 && (previous) == (char) UBX_SYNC_CHAR_1)
+#else
+#define GPS_IS_PACKET_START(c, previous)  ((c) == GPS_SENTENCE_START)
+#endif
+
+// USART1 runs in double speed mode, which at 16 MHz gets closer to 115200
+// baud (2.1% error) than normal mode does (-3.5%)
+#define GPS_UBRR(baud)          ((F_CPU + 4UL * (baud)) / (8UL * (baud)) - 1)
+
+// The configuration is verified by waiting for this many fixes with valid
+// checksums. A receiver still at its default 1 Hz rate can't send enough.
+#define GPS_VERIFY_TIMEOUT_MS   2000
+#define GPS_VERIFY_FIXES        (1000 / GPS_UPDATE_PERIOD_MS)
+
+#define GPS_STR(x)              #x
+#define GPS_XSTR(x)             GPS_STR(x)
+
+// Single-producer/single-consumer byte ring. Only the ISR writes
+// gps_rx_head and only gps_update() writes gps_rx_tail.
+static char gps_rx_ring[GPS_RX_RING_SZ];
+static volatile uint16_t gps_rx_head;
+static volatile uint16_t gps_rx_tail;
+static volatile uint32_t gps_rx_overruns;
+
+static gps_stats_t gps_stats;
+
+// Start of the window over which rx_bytes_per_sec is measured
+static uint32_t rate_window_start;
+static uint32_t rate_window_bytes;
+
+// When the last GGA (or NAV-PVT) with a fix was decoded
+static uint32_t valid_fix_ticks;
+
+// Arrival time of each start in the receive ring, in the same order. The
+// ISR pushes one for every start it adds to the ring, and gps_update() pops
+// one for every start it takes out; each side tracks the char before, as
+// it went into the ring or came out of it.
+static uint32_t gps_stamp_ring[GPS_STAMP_RING_SZ];
+static volatile uint8_t gps_stamp_head;
+static volatile uint8_t gps_stamp_tail;
+static char gps_rx_last_char;         // added to the ring by the ISR
+static char gps_parsed_last_char;     // taken out of it
+#if GPS_PROTOCOL_UBX
+static uint32_t gps_sync_ticks;       // arrival of the last sync char 1
+#endif
+
+static gps_fix_t gps_fix;
+
+#if GPS_RAW_CAPTURE
+static gps_raw_sink_t gps_raw_sink;
+#endif
+
+// Arrival time of the sentence (or packet) currently being parsed, and of
+// the last start taken out of the receive ring
+static uint32_t packet_stamp;
+static uint32_t start_stamp;
+
+#if GPS_PROTOCOL_UBX
+static ubx_parser_t gps_parser;
+
+// Messages the receiver is to send once per fix on its UART1 (our USART1)
+static const uint8_t cfg_msg_nav_pvt[] = { UBX_CLASS_NAV, UBX_NAV_PVT, 1 };
+static const uint8_t cfg_msg_nav_dop[] = { UBX_CLASS_NAV, UBX_NAV_DOP, 1 };
+
+// One navigation solution per measurement, aligned to GPS time
+static const uint8_t cfg_rate[] = {
+  GPS_UPDATE_PERIOD_MS & 0xFF, GPS_UPDATE_PERIOD_MS >> 8,
+  0x01, 0x00,                 // navRate
+  0x01, 0x00                  // timeRef: GPS time
+};
+
+// UART1 at GPS_BAUD, 8N1; accepts UBX and NMEA, sends only UBX
+static const uint8_t cfg_prt_uart1[] = {
+  0x01, 0x00, 0x00, 0x00,     // port 1, reserved, txReady off
+  0xD0, 0x08, 0x00, 0x00,     // mode: 8 data bits, no parity, 1 stop bit
+  GPS_BAUD & 0xFF, (GPS_BAUD >> 8) & 0xFF,
+  (GPS_BAUD >> 16) & 0xFF, (GPS_BAUD >> 24) & 0xFF,
+  0x03, 0x00,                 // input protocols: UBX, NMEA
+  0x01, 0x00,                 // output protocols: UBX
+  0x00, 0x00, 0x00, 0x00      // flags, reserved
+};
+
+static void send_ubx_packet(uint8_t msg_class, uint8_t msg_id,
+                            const uint8_t * payload, uint16_t length);
+#else
+static nmea_parser_t gps_parser;
+
+// MTK receiver commands. PMTK314 selects the sentences sent once per fix,
+// in the order GLL, RMC, VTG, GGA, GSA, GSV, then reserved and
+// proprietary ones: only RMC, VTG, GGA and GSA are decoded.
+#define PMTK_SET_NMEA_OUTPUT    "PMTK314,0,1,1,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0"
+#define PMTK_SET_FIX_PERIOD     "PMTK220," GPS_XSTR(GPS_UPDATE_PERIOD_MS)
+#define PMTK_SET_BAUD           "PMTK251," GPS_XSTR(GPS_BAUD)
+
+static void send_pmtk_command(const char * command);
+#endif
+
+static void configure_receiver(void);
+static uint8_t feed_gps_parser(char c, gps_fix_t * fix);
+static void reset_gps_rx(void);
+static void send_gps_byte(uint8_t c);
+static void set_gps_baud(uint16_t ubrr);
+static void wait_for_gps_tx(void);
+static uint8_t verify_gps_output(uint8_t fixes);
+static void commit_gps_fix(void);
+static void update_gps_stats(uint16_t received);
 static void initialize_gps_statevars();
-static uint8_t parse_gpgga(char * s);
-static uint8_t parse_gpgsa(char * s);
-static uint8_t parse_gprmc(char * s);
-static uint8_t parse_gpvtg(char * s);
-static void parse_gps_sentence(char * sentence);
-static uint8_t validate_checksum(char * s);
+static void process_gps_char(char c);
 
 /* Interrupt Service Routine that triggers whenever a new character
- * is received from the GPS sensor. Adds the new char to a buffer
- * such that all chars from the same sentence are saved to the same
- * buffer. Each new sentence is saved to the first available buffer.
+ * is received from the GPS sensor. Adds the new char to the receive
+ * ring and latches the arrival time of each start. The char is dropped
+ * (and counted) if the ring, or the stamp ring, is full.
  */
 ISR (USART1_RX_vect) {
   char new_char = UDR1;
+  uint16_t next_head = (gps_rx_head + 1) & GPS_RX_RING_MASK;
 
-  // If a gps buffer hasn't been identified to be filled,
-  // look for the first available buffer to start writing to
-  if (buffer_index == -1) {
-    uint8_t i;
+  if (next_head == gps_rx_tail) {
+    gps_rx_overruns = gps_rx_overruns + 1;
+    return;
+  }
 
-    for (i = 0; i < NUM_GPS_SENTENCE_BUFFS; i++) {
-      if (gps_buffers[i].ready == 0) {
-        buffer_index = i;
-        sentence_index = 0;
-        break;
-      }
-    }
+  if (GPS_IS_PACKET_START(new_char, gps_rx_last_char)) {
+    uint8_t next_stamp = (gps_stamp_head + 1) & GPS_STAMP_RING_MASK;
 
-    // No available buffers were found
-    if (i == NUM_GPS_SENTENCE_BUFFS) {
-      gps_no_buff_avail = 1;
+    if (next_stamp == gps_stamp_tail) {
+      gps_rx_overruns = gps_rx_overruns + 1;
       return;
     }
+
+#if GPS_PROTOCOL_UBX
+    gps_stamp_ring[gps_stamp_head] = gps_sync_ticks;
+#else
+    gps_stamp_ring[gps_stamp_head] = timebase_now();
+#endif
+    gps_stamp_head = next_stamp;
   }
 
-  // If we received a sentence_start character while in the middle
-  // of populating a buffer, mark this as unexpected and prepare
-  // to overwrite the current buffer starting at the beginning
-  if (new_char == GPS_SENTENCE_START && sentence_index != 0) {
-    gps_unexpected_start = 1;
-    buffer_index = 0;
+#if GPS_PROTOCOL_UBX
+  if (new_char == (char) UBX_SYNC_CHAR_1) {
+    gps_sync_ticks = timebase_now();
   }
+#endif
 
-  // If we received a data character or and unexpected start or
-  // a legitimate start, then add the character to the buffer
-  if (new_char != GPS_SENTENCE_END) {
-    gps_buffers[buffer_index].sentence[sentence_index] = new_char; 
-    sentence_index = sentence_index + 1;
-
-    // Verify that the buffer has enough room for the carriage return,
-    // newline, and null chars. If there isn't enough room, rollback the index.
-    if (sentence_index == GPS_SENTENCE_BUFF_SZ - 2) {
-      buffer_index = buffer_index - 1;
-      gps_buff_overflow = 1;
-    }
+  gps_rx_ring[gps_rx_head] = new_char;
+  gps_rx_head = next_head;
+  gps_rx_last_char = new_char;
+}
 
-    return;
+/* Initializes the GPS USART and configures the receiver to send only the
+ * sentences (or UBX packets) we decode, every GPS_UPDATE_PERIOD_MS, at
+ * GPS_BAUD. The new configuration is verified by watching for fixes with
+ * valid checksums at the new baud rate; if they don't arrive, the USART is set
+ * back to the receiver's default baud rate.
+ * Returns one of the GPS_CONFIG_* values.
+ */
+uint8_t gps_init(void) {
+  uint8_t result = GPS_CONFIG_OK;
+
+  memset(&gps_fix, 0, sizeof(gps_fix_t));
+
+  // Talk to the receiver at its power-on baud rate, then follow it to
+  // the new one once all of the commands have been sent
+  set_gps_baud(GPS_UBRR(GPS_DEFAULT_BAUD));
+  configure_receiver();
+  wait_for_gps_tx();
+  set_gps_baud(GPS_UBRR(GPS_BAUD));
+
+  if (!verify_gps_output(GPS_VERIFY_FIXES)) {
+    set_gps_baud(GPS_UBRR(GPS_DEFAULT_BAUD));
+
+    if (verify_gps_output(1)) {
+      result = GPS_CONFIG_DEFAULT_BAUD;
+    } else {
+      result = GPS_CONFIG_NO_OUTPUT;
+    }
   }
 
-  // We received a newline character, so terminate the current sentence buffer
-  gps_buffers[buffer_index].sentence[sentence_index++] = new_char;
-  gps_buffers[buffer_index].sentence[sentence_index] = '\0';
-  gps_buffers[buffer_index].ready = 1;
+  reset_gps_rx();
+  memset(&gps_fix, 0, sizeof(gps_fix_t));
+
+  // Count only what arrives after the configuration
+  cli();
+  gps_rx_overruns = 0;
+  sei();
+
+  memset(&gps_stats, 0, sizeof(gps_stats_t));
+  rate_window_start = timebase_now();
+  rate_window_bytes = 0;
+  valid_fix_ticks = rate_window_start;
 
-  buffer_index = -1;
+  return result;
 }
 
-/* Initializes the GPS by enabling USART RX, setting the baud rate to 115200,
- * and resetting the buffer indexes.
+/* Enables USART1 RX (with its interrupt) and TX at the specified baud
+ * rate register value, and empties the receive ring
  */
-void gps_init(void) {
-  buffer_index = -1;
-  sentence_index = 0;
-
+static void set_gps_baud(uint16_t ubrr) {
   // Disable interrupts before configuring USART
   cli();
 
-  // Unset the flags, double speed, and comm mode bits
-  //UCSR0A = 0;
+  // Double speed mode; clear any pending transmit complete flag
+  UCSR1A = (1 << U2X1) | (1 << TXC1);
 
-  // Enable receive interrupt and receiving
+  // Enable receive interrupt and receiving, and transmitting so that
+  // the receiver can be configured
   UCSR1B = 0;
-  UCSR1B = (1 << RXCIE1) | (1 << RXEN1);
+  UCSR1B = (1 << RXCIE1) | (1 << RXEN1) | (1 << TXEN1);
 
   // Enable 8-bit character size
   // Asynchronous USART, no parity, 1 stop bit already set (default)
   UCSR1C = 0;
   UCSR1C = (1 << UCSZ01) | (1 << UCSZ00);
 
-  // Set baud rate to 115200
-  // f_osc / (UBRRn + 1) == 115200
-  // See Table 20.7 in the Atmel specs
-  UBRR1H = 0;
-  //UBRR1L = 8;
-  UBRR1L = 103; //baud = 9600
+  // f_osc / (8 * (UBRRn + 1)) == baud
+  // See Table 22-12 in the Atmel specs
+  UBRR1H = ubrr >> 8;
+  UBRR1L = ubrr & 0xFF;
 
   // Re-enable interrupts after USART configuration is complete
   sei();
 
+  reset_gps_rx();
+
   return;
 }
 
-/* Orchestrates the GPS data parsing and error messaging */
-void gps_update(void) {
-  initialize_gps_statevars();
-
-  if (gps_no_buff_avail == 1) {
-    statevars.status |= STATUS_GPS_NO_BUFF_AVAIL;
-    gps_no_buff_avail = 0;
-  }
-
-  if (gps_buff_overflow == 1) {
-    statevars.status |= STATUS_GPS_BUFF_OVERFLOW;
-    gps_buff_overflow = 0;
-  }
+/* Empties the receive ring and resets the parser */
+static void reset_gps_rx(void) {
+  cli();
+  gps_rx_head = 0;
+  gps_rx_tail = 0;
+  gps_stamp_head = 0;
+  gps_stamp_tail = 0;
+  gps_rx_last_char = 0;
+  sei();
+  gps_parsed_last_char = 0;
 
-  if (gps_unexpected_start == 1) {
-    statevars.status |= STATUS_GPS_UNEXPECT_START;
-    gps_unexpected_start = 0;
-  }
+#if GPS_PROTOCOL_UBX
+  ubx_init(&gps_parser);
+#else
+  nmea_init(&gps_parser);
+#endif
 
-  if (gps_buffers[0].ready == 1) {
-    //uwrite_print_buff("ready\r\n");
-    memcpy(statevars.gps_sentence0, gps_buffers[0].sentence, GPS_SENTENCE_BUFF_SZ); 
-    //parse_gps_sentence(statevars.gps_sentence0);
-    parse_gps_sentence(gps_buffers[0].sentence);
+  return;
+}
 
-    memset(gps_buffers[0].sentence, '\0', GPS_SENTENCE_BUFF_SZ);
-    gps_buffers[0].ready = 0;
-  }
+/* Waits up to GPS_VERIFY_TIMEOUT_MS for the specified number of fixes with
+ * valid checksums. Returns 1 if they arrived in time.
+ */
+static uint8_t verify_gps_output(uint8_t fixes) {
+  gps_fix_t fix;
+  uint8_t received = 0;
+  uint16_t elapsed_ms;
+  uint16_t head;
+  uint16_t tail = 0;
+
+  memset(&fix, 0, sizeof(gps_fix_t));
+  reset_gps_rx();
+
+  for (elapsed_ms = 0; elapsed_ms < GPS_VERIFY_TIMEOUT_MS; elapsed_ms++) {
+    cli();
+    head = gps_rx_head;
+    sei();
+
+    while (tail != head) {
+      char c = gps_rx_ring[tail];
+
+      if (GPS_IS_PACKET_START(c, gps_parsed_last_char)) {
+        gps_stamp_tail = (gps_stamp_tail + 1) & GPS_STAMP_RING_MASK;
+      }
+      gps_parsed_last_char = c;
 
-  if (gps_buffers[1].ready == 1) {
-    //uwrite_print_buff("ready\r\n");
-    memcpy(statevars.gps_sentence1, gps_buffers[1].sentence, GPS_SENTENCE_BUFF_SZ); 
-    //parse_gps_sentence(statevars.gps_sentence1);
-    parse_gps_sentence(gps_buffers[1].sentence);
+      if (feed_gps_parser(c, &fix) && (fix.updated & GPS_FIX_GGA)) {
+        fix.updated = 0;
+        received = received + 1;
+      }
+      tail = (tail + 1) & GPS_RX_RING_MASK;
+    }
 
-    memset(gps_buffers[1].sentence, '\0', GPS_SENTENCE_BUFF_SZ);
-    gps_buffers[1].ready = 0;
-  }
+    cli();
+    gps_rx_tail = tail;
+    sei();
 
-  if (gps_buffers[2].ready == 1) {
-    //uwrite_print_buff("ready\r\n");
-    memcpy(statevars.gps_sentence2, gps_buffers[2].sentence, GPS_SENTENCE_BUFF_SZ); 
-    //parse_gps_sentence(statevars.gps_sentence2);
-    parse_gps_sentence(gps_buffers[2].sentence);
+    if (received >= fixes) {
+      return 1;
+    }
 
-    memset(gps_buffers[2].sentence, '\0', GPS_SENTENCE_BUFF_SZ);
-    gps_buffers[2].ready = 0;
+    _delay_ms(1);
   }
 
-  if (gps_buffers[3].ready == 1) {
-    //uwrite_print_buff("ready\r\n");
-    memcpy(statevars.gps_sentence3, gps_buffers[3].sentence, GPS_SENTENCE_BUFF_SZ); 
-    //parse_gps_sentence(statevars.gps_sentence3);
-    parse_gps_sentence(gps_buffers[3].sentence);
-
-    memset(gps_buffers[3].sentence, '\0', GPS_SENTENCE_BUFF_SZ);
-    gps_buffers[3].ready = 0;
-  }
+  return 0;
+}
 
-  return;
+/* Feeds a received char to the parser; returns 1 if it completed a
+ * sentence (or packet) that was decoded
+ */
+static uint8_t feed_gps_parser(char c, gps_fix_t * fix) {
+#if GPS_PROTOCOL_UBX
+  return ubx_feed(&gps_parser, c, fix) == UBX_PACKET_VALID;
+#else
+  return nmea_feed(&gps_parser, c, fix) == NMEA_SENTENCE_VALID;
+#endif
 }
 
-/* Resets all GPS-related statevars to zero. */
-static void initialize_gps_statevars() {
-  statevars.gps_latitude = 0.0;
-  statevars.gps_longitude = 0.0;
-  statevars.gps_hdop = 0.0;
-  statevars.gps_pdop = 0.0;
-  statevars.gps_vdop = 0.0;
-  statevars.gps_msl_altitude_m = 0.0;
-  statevars.gps_true_hdg_deg = 0.0;
-  statevars.gps_ground_course_deg = 0.0;
-  statevars.gps_speed_kmph = 0.0;
-  statevars.gps_ground_speed_kt = 0.0;
-  statevars.gps_speed_kt = 0.0;
-  statevars.gps_hours = 0;
-  statevars.gps_minutes = 0;
-  statevars.gps_seconds = 0.0;
-  memset(statevars.gps_date, 0, GPS_DATE_WIDTH);
-  statevars.gps_satcount = 0;
+/* Orchestrates the GPS data parsing and error messaging */
+void gps_update(void) {
+  uint16_t head;
+  uint16_t tail = gps_rx_tail;
+  uint32_t overruns;
 
-  return;
-}
+  initialize_gps_statevars();
 
-/* Parses the specified GPGGA sentence and saves the values of interest
- * to the statevars variable.
- *
- * Note: The current implementation is destructive because it uses strtok()
- * to tokenize the sentence. The ',' delimeters will be overwritten with
- * null chars.
- *
- * Returns 0 if successful; 1 otherwise
- */
-static uint8_t parse_gpgga(char * s) {
-  char field_buf[GPS_FIELD_BUFF_SZ];
-  memset(field_buf, '\0', GPS_FIELD_BUFF_SZ);
-
-  // $GPGGA header - ignore
-  s = strtok(s, ",");
-
-  // UTC Time - hhmmss.sss
-  s = strtok(NULL, ",");
-  strncpy(field_buf, s, 2);
-  statevars.gps_hours = atoi(field_buf);
-
-  memset(field_buf, '\0', GPS_FIELD_BUFF_SZ);
-  strncpy(field_buf, s+2, 2);
-  statevars.gps_minutes = atoi(field_buf);
-
-  memset(field_buf, '\0', GPS_FIELD_BUFF_SZ);
-  strncpy(field_buf, s+4, 6);
-  statevars.gps_seconds = atof(field_buf);
-
-  // Latitude - ddmm.mmmm
-  s = strtok(NULL, ",");
-  memset(field_buf, '\0', GPS_FIELD_BUFF_SZ);
-  strncpy(field_buf, s, 2);
-  uint8_t lat_degrees = atoi(field_buf);
-
-  memset(field_buf, '\0', GPS_FIELD_BUFF_SZ);
-  strncpy(field_buf, s+2, 7);
-  float lat_minutes = atof(field_buf);
-
-  // Latitude Hemisphere
-  s = strtok(NULL, ",");
-  uint8_t lat_is_south;
-  if (*s == 'N') {
-    lat_is_south = 0;
-  } else if (*s == 'S') {
-    lat_is_south = 1;
-  } else {
-    statevars.status |= STATUS_GPS_UNEXPECT_VAL;
-    return 1;
-  }
+  cli();
+  head = gps_rx_head;
+  overruns = gps_rx_overruns;
+  sei();
 
-  // Longitude - dddmm.mmmm
-  s = strtok(NULL, ",");
-  memset(field_buf, '\0', GPS_FIELD_BUFF_SZ);
-  strncpy(field_buf, s, 3);
-  uint8_t long_degrees = atoi(field_buf);
-
-  memset(field_buf, '\0', GPS_FIELD_BUFF_SZ);
-  strncpy(field_buf, s+3, 7);
-  float long_minutes = atof(field_buf);
-
-  // Longitude Hemisphere
-  s = strtok(NULL, ",");
-  uint8_t long_is_west;
-  if (*s == 'W') {
-    long_is_west = 1;
-  } else if (*s == 'E') {
-    long_is_west = 0;
-  } else {
-    statevars.status |= STATUS_GPS_UNEXPECT_VAL;
-    return 1;
+  if (overruns != gps_stats.rx_overruns) {
+    statevars.status |= STATUS_GPS_RX_OVERRUN;
+    gps_stats.rx_overruns = overruns;
   }
 
-  float latitude = lat_degrees + (lat_minutes / 60.0);
-  if (lat_is_south) {
-    latitude = -latitude;
+  uint16_t fill = (head - tail) & GPS_RX_RING_MASK;
+  if (fill > gps_stats.rx_peak_fill) {
+    gps_stats.rx_peak_fill = fill;
   }
 
-  float longitude = long_degrees + (long_minutes / 60.0);
-  if (long_is_west) {
-    longitude = -longitude;
+#if GPS_RAW_CAPTURE
+  // Hand the new bytes to the raw sink where they are in the ring; they
+  // are in two pieces if they wrap around its end
+  if (gps_raw_sink != NULL && tail != head) {
+    if (head > tail) {
+      gps_raw_sink(&gps_rx_ring[tail], head - tail);
+    } else {
+      gps_raw_sink(&gps_rx_ring[tail], GPS_RX_RING_SZ - tail);
+      if (head != 0) {
+        gps_raw_sink(gps_rx_ring, head);
+      }
+    }
   }
+#endif
 
-  statevars.gps_latitude = latitude;
-  statevars.gps_longitude = longitude;
+  // Parse everything received since the last update
+  while (tail != head) {
+    char c = gps_rx_ring[tail];
 
-  // Position (Fix) Indicator
-  s = strtok(NULL, ",");
-  // If there is no fix, set an error flag and error out
-  if (*s == GPS_NO_FIX) {
-    statevars.status |= STATUS_GPS_NO_FIX_AVAIL;
-    return 1;
+    if (GPS_IS_PACKET_START(c, gps_parsed_last_char)) {
+      start_stamp = gps_stamp_ring[gps_stamp_tail];
+      gps_stamp_tail = (gps_stamp_tail + 1) & GPS_STAMP_RING_MASK;
+    }
+    gps_parsed_last_char = c;
+
+    process_gps_char(c);
+    tail = (tail + 1) & GPS_RX_RING_MASK;
   }
 
-  // Satellite Count
-  s = strtok(NULL, ",");
-  statevars.gps_satcount = atoi(s);
+  // A 16-bit store isn't atomic on the AVR
+  cli();
+  gps_rx_tail = tail;
+  sei();
+
+  // Before the fix is committed, which clears its updated and error bits
+  update_gps_stats(fill);
+  commit_gps_fix();
 
-  // Horizontal Dilution of Precision (HDOP)
-  s = strtok(NULL, ",");
-  statevars.gps_hdop = atof(s);
+  return;
+}
 
-  // Mean Sea Level Altitude
-  s = strtok(NULL, ",");
-  statevars.gps_msl_altitude_m = atof(s);
+#if GPS_RAW_CAPTURE
+void gps_set_raw_sink(gps_raw_sink_t sink) {
+  gps_raw_sink = sink;
 
-  return 0;
+  return;
 }
+#endif
 
-// pdop, vdop
-static uint8_t parse_gpgsa(char * s) {
-  char field_buf[GPS_FIELD_BUFF_SZ];
-  memset(field_buf, '\0', GPS_FIELD_BUFF_SZ);
+#if GPS_PROTOCOL_UBX
+/* Feeds a received byte to the parser */
+static void process_gps_char(char c) {
+  uint8_t result = ubx_feed(&gps_parser, c, &gps_fix);
 
-  // $GPGSA header - ignore
-  s = strtok(s, ",");
+  // A sync pair in a payload was stamped too, but doesn't start a packet
+  if (ubx_packet_started(&gps_parser)) {
+    packet_stamp = start_stamp;
+  }
 
-  // Mode 1 - ignore
-  s = strtok(NULL, ",");
+  switch (result) {
+    case UBX_PACKET_VALID:
+      if (gps_parser.msg_id == UBX_NAV_PVT) {
+        gps_fix.stamp_ticks = packet_stamp;
+        gps_stats.decoded[GPS_STATS_GGA]++;
+      } else {
+        gps_stats.decoded[GPS_STATS_GSA]++;
+      }
+      break;
 
-  // Mode 2 - ignore
-  s = strtok(NULL, ",");
+    case UBX_PACKET_IGNORED:
+      gps_stats.ignored++;
+      break;
 
-  // Satellite Used (12 total) - ignore all
-  // Note: empty fields (e.g., ",,,,") will be skipped by strtok
-  // So we'll look for the first occurrence of a field with a decimal point.
-  // This first occurrence will be the PDOP field.
-  uint8_t i;
-  for (i = 0; i < 12; i++) {
-    s = strtok(NULL, ",");
+    case UBX_BAD_CHECKSUM:
+      gps_stats.checksum_failures++;
+      break;
 
-    // We found the PDOP field
-    if (*(s + 1) == '.') {
+    case UBX_BAD_LENGTH:
+      statevars.status |= STATUS_GPS_BUFF_OVERFLOW;
+      gps_stats.overflows++;
       break;
-    }
   }
 
-  // Position Dilution of Precision (PDOP)
-  // We only advance the cursor if all satellite fields contained values.
-  // If there is at least one unused satellite field, then the cursor would
-  // already be pointing to the PDOP field.
-  if (i == 12) {
-    s = strtok(NULL, ",");
+  return;
+}
+
+/* Frames the payload as a UBX packet and sends it to the receiver */
+static void send_ubx_packet(uint8_t msg_class, uint8_t msg_id,
+                            const uint8_t * payload, uint16_t length) {
+  uint8_t header[UBX_HEADER_LENGTH] = {
+    UBX_SYNC_CHAR_1, UBX_SYNC_CHAR_2, msg_class, msg_id,
+    length & 0xFF, length >> 8
+  };
+  uint8_t ck_a = 0;
+  uint8_t ck_b = 0;
+  uint16_t i;
+
+  for (i = 0; i < UBX_HEADER_LENGTH; i++) {
+    // The checksum doesn't cover the sync chars
+    if (i >= 2) {
+      UBX_CHECKSUM_ADD(ck_a, ck_b, header[i]);
+    }
+    send_gps_byte(header[i]);
   }
-  statevars.gps_pdop = atof(s);
 
-  // HDOP - ignore (we get this from $GPGGA)
-  s = strtok(NULL, ",");
+  for (i = 0; i < length; i++) {
+    UBX_CHECKSUM_ADD(ck_a, ck_b, payload[i]);
+    send_gps_byte(payload[i]);
+  }
 
-  // Vertical Dilution of Precision (VDOP)
-  s = strtok(NULL, ",");
-  statevars.gps_vdop = atof(s);
+  send_gps_byte(ck_a);
+  send_gps_byte(ck_b);
 
-  return 0;
+  return;
 }
 
-// speed over ground, course over ground, date, magnetic variation
-static uint8_t parse_gprmc(char * s) {
-  char field_buf[GPS_FIELD_BUFF_SZ];
-  memset(field_buf, '\0', GPS_FIELD_BUFF_SZ);
-
-  // $GPRMC header - ignore
-  s = strtok(s, ",");
-
-  // UTC Time - ignore (we get this from $GPGGA)
-  s = strtok(NULL, ",");
-
-  // Status
-  s = strtok(NULL, ",");
-  // 'A' == data valid; anything else is an error
-  // FYI: 'V' == data not valid
-  if (*s != 'A') {
-    statevars.status |= STATUS_GPS_DATA_NOT_VALID;
-    return 1;
+#else
+/* Feeds a received char to the parser */
+static void process_gps_char(char c) {
+  if (c == GPS_SENTENCE_START) {
+    packet_stamp = start_stamp;
   }
 
-  // Latitude - ignore (we get this from $GPGGA)
-  s = strtok(NULL, ",");
+  switch (nmea_feed(&gps_parser, c, &gps_fix)) {
+    case NMEA_SENTENCE_VALID:
+      switch (gps_parser.type) {
+        case NMEA_TYPE_GGA:
+          gps_fix.stamp_ticks = packet_stamp;
+          gps_stats.decoded[GPS_STATS_GGA]++;
+          break;
+        case NMEA_TYPE_GSA:
+          gps_stats.decoded[GPS_STATS_GSA]++;
+          break;
+        case NMEA_TYPE_RMC:
+          gps_stats.decoded[GPS_STATS_RMC]++;
+          break;
+        case NMEA_TYPE_VTG:
+          gps_stats.decoded[GPS_STATS_VTG]++;
+          break;
+      }
+      break;
 
-  // Latitude Hemisphere - ignore (we get this from $GPGGA)
-  s = strtok(NULL, ",");
+    case NMEA_SENTENCE_IGNORED:
+      gps_stats.ignored++;
+      break;
 
-  // Longitude - ignore (we get this from $GPGGA)
-  s = strtok(NULL, ",");
+    case NMEA_BAD_CHECKSUM:
+      gps_stats.checksum_failures++;
+      break;
 
-  // Longitude Hemisphere - ignore (we get this from $GPGGA)
-  s = strtok(NULL, ",");
+    case NMEA_OVERFLOW:
+      statevars.status |= STATUS_GPS_BUFF_OVERFLOW;
+      gps_stats.overflows++;
+      break;
 
-  // Speed over ground
-  s = strtok(NULL, ",");
-  statevars.gps_ground_speed_kt = atof(s);
+    case NMEA_UNEXPECTED_START:
+      statevars.status |= STATUS_GPS_UNEXPECT_START;
+      gps_stats.unexpected_starts++;
+      break;
+  }
 
-  // True course over ground
-  s = strtok(NULL, ",");
-  statevars.gps_ground_course_deg = atof(s);
+  return;
+}
 
-  // Date - ddmmyy
-  s = strtok(NULL, ",");
-  strncpy(statevars.gps_date, s, GPS_FIELD_BUFF_SZ);
+/* Sends a $PMTK command with its checksum */
+static void send_pmtk_command(const char * command) {
+  static const char hex[] = "0123456789ABCDEF";
+  uint8_t checksum = 0;
 
-  // Ignoring Magnetic variation - ignoring; this won't exist because we
-  // haven't configured the GPS sensor to produce this value
+  send_gps_byte(GPS_SENTENCE_START);
 
-  // Ignoring Magnetic variation direction
+  while (*command != '\0') {
+    checksum ^= *command;
+    send_gps_byte(*command);
+    command++;
+  }
 
-  // Ignoring Mode field
+  send_gps_byte('*');
+  send_gps_byte(hex[checksum >> 4]);
+  send_gps_byte(hex[checksum & 0x0F]);
+  send_gps_byte('\r');
+  send_gps_byte('\n');
 
-  return 0;
+  return;
 }
+#endif
 
-// true course in deg, speed in knots, speed in km/hr
-static uint8_t parse_gpvtg(char * s) {
-  char field_buf[GPS_FIELD_BUFF_SZ];
-  memset(field_buf, '\0', GPS_FIELD_BUFF_SZ);
-
-  // $GPVTG header - ignore
-  s = strtok(s, ",");
-
-  // Course - True heading
-  // only write the course value to statevars if the reference field that follows
-  // is valid
-  s = strtok(NULL, ",");
-  float true_hdg_deg = atof(s);
-
-  // Course reference
-  s = strtok(NULL, ",");
-  if (*s != 'T') {
-    statevars.status |= STATUS_GPS_UNEXPECT_VAL;
-    return 1; 
-  }
-  statevars.gps_true_hdg_deg = true_hdg_deg;
-
-  // Course - Magnetic heading - won't exist for us since we haven't configured
-  // the gps sensor to provide this. This should point to the next field ('M').
-  s = strtok(NULL, ",");
-
-  // Course reference - ignore (belongs with course magnetic heading)
-  // Note: We don't need to advance the cursor since the previous field doesn't
-  // exist
-  //s = strtok(NULL, ",");
-
-  // Horizontal speed in knots
-  // only write the speed value to statevars if the reference field that follows
-  // is valid
-  s = strtok(NULL, ",");
-  float speed_knots = atof(s);
-
-  // Speed reference
-  s = strtok(NULL, ",");
-  if (*s != 'N') {
-    statevars.status |= STATUS_GPS_UNEXPECT_VAL;
-    return 1;
-  }
-  statevars.gps_speed_kt = speed_knots;
+/* Sends the commands that select the output, update rate and baud rate.
+ * The baud rate is changed last since the receiver switches to it as soon
+ * as it has the command.
+ */
+static void configure_receiver(void) {
+#if GPS_PROTOCOL_UBX
+  send_ubx_packet(UBX_CLASS_CFG, UBX_CFG_MSG,
+                  cfg_msg_nav_pvt, sizeof(cfg_msg_nav_pvt));
+  send_ubx_packet(UBX_CLASS_CFG, UBX_CFG_MSG,
+                  cfg_msg_nav_dop, sizeof(cfg_msg_nav_dop));
+  send_ubx_packet(UBX_CLASS_CFG, UBX_CFG_RATE,
+                  cfg_rate, sizeof(cfg_rate));
+
+  // Also switches the output from NMEA to UBX
+  send_ubx_packet(UBX_CLASS_CFG, UBX_CFG_PRT,
+                  cfg_prt_uart1, sizeof(cfg_prt_uart1));
+#else
+  send_pmtk_command(PMTK_SET_NMEA_OUTPUT);
+  send_pmtk_command(PMTK_SET_FIX_PERIOD);
+  send_pmtk_command(PMTK_SET_BAUD);
+#endif
 
-  // Horizontal speed in kmph
-  // only write the speed value to statevars if the reference field that follows
-  // is valid
-  s = strtok(NULL, ",");
-  float speed_kmph = atof(s);
+  return;
+}
 
-  // Speed reference
-  s = strtok(NULL, ",");
-  if (*s != 'K') {
-    statevars.status |= STATUS_GPS_UNEXPECT_VAL;
-    return 1;
+/* Waits for the USART1 transmit buffer to empty, then sends the byte */
+static void send_gps_byte(uint8_t c) {
+  while (!(UCSR1A & (1 << UDRE1))) {
+    ;
   }
-  statevars.gps_speed_kmph = speed_kmph;
 
-  // Ignoring Mode field
+  UDR1 = c;
 
-  return 0;
+  return;
 }
 
-/* Parses the specified NMEA sentence and saves the values of interest
- * to the statevars variable
+/* Waits until the last byte sent has been shifted out. The transmit
+ * complete flag was cleared when the USART was configured.
  */
-static void parse_gps_sentence(char * sentence) {
-  if (strncmp(sentence, GPGGA_START, START_LENGTH) == 0) {
-    // ---- DEBUG 
-    uwrite_print_buff("GPGGA found!\r\n");
-    uwrite_print_buff(sentence);
-    // Copy the GPGGA sentence to statevars regardless of checksum; and
-    // include any null chars as well (versus strcpy)
-    memcpy(statevars.gps_sentence0, sentence, GPS_SENTENCE_BUFF_SZ);
-
-    // Parse the sentence only if the checksum is valid
-    if (validate_checksum(sentence) == 1) {
-      parse_gpgga(sentence);
-      // TODO: Consider changing the macro to STATUS_GPS_VALID_GPGGA_RCVD
-      statevars.status |= STATUS_GPS_GPGGA_RCVD;
-    }
-  } else if (strncmp(sentence, GPGSA_START, START_LENGTH) == 0) {
-    // ---- DEBUG
-    uwrite_print_buff("GPGSA found!\r\n");
-    uwrite_print_buff(sentence);
-
-    memcpy(statevars.gps_sentence1, sentence, GPS_SENTENCE_BUFF_SZ);
-
-    if (validate_checksum(sentence) == 1) {
-      parse_gpgsa(sentence);
-      statevars.status |= STATUS_GPS_GPGSA_RCVD;
-    }
-  } else if (strncmp(sentence, GPRMC_START, START_LENGTH) == 0) {
-    // ---- DEBUG
-    uwrite_print_buff("GPRMC found!\r\n");
-    uwrite_print_buff(sentence);
+static void wait_for_gps_tx(void) {
+  while (!(UCSR1A & (1 << TXC1))) {
+    ;
+  }
 
-    memcpy(statevars.gps_sentence2, sentence, GPS_SENTENCE_BUFF_SZ);
+  return;
+}
 
-    if (validate_checksum(sentence) == 1) {
-      parse_gprmc(sentence);
-      statevars.status |= STATUS_GPS_GPRMC_RCVD;
-    }
-  } else if (strncmp(sentence, GPVTG_START, START_LENGTH) == 0) {
-    // ---- DEBUG
-    uwrite_print_buff("GPVTG found!\r\n");
-    uwrite_print_buff(sentence);
+/* Updates the counters that depend on the time, then copies them all to
+ * the statevars. received is the number of bytes parsed by this update.
+ */
+static void update_gps_stats(uint16_t received) {
+  uint32_t now = timebase_now();
+  uint32_t elapsed = now - rate_window_start;
+
+  gps_stats.rx_bytes += received;
+  rate_window_bytes += received;
+
+  if (elapsed >= TIMEBASE_TICKS_PER_SEC) {
+    // Good for windows of up to 6 minutes at 115200 baud
+    gps_stats.rx_bytes_per_sec = (rate_window_bytes * 1000UL) /
+                                 (elapsed / (TIMEBASE_TICKS_PER_SEC / 1000));
+    rate_window_start = now;
+    rate_window_bytes = 0;
+  }
 
-    memcpy(statevars.gps_sentence3, sentence, GPS_SENTENCE_BUFF_SZ);
+  if ((gps_fix.updated & GPS_FIX_GGA) &&
+      !(gps_fix.errors & (GPS_FIX_ERR_NO_FIX | GPS_FIX_ERR_UNEXPECT_VAL))) {
+    valid_fix_ticks = gps_fix.stamp_ticks;
+  }
+  gps_stats.valid_fix_age_ticks = now - valid_fix_ticks;
 
-    if (validate_checksum(sentence) == 1) {
-      parse_gpvtg(sentence);
-      statevars.status |= STATUS_GPS_GPVTG_RCVD;
-    }
-  } else {
-    // We don't care about the GPGSV sentences
-    // ---- DEBUG
-    uwrite_print_buff("GPGSV ignored\r\n");
-  } 
+  statevars.gps_stats = gps_stats;
 
   return;
 }
 
-/* Returns the decimal value of the specified char if the char is a valid
- * hexadecimal char; returns an error byte if the specified char is invalid.
- */
-static uint8_t hexchar_to_dec(char c) {
-  if (c >= '0' && c <= '9') {
-    return c - '0';
-  } else if (c >= 'A' && c <= 'F') {
-    return c - 'A' + 10;
-  }
+/* Resets all GPS-related statevars to zero. */
+static void initialize_gps_statevars() {
+  statevars.gps_latitude_e7 = 0;
+  statevars.gps_longitude_e7 = 0;
+  statevars.gps_hdop_x100 = 0;
+  statevars.gps_pdop_x100 = 0;
+  statevars.gps_vdop_x100 = 0;
+  statevars.gps_msl_altitude_cm = 0;
+  statevars.gps_true_hdg_cdeg = 0;
+  statevars.gps_ground_course_cdeg = 0;
+  statevars.gps_speed_kmph_x100 = 0;
+  statevars.gps_ground_speed_kt_x100 = 0;
+  statevars.gps_speed_kt_x100 = 0;
+  statevars.gps_hours = 0;
+  statevars.gps_minutes = 0;
+  statevars.gps_seconds = 0;
+  statevars.gps_milliseconds = 0;
+  memset(statevars.gps_date, 0, GPS_DATE_WIDTH);
+  statevars.gps_satcount = 0;
+  statevars.gps_fix_ticks = 0;
+  statevars.gps_fix_age_ticks = 0;
 
-  return GPS_INVALID_HEX_CHAR;
+  return;
 }
 
-/* Validates the checksum of the specified NMEA sentence
- * Returns 1 if calculated checksum matched the received checksum;
- * Returns 0 otherwise
+/* Copies the sentences decoded by the parser since the last update
+ * to the statevars variable
  */
-static uint8_t validate_checksum(char * s) {
-  uint8_t checksum = 0;
-  uint8_t s_cursor;
-
-  // Calculate the checksum of the received characters in the sentence.
-  // Note: only the characters between '$' and '*' are used
-  for (s_cursor = 1; s_cursor < GPS_SENTENCE_BUFF_SZ; s_cursor++) {
-    if (*(s + s_cursor) != '*') {
-      checksum ^= *(s + s_cursor);
-    } else {
-      break;
-    }
+static void commit_gps_fix(void) {
+  const gps_fix_t fix = gps_fix;
+
+  gps_fix.updated = 0;
+  gps_fix.errors = 0;
+
+  if (fix.updated & GPS_FIX_GGA) {
+    statevars.gps_hours = fix.hours;
+    statevars.gps_minutes = fix.minutes;
+    statevars.gps_seconds = fix.seconds;
+    statevars.gps_milliseconds = fix.milliseconds;
+    statevars.gps_latitude_e7 = fix.latitude_e7;
+    statevars.gps_longitude_e7 = fix.longitude_e7;
+    statevars.gps_satcount = fix.satcount;
+    statevars.gps_hdop_x100 = fix.hdop_x100;
+    statevars.gps_msl_altitude_cm = fix.msl_altitude_cm;
+    statevars.gps_fix_ticks = fix.stamp_ticks;
+    statevars.gps_fix_age_ticks = timebase_now() - fix.stamp_ticks;
+    // TODO: Consider changing the macro to STATUS_GPS_VALID_GPGGA_RCVD
+    statevars.status |= STATUS_GPS_GPGGA_RCVD;
   }
 
-  // Advance the cursor to the position of the checksum's first char
-  s_cursor++;
+  if (fix.updated & GPS_FIX_GSA) {
+    statevars.gps_pdop_x100 = fix.pdop_x100;
+    statevars.gps_vdop_x100 = fix.vdop_x100;
+    statevars.status |= STATUS_GPS_GPGSA_RCVD;
+  }
 
-  // Verify that there was no overflow by checking whether the cursor
-  // went beyond the buffer limit, possibly due to not finding a '*'
-  if (s_cursor + GPS_CHECKSUM_LENGTH >= GPS_SENTENCE_BUFF_SZ) {
-    return 0;
+  if (fix.updated & GPS_FIX_RMC) {
+    statevars.gps_ground_speed_kt_x100 = fix.ground_speed_kt_x100;
+    statevars.gps_ground_course_cdeg = fix.ground_course_cdeg;
+    memcpy(statevars.gps_date, fix.date, GPS_DATE_WIDTH);
+    statevars.status |= STATUS_GPS_GPRMC_RCVD;
   }
 
-  // Convert the most significant and least significant nibbles of
-  // the checksum byte
-  uint8_t chk_upper = hexchar_to_dec(s[s_cursor]);
-  uint8_t chk_lower = hexchar_to_dec(s[s_cursor + 1]);
+  if (fix.updated & GPS_FIX_VTG) {
+    statevars.gps_true_hdg_cdeg = fix.true_hdg_cdeg;
+    statevars.gps_speed_kt_x100 = fix.speed_kt_x100;
+    statevars.gps_speed_kmph_x100 = fix.speed_kmph_x100;
+    statevars.status |= STATUS_GPS_GPVTG_RCVD;
+  }
 
-  // Verify no error occurred during the conversion
-  if (chk_upper == GPS_INVALID_HEX_CHAR || chk_lower == GPS_INVALID_HEX_CHAR) {
-    return 0;
+  if (fix.errors & GPS_FIX_ERR_NO_FIX) {
+    statevars.status |= STATUS_GPS_NO_FIX_AVAIL;
   }
 
-  // Assemble the expected checksum provided by the GPS receiver
-  uint8_t expected_checksum = (chk_upper << 4) | chk_lower;
+  if (fix.errors & GPS_FIX_ERR_UNEXPECT_VAL) {
+    statevars.status |= STATUS_GPS_UNEXPECT_VAL;
+  }
 
-  if (checksum == expected_checksum) {
-    return 1;
+  if (fix.errors & GPS_FIX_ERR_NOT_VALID) {
+    statevars.status |= STATUS_GPS_DATA_NOT_VALID;
   }
 
-  return 0;
+  return;
 }
-
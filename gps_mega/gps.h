@@ -1,25 +1,70 @@
 #ifndef _GPS_H_
 #define _GPS_H_
 
-#define GPGGA_START             "$GPGGA"
-#define GPGSA_START             "$GPGSA"
-#define GPRMC_START             "$GPRMC"
-#define GPVTG_START             "$GPVTG"
-#define START_LENGTH            6
-#define GPS_CHECKSUM_LENGTH     2
-#define GPS_INVALID_HEX_CHAR    0xFF
-#define GPS_FIELD_BUFF_SZ       8
-#define GPS_NO_FIX              '0'
-#define GPS_TIME_WIDTH          6
-#define GPS_SENTENCE_BUFF_SZ    128
-#define GPS_SENTENCE_END        '\n'
+#include <stdint.h>
+
+#define GPS_RX_RING_SZ          1024  // must be a power of two; holds more
+                                      // than one 250 ms loop of 10 Hz output
+#define GPS_STAMP_RING_SZ       32    // must be a power of two; arrival
+                                      // times of the sentences in the ring
 #define GPS_SENTENCE_START      '$'
-#define LAT_LONG_FIELD_LENGTH   9
-#define NUM_GPS_SENTENCE_BUFFS  4
 
-void gps_init(void);
+#define GPS_DEFAULT_BAUD        9600  // the receiver's power-on baud rate
+#define GPS_BAUD                115200
+#define GPS_UPDATE_PERIOD_MS    100   // 10 Hz
 
-void gps_update(void);
+// Set to 1 to have gps_update() pass every received byte, unparsed, to a
+// raw sink (e.g., a separate log stream) before decoding it
+#ifndef GPS_RAW_CAPTURE
+#define GPS_RAW_CAPTURE         0
+#endif
+
+// Indexes of gps_stats_t.decoded
+#define GPS_STATS_GGA           0     // or UBX NAV-PVT
+#define GPS_STATS_GSA           1     // or UBX NAV-DOP
+#define GPS_STATS_RMC           2
+#define GPS_STATS_VTG           3
+#define GPS_STATS_NUM_TYPES     4
 
+// Counters kept by gps_update() since gps_init(). Unlike the status bits
+// they aren't cleared every loop, so a log shows how often things happen.
+typedef struct {
+  uint32_t decoded[GPS_STATS_NUM_TYPES];  // valid sentences, by type
+  uint32_t ignored;             // valid sentences of types not decoded
+  uint32_t checksum_failures;
+  uint32_t overflows;           // sentences longer than the NMEA limit
+                                // (UBX: packets with a bad length)
+  uint32_t unexpected_starts;
+  uint32_t rx_overruns;         // bytes dropped because the ring was full
+  uint32_t rx_bytes;
+  uint16_t rx_bytes_per_sec;    // over the last second or so
+  uint16_t rx_peak_fill;        // most bytes ever waiting in the ring
+  uint32_t valid_fix_age_ticks; // time since the last GGA with a fix
+} gps_stats_t;
+
+// Values returned by gps_init()
+#define GPS_CONFIG_OK           0     // output verified at GPS_BAUD
+#define GPS_CONFIG_DEFAULT_BAUD 1     // fell back to GPS_DEFAULT_BAUD
+#define GPS_CONFIG_NO_OUTPUT    2     // no valid output at either baud rate
+
+// Set to 1 (make GPS_PROTOCOL=UBX) to have the receiver send UBX-NAV-PVT
+// packets instead of NMEA sentences
+#ifndef GPS_PROTOCOL_UBX
+#define GPS_PROTOCOL_UBX        0
 #endif
 
+uint8_t gps_init(void);
+
+#if GPS_RAW_CAPTURE
+/* Receives bytes straight out of the receive ring; they are only valid
+ * until the sink returns
+ */
+typedef void (*gps_raw_sink_t)(const char * bytes, uint16_t length);
+
+/* Sets the function that receives the raw bytes; NULL disables it */
+void gps_set_raw_sink(gps_raw_sink_t sink);
+#endif
+
+void gps_update(void);
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * File: gps_fix.h
+ *
+ * Defines the decoded GPS fix that is produced by the GPS sentence parser
+ * and committed to the statevars by gps_update().
+ *
+ * All values are scaled integers so that no floating point is needed to
+ * decode them. Positions are kept in 1e-7 degrees, which preserves every
+ * digit of a ddmm.mmmmm coordinate (a 32-bit float does not).
+ */
+#ifndef _GPS_FIX_H_
+#define _GPS_FIX_H_
+
+#include <stdint.h>
+
+#define GPS_FIX_DATE_WIDTH        8
+
+// Sentence types that have been committed to a fix (gps_fix_t.updated)
+#define GPS_FIX_GGA               (1 << 0)
+#define GPS_FIX_GSA               (1 << 1)
+#define GPS_FIX_RMC               (1 << 2)
+#define GPS_FIX_VTG               (1 << 3)
+
+// Problems found while decoding a sentence (gps_fix_t.errors)
+#define GPS_FIX_ERR_NO_FIX        (1 << 0)
+#define GPS_FIX_ERR_UNEXPECT_VAL  (1 << 1)
+#define GPS_FIX_ERR_NOT_VALID     (1 << 2)
+
+typedef struct {
+  uint8_t  updated;
+  uint8_t  errors;
+  int32_t  latitude_e7;         // degrees * 10^7
+  int32_t  longitude_e7;        // degrees * 10^7
+  uint16_t hdop_x100;
+  uint16_t pdop_x100;
+  uint16_t vdop_x100;
+  int32_t  msl_altitude_cm;
+  uint16_t true_hdg_cdeg;       // degrees * 100
+  uint16_t ground_course_cdeg;  // degrees * 100
+  uint16_t speed_kmph_x100;
+  uint16_t ground_speed_kt_x100;
+  uint16_t speed_kt_x100;
+  uint8_t  hours;
+  uint8_t  minutes;
+  uint8_t  seconds;
+  uint16_t milliseconds;
+  char     date[GPS_FIX_DATE_WIDTH];
+  uint8_t  satcount;
+  uint32_t stamp_ticks;         // when the GGA (or NAV-PVT) began to arrive
+} gps_fix_t;
+
+#endif /* _GPS_FIX_H_ */
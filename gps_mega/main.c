@@ -6,6 +6,7 @@
 #include <string.h>
 #include "gps.h"
 #include "statevars.h"
+#include "timebase.h"
 #include "uwrite.h"
 
 #include <util/delay.h>
@@ -14,6 +15,7 @@ static void print_gpgga_fields(void);
 static void print_gpgsa_fields(void);
 static void print_gprmc_fields(void);
 static void print_gpvtg_fields(void);
+static void print_gps_stats(void);
 
 statevars_t statevars;
 
@@ -23,10 +25,16 @@ int main(void) {
   memset(msg, 0, sizeof(msg));
 
   uwrite_init();
-  gps_init();
+  timebase_init();
+  uint8_t gps_config = gps_init();
 
   uwrite_print_buff("Starting...\r\n");
 
+  if (gps_config != GPS_CONFIG_OK) {
+    uwrite_print_buff("GPS configuration failed: ");
+    uwrite_println_byte(&gps_config);
+  }
+
   while (1) {
     statevars.status = 0;
 
@@ -44,47 +52,82 @@ int main(void) {
     // Print all $GPVTG fields that we are interested in
     print_gpvtg_fields();
 
+    // Print the GPS health and throughput counters
+    print_gps_stats();
+
     _delay_ms(250);
   }
 
   return 0;
 }
 
+static void print_gps_stats(void) {
+  gps_stats_t * stats = &statevars.gps_stats;
+
+  uwrite_print_buff("gga/gsa/rmc/vtg rcvd: ");
+  uwrite_println_long(&stats->decoded[GPS_STATS_GGA]);
+  uwrite_println_long(&stats->decoded[GPS_STATS_GSA]);
+  uwrite_println_long(&stats->decoded[GPS_STATS_RMC]);
+  uwrite_println_long(&stats->decoded[GPS_STATS_VTG]);
+  uwrite_print_buff("ignored: ");
+  uwrite_println_long(&stats->ignored);
+  uwrite_print_buff("bad checksums: ");
+  uwrite_println_long(&stats->checksum_failures);
+  uwrite_print_buff("overflows: ");
+  uwrite_println_long(&stats->overflows);
+  uwrite_print_buff("unexpected starts: ");
+  uwrite_println_long(&stats->unexpected_starts);
+  uwrite_print_buff("rx overruns: ");
+  uwrite_println_long(&stats->rx_overruns);
+  uwrite_print_buff("rx bytes/s: ");
+  uwrite_println_short(&stats->rx_bytes_per_sec);
+  uwrite_print_buff("rx peak fill: ");
+  uwrite_println_short(&stats->rx_peak_fill);
+  uwrite_print_buff("valid fix age (ticks): ");
+  uwrite_println_long(&stats->valid_fix_age_ticks);
+
+  return;
+}
+
 static void print_gpgga_fields(void) {
   uwrite_print_buff("hours: ");
   uwrite_println_byte(&statevars.gps_hours);
   uwrite_print_buff("minutes: ");
   uwrite_println_byte(&statevars.gps_minutes);
   uwrite_print_buff("seconds: ");
-  uwrite_println_long(&statevars.gps_seconds);
-  uwrite_print_buff("lat: ");
-  uwrite_println_long(&statevars.gps_latitude);
-  uwrite_print_buff("long: ");
-  uwrite_println_long(&statevars.gps_longitude);
+  uwrite_println_byte(&statevars.gps_seconds);
+  uwrite_print_buff("milliseconds: ");
+  uwrite_println_short(&statevars.gps_milliseconds);
+  uwrite_print_buff("lat (1e-7 deg): ");
+  uwrite_println_long(&statevars.gps_latitude_e7);
+  uwrite_print_buff("long (1e-7 deg): ");
+  uwrite_println_long(&statevars.gps_longitude_e7);
   uwrite_print_buff("sat count: ");
   uwrite_println_byte(&statevars.gps_satcount);
-  uwrite_print_buff("hdop: ");
-  uwrite_println_long(&statevars.gps_hdop);
-  uwrite_print_buff("msl alt: ");
-  uwrite_println_long(&statevars.gps_msl_altitude_m);
+  uwrite_print_buff("hdop (x100): ");
+  uwrite_println_short(&statevars.gps_hdop_x100);
+  uwrite_print_buff("msl alt (cm): ");
+  uwrite_println_long(&statevars.gps_msl_altitude_cm);
+  uwrite_print_buff("fix age (ticks): ");
+  uwrite_println_long(&statevars.gps_fix_age_ticks);
 
   return;
 }
 
 static void print_gpgsa_fields(void) {
-  uwrite_print_buff("pdop: ");
-  uwrite_println_long(&statevars.gps_pdop);
-  uwrite_print_buff("vdop: ");
-  uwrite_println_long(&statevars.gps_vdop);
+  uwrite_print_buff("pdop (x100): ");
+  uwrite_println_short(&statevars.gps_pdop_x100);
+  uwrite_print_buff("vdop (x100): ");
+  uwrite_println_short(&statevars.gps_vdop_x100);
 
   return;
 }
 
 static void print_gprmc_fields(void) {
-  uwrite_print_buff("gnd speed (kt): ");
-  uwrite_println_long(&statevars.gps_ground_speed_kt);
-  uwrite_print_buff("gnd course (deg): ");
-  uwrite_println_long(&statevars.gps_ground_course_deg);
+  uwrite_print_buff("gnd speed (kt x100): ");
+  uwrite_println_short(&statevars.gps_ground_speed_kt_x100);
+  uwrite_print_buff("gnd course (deg x100): ");
+  uwrite_println_short(&statevars.gps_ground_course_cdeg);
   uwrite_print_buff("date: ");
   uwrite_print_buff(statevars.gps_date);
   uwrite_print_buff("\r\n");
@@ -93,12 +136,12 @@ static void print_gprmc_fields(void) {
 }
 
 static void print_gpvtg_fields(void) {
-  uwrite_print_buff("true course (deg): ");
-  uwrite_println_long(&statevars.gps_true_hdg_deg);
-  uwrite_print_buff("speed (kt): ");
-  uwrite_println_long(&statevars.gps_speed_kt);
-  uwrite_print_buff("speed (kmph): ");
-  uwrite_println_long(&statevars.gps_speed_kmph);
+  uwrite_print_buff("true course (deg x100): ");
+  uwrite_println_short(&statevars.gps_true_hdg_cdeg);
+  uwrite_print_buff("speed (kt x100): ");
+  uwrite_println_short(&statevars.gps_speed_kt_x100);
+  uwrite_print_buff("speed (kmph x100): ");
+  uwrite_println_short(&statevars.gps_speed_kmph_x100);
  
   return;
 }
@@ -0,0 +1,509 @@
+/*
+ * File: nmea.c
+ *
+ * Streaming NMEA 0183 parser. Each call to nmea_feed() does a constant amount
+ * of work for the received character:
+ *   - the character is XORed into the running checksum
+ *   - digits are accumulated into the integer and fractional parts of the
+ *     current field; the first few characters are also kept as text
+ *   - at a field delimiter the field is handed to the decoder for the current
+ *     sentence type, which stores the value in a work area
+ *   - at the end of the checksum the work area is committed to the caller's
+ *     fix, but only if the checksum matched
+ */
+#include <string.h>
+
+#include "nmea.h"
+
+#define NMEA_STATE_WAIT_START   0
+#define NMEA_STATE_FIELDS       1
+#define NMEA_STATE_CHECKSUM_HI  2
+#define NMEA_STATE_CHECKSUM_LO  3
+
+#define NMEA_INVALID_HEX_CHAR   0xFF
+#define NMEA_NO_FIX             '0'
+
+#define NMEA_DEGREES_DIGITS     7     // positions are kept in 1e-7 degrees
+
+static const uint32_t powers_of_ten[NMEA_DEGREES_DIGITS + 1] = {
+  1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL
+};
+
+static void accumulate(nmea_parser_t * p, char c);
+static void begin_field(nmea_parser_t * p);
+static uint8_t commit_sentence(nmea_parser_t * p, gps_fix_t * fix);
+static void end_field(nmea_parser_t * p);
+static uint32_t field_fraction(const nmea_parser_t * p, uint8_t digits);
+static int32_t field_scaled(const nmea_parser_t * p, uint8_t digits);
+static uint8_t hexchar_to_dec(char c);
+static const struct nmea_sentence * lookup_sentence(const nmea_parser_t * p);
+
+#if NMEA_DECODE_GGA
+static int32_t field_degrees(const nmea_parser_t * p);
+static void decode_gga_field(nmea_parser_t * p);
+static void commit_gga(const gps_fix_t * work, gps_fix_t * fix);
+#endif
+#if NMEA_DECODE_GSA
+static void decode_gsa_field(nmea_parser_t * p);
+static void commit_gsa(const gps_fix_t * work, gps_fix_t * fix);
+#endif
+#if NMEA_DECODE_RMC
+static void decode_rmc_field(nmea_parser_t * p);
+static void commit_rmc(const gps_fix_t * work, gps_fix_t * fix);
+#endif
+#if NMEA_DECODE_VTG
+static void decode_vtg_field(nmea_parser_t * p);
+static void commit_vtg(const gps_fix_t * work, gps_fix_t * fix);
+#endif
+
+/* A sentence type the parser decodes. decode_field is called at the end of
+ * every field after the address; commit copies the decoded values to the
+ * caller's fix once the checksum has been verified.
+ */
+struct nmea_sentence {
+  uint16_t code;
+  uint8_t  type;
+  void (*decode_field)(nmea_parser_t * p);
+  void (*commit)(const gps_fix_t * work, gps_fix_t * fix);
+};
+
+// The sentence types that are compiled in. The talker ID isn't part of the
+// code, so the same decoder handles e.g. $GPGGA, $GNGGA, $GLGGA and $GAGGA.
+static const struct nmea_sentence sentences[] = {
+#if NMEA_DECODE_GGA
+  { NMEA_TYPE_CODE('G', 'G', 'A'), NMEA_TYPE_GGA, decode_gga_field, commit_gga },
+#endif
+#if NMEA_DECODE_GSA
+  { NMEA_TYPE_CODE('G', 'S', 'A'), NMEA_TYPE_GSA, decode_gsa_field, commit_gsa },
+#endif
+#if NMEA_DECODE_RMC
+  { NMEA_TYPE_CODE('R', 'M', 'C'), NMEA_TYPE_RMC, decode_rmc_field, commit_rmc },
+#endif
+#if NMEA_DECODE_VTG
+  { NMEA_TYPE_CODE('V', 'T', 'G'), NMEA_TYPE_VTG, decode_vtg_field, commit_vtg },
+#endif
+};
+
+#define NMEA_NUM_SENTENCES  (sizeof(sentences) / sizeof(sentences[0]))
+
+void nmea_init(nmea_parser_t * parser) {
+  memset(parser, 0, sizeof(nmea_parser_t));
+  parser->state = NMEA_STATE_WAIT_START;
+
+  return;
+}
+
+uint8_t nmea_feed(nmea_parser_t * p, char c, gps_fix_t * fix) {
+  uint8_t result = NMEA_IN_PROGRESS;
+
+  // A '$' always starts a new sentence, even if the previous one
+  // never finished
+  if (c == '$') {
+    if (p->state != NMEA_STATE_WAIT_START) {
+      result = NMEA_UNEXPECTED_START;
+    }
+
+    p->state = NMEA_STATE_FIELDS;
+    p->type = NMEA_TYPE_NONE;
+    p->sentence = NULL;
+    p->length = 1;
+    p->checksum = 0;
+    p->field_index = 0;
+    p->work.errors = 0;
+    begin_field(p);
+
+    return result;
+  }
+
+  if (p->state == NMEA_STATE_WAIT_START) {
+    return NMEA_IN_PROGRESS;
+  }
+
+  p->length = p->length + 1;
+  if (p->length > NMEA_MAX_SENTENCE_LEN) {
+    p->state = NMEA_STATE_WAIT_START;
+    return NMEA_OVERFLOW;
+  }
+
+  switch (p->state) {
+    case NMEA_STATE_FIELDS:
+      if (c == '*') {
+        end_field(p);
+        p->state = NMEA_STATE_CHECKSUM_HI;
+      } else if (c == '\r' || c == '\n') {
+        // The sentence ended without a checksum
+        p->state = NMEA_STATE_WAIT_START;
+        result = NMEA_BAD_CHECKSUM;
+      } else if (c == ',') {
+        p->checksum ^= c;
+        end_field(p);
+        p->field_index = p->field_index + 1;
+        begin_field(p);
+      } else {
+        p->checksum ^= c;
+        accumulate(p, c);
+      }
+      break;
+
+    case NMEA_STATE_CHECKSUM_HI:
+      p->expected_checksum = hexchar_to_dec(c);
+
+      if (p->expected_checksum == NMEA_INVALID_HEX_CHAR) {
+        p->state = NMEA_STATE_WAIT_START;
+        result = NMEA_BAD_CHECKSUM;
+      } else {
+        p->expected_checksum = p->expected_checksum << 4;
+        p->state = NMEA_STATE_CHECKSUM_LO;
+      }
+      break;
+
+    case NMEA_STATE_CHECKSUM_LO: {
+      uint8_t nibble = hexchar_to_dec(c);
+
+      p->state = NMEA_STATE_WAIT_START;
+
+      if (nibble == NMEA_INVALID_HEX_CHAR ||
+          (p->expected_checksum | nibble) != p->checksum) {
+        result = NMEA_BAD_CHECKSUM;
+      } else {
+        result = commit_sentence(p, fix);
+      }
+      break;
+    }
+  }
+
+  return result;
+}
+
+/* Clears the accumulators used for the next field */
+static void begin_field(nmea_parser_t * p) {
+  p->field_length = 0;
+  p->int_digits = 0;
+  p->frac_digits = 0;
+  p->seen_point = 0;
+  p->negative = 0;
+  p->int_part = 0;
+  p->frac_part = 0;
+  p->text[0] = '\0';
+
+  return;
+}
+
+/* Adds a single (non-delimiter) character to the current field */
+static void accumulate(nmea_parser_t * p, char c) {
+  if (c >= '0' && c <= '9') {
+    if (!p->seen_point) {
+      if (p->int_digits < NMEA_MAX_INT_DIGITS) {
+        p->int_part = p->int_part * 10 + (c - '0');
+        p->int_digits = p->int_digits + 1;
+      }
+    } else if (p->frac_digits < NMEA_MAX_FRAC_DIGITS) {
+      p->frac_part = p->frac_part * 10 + (c - '0');
+      p->frac_digits = p->frac_digits + 1;
+    }
+  } else if (c == '.') {
+    p->seen_point = 1;
+  } else if (c == '-') {
+    p->negative = 1;
+  }
+
+  if (p->field_length < NMEA_TEXT_LENGTH) {
+    p->text[p->field_length] = c;
+    p->text[p->field_length + 1] = '\0';
+  }
+  p->field_length = p->field_length + 1;
+
+  return;
+}
+
+/* Hands the completed field to the decoder for the current sentence type.
+ * Field 0 is the address (e.g., "GPGGA") which selects the decoder; after
+ * that each field costs a single indirect call.
+ */
+static void end_field(nmea_parser_t * p) {
+  if (p->field_index == 0) {
+    p->sentence = lookup_sentence(p);
+    if (p->sentence != NULL) {
+      p->type = p->sentence->type;
+      p->talker[0] = p->text[0];
+      p->talker[1] = p->text[1];
+    }
+    return;
+  }
+
+  if (p->sentence != NULL) {
+    p->sentence->decode_field(p);
+  }
+
+  return;
+}
+
+/* Returns the decoder for the address in the current field, or NULL if the
+ * sentence type isn't decoded. Proprietary sentences (e.g., $PMTK) and
+ * anything that isn't a two-letter talker ID plus three-letter type are
+ * ignored, as are the types we don't care about (e.g., GSV).
+ */
+static const struct nmea_sentence * lookup_sentence(const nmea_parser_t * p) {
+  const char * address = p->text;
+  uint8_t i;
+
+  if (p->field_length != 5 || address[0] == 'P') {
+    return NULL;
+  }
+
+  for (i = 2; i < 5; i++) {
+    if (address[i] < 'A' || address[i] > 'Z') {
+      return NULL;
+    }
+  }
+
+  uint16_t code = NMEA_TYPE_CODE(address[2], address[3], address[4]);
+
+  for (i = 0; i < NMEA_NUM_SENTENCES; i++) {
+    if (sentences[i].code == code) {
+      return &sentences[i];
+    }
+  }
+
+  return NULL;
+}
+
+/* Returns the fractional part of the current field with exactly the
+ * specified number of digits, e.g., ".5" with 2 digits is 50
+ */
+static uint32_t field_fraction(const nmea_parser_t * p, uint8_t digits) {
+  if (p->frac_digits > digits) {
+    return p->frac_part / powers_of_ten[p->frac_digits - digits];
+  }
+
+  return p->frac_part * powers_of_ten[digits - p->frac_digits];
+}
+
+/* Returns the value of the current field scaled by 10^digits,
+ * e.g., "-12.5" with 2 digits is -1250
+ */
+static int32_t field_scaled(const nmea_parser_t * p, uint8_t digits) {
+  int32_t value = p->int_part * powers_of_ten[digits] +
+                  field_fraction(p, digits);
+
+  if (p->negative) {
+    return -value;
+  }
+
+  return value;
+}
+
+#if NMEA_DECODE_GGA
+/* Returns the value of the current (d)ddmm.mmmm field in 1e-7 degrees */
+static int32_t field_degrees(const nmea_parser_t * p) {
+  uint32_t degrees = p->int_part / 100;
+  uint32_t minutes_e7 = (p->int_part % 100) * powers_of_ten[NMEA_DEGREES_DIGITS] +
+                        field_fraction(p, NMEA_DEGREES_DIGITS);
+
+  // Round to the nearest 1e-7 degree when converting minutes to degrees
+  return degrees * powers_of_ten[NMEA_DEGREES_DIGITS] + (minutes_e7 + 30) / 60;
+}
+// time, latitude, longitude, fix, satellite count, hdop, altitude
+static void decode_gga_field(nmea_parser_t * p) {
+  gps_fix_t * work = &p->work;
+
+  switch (p->field_index) {
+    case 1:   // UTC Time - hhmmss.sss
+      work->hours = p->int_part / 10000;
+      work->minutes = (p->int_part / 100) % 100;
+      work->seconds = p->int_part % 100;
+      work->milliseconds = field_fraction(p, 3);
+      break;
+    case 2:   // Latitude - ddmm.mmmm
+      work->latitude_e7 = field_degrees(p);
+      break;
+    case 3:   // Latitude Hemisphere
+      if (p->text[0] == 'S') {
+        work->latitude_e7 = -work->latitude_e7;
+      } else if (p->field_length != 0 && p->text[0] != 'N') {
+        work->errors |= GPS_FIX_ERR_UNEXPECT_VAL;
+      }
+      break;
+    case 4:   // Longitude - dddmm.mmmm
+      work->longitude_e7 = field_degrees(p);
+      break;
+    case 5:   // Longitude Hemisphere
+      if (p->text[0] == 'W') {
+        work->longitude_e7 = -work->longitude_e7;
+      } else if (p->field_length != 0 && p->text[0] != 'E') {
+        work->errors |= GPS_FIX_ERR_UNEXPECT_VAL;
+      }
+      break;
+    case 6:   // Position (Fix) Indicator
+      if (p->field_length == 0 || p->text[0] == NMEA_NO_FIX) {
+        work->errors |= GPS_FIX_ERR_NO_FIX;
+      }
+      break;
+    case 7:   // Satellite Count
+      work->satcount = p->int_part;
+      break;
+    case 8:   // Horizontal Dilution of Precision (HDOP)
+      work->hdop_x100 = field_scaled(p, 2);
+      break;
+    case 9:   // Mean Sea Level Altitude
+      work->msl_altitude_cm = field_scaled(p, 2);
+      break;
+  }
+
+  return;
+}
+
+static void commit_gga(const gps_fix_t * work, gps_fix_t * fix) {
+  fix->hours = work->hours;
+  fix->minutes = work->minutes;
+  fix->seconds = work->seconds;
+  fix->milliseconds = work->milliseconds;
+
+  if (!(work->errors & (GPS_FIX_ERR_NO_FIX | GPS_FIX_ERR_UNEXPECT_VAL))) {
+    fix->latitude_e7 = work->latitude_e7;
+    fix->longitude_e7 = work->longitude_e7;
+    fix->satcount = work->satcount;
+    fix->hdop_x100 = work->hdop_x100;
+    fix->msl_altitude_cm = work->msl_altitude_cm;
+  }
+
+  return;
+}
+#endif
+
+#if NMEA_DECODE_GSA
+// pdop, vdop
+static void decode_gsa_field(nmea_parser_t * p) {
+  // Fields 1-2 are the modes and 3-14 are the satellites used; since the
+  // fields are counted rather than tokenized, empty fields are fine here
+  switch (p->field_index) {
+    case 15:  // Position Dilution of Precision (PDOP)
+      p->work.pdop_x100 = field_scaled(p, 2);
+      break;
+    case 17:  // Vertical Dilution of Precision (VDOP)
+      p->work.vdop_x100 = field_scaled(p, 2);
+      break;
+  }
+
+  return;
+}
+
+static void commit_gsa(const gps_fix_t * work, gps_fix_t * fix) {
+  fix->pdop_x100 = work->pdop_x100;
+  fix->vdop_x100 = work->vdop_x100;
+
+  return;
+}
+#endif
+
+#if NMEA_DECODE_RMC
+// speed over ground, course over ground, date
+static void decode_rmc_field(nmea_parser_t * p) {
+  gps_fix_t * work = &p->work;
+
+  switch (p->field_index) {
+    case 2:   // Status - 'A' == data valid; 'V' == data not valid
+      if (p->text[0] != 'A') {
+        work->errors |= GPS_FIX_ERR_NOT_VALID;
+      }
+      break;
+    case 7:   // Speed over ground
+      work->ground_speed_kt_x100 = field_scaled(p, 2);
+      break;
+    case 8:   // True course over ground
+      work->ground_course_cdeg = field_scaled(p, 2);
+      break;
+    case 9:   // Date - ddmmyy
+      memcpy(work->date, p->text, GPS_FIX_DATE_WIDTH);
+      break;
+  }
+
+  return;
+}
+
+static void commit_rmc(const gps_fix_t * work, gps_fix_t * fix) {
+  if (!(work->errors & GPS_FIX_ERR_NOT_VALID)) {
+    fix->ground_speed_kt_x100 = work->ground_speed_kt_x100;
+    fix->ground_course_cdeg = work->ground_course_cdeg;
+    memcpy(fix->date, work->date, GPS_FIX_DATE_WIDTH);
+  }
+
+  return;
+}
+#endif
+
+#if NMEA_DECODE_VTG
+// true course in deg, speed in knots, speed in km/hr
+static void decode_vtg_field(nmea_parser_t * p) {
+  gps_fix_t * work = &p->work;
+
+  // Each value is followed by a reference field; the value is only used
+  // if its reference is the one we expect
+  switch (p->field_index) {
+    case 1:   // Course - True heading
+      work->true_hdg_cdeg = field_scaled(p, 2);
+      break;
+    case 2:
+      if (p->text[0] != 'T') {
+        work->errors |= GPS_FIX_ERR_UNEXPECT_VAL;
+      }
+      break;
+    case 5:   // Horizontal speed in knots
+      work->speed_kt_x100 = field_scaled(p, 2);
+      break;
+    case 6:
+      if (p->text[0] != 'N') {
+        work->errors |= GPS_FIX_ERR_UNEXPECT_VAL;
+      }
+      break;
+    case 7:   // Horizontal speed in kmph
+      work->speed_kmph_x100 = field_scaled(p, 2);
+      break;
+    case 8:
+      if (p->text[0] != 'K') {
+        work->errors |= GPS_FIX_ERR_UNEXPECT_VAL;
+      }
+      break;
+  }
+
+  return;
+}
+
+static void commit_vtg(const gps_fix_t * work, gps_fix_t * fix) {
+  if (!(work->errors & GPS_FIX_ERR_UNEXPECT_VAL)) {
+    fix->true_hdg_cdeg = work->true_hdg_cdeg;
+    fix->speed_kt_x100 = work->speed_kt_x100;
+    fix->speed_kmph_x100 = work->speed_kmph_x100;
+  }
+
+  return;
+}
+#endif
+
+/* Copies the values decoded from a sentence with a valid checksum
+ * to the fix. Only values that passed the sentence's checks are copied.
+ */
+static uint8_t commit_sentence(nmea_parser_t * p, gps_fix_t * fix) {
+  if (p->sentence == NULL) {
+    return NMEA_SENTENCE_IGNORED;
+  }
+
+  p->sentence->commit(&p->work, fix);
+  fix->updated |= p->sentence->type;
+  fix->errors |= p->work.errors;
+
+  return NMEA_SENTENCE_VALID;
+}
+
+/* Returns the decimal value of the specified char if the char is a valid
+ * hexadecimal char; returns an error byte if the specified char is invalid.
+ */
+static uint8_t hexchar_to_dec(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+
+  return NMEA_INVALID_HEX_CHAR;
+}
@@ -0,0 +1,99 @@
+/*
+ * File: nmea.h
+ *
+ * A streaming NMEA 0183 parser. Characters are fed in one at a time as they
+ * arrive from the receiver; the checksum, field boundaries and numeric values
+ * are all computed on the fly so a sentence never has to be rescanned. When a
+ * sentence with a valid checksum ends, its decoded values are committed to a
+ * gps_fix_t.
+ *
+ * This file has no AVR dependencies so that it can also be built on the host.
+ */
+#ifndef _NMEA_H_
+#define _NMEA_H_
+
+#include <stdint.h>
+#include "gps_fix.h"
+
+#define NMEA_MAX_SENTENCE_LEN   82    // includes the '$' and "\r\n"
+#define NMEA_MAX_INT_DIGITS     9     // more than this won't fit in a uint32
+#define NMEA_MAX_FRAC_DIGITS    7
+#define NMEA_TEXT_LENGTH        7     // chars kept of each field, e.g., ddmmyy
+
+// Sentence types to decode. A type that is disabled (e.g., with
+// -DNMEA_DECODE_VTG=0) isn't compiled in and is ignored like any other
+// unknown sentence.
+#ifndef NMEA_DECODE_GGA
+#define NMEA_DECODE_GGA         1
+#endif
+#ifndef NMEA_DECODE_GSA
+#define NMEA_DECODE_GSA         1
+#endif
+#ifndef NMEA_DECODE_RMC
+#define NMEA_DECODE_RMC         1
+#endif
+#ifndef NMEA_DECODE_VTG
+#define NMEA_DECODE_VTG         1
+#endif
+
+// Sentence types the parser knows how to decode (nmea_parser_t.type). Each
+// is the bit the type sets in gps_fix_t.updated.
+#define NMEA_TYPE_NONE          0
+#define NMEA_TYPE_GGA           GPS_FIX_GGA
+#define NMEA_TYPE_GSA           GPS_FIX_GSA
+#define NMEA_TYPE_RMC           GPS_FIX_RMC
+#define NMEA_TYPE_VTG           GPS_FIX_VTG
+
+// Packs the three letters of a sentence type (the address without its
+// talker ID) into 15 bits so that a type is matched with one comparison
+#define NMEA_TYPE_CODE(a, b, c) ((uint16_t) ((((a) - 'A') & 0x1F) << 10 | \
+                                             (((b) - 'A') & 0x1F) << 5 | \
+                                             (((c) - 'A') & 0x1F)))
+
+// Values returned by nmea_feed()
+#define NMEA_IN_PROGRESS        0     // mid-sentence, or between sentences
+#define NMEA_SENTENCE_VALID     1     // a decoded sentence was committed
+#define NMEA_SENTENCE_IGNORED   2     // checksum ok; type isn't decoded
+#define NMEA_BAD_CHECKSUM       3
+#define NMEA_OVERFLOW           4     // sentence longer than the NMEA limit
+#define NMEA_UNEXPECTED_START   5     // '$' received in the middle of a sentence
+
+struct nmea_sentence;
+
+typedef struct {
+  uint8_t  state;
+  uint8_t  type;
+  char     talker[2];   // e.g., "GP", "GN"; not checked by the parser
+  uint8_t  length;
+  uint8_t  checksum;
+  uint8_t  expected_checksum;
+
+  // The field currently being received; field 0 is the address (e.g., GPGGA)
+  uint8_t  field_index;
+  uint8_t  field_length;
+  uint8_t  int_digits;
+  uint8_t  frac_digits;
+  uint8_t  seen_point;
+  uint8_t  negative;
+  uint32_t int_part;
+  uint32_t frac_part;
+  char     text[NMEA_TEXT_LENGTH + 1];
+
+  // Decoder for the sentence in progress; NULL if its type isn't decoded
+  const struct nmea_sentence * sentence;
+
+  // Values decoded from the sentence in progress. They are only copied to
+  // the caller's fix once the checksum has been verified.
+  gps_fix_t work;
+} nmea_parser_t;
+
+/* Resets the parser to wait for the start of a sentence */
+void nmea_init(nmea_parser_t * parser);
+
+/* Feeds the next received character to the parser. The decoded values are
+ * committed to fix when a valid sentence ends. Returns one of the NMEA_*
+ * result codes above.
+ */
+uint8_t nmea_feed(nmea_parser_t * parser, char c, gps_fix_t * fix);
+
+#endif /* _NMEA_H_ */
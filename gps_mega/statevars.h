@@ -4,43 +4,44 @@
 #ifndef _STATEVARS_H_
 #define _STATEVARS_H_
 
-#define GPS_SENTENCE_LENGTH   84
+#include "gps.h"
+
 #define GPS_DATE_WIDTH         8
 
-#define STATUS_GPS_NO_BUFF_AVAIL  (1 << 2);
-#define STATUS_GPS_BUFF_OVERFLOW  (1 << 3);
-#define STATUS_GPS_UNEXPECT_START (1 << 4);
-#define STATUS_GPS_GPGGA_RCVD     (1 << 5);
-#define STATUS_GPS_GPVTG_RCVD     (1 << 6);
-#define STATUS_GPS_GPRMC_RCVD     (1 << 7);
-#define STATUS_GPS_GPGSA_RCVD     (1 << 8);
-#define STATUS_GPS_NO_FIX_AVAIL   (1 << 9);
-#define STATUS_GPS_UNEXPECT_VAL   (1 << 10);
-#define STATUS_GPS_DATA_NOT_VALID (1 << 11);
+#define STATUS_GPS_RX_OVERRUN     (1 << 2)
+#define STATUS_GPS_BUFF_OVERFLOW  (1 << 3)
+#define STATUS_GPS_UNEXPECT_START (1 << 4)
+#define STATUS_GPS_GPGGA_RCVD     (1 << 5)
+#define STATUS_GPS_GPVTG_RCVD     (1 << 6)
+#define STATUS_GPS_GPRMC_RCVD     (1 << 7)
+#define STATUS_GPS_GPGSA_RCVD     (1 << 8)
+#define STATUS_GPS_NO_FIX_AVAIL   (1 << 9)
+#define STATUS_GPS_UNEXPECT_VAL   (1 << 10)
+#define STATUS_GPS_DATA_NOT_VALID (1 << 11)
 
 typedef struct {
     uint32_t prefix;
     uint32_t status;
-    char     gps_sentence0[GPS_SENTENCE_LENGTH];
-    char     gps_sentence1[GPS_SENTENCE_LENGTH];
-    char     gps_sentence2[GPS_SENTENCE_LENGTH];
-    char     gps_sentence3[GPS_SENTENCE_LENGTH];
-    float    gps_latitude;
-    float    gps_longitude;
-    float    gps_hdop;
-    float    gps_pdop;
-    float    gps_vdop;
-    float    gps_msl_altitude_m;
-    float    gps_true_hdg_deg;
-    float    gps_ground_course_deg;
-    float    gps_speed_kmph;
-    float    gps_ground_speed_kt;
-    float    gps_speed_kt;
+    int32_t  gps_latitude_e7;         // degrees * 10^7
+    int32_t  gps_longitude_e7;        // degrees * 10^7
+    uint16_t gps_hdop_x100;
+    uint16_t gps_pdop_x100;
+    uint16_t gps_vdop_x100;
+    int32_t  gps_msl_altitude_cm;
+    uint16_t gps_true_hdg_cdeg;       // degrees * 100
+    uint16_t gps_ground_course_cdeg;  // degrees * 100
+    uint16_t gps_speed_kmph_x100;
+    uint16_t gps_ground_speed_kt_x100;
+    uint16_t gps_speed_kt_x100;
     uint8_t  gps_hours;
     uint8_t  gps_minutes;
-    float    gps_seconds;
+    uint8_t  gps_seconds;
+    uint16_t gps_milliseconds;
     char     gps_date[GPS_DATE_WIDTH];
     uint8_t  gps_satcount;
+    uint32_t gps_fix_ticks;       // timebase ticks when the fix began to arrive
+    uint32_t gps_fix_age_ticks;   // age of the fix when it was committed
+    gps_stats_t gps_stats;
     uint32_t suffix;
 } statevars_t;
 
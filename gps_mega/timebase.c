@@ -0,0 +1,54 @@
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "timebase.h"
+
+static volatile uint16_t timer1_overflows;
+
+ISR (TIMER1_OVF_vect) {
+  timer1_overflows = timer1_overflows + 1;
+}
+
+/* Starts Timer1 counting up from zero in normal mode with a prescaler of 64
+ * and enables its overflow interrupt
+ */
+void timebase_init(void) {
+  cli();
+
+  timer1_overflows = 0;
+
+  TCCR1A = 0;
+  TCCR1B = (1 << CS11) | (1 << CS10);
+  TCCR1C = 0;
+  TCNT1 = 0;
+
+  // Clear any pending overflow, then enable the overflow interrupt
+  TIFR1 = (1 << TOV1);
+  TIMSK1 = (1 << TOIE1);
+
+  sei();
+
+  return;
+}
+
+uint32_t timebase_now(void) {
+  uint8_t sreg = SREG;
+  uint16_t overflows;
+  uint16_t count;
+
+  cli();
+
+  count = TCNT1;
+  overflows = timer1_overflows;
+
+  // The timer may have overflowed since interrupts were disabled (or since
+  // the ISR calling us began); the low count tells us that the pending
+  // overflow happened before it was read
+  if ((TIFR1 & (1 << TOV1)) && count < 0x8000) {
+    overflows = overflows + 1;
+  }
+
+  SREG = sreg;
+
+  return ((uint32_t) overflows << 16) | count;
+}
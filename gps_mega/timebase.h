@@ -0,0 +1,20 @@
+/*
+ * File: timebase.h
+ *
+ * A free-running monotonic clock built from Timer1 (prescaler 64, 4 us per
+ * tick at 16 MHz) and a software count of its overflows. The clock wraps
+ * after about 4.7 hours.
+ */
+#ifndef _TIMEBASE_H_
+#define _TIMEBASE_H_
+
+#include <stdint.h>
+
+#define TIMEBASE_TICKS_PER_SEC  (F_CPU / 64)
+
+void timebase_init(void);
+
+/* Returns the current time in ticks. May be called from an ISR. */
+uint32_t timebase_now(void);
+
+#endif /* _TIMEBASE_H_ */
@@ -0,0 +1,279 @@
+/*
+ * File: ubx.c
+ *
+ * Streaming UBX parser. Each call to ubx_feed() does a constant amount of
+ * work for the received byte:
+ *   - the header bytes select whether the payload is kept; payloads of
+ *     packets we don't decode are only checksummed
+ *   - every byte between the sync chars and the checksum is added to the
+ *     running Fletcher checksum
+ *   - at the end of the checksum the kept payload is decoded into the
+ *     caller's fix, but only if the checksum matched
+ */
+#include <string.h>
+
+#include "ubx.h"
+
+#define UBX_STATE_SYNC_1        0
+#define UBX_STATE_SYNC_2        1
+#define UBX_STATE_CLASS         2
+#define UBX_STATE_ID            3
+#define UBX_STATE_LENGTH_LO     4
+#define UBX_STATE_LENGTH_HI     5
+#define UBX_STATE_PAYLOAD       6
+#define UBX_STATE_CK_A          7
+#define UBX_STATE_CK_B          8
+
+// Longer packets are taken to be a corrupted header rather than skipped
+#define UBX_MAX_SKIPPED_LENGTH  1024
+
+// NAV-PVT fixType values; 2D and 3D fixes are the ones with a position
+#define UBX_FIX_TYPE_2D         2
+#define UBX_FIX_TYPE_3D         3
+
+// NAV-PVT valid and flags bits
+#define UBX_VALID_DATE          (1 << 0)
+#define UBX_VALID_TIME          (1 << 1)
+#define UBX_FLAGS_GNSS_FIX_OK   (1 << 0)
+
+static uint8_t commit_packet(ubx_parser_t * p, gps_fix_t * fix);
+static void decode_nav_dop(const uint8_t * payload, gps_fix_t * fix);
+static void decode_nav_pvt(const uint8_t * payload, gps_fix_t * fix);
+static uint16_t expected_length(uint8_t msg_class, uint8_t msg_id);
+static uint16_t get_u16(const uint8_t * payload, uint8_t offset);
+static int32_t get_i32(const uint8_t * payload, uint8_t offset);
+static void set_date(char * date, uint8_t day, uint8_t month, uint16_t year);
+
+void ubx_init(ubx_parser_t * parser) {
+  memset(parser, 0, sizeof(ubx_parser_t));
+  parser->state = UBX_STATE_SYNC_1;
+
+  return;
+}
+
+uint8_t ubx_packet_started(const ubx_parser_t * parser) {
+  return parser->state == UBX_STATE_CLASS;
+}
+
+uint8_t ubx_feed(ubx_parser_t * p, uint8_t c, gps_fix_t * fix) {
+  uint8_t result = UBX_IN_PROGRESS;
+
+  switch (p->state) {
+    case UBX_STATE_SYNC_1:
+      if (c == UBX_SYNC_CHAR_1) {
+        p->state = UBX_STATE_SYNC_2;
+      }
+      break;
+
+    case UBX_STATE_SYNC_2:
+      if (c == UBX_SYNC_CHAR_2) {
+        p->ck_a = 0;
+        p->ck_b = 0;
+        p->state = UBX_STATE_CLASS;
+      } else if (c != UBX_SYNC_CHAR_1) {
+        p->state = UBX_STATE_SYNC_1;
+      }
+      break;
+
+    case UBX_STATE_CLASS:
+      UBX_CHECKSUM_ADD(p->ck_a, p->ck_b, c);
+      p->msg_class = c;
+      p->state = UBX_STATE_ID;
+      break;
+
+    case UBX_STATE_ID:
+      UBX_CHECKSUM_ADD(p->ck_a, p->ck_b, c);
+      p->msg_id = c;
+      p->state = UBX_STATE_LENGTH_LO;
+      break;
+
+    case UBX_STATE_LENGTH_LO:
+      UBX_CHECKSUM_ADD(p->ck_a, p->ck_b, c);
+      p->length = c;
+      p->state = UBX_STATE_LENGTH_HI;
+      break;
+
+    case UBX_STATE_LENGTH_HI:
+      UBX_CHECKSUM_ADD(p->ck_a, p->ck_b, c);
+      p->length |= (uint16_t) c << 8;
+      p->index = 0;
+
+      if (p->length > UBX_MAX_SKIPPED_LENGTH) {
+        p->state = UBX_STATE_SYNC_1;
+        result = UBX_BAD_LENGTH;
+      } else if (p->length == 0) {
+        p->state = UBX_STATE_CK_A;
+      } else {
+        p->state = UBX_STATE_PAYLOAD;
+      }
+      break;
+
+    case UBX_STATE_PAYLOAD:
+      UBX_CHECKSUM_ADD(p->ck_a, p->ck_b, c);
+
+      if (p->index < UBX_MAX_PAYLOAD_LENGTH) {
+        p->payload[p->index] = c;
+      }
+      p->index = p->index + 1;
+
+      if (p->index == p->length) {
+        p->state = UBX_STATE_CK_A;
+      }
+      break;
+
+    case UBX_STATE_CK_A:
+      p->expected_ck_a = c;
+      p->state = UBX_STATE_CK_B;
+      break;
+
+    case UBX_STATE_CK_B:
+      p->state = UBX_STATE_SYNC_1;
+
+      if (p->expected_ck_a != p->ck_a || c != p->ck_b) {
+        result = UBX_BAD_CHECKSUM;
+      } else {
+        result = commit_packet(p, fix);
+      }
+      break;
+  }
+
+  return result;
+}
+
+/* Returns the payload length of a packet we decode, or 0 if the packet
+ * isn't one we decode
+ */
+static uint16_t expected_length(uint8_t msg_class, uint8_t msg_id) {
+  if (msg_class != UBX_CLASS_NAV) {
+    return 0;
+  }
+
+  switch (msg_id) {
+    case UBX_NAV_PVT:
+      return UBX_NAV_PVT_LENGTH;
+    case UBX_NAV_DOP:
+      return UBX_NAV_DOP_LENGTH;
+  }
+
+  return 0;
+}
+
+/* Decodes the payload of a packet with a valid checksum into the fix */
+static uint8_t commit_packet(ubx_parser_t * p, gps_fix_t * fix) {
+  uint16_t length = expected_length(p->msg_class, p->msg_id);
+
+  if (length == 0) {
+    return UBX_PACKET_IGNORED;
+  }
+
+  // Newer protocol versions may only append to a payload
+  if (p->length < length) {
+    return UBX_BAD_LENGTH;
+  }
+
+  if (p->msg_id == UBX_NAV_PVT) {
+    decode_nav_pvt(p->payload, fix);
+  } else {
+    decode_nav_dop(p->payload, fix);
+  }
+
+  return UBX_PACKET_VALID;
+}
+
+/* Fills the values that the GGA, RMC and VTG sentences otherwise provide.
+ * As with the sentences, the time is always used but the position and
+ * velocity are only used if the receiver has a valid fix.
+ */
+static void decode_nav_pvt(const uint8_t * payload, gps_fix_t * fix) {
+  uint8_t valid = payload[11];
+  int32_t nano = get_i32(payload, 16);
+  uint8_t fix_type = payload[20];
+  uint8_t flags = payload[21];
+
+  fix->hours = payload[8];
+  fix->minutes = payload[9];
+  fix->seconds = payload[10];
+
+  // The time is rounded to the nearest second; nano corrects it
+  if (nano >= 0) {
+    fix->milliseconds = nano / 1000000L;
+  } else if (fix->seconds > 0) {
+    fix->seconds = fix->seconds - 1;
+    fix->milliseconds = (nano + 1000000000L) / 1000000L;
+  } else {
+    fix->milliseconds = 0;
+  }
+
+  fix->updated |= GPS_FIX_GGA | GPS_FIX_RMC | GPS_FIX_VTG;
+
+  if ((fix_type != UBX_FIX_TYPE_2D && fix_type != UBX_FIX_TYPE_3D) ||
+      !(flags & UBX_FLAGS_GNSS_FIX_OK)) {
+    fix->errors |= GPS_FIX_ERR_NO_FIX;
+    return;
+  }
+
+  fix->longitude_e7 = get_i32(payload, 24);
+  fix->latitude_e7 = get_i32(payload, 28);
+  fix->msl_altitude_cm = get_i32(payload, 36) / 10;   // mm
+  fix->satcount = payload[23];
+  fix->pdop_x100 = get_u16(payload, 76);
+
+  // Ground speed is in mm/s, heading of motion in 1e-5 degrees
+  int32_t speed_mm_s = get_i32(payload, 60);
+  uint16_t course_cdeg = get_i32(payload, 64) / 1000;
+
+  // mm/s to knots * 100 is * 360 / 1852; to km/h * 100 is * 36 / 100
+  fix->ground_speed_kt_x100 = (speed_mm_s * 90 + 231) / 463;
+  fix->speed_kt_x100 = fix->ground_speed_kt_x100;
+  fix->speed_kmph_x100 = (speed_mm_s * 9 + 12) / 25;
+  fix->ground_course_cdeg = course_cdeg;
+  fix->true_hdg_cdeg = course_cdeg;
+
+  if ((valid & (UBX_VALID_DATE | UBX_VALID_TIME)) ==
+      (UBX_VALID_DATE | UBX_VALID_TIME)) {
+    set_date(fix->date, payload[7], payload[6], get_u16(payload, 4));
+  } else {
+    fix->errors |= GPS_FIX_ERR_NOT_VALID;
+  }
+
+  return;
+}
+
+/* Fills the dilutions of precision that the GGA and GSA sentences
+ * otherwise provide; all are already scaled by 100
+ */
+static void decode_nav_dop(const uint8_t * payload, gps_fix_t * fix) {
+  fix->pdop_x100 = get_u16(payload, 6);
+  fix->vdop_x100 = get_u16(payload, 10);
+  fix->hdop_x100 = get_u16(payload, 12);
+  fix->updated |= GPS_FIX_GSA;
+
+  return;
+}
+
+/* Writes the date as ddmmyy text, the way RMC sentences carry it */
+static void set_date(char * date, uint8_t day, uint8_t month, uint16_t year) {
+  year = year % 100;
+
+  date[0] = '0' + day / 10;
+  date[1] = '0' + day % 10;
+  date[2] = '0' + month / 10;
+  date[3] = '0' + month % 10;
+  date[4] = '0' + year / 10;
+  date[5] = '0' + year % 10;
+  date[6] = '\0';
+
+  return;
+}
+
+// UBX values are little-endian, as is the AVR, but the payload isn't aligned
+static uint16_t get_u16(const uint8_t * payload, uint8_t offset) {
+  return payload[offset] | (uint16_t) payload[offset + 1] << 8;
+}
+
+static int32_t get_i32(const uint8_t * payload, uint8_t offset) {
+  return (int32_t) ((uint32_t) payload[offset] |
+                    (uint32_t) payload[offset + 1] << 8 |
+                    (uint32_t) payload[offset + 2] << 16 |
+                    (uint32_t) payload[offset + 3] << 24);
+}
@@ -0,0 +1,84 @@
+/*
+ * File: ubx.h
+ *
+ * A streaming decoder for the u-blox UBX binary protocol. A UBX packet is:
+ *   0xB5 0x62 <class> <id> <length lo> <length hi> <payload> <ck_a> <ck_b>
+ * where the checksum is an 8-bit Fletcher checksum over everything between
+ * the sync chars and the checksum. Bytes are fed in one at a time as they
+ * arrive from the receiver; the payload of a packet we decode is kept until
+ * its checksum has been verified and is then committed to a gps_fix_t.
+ *
+ * UBX-NAV-PVT carries the time, position, velocity, PDOP and fix status that
+ * otherwise take the GGA, GSA, RMC and VTG sentences. UBX-NAV-DOP supplies
+ * the HDOP and VDOP.
+ *
+ * This file has no AVR dependencies so that it can also be built on the host.
+ */
+#ifndef _UBX_H_
+#define _UBX_H_
+
+#include <stdint.h>
+#include "gps_fix.h"
+
+#define UBX_SYNC_CHAR_1         0xB5
+#define UBX_SYNC_CHAR_2         0x62
+#define UBX_HEADER_LENGTH       6     // sync chars, class, id and length
+#define UBX_CHECKSUM_LENGTH     2
+
+#define UBX_CLASS_NAV           0x01
+#define UBX_CLASS_CFG           0x06
+#define UBX_CLASS_ACK           0x05
+
+#define UBX_NAV_DOP             0x04
+#define UBX_NAV_PVT             0x07
+#define UBX_CFG_PRT             0x00
+#define UBX_CFG_MSG             0x01
+#define UBX_CFG_RATE            0x08
+#define UBX_ACK_NAK             0x00
+#define UBX_ACK_ACK             0x01
+
+#define UBX_NAV_DOP_LENGTH      18
+#define UBX_NAV_PVT_LENGTH      92
+#define UBX_MAX_PAYLOAD_LENGTH  UBX_NAV_PVT_LENGTH
+
+// Values returned by ubx_feed()
+#define UBX_IN_PROGRESS         0     // mid-packet, or between packets
+#define UBX_PACKET_VALID        1     // a decoded packet was committed
+#define UBX_PACKET_IGNORED      2     // checksum ok; packet isn't decoded
+#define UBX_BAD_CHECKSUM        3
+#define UBX_BAD_LENGTH          4     // a decoded packet had the wrong length
+
+// Adds a byte to a running 8-bit Fletcher checksum
+#define UBX_CHECKSUM_ADD(ck_a, ck_b, c)   do { (ck_a) += (c); \
+                                               (ck_b) += (ck_a); } while (0)
+
+typedef struct {
+  uint8_t  state;
+  uint8_t  msg_class;
+  uint8_t  msg_id;
+  uint16_t length;
+  uint16_t index;       // payload bytes received so far
+  uint8_t  ck_a;
+  uint8_t  ck_b;
+  uint8_t  expected_ck_a;
+
+  // Payload of the packet in progress, if it's one we decode
+  uint8_t  payload[UBX_MAX_PAYLOAD_LENGTH];
+} ubx_parser_t;
+
+/* Resets the parser to wait for the start of a packet */
+void ubx_init(ubx_parser_t * parser);
+
+/* Feeds the next received byte to the parser. The decoded values are
+ * committed to fix when a valid packet ends. Returns one of the UBX_*
+ * result codes above.
+ */
+uint8_t ubx_feed(ubx_parser_t * parser, uint8_t c, gps_fix_t * fix);
+
+/* Returns 1 if the byte fed last was the second sync char of a packet, so
+ * the parser is now in its header; 0 otherwise, including for a sync pair
+ * that turned up in the payload of a packet.
+ */
+uint8_t ubx_packet_started(const ubx_parser_t * parser);
+
+#endif /* _UBX_H_ */
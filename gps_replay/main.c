@@ -0,0 +1,650 @@
+/*
+ * File: main.c
+ *
+ * Replays a capture of NMEA sentences through the streaming parser (nmea.c),
+ * through the whole receive pipeline of gps_mega (the USART1 RX ISR and
+ * gps_update() in gps.c, see pipeline.c) and through the original
+ * strtok()-based decoder, then reports:
+ *   - how many sentences of each outcome (valid, ignored, bad checksum...)
+ *   - every decoded value that differs from the original decoder
+ *   - the time spent per sentence by each decoder, and the sentences per
+ *     second that the pipeline sustains
+ *
+ * The original decoder only knew the GP talker ID, so other talkers (GN, GL,
+ * GA...) are rewritten to GP, with the checksum adjusted, before it sees them.
+ * It also couldn't decode sparse sentences (e.g. those sent before a fix),
+ * which are counted but not compared.
+ *
+ * With -u the capture is instead a recording of UBX packets. It is replayed
+ * through the UBX decoder (ubx.c), which has no reference to compare against,
+ * so the outcomes, the last decoded fix and the time per packet are reported.
+ * With -e the fix after each packet is also checked against a file of the
+ * values expected, one line per packet as format_ubx_packet() writes it
+ * (lines starting with # are comments).
+ *
+ * Usage: gps_replay [-u [-e expected]] [-n repetitions] capture
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nmea.h"
+#include "pipeline.h"
+#include "reference.h"
+#include "timebase.h"
+#include "ubx.h"
+
+#define DEFAULT_REPETITIONS   100
+#define MAX_REPORTED_DIFFS    20
+// The reference decoder holds positions in 32-bit floats, which can be off
+// by more than 150e-7 degrees at longitudes above 128 degrees
+#define DEGREES_TOLERANCE     200
+#define VALUE_TOLERANCE       1
+#define UBX_LINE_SZ           256
+
+typedef struct {
+  const char * start;
+  size_t length;
+} line_t;
+
+static char * read_capture(const char * path, size_t * size);
+static size_t split_lines(const char * capture, size_t size, line_t ** lines);
+static uint32_t compare_fixes(const gps_fix_t * a, const gps_fix_t * b);
+static double elapsed_ns(const struct timespec * start);
+static void print_diff(const char * decoder, const line_t * line,
+                       uint32_t fields);
+static uint8_t normalize_talker(char * sentence);
+static void print_fix(const gps_fix_t * fix);
+static int replay_ubx(const char * capture, size_t size, long repetitions,
+                      const char * expected_path);
+static void format_ubx_packet(char * line, uint8_t result,
+                              const gps_fix_t * fix);
+static size_t skip_comments(const line_t * lines, size_t num_lines,
+                            size_t index);
+static int content_length(const line_t * line);
+static void usage(const char * name);
+
+static const char * field_names[] = {
+  "result", "errors", "time", "latitude", "longitude", "satcount", "hdop",
+  "altitude", "pdop", "vdop", "ground_speed", "ground_course", "date",
+  "true_heading", "speed_kt", "speed_kmph"
+};
+
+static const char * ubx_outcome_names[] = {
+  "in_progress", "valid", "ignored", "bad_checksum", "bad_length"
+};
+
+int main(int argc, char ** argv) {
+  long repetitions = DEFAULT_REPETITIONS;
+  const char * expected_path = NULL;
+  int ubx = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "e:n:u")) != -1) {
+    switch (opt) {
+      case 'e':
+        expected_path = optarg;
+        break;
+      case 'n':
+        repetitions = atol(optarg);
+        break;
+      case 'u':
+        ubx = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (optind >= argc || repetitions < 1 || (expected_path != NULL && !ubx)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  size_t size;
+  char * capture = read_capture(argv[optind], &size);
+  if (capture == NULL) {
+    return 1;
+  }
+
+  if (ubx) {
+    int status = replay_ubx(capture, size, repetitions, expected_path);
+    free(capture);
+    return status;
+  }
+
+  line_t * lines;
+  size_t num_lines = split_lines(capture, size, &lines);
+
+  // Correctness: decode each sentence with both decoders and compare
+  uint32_t outcomes[NMEA_UNEXPECTED_START + 1];
+  uint32_t num_diffs = 0;
+  uint32_t num_pipeline_diffs = 0;
+  uint32_t num_other_talkers = 0;
+  uint32_t num_undecodable = 0;
+  memset(outcomes, 0, sizeof(outcomes));
+
+  nmea_parser_t parser;
+  nmea_init(&parser);
+
+  uint8_t gps_config = pipeline_init();
+
+  size_t i;
+  for (i = 0; i < num_lines; i++) {
+    gps_fix_t streamed;
+    gps_fix_t piped;
+    gps_fix_t reference;
+    char sentence[REFERENCE_SENTENCE_BUFF_SZ];
+    uint8_t streamed_result = NMEA_IN_PROGRESS;
+    uint8_t reference_result;
+    size_t c;
+
+    memset(&streamed, 0, sizeof(streamed));
+    memset(&reference, 0, sizeof(reference));
+
+    for (c = 0; c < lines[i].length; c++) {
+      uint8_t result = nmea_feed(&parser, lines[i].start[c], &streamed);
+
+      if (result != NMEA_IN_PROGRESS) {
+        streamed_result = result;
+      }
+    }
+    outcomes[streamed_result]++;
+
+    pipeline_update(lines[i].start, lines[i].length, &piped);
+
+    if (lines[i].length >= REFERENCE_SENTENCE_BUFF_SZ) {
+      continue;
+    }
+    memset(sentence, 0, sizeof(sentence));
+    memcpy(sentence, lines[i].start, lines[i].length);
+    num_other_talkers += normalize_talker(sentence);
+    reference_result = reference_parse(sentence, &reference);
+
+    if (reference_result == REFERENCE_CANNOT_DECODE) {
+      num_undecodable++;
+      continue;
+    }
+
+    uint32_t diff = compare_fixes(&streamed, &reference);
+    if (streamed_result != reference_result) {
+      diff |= 1;
+    }
+
+    if (diff != 0) {
+      if (num_diffs < MAX_REPORTED_DIFFS) {
+        print_diff("parser", &lines[i], diff);
+      }
+      num_diffs++;
+    }
+
+    diff = compare_fixes(&piped, &reference);
+    if (diff != 0) {
+      if (num_pipeline_diffs < MAX_REPORTED_DIFFS) {
+        print_diff("pipeline", &lines[i], diff);
+      }
+      num_pipeline_diffs++;
+    }
+  }
+
+  printf("sentences:       %zu\n", num_lines);
+  printf("  valid:         %u\n", outcomes[NMEA_SENTENCE_VALID]);
+  printf("  ignored:       %u\n", outcomes[NMEA_SENTENCE_IGNORED]);
+  printf("  bad checksum:  %u\n", outcomes[NMEA_BAD_CHECKSUM]);
+  printf("  overflow:      %u\n", outcomes[NMEA_OVERFLOW]);
+  printf("  unexpected $:  %u\n", outcomes[NMEA_UNEXPECTED_START]);
+  printf("  incomplete:    %u\n", outcomes[NMEA_IN_PROGRESS]);
+  printf("  non-GP talker: %u\n", num_other_talkers);
+  printf("  not compared:  %u\n", num_undecodable);
+  printf("differences:     %u\n", num_diffs);
+  printf("pipeline:\n");
+  printf("  gps_init():    %u\n", gps_config);
+  printf("  differences:   %u\n", num_pipeline_diffs);
+  uint32_t num_raw_mismatches = pipeline_raw_mismatches();
+  printf("  raw mismatch:  %u\n", num_raw_mismatches);
+
+  // gps.c's counters should agree with the parser's outcomes
+  const gps_stats_t * stats = pipeline_stats();
+  uint32_t decoded = stats->decoded[GPS_STATS_GGA] +
+                     stats->decoded[GPS_STATS_GSA] +
+                     stats->decoded[GPS_STATS_RMC] +
+                     stats->decoded[GPS_STATS_VTG];
+  uint32_t num_stats_diffs =
+      (decoded != outcomes[NMEA_SENTENCE_VALID]) +
+      (stats->ignored != outcomes[NMEA_SENTENCE_IGNORED]) +
+      (stats->checksum_failures != outcomes[NMEA_BAD_CHECKSUM]) +
+      (stats->overflows != outcomes[NMEA_OVERFLOW]) +
+      (stats->unexpected_starts != outcomes[NMEA_UNEXPECTED_START]) +
+      (stats->rx_bytes != size);
+  printf("  gga/gsa/rmc/vtg: %u/%u/%u/%u\n", stats->decoded[GPS_STATS_GGA],
+         stats->decoded[GPS_STATS_GSA], stats->decoded[GPS_STATS_RMC],
+         stats->decoded[GPS_STATS_VTG]);
+  printf("  bad checksum:  %u\n", stats->checksum_failures);
+  printf("  rx bytes/s:    %u\n", stats->rx_bytes_per_sec);
+  printf("  stats diffs:   %u\n", num_stats_diffs);
+
+  // Cost: replay the whole capture through each decoder
+  struct timespec start;
+  gps_fix_t fix;
+  long r;
+
+  memset(&fix, 0, sizeof(fix));
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (r = 0; r < repetitions; r++) {
+    for (i = 0; i < size; i++) {
+      nmea_feed(&parser, capture[i], &fix);
+    }
+  }
+  double streamed_ns = elapsed_ns(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (r = 0; r < repetitions; r++) {
+    for (i = 0; i < num_lines; i++) {
+      char sentence[REFERENCE_SENTENCE_BUFF_SZ];
+
+      if (lines[i].length >= REFERENCE_SENTENCE_BUFF_SZ) {
+        continue;
+      }
+      memset(sentence, 0, sizeof(sentence));
+      memcpy(sentence, lines[i].start, lines[i].length);
+      normalize_talker(sentence);
+      reference_parse(sentence, &fix);
+    }
+  }
+  double reference_ns = elapsed_ns(&start);
+
+  // One gps_update() per main loop's worth of bytes
+  uint32_t piped_sentences = 0;
+
+  pipeline_init();
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (r = 0; r < repetitions; r++) {
+    piped_sentences += pipeline_replay(capture, size);
+  }
+  double pipeline_ns = elapsed_ns(&start);
+
+  double total = (double) num_lines * repetitions;
+  if (total > 0) {
+    printf("streaming:       %.1f ns/sentence\n", streamed_ns / total);
+    printf("reference:       %.1f ns/sentence\n", reference_ns / total);
+    printf("pipeline:        %.1f ns/sentence\n", pipeline_ns / total);
+  }
+  if (pipeline_ns > 0) {
+    printf("pipeline:        %.0f decoded sentences/s\n",
+           piped_sentences / (pipeline_ns / 1e9));
+    printf("max fix age:     %.3f ms\n",
+           pipeline_max_fix_age() * 1000.0 / TIMEBASE_TICKS_PER_SEC);
+  }
+
+  free(lines);
+  free(capture);
+
+  return num_diffs == 0 && num_pipeline_diffs == 0 &&
+         num_raw_mismatches == 0 && num_stats_diffs == 0 ? 0 : 2;
+}
+
+static void usage(const char * name) {
+  fprintf(stderr, "usage: %s [-u [-e expected]] [-n repetitions] capture\n",
+          name);
+
+  return;
+}
+
+/* Replays a UBX capture; returns 2 if no packet could be decoded or, given
+ * the values expected, if any packet was decoded differently
+ */
+static int replay_ubx(const char * capture, size_t size, long repetitions,
+                      const char * expected_path) {
+  uint32_t outcomes[UBX_BAD_LENGTH + 1];
+  uint32_t packets = 0;
+  uint32_t num_diffs = 0;
+  ubx_parser_t parser;
+  gps_fix_t fix;
+  char * expected = NULL;
+  line_t * lines = NULL;
+  size_t num_lines = 0;
+  size_t next_line = 0;
+  size_t i;
+
+  if (expected_path != NULL) {
+    size_t expected_size;
+
+    expected = read_capture(expected_path, &expected_size);
+    if (expected == NULL) {
+      return 1;
+    }
+    num_lines = split_lines(expected, expected_size, &lines);
+  }
+
+  memset(outcomes, 0, sizeof(outcomes));
+  memset(&fix, 0, sizeof(fix));
+  ubx_init(&parser);
+
+  for (i = 0; i < size; i++) {
+    uint8_t result = ubx_feed(&parser, capture[i], &fix);
+    char decoded[UBX_LINE_SZ];
+
+    outcomes[result]++;
+    if (result == UBX_IN_PROGRESS) {
+      continue;
+    }
+    packets++;
+
+    // As in gps_update(), each packet only shows what it updated itself
+    format_ubx_packet(decoded, result, &fix);
+    fix.updated = 0;
+    fix.errors = 0;
+
+    if (expected == NULL) {
+      continue;
+    }
+
+    const char * line = "(none)";
+    int length = strlen(line);
+
+    next_line = skip_comments(lines, num_lines, next_line);
+    if (next_line < num_lines) {
+      line = lines[next_line].start;
+      length = content_length(&lines[next_line]);
+      next_line++;
+    }
+
+    if (length != (int) strlen(decoded) || memcmp(line, decoded, length)) {
+      if (num_diffs < MAX_REPORTED_DIFFS) {
+        printf("packet %u:\n", packets);
+        printf("  expected: %.*s\n", length, line);
+        printf("  decoded:  %s\n", decoded);
+      }
+      num_diffs++;
+    }
+  }
+
+  // Packets that were expected but never turned up
+  next_line = skip_comments(lines, num_lines, next_line);
+  while (next_line < num_lines) {
+    if (num_diffs < MAX_REPORTED_DIFFS) {
+      printf("missing packet:\n");
+      printf("  expected: %.*s\n", content_length(&lines[next_line]),
+             lines[next_line].start);
+    }
+    num_diffs++;
+    next_line = skip_comments(lines, num_lines, next_line + 1);
+  }
+
+  printf("packets:         %u\n", packets);
+  printf("  valid:         %u\n", outcomes[UBX_PACKET_VALID]);
+  printf("  ignored:       %u\n", outcomes[UBX_PACKET_IGNORED]);
+  printf("  bad checksum:  %u\n", outcomes[UBX_BAD_CHECKSUM]);
+  printf("  bad length:    %u\n", outcomes[UBX_BAD_LENGTH]);
+  if (expected != NULL) {
+    printf("differences:     %u\n", num_diffs);
+  }
+  printf("last fix:\n");
+  print_fix(&fix);
+
+  struct timespec start;
+  long r;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (r = 0; r < repetitions; r++) {
+    for (i = 0; i < size; i++) {
+      ubx_feed(&parser, capture[i], &fix);
+    }
+  }
+  double ubx_ns = elapsed_ns(&start);
+
+  if (packets > 0) {
+    printf("ubx:             %.1f ns/packet\n",
+           ubx_ns / ((double) packets * repetitions));
+  }
+
+  free(lines);
+  free(expected);
+
+  return outcomes[UBX_PACKET_VALID] > 0 && num_diffs == 0 ? 0 : 2;
+}
+
+/* Writes the outcome of a packet and the fix that it left on one line, the
+ * way the lines of an expected values file give them
+ */
+static void format_ubx_packet(char * line, uint8_t result,
+                              const gps_fix_t * fix) {
+  snprintf(line, UBX_LINE_SZ,
+           "%s updated=%02x errors=%u time=%02u:%02u:%02u.%03u date=%.6s "
+           "lat=%d lon=%d alt_cm=%d sats=%u hdop=%u pdop=%u vdop=%u "
+           "kt=%u kmph=%u course=%u",
+           ubx_outcome_names[result], fix->updated, fix->errors, fix->hours,
+           fix->minutes, fix->seconds, fix->milliseconds,
+           fix->date[0] != '\0' ? fix->date : "-", fix->latitude_e7,
+           fix->longitude_e7, fix->msl_altitude_cm, fix->satcount,
+           fix->hdop_x100, fix->pdop_x100, fix->vdop_x100,
+           fix->ground_speed_kt_x100, fix->speed_kmph_x100,
+           fix->ground_course_cdeg);
+
+  return;
+}
+
+/* Returns the index of the first line from index on that isn't blank or a
+ * comment, or num_lines if there's none
+ */
+static size_t skip_comments(const line_t * lines, size_t num_lines,
+                            size_t index) {
+  while (index < num_lines &&
+         (content_length(&lines[index]) == 0 || lines[index].start[0] == '#')) {
+    index++;
+  }
+
+  return index;
+}
+
+/* Returns the length of a line without its line ending */
+static int content_length(const line_t * line) {
+  size_t length = line->length;
+
+  while (length > 0 && (line->start[length - 1] == '\n' ||
+                        line->start[length - 1] == '\r')) {
+    length--;
+  }
+
+  return length;
+}
+
+static void print_fix(const gps_fix_t * fix) {
+  printf("  time:          %02u:%02u:%02u.%03u\n", fix->hours, fix->minutes,
+         fix->seconds, fix->milliseconds);
+  printf("  date:          %.6s\n", fix->date);
+  printf("  latitude:      %.7f\n", fix->latitude_e7 / 1e7);
+  printf("  longitude:     %.7f\n", fix->longitude_e7 / 1e7);
+  printf("  altitude (m):  %.2f\n", fix->msl_altitude_cm / 100.0);
+  printf("  satcount:      %u\n", fix->satcount);
+  printf("  hdop:          %.2f\n", fix->hdop_x100 / 100.0);
+  printf("  pdop:          %.2f\n", fix->pdop_x100 / 100.0);
+  printf("  vdop:          %.2f\n", fix->vdop_x100 / 100.0);
+  printf("  speed (kt):    %.2f\n", fix->ground_speed_kt_x100 / 100.0);
+  printf("  speed (km/h):  %.2f\n", fix->speed_kmph_x100 / 100.0);
+  printf("  course (deg):  %.2f\n", fix->ground_course_cdeg / 100.0);
+
+  return;
+}
+
+static char * read_capture(const char * path, size_t * size) {
+  FILE * file = fopen(path, "rb");
+  if (file == NULL) {
+    perror(path);
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  char * capture = malloc(length + 1);
+  if (capture == NULL || fread(capture, 1, length, file) != (size_t) length) {
+    perror(path);
+    fclose(file);
+    free(capture);
+    return NULL;
+  }
+  capture[length] = '\0';
+  fclose(file);
+
+  *size = length;
+
+  return capture;
+}
+
+/* Splits the capture into sentences; each line keeps its newline */
+static size_t split_lines(const char * capture, size_t size, line_t ** lines) {
+  size_t count = 0;
+  size_t capacity = 1024;
+  size_t i;
+  const char * start = capture;
+
+  *lines = malloc(capacity * sizeof(line_t));
+
+  for (i = 0; i < size; i++) {
+    if (capture[i] != '\n' && i != size - 1) {
+      continue;
+    }
+
+    if (count == capacity) {
+      capacity *= 2;
+      *lines = realloc(*lines, capacity * sizeof(line_t));
+    }
+
+    (*lines)[count].start = start;
+    (*lines)[count].length = &capture[i] - start + 1;
+    count++;
+    start = &capture[i + 1];
+  }
+
+  return count;
+}
+
+/* Rewrites the talker ID of a standard sentence (e.g., $GNGGA) to GP and
+ * patches the checksum to match. Returns 1 if the sentence was changed.
+ */
+static uint8_t normalize_talker(char * sentence) {
+  static const char hex[] = "0123456789ABCDEF";
+  char * star = strchr(sentence, '*');
+
+  if (sentence[0] != '$' || sentence[1] == 'P' || star == NULL ||
+      star - sentence < 6 || (sentence[1] == 'G' && sentence[2] == 'P') ||
+      !isxdigit((unsigned char) star[1]) || !isxdigit((unsigned char) star[2])) {
+    return 0;
+  }
+
+  uint8_t expected = strtoul(star + 1, NULL, 16);
+  expected ^= sentence[1] ^ sentence[2] ^ 'G' ^ 'P';
+  sentence[1] = 'G';
+  sentence[2] = 'P';
+  star[1] = hex[expected >> 4];
+  star[2] = hex[expected & 0xF];
+
+  return 1;
+}
+
+#define DIFFERS(a, b, tol)  ((int32_t) (a) - (int32_t) (b) > (tol) || \
+                             (int32_t) (b) - (int32_t) (a) > (tol))
+
+/* Returns a bit mask (indexes into field_names) of the values that differ */
+static uint32_t compare_fixes(const gps_fix_t * a, const gps_fix_t * b) {
+  uint32_t diff = 0;
+
+  if (a->errors != b->errors) {
+    diff |= 1 << 1;
+  }
+
+  if (a->updated & GPS_FIX_GGA) {
+    if (a->hours != b->hours || a->minutes != b->minutes ||
+        a->seconds != b->seconds ||
+        DIFFERS(a->milliseconds, b->milliseconds, VALUE_TOLERANCE)) {
+      diff |= 1 << 2;
+    }
+
+    // The reference decoder stops at the first problem it finds, so the
+    // remaining values are only comparable for a good fix
+    if (a->errors == 0 && b->errors == 0) {
+      if (DIFFERS(a->latitude_e7, b->latitude_e7, DEGREES_TOLERANCE)) {
+        diff |= 1 << 3;
+      }
+      if (DIFFERS(a->longitude_e7, b->longitude_e7, DEGREES_TOLERANCE)) {
+        diff |= 1 << 4;
+      }
+      if (a->satcount != b->satcount) {
+        diff |= 1 << 5;
+      }
+      if (DIFFERS(a->hdop_x100, b->hdop_x100, VALUE_TOLERANCE)) {
+        diff |= 1 << 6;
+      }
+      if (DIFFERS(a->msl_altitude_cm, b->msl_altitude_cm, VALUE_TOLERANCE)) {
+        diff |= 1 << 7;
+      }
+    }
+  }
+
+  if (a->updated & GPS_FIX_GSA) {
+    if (DIFFERS(a->pdop_x100, b->pdop_x100, VALUE_TOLERANCE)) {
+      diff |= 1 << 8;
+    }
+    if (DIFFERS(a->vdop_x100, b->vdop_x100, VALUE_TOLERANCE)) {
+      diff |= 1 << 9;
+    }
+  }
+
+  if (a->updated & GPS_FIX_RMC && a->errors == 0) {
+    if (DIFFERS(a->ground_speed_kt_x100, b->ground_speed_kt_x100, VALUE_TOLERANCE)) {
+      diff |= 1 << 10;
+    }
+    if (DIFFERS(a->ground_course_cdeg, b->ground_course_cdeg, VALUE_TOLERANCE)) {
+      diff |= 1 << 11;
+    }
+    if (strncmp(a->date, b->date, 6) != 0) {
+      diff |= 1 << 12;
+    }
+  }
+
+  if (a->updated & GPS_FIX_VTG && a->errors == 0) {
+    if (DIFFERS(a->true_hdg_cdeg, b->true_hdg_cdeg, VALUE_TOLERANCE)) {
+      diff |= 1 << 13;
+    }
+    if (DIFFERS(a->speed_kt_x100, b->speed_kt_x100, VALUE_TOLERANCE)) {
+      diff |= 1 << 14;
+    }
+    if (DIFFERS(a->speed_kmph_x100, b->speed_kmph_x100, VALUE_TOLERANCE)) {
+      diff |= 1 << 15;
+    }
+  }
+
+  return diff;
+}
+
+static void print_diff(const char * decoder, const line_t * line,
+                       uint32_t fields) {
+  uint8_t i;
+
+  printf("%s differs in", decoder);
+  for (i = 0; i < sizeof(field_names) / sizeof(field_names[0]); i++) {
+    if (fields & (1UL << i)) {
+      printf(" %s", field_names[i]);
+    }
+  }
+  printf(": %.*s", (int) line->length, line->start);
+  if (line->start[line->length - 1] != '\n') {
+    printf("\n");
+  }
+
+  return;
+}
+
+static double elapsed_ns(const struct timespec * start) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
@@ -0,0 +1,190 @@
+/*
+ * File: pipeline.c
+ *
+ * Host harness around gps_mega/gps.c. The timebase is simulated: it
+ * advances by the time each byte takes to arrive at GPS_BAUD, so the fix
+ * ages in the statevars are those the vehicle would see with one
+ * gps_update() per PIPELINE_LOOP_BYTES.
+ */
+#include <avr/io.h>
+#include <string.h>
+
+#include "gps.h"
+#include "pipeline.h"
+#include "statevars.h"
+#include "timebase.h"
+
+#define BITS_PER_BYTE           10    // start, 8 data and stop bits
+#define TIMEBASE_HZ             250000ULL
+
+statevars_t statevars;
+
+static uint64_t bytes_received;
+static uint32_t max_fix_age;
+
+// The bytes that the raw sink should be handed next
+static const char * raw_expected;
+static uint32_t raw_mismatches;
+
+void USART1_RX_vect(void);
+
+static void check_raw_bytes(const char * bytes, uint16_t length);
+static uint32_t count_sentences(void);
+static void receive(const char * bytes, size_t length);
+static void statevars_to_fix(gps_fix_t * fix);
+static void track_fix_age(void);
+
+uint32_t timebase_now(void) {
+  return bytes_received * BITS_PER_BYTE * TIMEBASE_HZ / GPS_BAUD;
+}
+
+uint8_t pipeline_init(void) {
+  memset(&statevars, 0, sizeof(statevars));
+  bytes_received = 0;
+  max_fix_age = 0;
+  raw_mismatches = 0;
+
+  uint8_t result = gps_init();
+  gps_set_raw_sink(check_raw_bytes);
+
+  return result;
+}
+
+void pipeline_update(const char * bytes, size_t length, gps_fix_t * fix) {
+  raw_expected = bytes;
+  receive(bytes, length);
+
+  statevars.status = 0;
+  gps_update();
+
+  statevars_to_fix(fix);
+  track_fix_age();
+
+  return;
+}
+
+uint32_t pipeline_replay(const char * capture, size_t size) {
+  uint32_t sentences = 0;
+  size_t offset;
+
+  // Only the decoding is timed
+  gps_set_raw_sink(NULL);
+
+  for (offset = 0; offset < size; offset += PIPELINE_LOOP_BYTES) {
+    size_t length = size - offset;
+
+    if (length > PIPELINE_LOOP_BYTES) {
+      length = PIPELINE_LOOP_BYTES;
+    }
+
+    receive(&capture[offset], length);
+
+    statevars.status = 0;
+    gps_update();
+    sentences += count_sentences();
+    track_fix_age();
+  }
+
+  return sentences;
+}
+
+uint32_t pipeline_max_fix_age(void) {
+  return max_fix_age;
+}
+
+const gps_stats_t * pipeline_stats(void) {
+  return &statevars.gps_stats;
+}
+
+uint32_t pipeline_raw_mismatches(void) {
+  return raw_mismatches;
+}
+
+/* Raw sink: the bytes must be exactly those received, in order */
+static void check_raw_bytes(const char * bytes, uint16_t length) {
+  if (memcmp(bytes, raw_expected, length) != 0) {
+    raw_mismatches++;
+  }
+  raw_expected += length;
+
+  return;
+}
+
+static void receive(const char * bytes, size_t length) {
+  size_t i;
+
+  for (i = 0; i < length; i++) {
+    bytes_received++;
+    UDR1 = bytes[i];
+    USART1_RX_vect();
+  }
+
+  return;
+}
+
+static void track_fix_age(void) {
+  if (statevars.gps_fix_age_ticks > max_fix_age) {
+    max_fix_age = statevars.gps_fix_age_ticks;
+  }
+
+  return;
+}
+
+/* Returns the number of sentence types committed by the last update */
+static uint32_t count_sentences(void) {
+  uint32_t status = statevars.status;
+
+  return ((status & STATUS_GPS_GPGGA_RCVD) != 0) +
+         ((status & STATUS_GPS_GPGSA_RCVD) != 0) +
+         ((status & STATUS_GPS_GPRMC_RCVD) != 0) +
+         ((status & STATUS_GPS_GPVTG_RCVD) != 0);
+}
+
+static void statevars_to_fix(gps_fix_t * fix) {
+  uint32_t status = statevars.status;
+
+  memset(fix, 0, sizeof(gps_fix_t));
+
+  if (status & STATUS_GPS_GPGGA_RCVD) {
+    fix->updated |= GPS_FIX_GGA;
+  }
+  if (status & STATUS_GPS_GPGSA_RCVD) {
+    fix->updated |= GPS_FIX_GSA;
+  }
+  if (status & STATUS_GPS_GPRMC_RCVD) {
+    fix->updated |= GPS_FIX_RMC;
+  }
+  if (status & STATUS_GPS_GPVTG_RCVD) {
+    fix->updated |= GPS_FIX_VTG;
+  }
+  if (status & STATUS_GPS_NO_FIX_AVAIL) {
+    fix->errors |= GPS_FIX_ERR_NO_FIX;
+  }
+  if (status & STATUS_GPS_UNEXPECT_VAL) {
+    fix->errors |= GPS_FIX_ERR_UNEXPECT_VAL;
+  }
+  if (status & STATUS_GPS_DATA_NOT_VALID) {
+    fix->errors |= GPS_FIX_ERR_NOT_VALID;
+  }
+
+  fix->latitude_e7 = statevars.gps_latitude_e7;
+  fix->longitude_e7 = statevars.gps_longitude_e7;
+  fix->hdop_x100 = statevars.gps_hdop_x100;
+  fix->pdop_x100 = statevars.gps_pdop_x100;
+  fix->vdop_x100 = statevars.gps_vdop_x100;
+  fix->msl_altitude_cm = statevars.gps_msl_altitude_cm;
+  fix->true_hdg_cdeg = statevars.gps_true_hdg_cdeg;
+  fix->ground_course_cdeg = statevars.gps_ground_course_cdeg;
+  fix->speed_kmph_x100 = statevars.gps_speed_kmph_x100;
+  fix->ground_speed_kt_x100 = statevars.gps_ground_speed_kt_x100;
+  fix->speed_kt_x100 = statevars.gps_speed_kt_x100;
+  fix->hours = statevars.gps_hours;
+  fix->minutes = statevars.gps_minutes;
+  fix->seconds = statevars.gps_seconds;
+  fix->milliseconds = statevars.gps_milliseconds;
+  memcpy(fix->date, statevars.gps_date, GPS_FIX_DATE_WIDTH);
+  fix->satcount = statevars.gps_satcount;
+  fix->stamp_ticks = statevars.gps_fix_ticks;
+
+  return;
+}
@@ -0,0 +1,44 @@
+/*
+ * File: pipeline.h
+ *
+ * Runs the whole GPS receive path of gps_mega (gps.c) on the host: bytes
+ * are delivered through the USART1 RX ISR and decoded by gps_update(), as
+ * they would be on the vehicle. The registers are stand-ins (see stubs/).
+ */
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gps.h"
+#include "gps_fix.h"
+
+// Bytes received in one 25 ms main loop at 115200 baud
+#define PIPELINE_LOOP_BYTES     288
+
+/* Initializes gps.c and returns the gps_init() result */
+uint8_t pipeline_init(void);
+
+/* Delivers the bytes through the ISR, runs one gps_update() and returns
+ * what it committed to the statevars as a fix
+ */
+void pipeline_update(const char * bytes, size_t length, gps_fix_t * fix);
+
+/* Delivers the whole capture in PIPELINE_LOOP_BYTES chunks, with one
+ * gps_update() per chunk, and returns the number of sentences committed
+ */
+uint32_t pipeline_replay(const char * capture, size_t size);
+
+/* Returns the number of raw sink calls (from pipeline_update()) that
+ * didn't match the bytes received
+ */
+uint32_t pipeline_raw_mismatches(void);
+
+/* Returns the counters gps.c last copied to the statevars */
+const gps_stats_t * pipeline_stats(void);
+
+/* Returns the largest fix age (in timebase ticks) seen at a commit */
+uint32_t pipeline_max_fix_age(void);
+
+#endif /* _PIPELINE_H_ */
@@ -0,0 +1,351 @@
+/*
+ * File: reference.c
+ *
+ * The parse_gpgga(), parse_gpgsa(), parse_gprmc() and parse_gpvtg() functions
+ * as they were in gps_mega/gps.c before the streaming parser. The only changes
+ * are that values are written to a gps_fix_t instead of the statevars and the
+ * debug printing was removed. The float results are rounded to the fix's
+ * scaled integers as they are stored.
+ *
+ * strtok() merges empty fields, so a sparse sentence (e.g. one without a
+ * fix) runs out of fields early, or has them shifted into the wrong places;
+ * the original dereferenced the NULL at the end, or read fixed-width fields
+ * past the end of shorter ones. Every field is now checked, and such a
+ * sentence is reported as REFERENCE_CANNOT_DECODE instead.
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nmea.h"
+#include "reference.h"
+
+#define GPGGA_START             "$GPGGA"
+#define GPGSA_START             "$GPGSA"
+#define GPRMC_START             "$GPRMC"
+#define GPVTG_START             "$GPVTG"
+#define START_LENGTH            6
+#define GPS_CHECKSUM_LENGTH     2
+#define GPS_INVALID_HEX_CHAR    0xFF
+#define GPS_FIELD_BUFF_SZ       8
+#define GPS_NO_FIX              '0'
+
+// Returned by the parse_*() functions, along with 0 (decoded) and 1 (an
+// error was flagged in the fix)
+#define PARSE_CANNOT_DECODE     2
+
+// Moves s to the next field, or gives up on a sentence that has run out
+#define NEXT_FIELD(s)           do { (s) = strtok(NULL, ","); \
+                                     if ((s) == NULL) { \
+                                       return PARSE_CANNOT_DECODE; \
+                                     } } while (0)
+
+// As NEXT_FIELD(), for a fixed-width field that's read from its start
+#define NEXT_FIELD_OF(s, width) do { NEXT_FIELD(s); \
+                                     if (strlen(s) < (width)) { \
+                                       return PARSE_CANNOT_DECODE; \
+                                     } } while (0)
+
+// Rounds a value decoded as a float the way the AVR would have held it
+#define SCALED(value, scale)    lround((double) (float) (value) * (scale))
+
+static uint8_t hexchar_to_dec(char c);
+static uint8_t parse_gpgga(char * s, gps_fix_t * fix);
+static uint8_t parse_gpgsa(char * s, gps_fix_t * fix);
+static uint8_t parse_gprmc(char * s, gps_fix_t * fix);
+static uint8_t parse_gpvtg(char * s, gps_fix_t * fix);
+static uint8_t validate_checksum(char * s);
+
+uint8_t reference_parse(char * sentence, gps_fix_t * fix) {
+  uint8_t parsed;
+
+  if (validate_checksum(sentence) != 1) {
+    return NMEA_BAD_CHECKSUM;
+  }
+
+  if (strncmp(sentence, GPGGA_START, START_LENGTH) == 0) {
+    parsed = parse_gpgga(sentence, fix);
+    fix->updated |= GPS_FIX_GGA;
+  } else if (strncmp(sentence, GPGSA_START, START_LENGTH) == 0) {
+    parsed = parse_gpgsa(sentence, fix);
+    fix->updated |= GPS_FIX_GSA;
+  } else if (strncmp(sentence, GPRMC_START, START_LENGTH) == 0) {
+    parsed = parse_gprmc(sentence, fix);
+    fix->updated |= GPS_FIX_RMC;
+  } else if (strncmp(sentence, GPVTG_START, START_LENGTH) == 0) {
+    parsed = parse_gpvtg(sentence, fix);
+    fix->updated |= GPS_FIX_VTG;
+  } else {
+    return NMEA_SENTENCE_IGNORED;
+  }
+
+  if (parsed == PARSE_CANNOT_DECODE) {
+    return REFERENCE_CANNOT_DECODE;
+  }
+
+  return NMEA_SENTENCE_VALID;
+}
+
+static uint8_t parse_gpgga(char * s, gps_fix_t * fix) {
+  char field_buf[GPS_FIELD_BUFF_SZ];
+  memset(field_buf, '\0', GPS_FIELD_BUFF_SZ);
+
+  // $GPGGA header - ignore
+  s = strtok(s, ",");
+
+  // UTC Time - hhmmss.sss
+  NEXT_FIELD_OF(s, 6);
+  strncpy(field_buf, s, 2);
+  fix->hours = atoi(field_buf);
+
+  memset(field_buf, '\0', GPS_FIELD_BUFF_SZ);
+  strncpy(field_buf, s+2, 2);
+  fix->minutes = atoi(field_buf);
+
+  memset(field_buf, '\0', GPS_FIELD_BUFF_SZ);
+  strncpy(field_buf, s+4, 6);
+  long milliseconds = SCALED(atof(field_buf), 1000);
+  fix->seconds = milliseconds / 1000;
+  fix->milliseconds = milliseconds % 1000;
+
+  // Latitude - ddmm.mmmm
+  NEXT_FIELD_OF(s, 4);
+  memset(field_buf, '\0', GPS_FIELD_BUFF_SZ);
+  strncpy(field_buf, s, 2);
+  uint8_t lat_degrees = atoi(field_buf);
+
+  memset(field_buf, '\0', GPS_FIELD_BUFF_SZ);
+  strncpy(field_buf, s+2, 7);
+  float lat_minutes = atof(field_buf);
+
+  // Latitude Hemisphere
+  NEXT_FIELD(s);
+  uint8_t lat_is_south;
+  if (*s == 'N') {
+    lat_is_south = 0;
+  } else if (*s == 'S') {
+    lat_is_south = 1;
+  } else {
+    fix->errors |= GPS_FIX_ERR_UNEXPECT_VAL;
+    return 1;
+  }
+
+  // Longitude - dddmm.mmmm
+  NEXT_FIELD_OF(s, 5);
+  memset(field_buf, '\0', GPS_FIELD_BUFF_SZ);
+  strncpy(field_buf, s, 3);
+  uint8_t long_degrees = atoi(field_buf);
+
+  memset(field_buf, '\0', GPS_FIELD_BUFF_SZ);
+  strncpy(field_buf, s+3, 7);
+  float long_minutes = atof(field_buf);
+
+  // Longitude Hemisphere
+  NEXT_FIELD(s);
+  uint8_t long_is_west;
+  if (*s == 'W') {
+    long_is_west = 1;
+  } else if (*s == 'E') {
+    long_is_west = 0;
+  } else {
+    fix->errors |= GPS_FIX_ERR_UNEXPECT_VAL;
+    return 1;
+  }
+
+  float latitude = lat_degrees + (lat_minutes / 60.0);
+  if (lat_is_south) {
+    latitude = -latitude;
+  }
+
+  float longitude = long_degrees + (long_minutes / 60.0);
+  if (long_is_west) {
+    longitude = -longitude;
+  }
+
+  fix->latitude_e7 = SCALED(latitude, 1e7);
+  fix->longitude_e7 = SCALED(longitude, 1e7);
+
+  // Position (Fix) Indicator
+  NEXT_FIELD(s);
+  if (*s == GPS_NO_FIX) {
+    fix->errors |= GPS_FIX_ERR_NO_FIX;
+    return 1;
+  }
+
+  // Satellite Count
+  NEXT_FIELD(s);
+  fix->satcount = atoi(s);
+
+  // Horizontal Dilution of Precision (HDOP)
+  NEXT_FIELD(s);
+  fix->hdop_x100 = SCALED(atof(s), 100);
+
+  // Mean Sea Level Altitude
+  NEXT_FIELD(s);
+  fix->msl_altitude_cm = SCALED(atof(s), 100);
+
+  return 0;
+}
+
+static uint8_t parse_gpgsa(char * s, gps_fix_t * fix) {
+  // $GPGSA header - ignore
+  s = strtok(s, ",");
+
+  // Mode 1 - ignore
+  NEXT_FIELD(s);
+
+  // Mode 2 - ignore
+  NEXT_FIELD(s);
+
+  // Satellite Used (12 total) - ignore all
+  // The first field with a decimal point is taken to be the PDOP field
+  uint8_t i;
+  for (i = 0; i < 12; i++) {
+    NEXT_FIELD(s);
+
+    if (*(s + 1) == '.') {
+      break;
+    }
+  }
+
+  if (i == 12) {
+    NEXT_FIELD(s);
+  }
+  fix->pdop_x100 = SCALED(atof(s), 100);
+
+  // HDOP - ignore (we get this from $GPGGA)
+  NEXT_FIELD(s);
+
+  // Vertical Dilution of Precision (VDOP)
+  NEXT_FIELD(s);
+  fix->vdop_x100 = SCALED(atof(s), 100);
+
+  return 0;
+}
+
+static uint8_t parse_gprmc(char * s, gps_fix_t * fix) {
+  // $GPRMC header - ignore
+  s = strtok(s, ",");
+
+  // UTC Time - ignore (we get this from $GPGGA)
+  NEXT_FIELD(s);
+
+  // Status
+  NEXT_FIELD(s);
+  if (*s != 'A') {
+    fix->errors |= GPS_FIX_ERR_NOT_VALID;
+    return 1;
+  }
+
+  // Latitude, Hemisphere, Longitude, Hemisphere - ignore
+  NEXT_FIELD(s);
+  NEXT_FIELD(s);
+  NEXT_FIELD(s);
+  NEXT_FIELD(s);
+
+  // Speed over ground
+  NEXT_FIELD(s);
+  fix->ground_speed_kt_x100 = SCALED(atof(s), 100);
+
+  // True course over ground
+  NEXT_FIELD(s);
+  fix->ground_course_cdeg = SCALED(atof(s), 100);
+
+  // Date - ddmmyy
+  NEXT_FIELD_OF(s, 6);
+  strncpy(fix->date, s, GPS_FIX_DATE_WIDTH - 1);
+
+  return 0;
+}
+
+static uint8_t parse_gpvtg(char * s, gps_fix_t * fix) {
+  // $GPVTG header - ignore
+  s = strtok(s, ",");
+
+  // Course - True heading
+  NEXT_FIELD(s);
+  float true_hdg_deg = atof(s);
+
+  // Course reference
+  NEXT_FIELD(s);
+  if (*s != 'T') {
+    fix->errors |= GPS_FIX_ERR_UNEXPECT_VAL;
+    return 1;
+  }
+  fix->true_hdg_cdeg = SCALED(true_hdg_deg, 100);
+
+  // Course - Magnetic heading - expected to be empty, so strtok() is
+  // already pointing at its reference field ('M')
+  NEXT_FIELD(s);
+
+  // Horizontal speed in knots
+  NEXT_FIELD(s);
+  float speed_knots = atof(s);
+
+  // Speed reference
+  NEXT_FIELD(s);
+  if (*s != 'N') {
+    fix->errors |= GPS_FIX_ERR_UNEXPECT_VAL;
+    return 1;
+  }
+  fix->speed_kt_x100 = SCALED(speed_knots, 100);
+
+  // Horizontal speed in kmph
+  NEXT_FIELD(s);
+  float speed_kmph = atof(s);
+
+  // Speed reference
+  NEXT_FIELD(s);
+  if (*s != 'K') {
+    fix->errors |= GPS_FIX_ERR_UNEXPECT_VAL;
+    return 1;
+  }
+  fix->speed_kmph_x100 = SCALED(speed_kmph, 100);
+
+  return 0;
+}
+
+static uint8_t hexchar_to_dec(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+
+  return GPS_INVALID_HEX_CHAR;
+}
+
+static uint8_t validate_checksum(char * s) {
+  uint8_t checksum = 0;
+  uint8_t s_cursor;
+
+  // Note: only the characters between '$' and '*' are used
+  for (s_cursor = 1; s_cursor < REFERENCE_SENTENCE_BUFF_SZ; s_cursor++) {
+    if (*(s + s_cursor) != '*') {
+      checksum ^= *(s + s_cursor);
+    } else {
+      break;
+    }
+  }
+
+  s_cursor++;
+
+  if (s_cursor + GPS_CHECKSUM_LENGTH >= REFERENCE_SENTENCE_BUFF_SZ) {
+    return 0;
+  }
+
+  uint8_t chk_upper = hexchar_to_dec(s[s_cursor]);
+  uint8_t chk_lower = hexchar_to_dec(s[s_cursor + 1]);
+
+  if (chk_upper == GPS_INVALID_HEX_CHAR || chk_lower == GPS_INVALID_HEX_CHAR) {
+    return 0;
+  }
+
+  uint8_t expected_checksum = (chk_upper << 4) | chk_lower;
+
+  if (checksum == expected_checksum) {
+    return 1;
+  }
+
+  return 0;
+}
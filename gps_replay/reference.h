@@ -0,0 +1,24 @@
+/*
+ * File: reference.h
+ *
+ * The original strtok()/atof() sentence decoder from gps_mega/gps.c. It is
+ * kept here so the streaming parser can be checked against it.
+ */
+#ifndef _REFERENCE_H_
+#define _REFERENCE_H_
+
+#include "gps_fix.h"
+
+#define REFERENCE_SENTENCE_BUFF_SZ  128
+
+// Returned for a sentence that's missing fields the original decoder
+// needed (it would have crashed, or decoded garbage); there is nothing to
+// compare against
+#define REFERENCE_CANNOT_DECODE     0xFF
+
+/* Decodes a single, complete sentence (destructively). Returns one of the
+ * NMEA_* result codes from nmea.h, or REFERENCE_CANNOT_DECODE.
+ */
+uint8_t reference_parse(char * sentence, gps_fix_t * fix);
+
+#endif /* _REFERENCE_H_ */
@@ -0,0 +1,14 @@
+/*
+ * File: interrupt.h
+ *
+ * Host stand-in: an ISR becomes a plain function that the replay calls for
+ * each received byte, and there are no interrupts to enable or disable.
+ */
+#ifndef _STUB_AVR_INTERRUPT_H_
+#define _STUB_AVR_INTERRUPT_H_
+
+#define ISR(vector)     void vector(void)
+#define cli()
+#define sei()
+
+#endif /* _STUB_AVR_INTERRUPT_H_ */
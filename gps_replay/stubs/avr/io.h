@@ -0,0 +1,32 @@
+/*
+ * File: io.h
+ *
+ * Host stand-ins for the ATmega2560 registers used by gps_mega/gps.c. The
+ * registers are plain variables (see registers.c) except UCSR1A, which
+ * always reports that the transmitter is ready so that the commands sent
+ * to the receiver never block.
+ */
+#ifndef _STUB_AVR_IO_H_
+#define _STUB_AVR_IO_H_
+
+#include <stdint.h>
+
+extern volatile uint8_t UDR1;
+extern volatile uint8_t UCSR1B;
+extern volatile uint8_t UCSR1C;
+extern volatile uint8_t UBRR1H;
+extern volatile uint8_t UBRR1L;
+extern volatile uint8_t stub_ucsr1a;
+
+#define UCSR1A  (*(stub_ucsr1a |= (1 << UDRE1) | (1 << TXC1), &stub_ucsr1a))
+
+#define RXCIE1  7
+#define TXC1    6
+#define UDRE1   5
+#define RXEN1   4
+#define TXEN1   3
+#define UCSZ01  2
+#define UCSZ00  1
+#define U2X1    1
+
+#endif /* _STUB_AVR_IO_H_ */
@@ -0,0 +1,13 @@
+/*
+ * File: registers.c
+ *
+ * Storage for the stand-in registers declared in stubs/avr/io.h
+ */
+#include <avr/io.h>
+
+volatile uint8_t UDR1;
+volatile uint8_t UCSR1B;
+volatile uint8_t UCSR1C;
+volatile uint8_t UBRR1H;
+volatile uint8_t UBRR1L;
+volatile uint8_t stub_ucsr1a;
@@ -0,0 +1,12 @@
+/*
+ * File: delay.h
+ *
+ * Host stand-in: delays return immediately.
+ */
+#ifndef _STUB_UTIL_DELAY_H_
+#define _STUB_UTIL_DELAY_H_
+
+#define _delay_ms(ms)
+#define _delay_us(us)
+
+#endif /* _STUB_UTIL_DELAY_H_ */
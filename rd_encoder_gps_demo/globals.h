@@ -15,14 +15,15 @@
 
 #define GLOBAL_START                     0xBABECAFEL
 #define GLOBAL_STOP                      0xDEADBEEFL
-#define GLOBAL_PADDING_SIZE              150  // 512 - 362
+#define GLOBAL_PADDING_SIZE              144  // 512 - 368
 
 #define METERS_FROM_ENCODER_TICKS        0.000187987592819  // 1.0/5319.5
 
 #define GPS_RADIUS_LONGITUDE             6383576.31721
 #define GPS_RADIUS_LATITUDE              6351161.08104
-#define GPS_REF_LATITUDE_RAD             0.699377429551343  // SparkFun AVC
-#define GPS_REF_LONGITUDE_RAD            -1.836606289228911 // starting line
+#define GPS_E7_TO_RAD                    1.74532925199e-9   // DEG_TO_RAD / 10^7
+#define GPS_REF_LATITUDE_E7              400713750L   // SparkFun AVC starting
+#define GPS_REF_LONGITUDE_E7             -1052297890L // line (1e-7 degrees)
 #define GPS_REF_HEAD_SIN                 0.0
 #define GPS_REF_HEAD_COS                 1.0
 
@@ -65,10 +66,12 @@ typedef struct {
   char     gps1_string[84];
   char     gps2_string[84];
   char     gps3_string[84];
-  float    gga_latitude;
-  float    gga_longitude;
-  float    gga_hdop;
-  float    gga_altitude;
+  int32_t  gga_latitude_e7;   // degrees * 10^7
+  int32_t  gga_longitude_e7;  // degrees * 10^7
+  uint16_t gga_hdop_x100;
+  int32_t  gga_altitude_cm;
+  uint32_t gga_stamp_ticks;   // TIMER1 ticks when the $ of the GGA arrived
+  uint32_t gga_age_ticks;     // age of the GGA when it was processed
   float    gga_local_x;
   float    gga_local_y;
   
@@ -107,12 +110,26 @@ typedef struct {
   uint16_t steering_servo_us;
   uint16_t gasbrake_servo_us;
 
-  char padding[150];
+  char padding[GLOBAL_PADDING_SIZE];
   uint32_t stop_bytes;
 } globals_t;
 
 extern globals_t globals;
 
+// TIMER1 ticks counted in the previous loops. The main loop adds TCNT1 to
+// it just before resetting TCNT1, so timer1_base_ticks + TCNT1 is a
+// monotonic time in 4 us ticks.
+extern volatile uint32_t timer1_base_ticks;
+
+inline uint32_t timer1_now_ticks(void)
+{
+  uint8_t sreg = SREG;
+  cli();
+  uint32_t now = timer1_base_ticks + TCNT1;
+  SREG = sreg;
+  return now;
+}
+
 inline void set_padding(globals_t * globals)
 {
     for (uint16_t i = 0; i < GLOBAL_PADDING_SIZE; i++)
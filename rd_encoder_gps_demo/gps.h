@@ -20,6 +20,7 @@
 // Serial buffers
 typedef struct {
   uint8_t ready;
+  uint32_t stamp_ticks;   // when the $ arrived; see timer1_now_ticks()
   char data[SERIAL_BUFFER_SIZE];
 } rx_buffer_t;
 
@@ -58,10 +59,14 @@ ISR(USART_RX_vect)
     }
   }
 
-  if (ch == '$' && active_buffer_index != 0)
+  if (ch == '$')
   {
-    serial_unexpected_start = 1;
-    active_buffer_index = 0;
+    if (active_buffer_index != 0)
+    {
+      serial_unexpected_start = 1;
+      active_buffer_index = 0;
+    }
+    rx_buffers[active_buffer].stamp_ticks = timer1_now_ticks();
   }
   
   if (ch != '\n')
@@ -152,18 +157,79 @@ uint8_t check_nmea_checksum(char *string)
 }
 
 
+/* Reads a decimal number such as "-12.5" and returns it scaled by
+ * 10^decimals (e.g., -1250 for 2 decimals) without using floating point.
+ * Any digits beyond the requested decimals are dropped.
+ */
+int32_t parse_scaled(char *string, uint8_t decimals)
+{
+  int32_t value = 0;
+  uint8_t negative = 0;
+
+  if (*string == '-')
+  {
+    negative = 1;
+    string++;
+  }
+
+  while (*string >= '0' && *string <= '9')
+    value = value * 10 + (*string++ - '0');
+
+  if (*string == '.')
+    string++;
+
+  for (; decimals > 0; decimals--)
+  {
+    value = value * 10;
+    if (*string >= '0' && *string <= '9')
+      value += *string++ - '0';
+  }
+
+  if (negative)
+    return -value;
+
+  return value;
+}
+
+
+/* Reads a (d)ddmm.mmmm coordinate and returns it in 1e-7 degrees */
+int32_t parse_degrees_e7(char *string)
+{
+  uint32_t ddmm = 0;
+
+  while (*string >= '0' && *string <= '9')
+    ddmm = ddmm * 10 + (*string++ - '0');
+
+  uint32_t minutes_e7 = (ddmm % 100) * 10000000UL;
+
+  if (*string == '.')
+    string++;
+
+  for (uint32_t scale = 1000000UL; scale > 0; scale /= 10)
+  {
+    if (*string < '0' || *string > '9')
+      break;
+    minutes_e7 += (*string++ - '0') * scale;
+  }
+
+  return (ddmm / 100) * 10000000L + (minutes_e7 + 30) / 60;
+}
+
+
 void update_local_xy()
 {
-  double rlat = globals.gga_latitude * DEG_TO_RAD;
-  double rlon = globals.gga_longitude * DEG_TO_RAD;
-  double dLat = (rlat - GPS_REF_LATITUDE_RAD) * GPS_RADIUS_LATITUDE;
-  double dLon = (rlon - GPS_REF_LONGITUDE_RAD) * GPS_RADIUS_LONGITUDE;
+  // Take the difference from the reference point while still in integer
+  // 1e-7 degrees; only the (small) offsets are converted to floating point
+  double dLat = (globals.gga_latitude_e7 - GPS_REF_LATITUDE_E7) *
+                GPS_E7_TO_RAD * GPS_RADIUS_LATITUDE;
+  double dLon = (globals.gga_longitude_e7 - GPS_REF_LONGITUDE_E7) *
+                GPS_E7_TO_RAD * GPS_RADIUS_LONGITUDE;
 
   globals.gga_local_y = dLat * GPS_REF_HEAD_COS + dLon * GPS_REF_HEAD_SIN;
   globals.gga_local_x = -dLat * GPS_REF_HEAD_SIN + dLon * GPS_REF_HEAD_COS;
 }
 
-void process_gps_string(char *string)
+void process_gps_string(char *string, uint32_t stamp_ticks)
 {
   if (strncmp(string, "$GPGGA", 6) != 0)
     return;
@@ -174,53 +240,22 @@ void process_gps_string(char *string)
   string = strchr(string, ',')+1; // Time
   // ignore
 
-  uint8_t i;
-  char temp[10];
   string = strchr(string, ',')+1; // Latitude
+  int32_t latitude = parse_degrees_e7(string);
 
-  for (i = 0; i < 10; i++)
-  {
-    if (string[i+2] == '.')
-      break;
-    temp[i] = string[i];
-  }
-  temp[i] = '\0';
-
-  int latitude_degrees = atoi(temp);
-
-  string += i;    
-  float latitude_minutes = atof(string);
-  
   string = strchr(string, ',')+1; // N/S
-  uint8_t south = 0;
   if (*string == 'S')
-    south = 1;
-  else if (*string == 'N')
-    south = 0;
-  else
+    latitude = -latitude;
+  else if (*string != 'N')
     return;
-      
-  string = strchr(string, ',')+1; // Longitude
 
-  for (i = 0; i < 10; i++)
-  {
-    if (string[i+2] == '.')
-      break;
-    temp[i] = string[i];
-  }
-  temp[i] = '\0';
+  string = strchr(string, ',')+1; // Longitude
+  int32_t longitude = parse_degrees_e7(string);
 
-  float longitude_degrees = atoi(temp);
-  string += i;    
-  float longitude_minutes = atof(string);
-  
   string = strchr(string, ',')+1; // E/W
-  uint8_t west = 0;
   if (*string == 'W')
-    west = 1;
-  else if (*string == 'E')
-    west = 0;
-  else
+    longitude = -longitude;
+  else if (*string != 'E')
     return;
 
   string = strchr(string, ',')+1; // quality indicator
@@ -232,26 +267,21 @@ void process_gps_string(char *string)
   // ignore
   
   string = strchr(string, ',')+1; // hdop
-  float hdop = atof(string);
+  uint16_t hdop = parse_scaled(string, 2);
   
   string = strchr(string, ',')+1; // altitude
-  float altitude = atof(string);
+  int32_t altitude = parse_scaled(string, 2);
   
   // ignore the remaining fields
 
-  double latitude = latitude_degrees + latitude_minutes/60.0;
-  if (south)
-    latitude = -latitude;
-
-  double longitude = longitude_degrees + longitude_minutes/60.0;
-  if (west)
-    longitude = -longitude;
-
-  globals.gga_latitude = latitude;
-  globals.gga_longitude = longitude;
+  globals.gga_latitude_e7 = latitude;
+  globals.gga_longitude_e7 = longitude;
   
-  globals.gga_hdop = hdop;
-  globals.gga_altitude = altitude;
+  globals.gga_hdop_x100 = hdop;
+  globals.gga_altitude_cm = altitude;
+
+  globals.gga_stamp_ticks = stamp_ticks;
+  globals.gga_age_ticks = timer1_now_ticks() - stamp_ticks;
 
   update_local_xy();
   
@@ -286,10 +316,12 @@ void update_gps(void)
     globals.gps3_string[i] = 0;
   }
 
-  globals.gga_latitude = 0;
-  globals.gga_longitude = 0;
-  globals.gga_hdop = 0;
-  globals.gga_altitude = 0;
+  globals.gga_latitude_e7 = 0;
+  globals.gga_longitude_e7 = 0;
+  globals.gga_hdop_x100 = 0;
+  globals.gga_altitude_cm = 0;
+  globals.gga_stamp_ticks = 0;
+  globals.gga_age_ticks = 0;
 
   if (serial_no_free_buffer)
   {
@@ -312,21 +344,21 @@ void update_gps(void)
   if (rx_buffers[0].ready)
   { 
     memcpy(globals.gps1_string, rx_buffers[0].data, SERIAL_BUFFER_SIZE);
-    process_gps_string(globals.gps1_string);
+    process_gps_string(globals.gps1_string, rx_buffers[0].stamp_ticks);
     globals.status_bits |= STATUS_GPS1_RECEIVED;
     rx_buffers[0].ready = 0;
   }
   if (rx_buffers[1].ready)
   {
     memcpy(globals.gps2_string, rx_buffers[1].data, SERIAL_BUFFER_SIZE);
-    process_gps_string(globals.gps2_string);
+    process_gps_string(globals.gps2_string, rx_buffers[1].stamp_ticks);
     globals.status_bits |= STATUS_GPS2_RECEIVED;
     rx_buffers[1].ready = 0;
   }
   if (rx_buffers[2].ready)
   {
     memcpy(globals.gps3_string, rx_buffers[2].data, SERIAL_BUFFER_SIZE);
-    process_gps_string(globals.gps3_string);
+    process_gps_string(globals.gps3_string, rx_buffers[2].stamp_ticks);
     globals.status_bits |= STATUS_GPS3_RECEIVED;
     rx_buffers[2].ready = 0;
   }
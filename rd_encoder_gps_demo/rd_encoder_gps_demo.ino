@@ -21,6 +21,7 @@ This code is based on the Rocksteady framework.
 #include "waypoints.h"
 
 volatile uint8_t timer1_overflow = 0;
+volatile uint32_t timer1_base_ticks = 0;
 globals_t globals;
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -113,7 +114,15 @@ void setup() {
 
 void loop() {
   LOOP_ACTIVE_PORT |= LOOP_ACTIVE_PIN;
-  TCNT1 = 0; // reset timer/counter 1 for each loop iteration
+
+  // keep the time since setup before resetting timer/counter 1 for each
+  // loop iteration; the GPS ISR reads both
+  noInterrupts();
+  timer1_base_ticks += TCNT1;
+  if (timer1_overflow)
+    timer1_base_ticks += 0x10000UL;
+  TCNT1 = 0;
+  interrupts();
   
   // start the PWM pulses for steering and gasbrake
   PORTD |= (GASBRAKE_PIN | STEERING_PIN);
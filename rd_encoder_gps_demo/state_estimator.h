@@ -30,6 +30,18 @@ void update_state_estimator(void)
   {
     globals.vehicle_x = globals.gga_local_x;
     globals.vehicle_y = globals.gga_local_y;
+
+    // The fix is where the vehicle was when the GGA sentence began to
+    // arrive. Carry it forward by the distance driven since then, at the
+    // speed the encoder measured over the last loop.
+    if (globals.status_bits & STATUS_ENCODER_VALID)
+    {
+      float meters = globals.encoder_ticks * METERS_FROM_ENCODER_TICKS *
+                     globals.gga_age_ticks / LOOP_PERIOD_TICKS;
+
+      globals.vehicle_x += cos(globals.vehicle_angle) * meters;
+      globals.vehicle_y += sin(globals.vehicle_angle) * meters;
+    }
   }
   else if (globals.status_bits & STATUS_ENCODER_VALID)
   {
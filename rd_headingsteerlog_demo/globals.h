@@ -19,8 +19,8 @@
 #define STEERING_GAIN              2.7777777777777  // 500 pwm_us / 180 degrees
 
 #define GLOBAL_START               0xBABECAFEL
-#define GLOBAL_STOP                0xDEADBEEFL
-#define GLOBAL_PADDING_SIZE        471  // 512 - (4+4+4+1+1+1+2+4+4+4+4+2+2+4)
+#define GLOBAL_STOP                0xDEADC0DEL  // 0xDEADBEEF before the CRC
+#define GLOBAL_PADDING_SIZE        467  // 512 - (4+4+4+1+1+1+2+4+4+4+4+2+2+4+4)
 
 ////////////////////////////////////////////////////////////////////////////////
 // Global Variables
@@ -45,6 +45,8 @@ typedef struct {
   uint16_t gasbrake_servo_us;
   
   char padding[GLOBAL_PADDING_SIZE];
+  uint32_t crc;                   // CRC-32 of the bytes before it; start_log()
+                                  // works it out as it sends them
   uint32_t stop_bytes;
 } globals_t;
 
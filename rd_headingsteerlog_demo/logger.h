@@ -1,6 +1,9 @@
 #include <avr/interrupt.h>
+#include <inttypes.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "globals.h"
 #include "RobotDevil.h"
 
@@ -13,9 +16,168 @@
 #define CMD0 0                // resets the card to idle state
 #define CMD8 8                // send interface condition
 #define CMD9 9                // indicates card-specific data will be sent
+#define CMD17 17              // block read command
 #define CMD24 24              // block write command
 #define CMD55 55              // indicates next command is application-specific
 #define ACMD41 41             // app specific command: request card's OCR
+#define CMD59 59              // turns the card's CRC checking on or off
+
+/* The first blocks of the card hold a journal that says where logging
+ * should resume.  Each entry is written to the next of its blocks in
+ * turn, so the newest entry is the valid one with the highest sequence
+ * number.
+ */
+#define LOGGER_JOURNAL_BLOCKS    8
+#define LOGGER_FIRST_BLOCK       LOGGER_JOURNAL_BLOCKS
+#define LOGGER_JOURNAL_MAGIC     0x4C4E524AUL    // "JRNL"
+#define LOGGER_JOURNAL_INTERVAL  64    // blocks logged between entries
+#define LOGGER_RESUME_SCAN_LIMIT (2 * LOGGER_JOURNAL_INTERVAL)
+
+/* The card programs each block while the loop carries on, and is polled
+ * once per loop rather than waited for.  How many loops each block took
+ * is counted in buckets of powers of two: 0, 1, 2-3, 4-7 ... with the
+ * last holding the rest.  A card that's always done within a loop keeps
+ * up with the log.
+ */
+#define LOGGER_BUSY_BUCKETS      8
+
+/* Each block of globals carries a CRC-32 (as zlib's crc32()) of the bytes
+ * before it, so the host can tell a block that was corrupted anywhere on
+ * the way.  Set LOGGER_CRC to 1 to also have the card check the CRC7 of
+ * every command (CMD59) and the CRC16 of every data block.  A block the
+ * card rejects (for its CRC, or a write error) isn't counted, so the next
+ * loop's globals go to the same block, up to LOGGER_WRITE_RETRIES times
+ * in a row before logging is disabled.
+ *
+ * Both CRCs of each byte are worked out from byte-wide tables while the
+ * SPI shifts it out: that takes about as long as the 64 cycles that a
+ * byte takes at 2 MHz, so the CRCs add next to nothing to start_log().
+ */
+#ifndef LOGGER_CRC
+#define LOGGER_CRC               0
+#endif
+#define LOGGER_WRITE_RETRIES     3
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t sequence;        // one more than the previous entry's
+  uint32_t next_block;      // the blocks before it hold log frames
+  uint32_t session;         // counts the times the card was initialized
+  uint32_t session_start;   // the first block of this session
+  uint32_t check;           // ~sequence; guards against a torn entry
+} logger_journal_t;
+
+typedef struct
+{
+  uint32_t crc32;           // inverted, as it's worked out
+  uint16_t crc16;           // of the data block, for the card
+} logger_crc_t;
+
+/* Byte-wide CRC tables (see LOGGER_CRC) */
+const uint16_t logger_crc16_table[256] PROGMEM =
+{
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+  0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+  0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+  0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+  0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+  0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+  0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+  0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+  0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+  0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+  0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+  0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+  0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+  0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+  0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+  0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+  0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+  0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+  0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+  0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+  0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+  0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+  0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+  0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+  0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+  0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+  0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+  0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+  0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+  0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+  0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
+const uint32_t logger_crc32_table[256] PROGMEM =
+{
+  0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA,
+  0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3,
+  0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+  0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91,
+  0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE,
+  0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+  0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC,
+  0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5,
+  0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+  0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B,
+  0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940,
+  0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+  0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116,
+  0x21B4F4B5, 0x56B3C423, 0xCFBA9599, 0xB8BDA50F,
+  0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+  0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D,
+  0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A,
+  0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+  0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818,
+  0x7F6A0DBB, 0x086D3D2D, 0x91646C97, 0xE6635C01,
+  0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+  0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457,
+  0x65B0D9C6, 0x12B7E950, 0x8BBEB8EA, 0xFCB9887C,
+  0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+  0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2,
+  0x4ADFA541, 0x3DD895D7, 0xA4D1C46D, 0xD3D6F4FB,
+  0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+  0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9,
+  0x5005713C, 0x270241AA, 0xBE0B1010, 0xC90C2086,
+  0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+  0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4,
+  0x59B33D17, 0x2EB40D81, 0xB7BD5C3B, 0xC0BA6CAD,
+  0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+  0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683,
+  0xE3630B12, 0x94643B84, 0x0D6D6A3E, 0x7A6A5AA8,
+  0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+  0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE,
+  0xF762575D, 0x806567CB, 0x196C3671, 0x6E6B06E7,
+  0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+  0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5,
+  0xD6D6A3E8, 0xA1D1937E, 0x38D8C2C4, 0x4FDFF252,
+  0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+  0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60,
+  0xDF60EFC3, 0xA867DF55, 0x316E8EEF, 0x4669BE79,
+  0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+  0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F,
+  0xC5BA3BBE, 0xB2BD0B28, 0x2BB45A92, 0x5CB36A04,
+  0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+  0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A,
+  0x9C0906A9, 0xEB0E363F, 0x72076785, 0x05005713,
+  0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+  0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21,
+  0x86D3D2D4, 0xF1D4E242, 0x68DDB3F8, 0x1FDA836E,
+  0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+  0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C,
+  0x8F659EFF, 0xF862AE69, 0x616BFFD3, 0x166CCF45,
+  0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+  0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB,
+  0xAED16A4A, 0xD9D65ADC, 0x40DF0B66, 0x37D83BF0,
+  0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+  0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6,
+  0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
+  0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+  0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+};
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -23,11 +185,18 @@
 volatile uint8_t logger_enabled;
 uint32_t logger_next_block;
 uint32_t logger_card_blocks;
+logger_journal_t logger_journal;   // the newest entry in the journal
+uint8_t logger_card_busy;          // programming the last block sent
+uint16_t logger_busy_loops;        // that ended while it was
+uint32_t logger_busy_histogram[LOGGER_BUSY_BUCKETS];
+uint32_t logger_deferred;          // loops not logged as the card was busy
+uint32_t logger_crc_errors;        // blocks read or sent with a bad CRC
+uint8_t logger_write_retries;      // of the block being logged, so far
 
 
 ////////////////////////////////////////////////////////////////////////////////
 // Logger Functions
-void serial_write(char *cmd)
+void serial_write(const char *cmd)
 {
 #define SERIAL_OUTPUT 1
 #if SERIAL_OUTPUT
@@ -47,15 +216,70 @@ uint8_t spi_transfer(uint8_t ch)
   return SPDR;
 }
 
+/* Sends a byte and, while the SPI shifts it out, updates the CRCs of the
+ * bytes sent so far with it.
+ */
+uint8_t spi_transfer_crc(uint8_t ch, logger_crc_t *crc)
+{
+  SPDR = ch;
+
+  crc->crc32 = (crc->crc32 >> 8) ^
+    pgm_read_dword(&logger_crc32_table[(uint8_t)crc->crc32 ^ ch]);
+#if LOGGER_CRC
+  crc->crc16 = (crc->crc16 << 8) ^
+    pgm_read_word(&logger_crc16_table[(uint8_t)(crc->crc16 >> 8) ^ ch]);
+#endif
+
+  while(!(SPSR & (1<<SPIF))) {}
+  return SPDR;
+}
+
+/* Returns the CRC16 of a data block updated with a byte received */
+uint16_t crc16_update(uint16_t crc, uint8_t ch)
+{
+  return (crc << 8) ^ pgm_read_word(&logger_crc16_table[(uint8_t)(crc >> 8) ^ ch]);
+}
+
+/* Returns the last byte of a command: the CRC7 of the length bytes
+ * before it, then the end bit.
+ */
+uint8_t crc7_suffix(const uint8_t *bytes, uint8_t length)
+{
+  uint8_t crc = 0;
+
+  for (uint8_t i = 0; i < length; i++)
+  {
+    uint8_t ch = bytes[i];
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+      crc <<= 1;
+      if ((ch ^ crc) & 0x80)
+        crc ^= 0x09;
+      ch <<= 1;
+    }
+  }
+
+  return (crc << 1) | 1;
+}
+
 uint8_t sd_command(uint8_t cmd,
                    uint32_t arg,
                    uint8_t crc)
 {
-  spi_transfer(0b01000000 | (cmd & 0b00111111));
-  spi_transfer(arg>>24);
-  spi_transfer(arg>>16);
-  spi_transfer(arg>>8);
-  spi_transfer(arg);
+  uint8_t bytes[5];
+  bytes[0] = 0b01000000 | (cmd & 0b00111111);
+  bytes[1] = arg>>24;
+  bytes[2] = arg>>16;
+  bytes[3] = arg>>8;
+  bytes[4] = arg;
+
+  for (uint8_t i = 0; i < sizeof(bytes); i++)
+    spi_transfer(bytes[i]);
+
+#if LOGGER_CRC
+  /* The card checks every command's CRC, not just CMD0's and CMD8's. */
+  crc = crc7_suffix(bytes, sizeof(bytes));
+#endif
   spi_transfer(crc);
 
   for (uint8_t i = 0; i < 0xFF; i++)
@@ -130,7 +354,7 @@ uint8_t read_card_size(void)
   logger_card_blocks = (c_size+1) * 1024;
 
   snprintf(msg, 100,
-           "card size: %lu blocks\n", logger_card_blocks);
+           "card size: %" PRIu32 " blocks\n", logger_card_blocks);
   serial_write(msg);
 
   if (logger_card_blocks == 0)
@@ -139,30 +363,17 @@ uint8_t read_card_size(void)
   return 1;
 }
 
-/* Determines if a block on the SD card has been (fully or partially)
- * filled in by looking at the first 32 bits.
- *
- * Returns 1 if the block starts with GLOBAL_START
- *
- * Returns 0 if the block does not start with GLOBAL_START
+/* Reads the first length bytes of a block into buff and skips the rest.
  *
- * Returns -1 if there was an error reading the block.
- * 
+ * Returns 1 if successful, 0 if there was an error reading the block.
  */
-int8_t check_block(uint32_t block_address)
-{  
+uint8_t read_block_start(uint32_t block_address, void *buff, uint16_t length)
+{
   uint16_t i;
   uint8_t ch;
-  union {
-    uint8_t bytes[4];
-    uint32_t dword;
-  } data;
 
-  char msg[100];
-  snprintf(msg, 100, "reading block %lu\n", block_address);
-  serial_write(msg);
-  if (sd_command(17, block_address, 0) != 0)
-    return -1;
+  if (sd_command(CMD17, block_address, 0) != 0)
+    return 0;
   
   for (i = 0; i < 0xFF; i++)
   {
@@ -171,94 +382,179 @@ int8_t check_block(uint32_t block_address)
         break;
   }
   if (ch != 0xFE)
-    return -1;
-  
-  // Read the first 32 bits of data
-  data.bytes[0] = spi_transfer(0xFF);
-  data.bytes[1] = spi_transfer(0xFF);
-  data.bytes[2] = spi_transfer(0xFF);
-  data.bytes[3] = spi_transfer(0xFF);
-  
-  // Ignore the remaining data from the block
-  for (i = 0; i < 508; i++)
-    spi_transfer(0xFF);
+    return 0;
   
+#if LOGGER_CRC
+  uint16_t crc = 0;
+#endif
+  for (i = 0; i < 512; i++)
+  {
+    ch = spi_transfer(0xFF);
+    if (i < length)
+      ((uint8_t*)buff)[i] = ch;
+#if LOGGER_CRC
+    crc = crc16_update(crc, ch);
+#endif
+  }
+
+#if LOGGER_CRC
+  // Check the whole block against its 16 bit CRC
+  uint16_t received = (uint16_t)spi_transfer(0xFF) << 8;
+  received |= spi_transfer(0xFF);
+  if (received != crc)
+  {
+    logger_crc_errors += 1;
+    return 0;
+  }
+#else
   // Ignore the 16 bit CRC
   spi_transfer(0xFF);
   spi_transfer(0xFF);
+#endif
+
+  return 1;
+}
+
+/* Determines if a block on the SD card has been (fully or partially)
+ * filled in by looking at the first 32 bits.
+ *
+ * Returns 1 if the block starts with GLOBAL_START
+ *
+ * Returns 0 if the block does not start with GLOBAL_START
+ *
+ * Returns -1 if there was an error reading the block.
+ * 
+ */
+int8_t check_block(uint32_t block_address)
+{  
+  uint32_t start_bytes;
+
+  if (!read_block_start(block_address, &start_bytes, sizeof(start_bytes)))
+    return -1;
   
-  if (data.dword == GLOBAL_START)
+  if (start_bytes == GLOBAL_START)
     return 1;
   else
     return 0;
 }
 
-uint8_t find_available_block(void)
+/* Polls the card once, without waiting, if it may still be programming
+ * a block, and once it's done, records how many loops that took.
+ *
+ * Returns 1 while the card is busy, 0 once it's ready.
+ */
+uint8_t poll_card_busy(void)
 {
-  uint32_t min_address;
-  uint32_t max_address;;
-  uint8_t result;
-  char msg[100];
+  if (!logger_card_busy)
+    return 0;
 
-  /* Explicitly check the first block.  It is likely to be free since
-   * we clear the card every time we read it, and the binary search is
-   * simplified by not including the first address since we can always
-   * assume there is at least one preceding address.
-   */
-  
-  result = check_block(0);
-  if (result == -1)
+  if (spi_transfer(0xFF) != 0xFF)
+    return 1;
+
+  logger_card_busy = 0;
+
+  uint8_t bucket = 0;
+  for (uint16_t loops = logger_busy_loops;
+       loops > 0 && bucket < LOGGER_BUSY_BUCKETS - 1; loops >>= 1)
+    bucket++;
+  logger_busy_histogram[bucket] += 1;
+
+  return 0;
+}
+
+/* Writes the journal entry for the blocks logged so far to the next
+ * block of the journal, and leaves the card programming it.
+ *
+ * Returns 1 if successful, 0 otherwise.
+ */
+uint8_t write_journal(void)
+{
+  logger_journal.magic = LOGGER_JOURNAL_MAGIC;
+  logger_journal.sequence += 1;
+  logger_journal.next_block = logger_next_block;
+  logger_journal.check = ~logger_journal.sequence;
+
+  if (sd_command(CMD24, logger_journal.sequence % LOGGER_JOURNAL_BLOCKS, 0) != 0)
+    return 0;
+
+  spi_transfer(0xFE);
+
+  logger_crc_t crc = {0xFFFFFFFF, 0};
+  uint16_t i = 0;
+  for(i = 0; i < sizeof(logger_journal_t); i++)
+    spi_transfer_crc(((uint8_t*)&logger_journal)[i], &crc);
+  for(; i < 512; i++)
+    spi_transfer_crc(0x00, &crc);
+
+#if LOGGER_CRC
+  spi_transfer(crc.crc16 >> 8);
+  spi_transfer(crc.crc16);
+#else
+  /* Send ignored 16bit CRC checksum. */
+  spi_transfer(0x00);
+  spi_transfer(0x00);
+#endif
+
+  if ((spi_transfer(0xFF) & 0x1F) != 0x05)
     return 0;
-  if (result == 0)
+
+  logger_card_busy = 1;
+  logger_busy_loops = 0;
+
+  return 1;
+}
+
+/* Finds where the previous session stopped logging from the newest entry
+ * in the journal, and starts a new session there.  The entry can be up
+ * to LOGGER_JOURNAL_INTERVAL blocks out of date, so the blocks after it
+ * are checked for frames, up to LOGGER_RESUME_SCAN_LIMIT of them.  This
+ * takes the same time whatever the size of the card.
+ *
+ * Returns 1 if successful, 0 otherwise.
+ */
+uint8_t resume_log(void)
+{
+  logger_journal_t entry;
+  uint8_t i;
+
+  /* A card without a journal starts logging after the journal blocks. */
+  memset(&logger_journal, 0, sizeof(logger_journal));
+  logger_journal.next_block = LOGGER_FIRST_BLOCK;
+
+  for (i = 0; i < LOGGER_JOURNAL_BLOCKS; i++)
   {
-    logger_next_block = 0;
-    return 1;
+    if (!read_block_start(i, &entry, sizeof(entry)))
+      return 0;
+
+    if (entry.magic == LOGGER_JOURNAL_MAGIC &&
+        entry.check == ~entry.sequence &&
+        entry.sequence > logger_journal.sequence &&
+        entry.next_block >= LOGGER_FIRST_BLOCK &&
+        entry.next_block <= logger_card_blocks)
+      logger_journal = entry;
   }
 
-  min_address = 1;
-  max_address = logger_card_blocks-1;
-  while (max_address >= min_address)
+  uint32_t block = logger_journal.next_block;
+  for (uint16_t scanned = 0; scanned < LOGGER_RESUME_SCAN_LIMIT; scanned++)
   {
-    uint32_t midpoint = min_address + (max_address - min_address) / 2;
+    if (block >= logger_card_blocks)
+      break;
 
-    snprintf(msg, sizeof(msg), "[%lu %lu]: %lu\n", min_address, max_address, midpoint);
-    serial_write(msg);
-    
-    result = check_block(midpoint);
+    int8_t result = check_block(block);
     if (result == -1)
-      return -1;
-    else if (result == 0)
-    {
-      /* This block is free.  If the preceding block is used, this is
-       * the block we're looking for.
-       */
-      result = check_block(midpoint-1);
-      if (result == -1)
-        return -1;
-      if (result == 1)
-      {
-        /* Preceding block is used, so this is the correct block. */
-        logger_next_block = midpoint;
-        return 1;
-      }
-      /* The preceding block is also free, so move the search to the
-       * first half of the search space.
-       */
-      max_address = midpoint-1;      
-    }
-    else
-    {
-      /* This block is used, move search to the second half of the
-       * space.
-       */
-      min_address = midpoint+1;
-    }
+      return 0;
+    if (result == 0)
+      break;
+
+    block++;
   }
 
-  /* Searched entire space and didn't find a free block.  Either the
-   * card is full, or the blocks are not contiguous.
-   */
-  return 0;
+  logger_next_block = block;
+  logger_journal.session += 1;
+  logger_journal.session_start = block;
+
+  /* Record the start of the session. */
+  return write_journal();
 }
 
 void init_logger(void)
@@ -291,6 +587,10 @@ void init_logger(void)
   else if (response != 0x01)
     return;
 
+  // Clock out the rest of the R7 response before the next command.
+  for (i = 0; i < 4; i++)
+    spi_transfer(0xFF);
+
   for (i = 0; i < 0xFF; i++)
   {
     sd_command(CMD55, 0, 0);
@@ -300,6 +600,13 @@ void init_logger(void)
   }
   if (i == 0xFF)
     return;
+
+#if LOGGER_CRC
+  /* From here on, the card checks the CRC of every command and block. */
+  response = sd_command(CMD59, 1, 0x83);
+  if (response != 0)
+    return;
+#endif
     
   // Increase SPI speed to 2Mhz
   SPCR = (1<<SPE) | (1<<MSTR);
@@ -307,12 +614,13 @@ void init_logger(void)
   if (!read_card_size())
     return;
 
-  if (!find_available_block())
+  if (!resume_log())
     return;
 
   char msg[100];
   snprintf(msg, sizeof(msg),
-           "Logging enabled starting at block %lu\n", logger_next_block);
+           "Logging enabled starting at block %" PRIu32 "\n",
+           logger_next_block);
   serial_write(msg);
   logger_enabled = 1;
 }
@@ -332,6 +640,27 @@ void start_log(void)
     return;
   }
 
+  /* If the card is still programming the last block (or journal entry),
+   * this loop's globals aren't logged rather than waiting for it.
+   */
+  if (poll_card_busy())
+  {
+    logger_deferred += 1;
+    return;
+  }
+
+  /* Bring the journal up to date if finish_log() hasn't had the chance
+   * to; this loop's globals aren't logged while the card programs it.
+   */
+  if (logger_next_block - logger_journal.next_block >= LOGGER_JOURNAL_INTERVAL)
+  {
+    if (!write_journal())
+      logger_enabled = 0;
+    else
+      logger_deferred += 1;
+    return;
+  }
+
   /* Send command to start a block write. */
   uint8_t response;
   response = sd_command(CMD24, logger_next_block, 0);
@@ -346,38 +675,85 @@ void start_log(void)
 
   spi_transfer(0xFE);
 
+  /* The CRC-32 of the globals is filled in once the bytes before it have
+   * been sent; it's sent straight after them.
+   */
+  logger_crc_t crc = {0xFFFFFFFF, 0};
   uint16_t i = 0;
-  for(i = 0; i < sizeof(globals_t); i++)
-    spi_transfer(((uint8_t*)&globals)[i]);
+  for(i = 0; i < offsetof(globals_t, crc); i++)
+    spi_transfer_crc(((uint8_t*)&globals)[i], &crc);
+  globals.crc = ~crc.crc32;
+  for(; i < sizeof(globals_t); i++)
+    spi_transfer_crc(((uint8_t*)&globals)[i], &crc);
 
   /* Fill remaining block with 0xBB.  This should never occur because
    * globals_t is padded to be 512 bytes.
    */
   for(; i < 512; i++)
-    spi_transfer(0xBB);
+    spi_transfer_crc(0xBB, &crc);
 
+#if LOGGER_CRC
+  spi_transfer(crc.crc16 >> 8);
+  spi_transfer(crc.crc16);
+#else
   /* Send ignored 16bit CRC checksum. */
   spi_transfer(0x00);
   spi_transfer(0x00);
+#endif
 
-  if (spi_transfer(0xFF) != 0xE5)
+  response = spi_transfer(0xFF);
+
+  /* The card may hold DO low while it's busy even after rejecting the
+   * block, so the next block waits for it either way.
+   */
+  logger_card_busy = 1;
+  logger_busy_loops = 0;
+
+  if (response != 0xE5)
   {
+    /* The card rejected the block (in CRC mode, perhaps corrupted on its
+     * way to the card); the next loop's globals go to the same block
+     * instead.
+     */
+    if (logger_write_retries < LOGGER_WRITE_RETRIES)
+    {
+#if LOGGER_CRC
+      if ((response & 0x1F) == 0x0B)
+        logger_crc_errors += 1;
+#endif
+      logger_write_retries += 1;
+      logger_next_block -= 1;
+      return;
+    }
+
     // Write failed, disable SD card.
     logger_enabled = 0;
     return;
   }
+
+  logger_write_retries = 0;
 }
 
 void finish_log(void)
 {
-  /* Wait for the SD card to finish writing. I'm assuming the SD card
-   * continued writing without receiving the SPI clock from us.  If
-   * this is true, waiting here instead of in start_log() saves time
-   * by allowing us to keep working while the card writes.  If not, we
-   * should still be fine by get no advantage by waiting here instead
-   * of in start_log().  I suspect the card is fast enough that most
-   * of our logging time is spent transmitting the data and not
-   * waiting on the card, so this probably doesn't matter much.
+  /* Check whether the SD card has finished writing, but don't wait for
+   * it.  It programs the block without receiving the SPI clock from us,
+   * so the loop keeps working; if it's still busy when the next loop
+   * starts, start_log() skips that loop's globals.
    */
-  while (spi_transfer(0xFF) != 0xFF);
+  if (poll_card_busy())
+  {
+    logger_busy_loops += 1;
+    return;
+  }
+
+  /* Bring the journal up to date every so often, now that the card is
+   * idle.  It has the rest of the loop to program the entry.
+   */
+  if (logger_enabled &&
+      logger_next_block - logger_journal.next_block >= LOGGER_JOURNAL_INTERVAL)
+  {
+    if (!write_journal())
+      logger_enabled = 0;
+  }
 }
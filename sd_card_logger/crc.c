@@ -0,0 +1,81 @@
+/*
+ * File: crc.c
+ */
+#include "crc.h"
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_word(address)  (*(const uint16_t *) (address))
+#define pgm_read_dword(address) (*(const uint32_t *) (address))
+#endif
+
+// The CRC of each nibble, shifted to where it enters the register
+static const uint16_t CRC16_nibbles[16] PROGMEM = {
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+// Reflected: the register shifts right, and takes the low nibble first
+static const uint32_t CRC32_nibbles[16] PROGMEM = {
+  0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+  0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+  0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+  0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint8_t crc7_suffix(const uint8_t * command, uint8_t length) {
+  uint8_t crc = 0;
+  uint8_t byte_index;
+  uint8_t bit_index;
+
+  // Commands are rare enough to take a bit at a time
+  for (byte_index = 0; byte_index < length; byte_index++) {
+    uint8_t byte = command[byte_index];
+
+    for (bit_index = 0; bit_index < 8; bit_index++) {
+      crc = crc << 1;
+      if ((byte ^ crc) & 0x80) {
+        crc = crc ^ 0x09;
+      }
+      byte = byte << 1;
+    }
+  }
+
+  return (crc << 1) | 0x01;
+}
+
+uint16_t crc16_update(uint16_t crc, const void * data, uint16_t length) {
+  const uint8_t * bytes = (const uint8_t *) data;
+  uint16_t byte_index;
+
+  for (byte_index = 0; byte_index < length; byte_index++) {
+    uint8_t byte = bytes[byte_index];
+
+    crc = (crc << 4) ^
+          pgm_read_word(&CRC16_nibbles[((crc >> 12) ^ (byte >> 4)) & 0x0F]);
+    crc = (crc << 4) ^
+          pgm_read_word(&CRC16_nibbles[((crc >> 12) ^ byte) & 0x0F]);
+  }
+
+  return crc;
+}
+
+uint32_t crc32_update(uint32_t crc, const void * data, uint16_t length) {
+  const uint8_t * bytes = (const uint8_t *) data;
+  uint16_t byte_index;
+
+  // The register holds the CRC inverted
+  crc = ~crc;
+
+  for (byte_index = 0; byte_index < length; byte_index++) {
+    uint8_t byte = bytes[byte_index];
+
+    crc = (crc >> 4) ^ pgm_read_dword(&CRC32_nibbles[(crc ^ byte) & 0x0F]);
+    crc = (crc >> 4) ^
+          pgm_read_dword(&CRC32_nibbles[(crc ^ (byte >> 4)) & 0x0F]);
+  }
+
+  return ~crc;
+}
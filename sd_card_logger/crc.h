@@ -0,0 +1,46 @@
+/*
+ * File: crc.h
+ *
+ * The CRCs the logger uses:
+ *   - CRC7, the suffix of an SD command (polynomial 0x09)
+ *   - CRC-16/XMODEM, the CRC that follows an SD data block (polynomial
+ *     0x1021, from 0, most significant bit first)
+ *   - CRC-32, as zlib's crc32(), that the header of each block of the log
+ *     holds for its records (see sd_card.h)
+ * The 16 and 32-bit CRCs take a nibble at a time from tables of 16 entries
+ * in program memory: about twice as fast as a bit at a time on the AVR,
+ * for 96 bytes of flash rather than the 1.5 KB of byte-wide tables.
+ *
+ * This file has no AVR dependencies so that the decoders can also be built
+ * on the host.
+ */
+#ifndef _CRC_H_
+#define _CRC_H_
+
+#include <stdint.h>
+
+#define CRC16_INIT                0x0000
+#define CRC32_INIT                0x00000000UL
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Returns the suffix of a command whose first length bytes (the command
+   index and argument) are in command: their CRC7, then the end bit.
+*/
+uint8_t crc7_suffix(const uint8_t * command, uint8_t length);
+
+/* Returns crc (CRC16_INIT to start) updated with length bytes of data */
+uint16_t crc16_update(uint16_t crc, const void * data, uint16_t length);
+
+/* Returns crc (CRC32_INIT to start) updated with length bytes of data.
+   The CRC of data split into pieces is that of the whole.
+*/
+uint32_t crc32_update(uint32_t crc, const void * data, uint16_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CRC_H_ */
@@ -0,0 +1,376 @@
+/*
+ * File: fat32.c
+ */
+#include <string.h>
+#include "fat32.h"
+#include "sd_card.h"
+
+static uint8_t fat32_mount(uint8_t * scratch);
+static uint8_t fat32_find_dir_entry(fat32_file_t * file, uint8_t * scratch);
+static uint8_t fat32_check_contiguous(uint32_t first_cluster,
+                                      uint32_t * num_clusters,
+                                      uint8_t * scratch);
+static uint8_t fat32_create_log_file(fat32_file_t * file, uint8_t * scratch);
+static uint8_t fat32_read_entry(uint32_t cluster, uint32_t * entry,
+                                uint8_t * scratch);
+
+// The layout of the volume, in card blocks
+uint32_t FAT32_fat_block;       // the first FAT
+uint32_t FAT32_fat_size;        // blocks per FAT
+uint8_t  FAT32_num_fats;
+uint32_t FAT32_data_block;      // cluster 2
+uint8_t  FAT32_blocks_per_cluster;
+uint32_t FAT32_num_clusters;
+uint32_t FAT32_root_cluster;
+uint32_t FAT32_fsinfo_block;
+
+static uint16_t get16(const uint8_t * bytes, uint16_t offset) {
+  return bytes[offset] | ((uint16_t) bytes[offset + 1] << 8);
+}
+
+static uint32_t get32(const uint8_t * bytes, uint16_t offset) {
+  return get16(bytes, offset) | ((uint32_t) get16(bytes, offset + 2) << 16);
+}
+
+static void put16(uint8_t * bytes, uint16_t offset, uint16_t value) {
+  bytes[offset] = (uint8_t) value;
+  bytes[offset + 1] = (uint8_t) (value >> 8);
+
+  return;
+}
+
+static void put32(uint8_t * bytes, uint16_t offset, uint32_t value) {
+  put16(bytes, offset, (uint16_t) value);
+  put16(bytes, offset + 2, (uint16_t) (value >> 16));
+
+  return;
+}
+
+static uint32_t cluster_to_block(uint32_t cluster) {
+  return FAT32_data_block + (cluster - 2) * FAT32_blocks_per_cluster;
+}
+
+uint8_t fat32_open_log_file(fat32_file_t * file, uint8_t * scratch) {
+  file->created = 0;
+
+  if (!fat32_mount(scratch)) {
+    return 0;
+  }
+
+  // Use the file if it's there, as long as it's contiguous
+  if (fat32_find_dir_entry(file, scratch)) {
+    uint32_t first_cluster;
+    uint32_t num_clusters;
+
+    if (!sdcard_read_block_start(file->dir_entry_block, scratch,
+                                 SDCARD_BYTES_PER_BLOCK)) {
+      return 0;
+    }
+
+    uint8_t * entry = scratch + file->dir_entry_offset;
+    first_cluster = ((uint32_t) get16(entry, FAT32_DIR_CLUSTER_HIGH) << 16) |
+                    get16(entry, FAT32_DIR_CLUSTER_LOW);
+
+    if (first_cluster < 2 ||
+        !fat32_check_contiguous(first_cluster, &num_clusters, scratch)) {
+      return 0;
+    }
+
+    file->first_block = cluster_to_block(first_cluster);
+    file->num_blocks = num_clusters * FAT32_blocks_per_cluster;
+
+    return 1;
+  }
+
+  return fat32_create_log_file(file, scratch);
+}
+
+uint8_t fat32_set_file_size(const fat32_file_t * file, uint32_t size,
+                            uint8_t * scratch) {
+  if (!sdcard_read_block_start(file->dir_entry_block, scratch,
+                               SDCARD_BYTES_PER_BLOCK)) {
+    return 0;
+  }
+
+  put32(scratch + file->dir_entry_offset, FAT32_DIR_FILE_SIZE, size);
+
+  return sdcard_write_block(file->dir_entry_block, scratch);
+}
+
+/* Finds the FAT32 volume, either in the first partition or covering the
+   whole card, and reads its layout. Returns 1 if successful; 0 otherwise.
+*/
+static uint8_t fat32_mount(uint8_t * scratch) {
+  uint32_t volume_block = 0;
+
+  if (!sdcard_read_block_start(0, scratch, SDCARD_BYTES_PER_BLOCK)) {
+    return 0;
+  }
+
+  if (get16(scratch, FAT32_MBR_SIGNATURE_OFFSET) != FAT32_MBR_SIGNATURE) {
+    return 0;
+  }
+
+  // Block 0 is either the volume's boot sector or a partition table
+  if (memcmp(scratch + FAT32_BPB_FS_TYPE, "FAT32", 5) != 0) {
+    uint8_t type = scratch[FAT32_MBR_PARTITION_OFFSET + 4];
+
+    if (type != FAT32_PARTITION_TYPE_CHS &&
+        type != FAT32_PARTITION_TYPE_LBA) {
+      return 0;
+    }
+
+    volume_block = get32(scratch, FAT32_MBR_PARTITION_OFFSET + 8);
+
+    if (!sdcard_read_block_start(volume_block, scratch,
+                                 SDCARD_BYTES_PER_BLOCK)) {
+      return 0;
+    }
+  }
+
+  if (get16(scratch, FAT32_BPB_BYTES_PER_SECTOR) != SDCARD_BYTES_PER_BLOCK ||
+      memcmp(scratch + FAT32_BPB_FS_TYPE, "FAT32", 5) != 0) {
+    return 0;
+  }
+
+  FAT32_blocks_per_cluster = scratch[FAT32_BPB_SECTORS_PER_CLUSTER];
+  FAT32_num_fats = scratch[FAT32_BPB_NUM_FATS];
+  FAT32_fat_size = get32(scratch, FAT32_BPB_FAT_SIZE);
+  FAT32_fat_block = volume_block + get16(scratch, FAT32_BPB_RESERVED_SECTORS);
+  FAT32_data_block = FAT32_fat_block + FAT32_num_fats * FAT32_fat_size;
+  FAT32_root_cluster = get32(scratch, FAT32_BPB_ROOT_CLUSTER);
+  FAT32_fsinfo_block = volume_block + get16(scratch, FAT32_BPB_FSINFO_SECTOR);
+
+  if (FAT32_blocks_per_cluster == 0) {
+    return 0;
+  }
+
+  FAT32_num_clusters = (volume_block + get32(scratch, FAT32_BPB_TOTAL_SECTORS)
+                        - FAT32_data_block) / FAT32_blocks_per_cluster;
+
+  return 1;
+}
+
+/* Reads the FAT entry of the specified cluster. Returns 1 if successful; 0
+   otherwise.
+*/
+static uint8_t fat32_read_entry(uint32_t cluster, uint32_t * entry,
+                                uint8_t * scratch) {
+  uint32_t block = FAT32_fat_block + cluster / FAT32_ENTRIES_PER_BLOCK;
+
+  if (!sdcard_read_block_start(block, scratch, SDCARD_BYTES_PER_BLOCK)) {
+    return 0;
+  }
+
+  *entry = get32(scratch, (cluster % FAT32_ENTRIES_PER_BLOCK) * 4) &
+           FAT32_ENTRY_MASK;
+
+  return 1;
+}
+
+/* Looks through the root directory for the log file. Sets the file's
+   directory entry location and returns 1 if it's there. Otherwise, sets the
+   location of a free entry (dir_entry_block is 0 if there isn't one) and
+   returns 0.
+*/
+static uint8_t fat32_find_dir_entry(fat32_file_t * file, uint8_t * scratch) {
+  uint32_t cluster = FAT32_root_cluster;
+
+  file->dir_entry_block = 0;
+
+  while (cluster >= 2 && cluster < FAT32_ENTRY_END_MIN) {
+    uint8_t block_index;
+
+    for (block_index = 0; block_index < FAT32_blocks_per_cluster;
+         block_index++) {
+      uint32_t block = cluster_to_block(cluster) + block_index;
+      uint16_t offset;
+
+      if (!sdcard_read_block_start(block, scratch, SDCARD_BYTES_PER_BLOCK)) {
+        return 0;
+      }
+
+      for (offset = 0; offset < SDCARD_BYTES_PER_BLOCK;
+           offset += FAT32_DIR_ENTRY_LENGTH) {
+        uint8_t * entry = scratch + offset;
+
+        if (entry[0] == FAT32_DIR_END || entry[0] == FAT32_DIR_DELETED) {
+          if (file->dir_entry_block == 0) {
+            file->dir_entry_block = block;
+            file->dir_entry_offset = offset;
+          }
+
+          // Nothing follows the last entry
+          if (entry[0] == FAT32_DIR_END) {
+            return 0;
+          }
+
+          continue;
+        }
+
+        if (entry[FAT32_DIR_ATTRIBUTES] != FAT32_ATTR_LONG_NAME &&
+            memcmp(entry, FAT32_LOG_FILE_NAME,
+                   FAT32_DIR_NAME_LENGTH) == 0) {
+          file->dir_entry_block = block;
+          file->dir_entry_offset = offset;
+
+          return 1;
+        }
+      }
+    }
+
+    if (!fat32_read_entry(cluster, &cluster, scratch)) {
+      return 0;
+    }
+  }
+
+  return 0;
+}
+
+/* Follows the cluster chain of a file, and counts its clusters. Returns 1
+   if they are contiguous; 0 otherwise.
+*/
+static uint8_t fat32_check_contiguous(uint32_t first_cluster,
+                                      uint32_t * num_clusters,
+                                      uint8_t * scratch) {
+  uint32_t cluster = first_cluster;
+  uint32_t entry;
+
+  // Each FAT block read covers the next 128 clusters
+  while (1) {
+    uint16_t index = cluster % FAT32_ENTRIES_PER_BLOCK;
+
+    if (!fat32_read_entry(cluster, &entry, scratch)) {
+      return 0;
+    }
+
+    while (1) {
+      if (entry >= FAT32_ENTRY_END_MIN) {
+        *num_clusters = cluster - first_cluster + 1;
+        return 1;
+      }
+
+      if (entry != cluster + 1) {
+        return 0;
+      }
+
+      cluster = entry;
+      index = index + 1;
+
+      if (index == FAT32_ENTRIES_PER_BLOCK) {
+        break;
+      }
+
+      entry = get32(scratch, index * 4) & FAT32_ENTRY_MASK;
+    }
+  }
+}
+
+/* Allocates a contiguous run of clusters for the log file and adds it to
+   the root directory. Returns 1 if successful; 0 otherwise.
+*/
+static uint8_t fat32_create_log_file(fat32_file_t * file, uint8_t * scratch) {
+  uint32_t needed = (FAT32_LOG_FILE_BLOCKS + FAT32_blocks_per_cluster - 1) /
+                    FAT32_blocks_per_cluster;
+  uint32_t run_start = 0;
+  uint32_t run_length = 0;
+  uint32_t cluster;
+
+  // fat32_find_dir_entry() found no room for another entry
+  if (file->dir_entry_block == 0) {
+    return 0;
+  }
+
+  // Find the first run of free clusters that's long enough
+  for (cluster = 2; cluster < FAT32_num_clusters + 2 && run_length < needed;
+       cluster++) {
+    uint16_t index = cluster % FAT32_ENTRIES_PER_BLOCK;
+
+    if (cluster == 2 || index == 0) {
+      uint32_t block = FAT32_fat_block + cluster / FAT32_ENTRIES_PER_BLOCK;
+
+      if (!sdcard_read_block_start(block, scratch, SDCARD_BYTES_PER_BLOCK)) {
+        return 0;
+      }
+    }
+
+    if ((get32(scratch, index * 4) & FAT32_ENTRY_MASK) == FAT32_ENTRY_FREE) {
+      if (run_length == 0) {
+        run_start = cluster;
+      }
+      run_length = run_length + 1;
+    } else {
+      run_length = 0;
+    }
+  }
+
+  if (run_length < needed) {
+    return 0;
+  }
+
+  // Chain the clusters together, one FAT block at a time, in every FAT
+  uint32_t last_cluster = run_start + needed - 1;
+  uint32_t fat_offset;
+
+  for (fat_offset = run_start / FAT32_ENTRIES_PER_BLOCK;
+       fat_offset <= last_cluster / FAT32_ENTRIES_PER_BLOCK; fat_offset++) {
+    uint16_t index;
+    uint8_t fat_index;
+
+    if (!sdcard_read_block_start(FAT32_fat_block + fat_offset, scratch,
+                                 SDCARD_BYTES_PER_BLOCK)) {
+      return 0;
+    }
+
+    for (index = 0; index < FAT32_ENTRIES_PER_BLOCK; index++) {
+      cluster = fat_offset * FAT32_ENTRIES_PER_BLOCK + index;
+
+      if (cluster >= run_start && cluster < last_cluster) {
+        put32(scratch, index * 4, cluster + 1);
+      } else if (cluster == last_cluster) {
+        put32(scratch, index * 4, FAT32_ENTRY_END);
+      }
+    }
+
+    for (fat_index = 0; fat_index < FAT32_num_fats; fat_index++) {
+      if (!sdcard_write_block(FAT32_fat_block + fat_index * FAT32_fat_size +
+                              fat_offset, scratch)) {
+        return 0;
+      }
+    }
+  }
+
+  // Add the directory entry; the size is set when logging stops
+  if (!sdcard_read_block_start(file->dir_entry_block, scratch,
+                               SDCARD_BYTES_PER_BLOCK)) {
+    return 0;
+  }
+
+  uint8_t * entry = scratch + file->dir_entry_offset;
+
+  memset(entry, 0, FAT32_DIR_ENTRY_LENGTH);
+  memcpy(entry, FAT32_LOG_FILE_NAME, FAT32_DIR_NAME_LENGTH);
+  entry[FAT32_DIR_ATTRIBUTES] = FAT32_ATTR_ARCHIVE;
+  put16(entry, FAT32_DIR_CLUSTER_HIGH, (uint16_t) (run_start >> 16));
+  put16(entry, FAT32_DIR_CLUSTER_LOW, (uint16_t) run_start);
+  put16(entry, FAT32_DIR_WRITE_DATE, FAT32_DATE_1980_01_01);
+
+  if (!sdcard_write_block(file->dir_entry_block, scratch)) {
+    return 0;
+  }
+
+  // The free cluster count is now out of date; tell the PC to work it out
+  if (sdcard_read_block_start(FAT32_fsinfo_block, scratch,
+                              SDCARD_BYTES_PER_BLOCK) &&
+      get32(scratch, 0) == FAT32_FSINFO_SIGNATURE) {
+    put32(scratch, FAT32_FSINFO_FREE_COUNT, FAT32_FSINFO_UNKNOWN);
+    put32(scratch, FAT32_FSINFO_NEXT_FREE, FAT32_FSINFO_UNKNOWN);
+    sdcard_write_block(FAT32_fsinfo_block, scratch);
+  }
+
+  file->first_block = cluster_to_block(run_start);
+  file->num_blocks = needed * FAT32_blocks_per_cluster;
+  file->created = 1;
+
+  return 1;
+}
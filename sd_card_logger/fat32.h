@@ -0,0 +1,88 @@
+/*
+ * File: fat32.h
+ *
+ * Just enough FAT32 to give the logger a file that a PC can read: the log
+ * file is found in (or added to) the root directory of the card's first
+ * partition, with its clusters allocated in one contiguous run. The logger
+ * then writes raw blocks into that run, so no FAT updates are needed while
+ * logging; only the file's size in its directory entry is set when logging
+ * stops.
+ */
+#ifndef _FAT32_H_
+#define _FAT32_H_
+
+#include <stdint.h>
+
+// The 8.3 name of the log file, padded with spaces; "LOG.DAT"
+#define FAT32_LOG_FILE_NAME       "LOG     DAT"
+
+// The size of the log file when it's created. A FAT32 file must be smaller
+// than 4 GiB.
+#ifndef FAT32_LOG_FILE_BLOCKS
+#define FAT32_LOG_FILE_BLOCKS     0x200000UL // 1 GiB
+#endif
+
+#define FAT32_MBR_SIGNATURE_OFFSET  510
+#define FAT32_MBR_SIGNATURE         0xAA55
+#define FAT32_MBR_PARTITION_OFFSET  0x1BE
+#define FAT32_PARTITION_TYPE_CHS    0x0B
+#define FAT32_PARTITION_TYPE_LBA    0x0C
+
+// Fields of the boot sector (the BIOS Parameter Block)
+#define FAT32_BPB_BYTES_PER_SECTOR  0x0B
+#define FAT32_BPB_SECTORS_PER_CLUSTER 0x0D
+#define FAT32_BPB_RESERVED_SECTORS  0x0E
+#define FAT32_BPB_NUM_FATS          0x10
+#define FAT32_BPB_TOTAL_SECTORS     0x20
+#define FAT32_BPB_FAT_SIZE          0x24
+#define FAT32_BPB_ROOT_CLUSTER      0x2C
+#define FAT32_BPB_FSINFO_SECTOR     0x30
+#define FAT32_BPB_FS_TYPE           0x52  // "FAT32   "
+
+#define FAT32_FSINFO_SIGNATURE      0x41615252UL
+#define FAT32_FSINFO_FREE_COUNT     488
+#define FAT32_FSINFO_NEXT_FREE      492
+#define FAT32_FSINFO_UNKNOWN        0xFFFFFFFFUL
+
+#define FAT32_ENTRIES_PER_BLOCK     128
+#define FAT32_ENTRY_MASK            0x0FFFFFFFUL
+#define FAT32_ENTRY_FREE            0x0
+#define FAT32_ENTRY_END_MIN         0x0FFFFFF8UL
+#define FAT32_ENTRY_END             0x0FFFFFFFUL
+
+// Directory entries
+#define FAT32_DIR_ENTRY_LENGTH      32
+#define FAT32_DIR_NAME_LENGTH       11
+#define FAT32_DIR_ATTRIBUTES        0x0B
+#define FAT32_DIR_CLUSTER_HIGH      0x14
+#define FAT32_DIR_WRITE_DATE        0x18
+#define FAT32_DIR_CLUSTER_LOW       0x1A
+#define FAT32_DIR_FILE_SIZE         0x1C
+#define FAT32_DIR_END               0x00  // first name byte of the last entry
+#define FAT32_DIR_DELETED           0xE5  // first name byte of a free entry
+#define FAT32_ATTR_LONG_NAME        0x0F
+#define FAT32_ATTR_ARCHIVE          0x20
+#define FAT32_DATE_1980_01_01       0x0021
+
+typedef struct {
+  uint32_t first_block;       // the file's data, in card blocks
+  uint32_t num_blocks;
+  uint32_t dir_entry_block;   // where its directory entry is
+  uint16_t dir_entry_offset;
+  uint8_t  created;           // 1 if the file was just created
+} fat32_file_t;
+
+/* Finds the log file on the card, or creates it if there isn't one. The
+   file's clusters must be contiguous. A new file holds whatever the card
+   held before. scratch must hold a block. Returns 1 if successful; 0
+   otherwise.
+*/
+uint8_t fat32_open_log_file(fat32_file_t * file, uint8_t * scratch);
+
+/* Sets the size of the file, in bytes, in its directory entry. scratch
+   must hold a block. Returns 1 if successful; 0 otherwise.
+*/
+uint8_t fat32_set_file_size(const fat32_file_t * file, uint32_t size,
+                            uint8_t * scratch);
+
+#endif /* _FAT32_H_ */
@@ -0,0 +1,106 @@
+/*
+ * File: log_channel.c
+ */
+#include <string.h>
+#include "log_channel.h"
+
+const log_channel_t * LOG_CHANNEL_channels[LOG_CHANNEL_MAX_CHANNELS];
+uint8_t LOG_CHANNEL_num_channels;
+uint8_t LOG_CHANNEL_published;  // a bit for each channel
+
+uint16_t log_channel_schema_length(const log_channel_t * channel) {
+  uint16_t length = LOG_CHANNEL_SCHEMA_HEADER_LENGTH + strlen(channel->name);
+  uint8_t field_index;
+
+  for (field_index = 0; field_index < channel->num_fields; field_index++) {
+    length = length + LOG_CHANNEL_FIELD_HEADER_LENGTH +
+             strlen(channel->fields[field_index].name);
+  }
+
+  return length;
+}
+
+uint8_t log_channel_register(const log_channel_t * channel) {
+  uint8_t id = LOG_CHANNEL_num_channels;
+
+  if (id >= LOG_CHANNEL_MAX_CHANNELS ||
+      channel->length > LOG_CHANNEL_MAX_LENGTH ||
+      log_channel_schema_length(channel) > LOG_CHANNEL_MAX_SCHEMA_LENGTH) {
+    return LOG_CHANNEL_NONE;
+  }
+
+  LOG_CHANNEL_channels[id] = channel;
+  LOG_CHANNEL_num_channels = id + 1;
+
+  return id;
+}
+
+const log_channel_t * log_channel_get(uint8_t id) {
+  if (id >= LOG_CHANNEL_num_channels) {
+    return NULL;
+  }
+
+  return LOG_CHANNEL_channels[id];
+}
+
+void log_channel_publish(uint8_t id) {
+  if (id < LOG_CHANNEL_num_channels) {
+    LOG_CHANNEL_published |= (1 << id);
+  }
+
+  return;
+}
+
+uint8_t log_channel_take_published(uint8_t id) {
+  uint8_t mask = (1 << id);
+
+  if (id >= LOG_CHANNEL_num_channels || !(LOG_CHANNEL_published & mask)) {
+    return 0;
+  }
+
+  LOG_CHANNEL_published &= ~mask;
+
+  return 1;
+}
+
+uint8_t log_channel_count(void) {
+  return LOG_CHANNEL_num_channels;
+}
+
+/* Appends a name, after its length */
+static uint8_t * log_channel_put_name(uint8_t * out, const char * name) {
+  uint8_t length = strlen(name);
+
+  *out++ = length;
+  memcpy(out, name, length);
+
+  return out + length;
+}
+
+uint8_t log_channel_encode_schema(uint8_t id, uint8_t * out) {
+  const log_channel_t * channel = log_channel_get(id);
+  uint8_t * next = out;
+  uint8_t field_index;
+
+  if (channel == NULL) {
+    return 0;
+  }
+
+  *next++ = id;
+  *next++ = channel->rate_hz & 0xFF;
+  *next++ = channel->rate_hz >> 8;
+  *next++ = channel->length;
+  *next++ = channel->num_fields;
+  next = log_channel_put_name(next, channel->name);
+
+  for (field_index = 0; field_index < channel->num_fields; field_index++) {
+    const log_field_t * field = &channel->fields[field_index];
+
+    *next++ = field->type;
+    *next++ = field->offset;
+    *next++ = field->count;
+    next = log_channel_put_name(next, field->name);
+  }
+
+  return next - out;
+}
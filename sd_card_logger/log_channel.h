@@ -0,0 +1,106 @@
+/*
+ * File: log_channel.h
+ *
+ * Lets each subsystem (gps, compass, encoders, mobility...) log its own
+ * data at the rate it produces it, rather than everything being logged at
+ * loop rate as one struct. A subsystem registers a channel that describes
+ * its data, field by field, along with the rate it's nominally published
+ * at; then calls log_channel_publish() whenever the data changes. The
+ * logger writes a record of a channel only when it's been published since
+ * the last one.
+ *
+ * A schema record for each channel is logged at the start of each session,
+ * so the log can be decoded without knowing the firmware that wrote it:
+ *   <id> <rate_hz: 2> <length> <num_fields> <name_length> <name>
+ * then for each field:
+ *   <type> <offset> <count> <name_length> <name>
+ * Multi-byte values are little-endian, as on the AVR. A channel's data is
+ * logged as its id followed by its length bytes.
+ *
+ * This file has no AVR dependencies so that the decoder can also use it
+ * on the host.
+ */
+#ifndef _LOG_CHANNEL_H_
+#define _LOG_CHANNEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOG_CHANNEL_MAX_CHANNELS  8     // one bit each of a byte
+
+#define LOG_CHANNEL_NONE          0xFF
+#define LOG_CHANNEL_MAX_LENGTH    254   // leaves room for the id in a record
+#define LOG_CHANNEL_MAX_SCHEMA_LENGTH 255
+#define LOG_CHANNEL_SCHEMA_HEADER_LENGTH 6
+#define LOG_CHANNEL_FIELD_HEADER_LENGTH  4
+
+// Types of fields
+#define LOG_FIELD_U8              0x01
+#define LOG_FIELD_I8              0x02
+#define LOG_FIELD_U16             0x03
+#define LOG_FIELD_I16             0x04
+#define LOG_FIELD_U32             0x05
+#define LOG_FIELD_I32             0x06
+#define LOG_FIELD_FLOAT           0x07  // also a double, on the AVR
+#define LOG_FIELD_CHAR            0x08  // count chars, not always terminated
+
+// The size of a field of the specified type, in bytes
+#define LOG_FIELD_SIZE(type) \
+  (((type) <= LOG_FIELD_I8 || (type) == LOG_FIELD_CHAR) ? 1 : \
+   ((type) <= LOG_FIELD_I16) ? 2 : 4)
+
+/* Describes the member of a struct; e.g.
+     LOG_FIELD(gps_fix_t, latitude, LOG_FIELD_I32)
+*/
+#define LOG_FIELD(struct_type, member, field_type) \
+  { #member, field_type, offsetof(struct_type, member), \
+    sizeof(((struct_type *) 0)->member) / LOG_FIELD_SIZE(field_type) }
+
+typedef struct {
+  const char * name;
+  uint8_t  type;            // LOG_FIELD_...
+  uint8_t  offset;          // in the channel's data
+  uint8_t  count;           // elements, for an array
+} log_field_t;
+
+typedef struct {
+  const char * name;
+  const log_field_t * fields;
+  uint8_t  num_fields;
+  const void * data;        // logged as is when the channel is published
+  uint8_t  length;
+  uint16_t rate_hz;         // how often it's published, nominally
+} log_channel_t;
+
+/* Adds a channel. channel must stay valid while logging. Returns its id,
+   or LOG_CHANNEL_NONE if there are too many channels, or its data or
+   schema are too long for a record.
+*/
+uint8_t log_channel_register(const log_channel_t * channel);
+
+/* Returns the channel with the specified id, or NULL if there's none */
+const log_channel_t * log_channel_get(uint8_t id);
+
+/* Marks the channel as having new data, to be logged. Call from the main
+   loop, not from an ISR.
+*/
+void log_channel_publish(uint8_t id);
+
+/* Returns 1 (and forgets it) if the channel has been published since it
+   was last taken; 0 otherwise.
+*/
+uint8_t log_channel_take_published(uint8_t id);
+
+/* Returns the number of channels registered */
+uint8_t log_channel_count(void);
+
+/* Returns the length of the schema of a channel, in bytes */
+uint16_t log_channel_schema_length(const log_channel_t * channel);
+
+/* Writes the schema of a channel to out, which must hold
+   LOG_CHANNEL_MAX_SCHEMA_LENGTH bytes. Returns the number of bytes
+   written.
+*/
+uint8_t log_channel_encode_schema(uint8_t id, uint8_t * out);
+
+#endif /* _LOG_CHANNEL_H_ */
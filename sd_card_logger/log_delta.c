@@ -0,0 +1,162 @@
+/*
+ * File: log_delta.c
+ */
+#include <string.h>
+#include "log_delta.h"
+
+void log_delta_encoder_init(log_delta_encoder_t * encoder, void * previous,
+                            uint8_t length) {
+  encoder->previous = (uint8_t *) previous;
+  encoder->length = length;
+  encoder->since_keyframe = LOG_DELTA_KEYFRAME_INTERVAL;
+
+  return;
+}
+
+/* Writes the delta from the previous frame to out. Returns the number of
+   bytes written, or 0 if they wouldn't fit in max_length.
+*/
+static uint8_t encode_delta(const log_delta_encoder_t * encoder,
+                            const uint8_t * frame, uint8_t * out,
+                            uint8_t max_length) {
+  const uint8_t * previous = encoder->previous;
+  uint8_t length = encoder->length;
+  uint8_t * run = NULL;     // header of the run being extended
+  uint8_t used = 0;
+  uint8_t run_end = 0;      // end of the last run, in the frame
+  uint8_t index;
+
+  for (index = 0; index < length; index++) {
+    if (frame[index] == previous[index]) {
+      continue;
+    }
+
+    uint8_t gap = index - run_end;
+
+    // Extend the current run over a short gap, rather than start another
+    if (run != NULL && gap <= LOG_DELTA_MERGE_GAP &&
+        run[1] + gap + 1 <= LOG_DELTA_MAX_RUN_LENGTH) {
+      if (used + gap + 1 > max_length) {
+        return 0;
+      }
+
+      memcpy(out + used, frame + run_end, gap + 1);
+      used = used + gap + 1;
+      run[1] = run[1] + gap + 1;
+    } else {
+      if (used + LOG_DELTA_RUN_HEADER_LENGTH + 1 > max_length) {
+        return 0;
+      }
+
+      run = out + used;
+      run[0] = gap;
+      run[1] = 1;
+      out[used + LOG_DELTA_RUN_HEADER_LENGTH] = frame[index];
+      used = used + LOG_DELTA_RUN_HEADER_LENGTH + 1;
+    }
+
+    run_end = index + 1;
+  }
+
+  // An unchanged frame is still logged, as a run that changes nothing
+  if (used == 0) {
+    if (max_length < LOG_DELTA_RUN_HEADER_LENGTH) {
+      return 0;
+    }
+
+    out[0] = 0;
+    out[1] = 0;
+    used = LOG_DELTA_RUN_HEADER_LENGTH;
+  }
+
+  return used;
+}
+
+uint8_t log_delta_encode(log_delta_encoder_t * encoder, const void * frame,
+                         uint8_t keyframe, uint8_t * out, uint8_t max_length,
+                         uint8_t * kind) {
+  const uint8_t * bytes = (const uint8_t *) frame;
+  uint8_t length = encoder->length;
+
+  if (!keyframe && encoder->since_keyframe < LOG_DELTA_KEYFRAME_INTERVAL) {
+    // A delta must be smaller than the frame to be worth it
+    uint8_t limit = (max_length < length) ? max_length : length - 1;
+    uint8_t used = encode_delta(encoder, bytes, out, limit);
+
+    if (used > 0) {
+      memcpy(encoder->previous, bytes, length);
+      encoder->since_keyframe = encoder->since_keyframe + 1;
+      *kind = LOG_DELTA_DELTA;
+
+      return used;
+    }
+  }
+
+  if (length > max_length) {
+    return 0;
+  }
+
+  memcpy(out, bytes, length);
+  memcpy(encoder->previous, bytes, length);
+  encoder->since_keyframe = 0;
+  *kind = LOG_DELTA_KEYFRAME;
+
+  return length;
+}
+
+void log_delta_decoder_init(log_delta_decoder_t * decoder, void * frame,
+                            uint8_t length) {
+  decoder->frame = (uint8_t *) frame;
+  decoder->length = length;
+  decoder->has_keyframe = 0;
+
+  return;
+}
+
+uint8_t log_delta_decode(log_delta_decoder_t * decoder, uint8_t kind,
+                         const uint8_t * data, uint8_t length) {
+  if (kind == LOG_DELTA_KEYFRAME) {
+    if (length != decoder->length) {
+      return 0;
+    }
+
+    memcpy(decoder->frame, data, length);
+    decoder->has_keyframe = 1;
+
+    return 1;
+  }
+
+  if (!decoder->has_keyframe) {
+    return 0;
+  }
+
+  // Runs are checked before any is applied, so a bad delta changes nothing
+  uint16_t used;
+  uint16_t position = 0;
+
+  for (used = 0; used < length; ) {
+    if (used + LOG_DELTA_RUN_HEADER_LENGTH > length) {
+      return 0;
+    }
+
+    position = position + data[used] + data[used + 1];
+    used = used + LOG_DELTA_RUN_HEADER_LENGTH + data[used + 1];
+
+    if (used > length || position > decoder->length) {
+      return 0;
+    }
+  }
+
+  position = 0;
+  for (used = 0; used < length; ) {
+    uint8_t count = data[used + 1];
+
+    position = position + data[used];
+    memcpy(decoder->frame + position, data + used + LOG_DELTA_RUN_HEADER_LENGTH,
+           count);
+    position = position + count;
+    used = used + LOG_DELTA_RUN_HEADER_LENGTH + count;
+  }
+
+  return 1;
+}
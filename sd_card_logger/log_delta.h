@@ -0,0 +1,87 @@
+/*
+ * File: log_delta.h
+ *
+ * Encodes a frame (e.g. the statevars) that's logged every loop as the
+ * bytes that changed since the previous one. Most fields change slowly, so
+ * a delta is usually a small fraction of the frame. A delta is a series of
+ * runs, each:
+ *   <skip> <count> <count bytes>
+ * where skip is the number of unchanged bytes since the end of the previous
+ * run and the bytes replace the next count bytes of the frame. An
+ * unchanged frame is a single run with a skip and count of 0. Nearby runs
+ * are merged, since a gap of up to two bytes costs no more than another run
+ * header.
+ *
+ * A keyframe (the whole frame) is sent instead when asked for, when one is
+ * due (every LOG_DELTA_KEYFRAME_INTERVAL frames) or when the delta would be
+ * no smaller. Encoding takes one pass over the frame.
+ *
+ * This file has no AVR dependencies so that the decoder can also be built
+ * on the host.
+ */
+#ifndef _LOG_DELTA_H_
+#define _LOG_DELTA_H_
+
+#include <stdint.h>
+
+#define LOG_DELTA_MAX_FRAME_LENGTH  255
+#define LOG_DELTA_RUN_HEADER_LENGTH 2
+#define LOG_DELTA_MAX_RUN_LENGTH    255
+#define LOG_DELTA_MERGE_GAP         LOG_DELTA_RUN_HEADER_LENGTH
+
+#ifndef LOG_DELTA_KEYFRAME_INTERVAL
+#define LOG_DELTA_KEYFRAME_INTERVAL 40    // once a second at 40 Hz
+#endif
+
+// Kinds of encoded frames
+#define LOG_DELTA_KEYFRAME          0
+#define LOG_DELTA_DELTA             1
+
+typedef struct {
+  uint8_t * previous;       // the last frame encoded
+  uint8_t  length;
+  uint8_t  since_keyframe;  // frames encoded since the last keyframe
+} log_delta_encoder_t;
+
+typedef struct {
+  uint8_t * frame;          // the last frame decoded
+  uint8_t  length;
+  uint8_t  has_keyframe;    // deltas can't be applied until there's one
+} log_delta_decoder_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Prepares to encode frames of length bytes. previous must hold a frame;
+   the first frame encoded will be a keyframe.
+*/
+void log_delta_encoder_init(log_delta_encoder_t * encoder, void * previous,
+                            uint8_t length);
+
+/* Encodes frame into out, which has room for max_length bytes, as a delta
+   from the previous frame, or as a keyframe if keyframe is set (or one is
+   due). Sets kind to LOG_DELTA_KEYFRAME or LOG_DELTA_DELTA. Returns the
+   number of bytes written, or 0 if they wouldn't fit; the encoder is
+   unchanged in that case.
+*/
+uint8_t log_delta_encode(log_delta_encoder_t * encoder, const void * frame,
+                         uint8_t keyframe, uint8_t * out, uint8_t max_length,
+                         uint8_t * kind);
+
+/* Prepares to decode frames of length bytes into frame */
+void log_delta_decoder_init(log_delta_decoder_t * decoder, void * frame,
+                            uint8_t length);
+
+/* Applies an encoded frame of the specified kind to decoder->frame. Returns
+   1 if successful; 0 if it's malformed or is a delta with no keyframe
+   before it.
+*/
+uint8_t log_delta_decode(log_delta_decoder_t * decoder, uint8_t kind,
+                         const uint8_t * data, uint8_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LOG_DELTA_H_ */
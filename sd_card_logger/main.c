@@ -1,35 +1,129 @@
 /*
  * File: main.c
  */
+#include <avr/pgmspace.h>
 #include <stdio.h>
 #include <string.h>
+#include <util/delay.h>
+#include "log_channel.h"
+#include "offload.h"
 #include "sd_card.h"
 #include "statevars.h"
 #include "uwrite.h"
 
 void init_statevars(statevars_t * vars);
 void print_block(uint8_t * block);
+uint8_t offload_button_held(void);
 
 statevars_t statevars;
 
+// Data that would come from two subsystems: one that updates every loop,
+// and one that updates at a tenth of the rate. Each is logged as a channel
+// when it changes.
+typedef struct {
+    uint32_t loop_count;
+    uint8_t  frame;
+} counters_t;
+
+typedef struct {
+    int32_t  value;
+    char     label[8];
+} reading_t;
+
+counters_t counters;
+reading_t reading;
+
+const log_field_t counters_fields[] = {
+    LOG_FIELD(counters_t, loop_count, LOG_FIELD_U32),
+    LOG_FIELD(counters_t, frame, LOG_FIELD_U8),
+};
+
+const log_field_t reading_fields[] = {
+    LOG_FIELD(reading_t, value, LOG_FIELD_I32),
+    LOG_FIELD(reading_t, label, LOG_FIELD_CHAR),
+};
+
+const log_channel_t counters_channel = {
+    "counters", counters_fields, 2, &counters, sizeof(counters_t), 40
+};
+
+const log_channel_t reading_channel = {
+    "reading", reading_fields, 2, &reading, sizeof(reading_t), 4
+};
+
 int main(void) {
     memset(&statevars, 0, sizeof(statevars));
     init_statevars(&statevars);
 
     uwrite_init();
-    uwrite_print_buff("---Start---\r\n");
+    uwrite_print_buff_P(PSTR("---Start---\r\n"));
+
+    // Send the log back over the USART instead, if the button is held
+    if (offload_button_held()) {
+        uwrite_print_buff_P(PSTR("Offloading the log\r\n"));
+        spi_init();
+        offload_run();
+    }
+
+    uint8_t counters_id = log_channel_register(&counters_channel);
+    uint8_t reading_id = log_channel_register(&reading_channel);
 
     spi_init();
     sdcard_init();
-    //sdcard_write_data();
+
+    // Log a few snapshots, one per 25 ms loop, in one multi-block write
+    uint8_t frame;
+    for (frame = 0; frame < 8; frame++) {
+        statevars.unsigned_byte = frame;
+        sdcard_mark_loop(frame, 0);
+        sdcard_write_data();
+        _delay_ms(25);
+    }
+
+    // Then a second of loops that log only what changed
+    strcpy(reading.label, "demo");
+    for (counters.loop_count = 0; counters.loop_count < 40;
+         counters.loop_count++) {
+        counters.frame = counters.loop_count & 0xFF;
+        log_channel_publish(counters_id);
+
+        if (counters.loop_count % 10 == 0) {
+            reading.value = -(int32_t) counters.loop_count;
+            log_channel_publish(reading_id);
+        }
+
+        sdcard_mark_loop(8 + counters.loop_count, 0);
+        sdcard_write_channels();
+        _delay_ms(25);
+    }
+    sdcard_finish();
+
+    uint8_t high_water = sdcard_frames_high_water();
+    uint32_t dropped = sdcard_records_dropped();
+    uwrite_print_buff_P(PSTR("Blocks queued at most: "));
+    uwrite_print_byte(&high_water);
+    uwrite_print_buff_P(PSTR("Records dropped: "));
+    uwrite_print_long(&dropped);
+
+    uint32_t crc_errors = sdcard_crc_errors();
+    uwrite_print_buff_P(PSTR("Blocks that failed their CRC: "));
+    uwrite_print_long(&crc_errors);
+
+    // How many loops the card took to program each block
+    uint8_t bucket;
+    uwrite_print_buff_P(PSTR("Card busy for 0, 1, 2-3 ... 64+ loops:\r\n"));
+    for (bucket = 0; bucket < SDCARD_BUSY_BUCKETS; bucket++) {
+        uint32_t count = sdcard_busy_histogram(bucket);
+        uwrite_print_long(&count);
+    }
 
     // Print the contents of a block
-    char block_buff[SDCARD_BYTES_PER_BLOCK + 1]; 
-    memset(block_buff, 0, sizeof(block_buff));
-    sdcard_read_block(0, block_buff);
+    uint8_t * block_buff = sdcard_block_buffer();
+    memset(block_buff, 0, SDCARD_BYTES_PER_BLOCK);
+    sdcard_read_block(SDCARD_LOG_FIRST_BLOCK, block_buff);
 
-    uwrite_print_buff("print_buff\r\n");
-    print_block((uint8_t *)block_buff);
+    uwrite_print_buff_P(PSTR("print_buff\r\n"));
+    print_block(block_buff);
 
     // Turn on DEBUG LED if there were no issues
     if (sdcard_is_enabled()) {
@@ -44,8 +138,8 @@ void init_statevars(statevars_t * vars) {
     vars->unsigned_long = 8675309;
     vars->unsigned_short = 3560;
     vars->unsigned_byte = 2;
-    snprintf(vars->sentence, sizeof(vars->sentence),
-        "This is just a test. Nothing interesting to see here.");
+    snprintf_P(vars->sentence, sizeof(vars->sentence),
+        PSTR("This is just a test. Nothing interesting to see here."));
     vars->float_value = 500.0;
     vars->double_value = 500.0;
     vars->signed_byte = -2;
@@ -56,14 +150,34 @@ void init_statevars(statevars_t * vars) {
     return;
 }
 
+// Returns 1 if the offload button is held down; 0 otherwise
+uint8_t offload_button_held(void) {
+    // Make the button's pin an input, pulled up, and give it time to rise
+    OFFLOAD_BUTTON_DDR &= ~(1 << OFFLOAD_BUTTON);
+    OFFLOAD_BUTTON_PORT |= (1 << OFFLOAD_BUTTON);
+    _delay_ms(1);
+
+    // It has to stay down for 20 ms, so a bounce doesn't count
+    uint8_t sample;
+    for (sample = 0; sample < 10; sample++) {
+        if (OFFLOAD_BUTTON_PIN & (1 << OFFLOAD_BUTTON)) {
+            return 0;
+        }
+        _delay_ms(2);
+    }
+
+    return 1;
+}
+
 void print_block(uint8_t * b) {
     char msg[45];
     memset(msg, 0, sizeof(msg));
 
     uint16_t i;
     for (i = 0; i < 512/8; i++) {
-        snprintf(msg, sizeof(msg),
-            "0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x \r\n",
+        snprintf_P(msg, sizeof(msg),
+            PSTR("0x%02x 0x%02x 0x%02x 0x%02x "
+                 "0x%02x 0x%02x 0x%02x 0x%02x \r\n"),
             b[8*i], b[8*i+1], b[8*i+2], b[8*i+3],
             b[8*i+4], b[8*i+5], b[8*i+6], b[8*i+7]);
         uwrite_print_buff(msg);
@@ -0,0 +1,173 @@
+/*
+ * File: offload.c
+ */
+#include <stddef.h>
+#include <string.h>
+#include "crc.h"
+#include "offload.h"
+#include "sd_card.h"
+#include "uwrite.h"
+
+static uint8_t offload_receive_request(void);
+static void offload_send(const void * data, uint16_t length);
+static void offload_send_byte(uint8_t byte);
+static void offload_send_info(void);
+static void offload_send_blocks(void);
+
+// The blocks that can be asked for, found when the card was opened
+uint32_t OFFLOAD_first_block;
+uint32_t OFFLOAD_log_first_block;
+uint32_t OFFLOAD_end_block;
+
+// The bytes received last, which end with a request once it's all come in
+uint8_t OFFLOAD_received[sizeof(offload_request_t)];
+offload_request_t OFFLOAD_request; // the newest request
+uint8_t OFFLOAD_request_pending;   // and it hasn't been answered yet
+
+// The frame being sent
+uint32_t OFFLOAD_crc;           // of its bytes so far
+uint16_t OFFLOAD_block_bytes;   // of the block that have been sent
+
+void offload_run(void) {
+  if (!sdcard_open_log(&OFFLOAD_first_block, &OFFLOAD_log_first_block,
+                       &OFFLOAD_end_block)) {
+    OFFLOAD_first_block = 0;
+    OFFLOAD_log_first_block = 0;
+    OFFLOAD_end_block = 0;
+  }
+
+  // Once the card's debug output has gone at the usual rate
+  uwrite_init_fast();
+
+  for (;;) {
+    if (!OFFLOAD_request_pending && !offload_receive_request()) {
+      continue;
+    }
+    OFFLOAD_request_pending = 0;
+
+    if (OFFLOAD_request.count == 0) {
+      offload_send_info();
+    } else {
+      offload_send_blocks();
+    }
+  }
+}
+
+/* Takes the bytes received so far, up to the end of the first request
+   among them. Returns 1 if there was one, and copies it to
+   OFFLOAD_request; 0 otherwise.
+*/
+static uint8_t offload_receive_request(void) {
+  uint8_t byte;
+
+  while (uwrite_receive_byte(&byte)) {
+    uint32_t magic;
+
+    memmove(OFFLOAD_received, OFFLOAD_received + 1,
+            sizeof(OFFLOAD_received) - 1);
+    OFFLOAD_received[sizeof(OFFLOAD_received) - 1] = byte;
+
+    memcpy(&magic, OFFLOAD_received, sizeof(magic));
+    if (magic != OFFLOAD_REQUEST_MAGIC) {
+      continue;
+    }
+
+    memcpy(&OFFLOAD_request, OFFLOAD_received, sizeof(offload_request_t));
+    if (OFFLOAD_request.crc ==
+        crc32_update(CRC32_INIT, OFFLOAD_received,
+                     offsetof(offload_request_t, crc))) {
+      memset(OFFLOAD_received, 0, sizeof(OFFLOAD_received));
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* Sends length bytes of data as part of the frame */
+static void offload_send(const void * data, uint16_t length) {
+  uint16_t byte_index;
+
+  for (byte_index = 0; byte_index < length; byte_index++) {
+    uint8_t byte = ((const uint8_t *) data)[byte_index];
+
+    uwrite_send_byte(byte);
+    OFFLOAD_crc = crc32_update(OFFLOAD_crc, &byte, 1);
+  }
+
+  return;
+}
+
+/* Passed each byte of a block as it's read from the card */
+static void offload_send_byte(uint8_t byte) {
+  // The CRC is worked out while the USART sends the byte
+  uwrite_send_byte(byte);
+  OFFLOAD_crc = crc32_update(OFFLOAD_crc, &byte, 1);
+  OFFLOAD_block_bytes = OFFLOAD_block_bytes + 1;
+
+  return;
+}
+
+static void offload_send_info(void) {
+  offload_info_t info;
+
+  info.magic = OFFLOAD_INFO_MAGIC;
+  info.sequence = OFFLOAD_request.sequence;
+  info.first_block = OFFLOAD_first_block;
+  info.log_first_block = OFFLOAD_log_first_block;
+  info.end_block = OFFLOAD_end_block;
+  info.crc = crc32_update(CRC32_INIT, &info, offsetof(offload_info_t, crc));
+
+  OFFLOAD_crc = CRC32_INIT;
+  offload_send(&info, sizeof(info));
+
+  return;
+}
+
+/* Sends the blocks asked for (those of them that can be) until they've
+   all been sent, or another request comes in
+*/
+static void offload_send_blocks(void) {
+  offload_block_header_t header;
+  uint32_t end_block = OFFLOAD_end_block;
+
+  header.magic = OFFLOAD_BLOCK_MAGIC;
+  header.sequence = OFFLOAD_request.sequence;
+  header.block = OFFLOAD_request.first_block;
+
+  if (header.block < OFFLOAD_first_block || header.block >= end_block) {
+    return;
+  }
+  if (OFFLOAD_request.count < end_block - header.block) {
+    end_block = header.block + OFFLOAD_request.count;
+  }
+
+  if (!sdcard_read_start(header.block)) {
+    return;
+  }
+
+  for (; header.block < end_block; header.block++) {
+    OFFLOAD_crc = CRC32_INIT;
+    OFFLOAD_block_bytes = 0;
+    offload_send(&header, sizeof(header));
+
+    uint8_t block_read = sdcard_read_next(NULL, offload_send_byte);
+
+    // The card didn't send the block; the host will ask again
+    if (OFFLOAD_block_bytes < OFFLOAD_BLOCK_LENGTH) {
+      break;
+    }
+
+    uint32_t crc = block_read ? OFFLOAD_crc : ~OFFLOAD_crc;
+    offload_send(&crc, sizeof(crc));
+
+    if (offload_receive_request()) {
+      OFFLOAD_request_pending = 1;
+      break;
+    }
+  }
+
+  sdcard_read_stop();
+
+  return;
+}
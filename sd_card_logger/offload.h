@@ -0,0 +1,72 @@
+/*
+ * File: offload.h
+ *
+ * Sends the log back over the USART at 1 Mbps (see uwrite_init_fast()), so
+ * it can be pulled without taking the card out of the vehicle. It runs in
+ * place of logging when the offload button is held at power up.
+ *
+ * The host drives it. It sends a request, and the logger answers with
+ * frames: a request for no blocks with an info frame, which gives the
+ * range of blocks that the journal and the log take up; any other with a
+ * block frame for each block asked for, read from the card in a single
+ * multi-block read and sent on a byte at a time as it's read. Every frame
+ * starts with a magic number, echoes the sequence number of the request it
+ * answers, and ends with the CRC-32 (see crc.h) of the rest of it.
+ *
+ * A new request is taken between blocks, so the host can ask again from a
+ * block that was lost or corrupted without waiting for the rest; frames
+ * still on their way for the old request are told apart by its sequence
+ * number. A block that fails its CRC on the way from the card (in CRC
+ * mode) is sent with its frame's CRC inverted, so the host asks for it
+ * again; one the card doesn't send at all ends the read, and the frame is
+ * cut short. sd_log_offload is the host's side.
+ *
+ * The frames are laid out the same on the AVR and the host: little-endian,
+ * with no padding.
+ */
+#ifndef _OFFLOAD_H_
+#define _OFFLOAD_H_
+
+#include <stdint.h>
+
+#define OFFLOAD_REQUEST_MAGIC     0x5152464FUL // "OFRQ"
+#define OFFLOAD_INFO_MAGIC        0x4E49464FUL // "OFIN"
+#define OFFLOAD_BLOCK_MAGIC       0x4B42464FUL // "OFBK"
+#define OFFLOAD_BLOCK_LENGTH      512 // as SDCARD_BYTES_PER_BLOCK
+
+typedef struct {
+  uint32_t magic;           // OFFLOAD_REQUEST_MAGIC
+  uint32_t sequence;        // echoed by the frames that answer it
+  uint32_t first_block;
+  uint32_t count;           // 0 asks for the info frame
+  uint32_t crc;
+} offload_request_t;
+
+// The blocks that can be asked for are first_block up to end_block; the
+// range is empty if the card couldn't be read
+typedef struct {
+  uint32_t magic;           // OFFLOAD_INFO_MAGIC
+  uint32_t sequence;
+  uint32_t first_block;     // of the journal
+  uint32_t log_first_block; // after the journal
+  uint32_t end_block;       // after the last block logged
+  uint32_t crc;
+} offload_info_t;
+
+// Followed by the block, then the CRC-32 of both
+typedef struct {
+  uint32_t magic;           // OFFLOAD_BLOCK_MAGIC
+  uint32_t sequence;
+  uint32_t block;           // its address on the card
+} offload_block_header_t;
+
+#define OFFLOAD_BLOCK_FRAME_LENGTH \
+  (sizeof(offload_block_header_t) + OFFLOAD_BLOCK_LENGTH + sizeof(uint32_t))
+
+/* Opens the card to read the log (see sdcard_open_log()), then answers
+   the host's requests. Call in place of sdcard_init(), once spi_init()
+   has been. Never returns.
+*/
+void offload_run(void);
+
+#endif /* _OFFLOAD_H_ */
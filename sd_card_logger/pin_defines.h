@@ -33,6 +33,13 @@
 #define SPI_SCK_PIN     PINB
 #define SPI_SCK         PB5     /* Digital Pin 13 */
 
+////////////////////////////////////////////////////////////////////////////////
+// Offload Button (held at power up to send the log back; see offload.h)
+// Pressing it pulls the pin low against its pull-up resistor
+#define OFFLOAD_BUTTON_PORT   PORTC
+#define OFFLOAD_BUTTON_DDR    DDRC
+#define OFFLOAD_BUTTON_PIN    PINC
+#define OFFLOAD_BUTTON        PC2     /* Analog Pin 2 */
 
 #endif /* _PIN_DEFINES_H_ */
 
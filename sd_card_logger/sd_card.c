@@ -1,21 +1,110 @@
 /*
  * File: sd_card.c
  */
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
+#include "crc.h"
+#include "fat32.h"
+#include "log_channel.h"
+#include "log_delta.h"
 #include "sd_card.h"
+#include "spi.h"
 #include "statevars.h"
 #include "uwrite.h"
 
-static uint8_t spi_exchange_byte(uint8_t byte);
 static int8_t sdcard_check_block(uint32_t block_address);
-static uint8_t sdcard_find_available_block(void);
+static uint8_t sdcard_init_card(void);
+static uint8_t sdcard_find_log_end(void);
+static uint8_t sdcard_resume_log(void);
 static uint8_t sdcard_get_response(void);
+static uint8_t sdcard_receive_crc(uint16_t crc);
+static uint8_t sdcard_receive_csd(uint8_t * csd_register);
 static uint8_t sdcard_read_card_size(void);
+static void sdcard_clear_frame(void);
+static void sdcard_start_frame(void);
+static uint8_t * sdcard_record_space(uint16_t * available);
+static void sdcard_commit_record(uint8_t type, uint8_t length);
+static uint8_t sdcard_wait_until_ready(void);
+static uint8_t sdcard_poll_ready(void);
+static void sdcard_start_busy(void);
+static uint8_t sdcard_erase_due(uint32_t * end_block);
+static uint8_t sdcard_send_erase(uint32_t end_block);
+static void sdcard_erase_ahead(void);
+static uint8_t sdcard_send_single_block(uint32_t block_address,
+                                        const void * data,
+                                        uint16_t length);
+static uint8_t sdcard_write_single_block(uint32_t block_address,
+                                         const void * data,
+                                         uint16_t length);
 static void sdcard_send_command(uint8_t command, uint32_t argument, uint8_t suffix);
 
 volatile uint8_t SDCARD_enabled;
+uint8_t SDCARD_writing;       // a multi-block write is in progress
+volatile uint8_t SDCARD_stop_pending; // the session must end once idle
+
+// A queue of blocks of records waiting to be written. Each is framed by its
+// data token and followed by the CRC and a byte to clock in the card's data
+// response, so it can be sent as it is. The main loop adds records to the
+// frame at the head until it's full, then queues it; frames are released
+// at the tail once the SPI ISR has sent them.
+uint8_t SDCARD_frames[SDCARD_POOL_FRAMES][SDCARD_BLOCK_FRAME_LENGTH];
+uint8_t SDCARD_frame_records[SDCARD_POOL_FRAMES]; // records in each frame
+uint8_t SDCARD_frames_head;
+uint8_t SDCARD_frames_tail;
+volatile uint8_t SDCARD_frames_queued;
+uint8_t SDCARD_frames_high_water;
+uint32_t SDCARD_records_dropped;
+
+// The frame being filled
+uint16_t SDCARD_frame_used;     // bytes of records in it so far
+uint32_t SDCARD_frame_crc;      // of those bytes
+uint32_t SDCARD_block_sequence; // of the next block; its offset in the log
+
+// The statevars are logged as deltas from the previous snapshot
+log_delta_encoder_t SDCARD_delta;
+uint8_t SDCARD_previous_statevars[sizeof(statevars_t)];
+uint8_t SDCARD_frame_has_keyframe; // of the statevars, in the frame
+
+uint8_t SDCARD_schema_pending;  // the channels' schema is logged per session
+
+// The card programs each block it's sent while holding MISO low. The main
+// loop polls it rather than waiting, and records how long it took.
+volatile uint8_t SDCARD_card_busy;
+uint16_t SDCARD_busy_loops;     // marked since it started
+uint32_t SDCARD_busy_histogram[SDCARD_BUSY_BUCKETS];
+
+// The blocks ahead of the log are erased before it gets to them. An erase
+// leaves the card busy too, but it isn't counted as programming a block.
+uint32_t SDCARD_erased_block;   // the block after those erased so far
+uint8_t SDCARD_card_erasing;
+
+// In CRC mode, blocks that failed their CRC
+uint32_t SDCARD_crc_errors;
+
+// Whether the block at the tail of the queue was rejected, and must be
+// sent again
+uint8_t SDCARD_write_retries;   // of the block at the tail, so far
+volatile uint8_t SDCARD_resend_pending;
+
+// Where the session is up to, for the index and its summary
+sdcard_index_t SDCARD_index;
+sdcard_session_summary_t SDCARD_summary;
+uint8_t SDCARD_loop_marked;     // since the session started
 uint32_t SDCARD_next_block;
 uint32_t SDCARD_num_blocks;
+sdcard_journal_t SDCARD_journal; // the newest entry in the journal
+
+// Where the journal and the log frames go: the start of the card (and the
+// rest of it), or the log file in FAT32 mode
+uint32_t SDCARD_journal_first_block;
+uint32_t SDCARD_log_first_block;
+uint32_t SDCARD_log_end_block;
+#if SDCARD_FAT32
+fat32_file_t SDCARD_file;
+#endif
 
 void spi_init(void) {
   SPI_CS_DDR |= (1 << SPI_CS); // set chip select pin as an output
@@ -37,7 +126,10 @@ void spi_init(void) {
   SPCR |= (1 << SPE);               // enable SPI operations
 }
 
-void sdcard_init(void) {
+/* Brings the card up in SPI mode, at 2 MHz, and finds where the journal
+   and the log go. Returns 1 if successful; 0 otherwise.
+*/
+static uint8_t sdcard_init_card(void) {
   CHIP_DESELECT;
 
   // Before sending any commands, make sure the SD card is ready by sending
@@ -51,7 +143,7 @@ void sdcard_init(void) {
   // Send command to go into idle state (CMD0)
   // Response should indicate idle state (1 byte)
   //----- DEBUG
-  uwrite_print_buff("Sending GO_IDLE_STATE     (CMD0) ... got ");
+  uwrite_print_buff_P(PSTR("Sending GO_IDLE_STATE     (CMD0) ... got "));
   //----- DEBUG
 
   sdcard_send_command(SDCMD_GO_IDLE_STATE,
@@ -64,14 +156,14 @@ void sdcard_init(void) {
   //----- DEBUG
 
   if (idle_cmd_response == ERROR_BYTE)
-    return;
+    return 0;
   else if (idle_cmd_response != SDRES_IN_IDLE_STATE_OK)
-    return;
+    return 0;
 
   // Send command to request interface condition (CMD8)
   // Response should indicate idle state (and the condition, another 4 bytes) 
   //----- DEBUG
-  uwrite_print_buff("Sending SEND_IF_COND      (CMD8) ... got ");
+  uwrite_print_buff_P(PSTR("Sending SEND_IF_COND      (CMD8) ... got "));
   //----- DEBUG
 
   sdcard_send_command(SDCMD_SEND_IF_COND,
@@ -84,9 +176,13 @@ void sdcard_init(void) {
   //----- DEBUG
 
   if (cond_response == ERROR_BYTE)
-    return;
+    return 0;
   else if (cond_response != SDRES_IN_IDLE_STATE_OK)
-    return;
+    return 0;
+
+  // Clock out the rest of the R7 response before the next command
+  for (i = 0; i < 4; i++)
+    spi_exchange_byte(JUNK_BYTE);
   
   uint8_t op_cond_response;
   uint8_t retry_index;
@@ -95,7 +191,7 @@ void sdcard_init(void) {
     // we have to send the Application Specific Command (CMD55)
     // Response should indicate idle state
     //----- DEBUG
-    uwrite_print_buff("Sending APP_CMD          (CMD55) ... got ");
+    uwrite_print_buff_P(PSTR("Sending APP_CMD          (CMD55) ... got "));
     //----- DEBUG
 
     sdcard_send_command(SDCMD_APP_CMD,
@@ -108,12 +204,12 @@ void sdcard_init(void) {
     //----- DEBUG
 
     if (app_response == ERROR_BYTE)
-      return;
+      return 0;
     else if (app_response != SDRES_IN_IDLE_STATE_OK)
-      return;
+      return 0;
   
     //----- DEBUG
-    uwrite_print_buff("Sending SD_SEND_OP_COND (ACMD41) ... got ");
+    uwrite_print_buff_P(PSTR("Sending SD_SEND_OP_COND (ACMD41) ... got "));
     //----- DEBUG
 
     sdcard_send_command(SDCMD_SD_SEND_OP_COND,
@@ -131,11 +227,30 @@ void sdcard_init(void) {
       break;
   }
   if (op_cond_response == ERROR_BYTE)
-    return;
+    return 0;
+
+#if SDCARD_CRC
+  // From here on, the card checks the CRC of every command and data block
+  //----- DEBUG
+  uwrite_print_buff_P(PSTR("Sending CRC_ON_OFF       (CMD59) ... got "));
+  //----- DEBUG
+
+  sdcard_send_command(SDCMD_CRC_ON_OFF,
+                      SDARG_CRC_ON_OFF,
+                      SDSFX_CRC_ON_OFF);
+  uint8_t crc_on_off_response = sdcard_get_response();
+
+  //----- DEBUG
+  uwrite_print_byte(&crc_on_off_response);
+  //----- DEBUG
+
+  if (crc_on_off_response != SDRES_CRC_ON_OFF)
+    return 0;
+#endif
 
   // Verify that the card is a high capacity card
   //----- DEBUG
-  uwrite_print_buff("Sending READ_OCR         (CMD58) ... got ");
+  uwrite_print_buff_P(PSTR("Sending READ_OCR         (CMD58) ... got "));
   //----- DEBUG
 
   sdcard_send_command(SDCMD_READ_OCR,
@@ -148,7 +263,16 @@ void sdcard_init(void) {
   //----- DEBUG
 
   if (read_ocr_response != SDRES_READ_OCR)
-    return;
+    return 0;
+
+  // The rest of the R3 response is the OCR, whose CCS bit is set for a
+  // high capacity card
+  uint8_t ocr_high = spi_exchange_byte(JUNK_BYTE);
+  for (i = 1; i < 4; i++)
+    spi_exchange_byte(JUNK_BYTE);
+
+  if (!(ocr_high & SDRES_OCR_CCS))
+    return 0;
 
   // Increase SPI clock to 2 MHz
   SPSR |= (1 << SPI2X);
@@ -156,207 +280,353 @@ void sdcard_init(void) {
 
   // Read the card size
   if (!sdcard_read_card_size()) {
+    return 0;
+  }
+
+  // Find where to log
+#if SDCARD_FAT32
+  // The first frame of the pool isn't in use yet
+  if (!fat32_open_log_file(&SDCARD_file, SDCARD_frames[0])) {
+    uwrite_print_buff_P(PSTR("Could not open the FAT32 log file\r\n"));
+    return 0;
+  }
+
+  if (SDCARD_file.num_blocks <= SDCARD_JOURNAL_BLOCKS) {
+    return 0;
+  }
+
+  SDCARD_journal_first_block = SDCARD_file.first_block;
+  SDCARD_log_end_block = SDCARD_file.first_block + SDCARD_file.num_blocks;
+
+  // A new file may hold an old journal
+  if (SDCARD_file.created) {
+    uint8_t journal_index;
+    for (journal_index = 0; journal_index < SDCARD_JOURNAL_BLOCKS;
+         journal_index++) {
+      if (!sdcard_write_single_block(SDCARD_journal_first_block +
+                                     journal_index, NULL, 0)) {
+        return 0;
+      }
+    }
+  }
+#else
+  SDCARD_journal_first_block = 0;
+  SDCARD_log_end_block = SDCARD_num_blocks;
+#endif
+  SDCARD_log_first_block = SDCARD_journal_first_block + SDCARD_JOURNAL_BLOCKS;
+
+  return 1;
+}
+
+void sdcard_init(void) {
+  if (!sdcard_init_card()) {
     return;
   }
 
   // Find the next available block for writing
-  if (!sdcard_find_available_block()) {
-    uwrite_print_buff("Could not find a block to write :-(\r\n");
+  if (!sdcard_resume_log()) {
+    uwrite_print_buff_P(PSTR("Could not find a block to write :-(\r\n"));
     return;
   }
 
   //----- DEBUG
-  uwrite_print_buff("First available block: ");
+  uwrite_print_buff_P(PSTR("First available block: "));
   uwrite_print_long(&SDCARD_next_block);
   //----- DEBUG
 
+  // Erase ahead of the log while there's time to wait for it. The erase is
+  // only there to speed the writes up, so the log goes ahead without it.
+  uint32_t erase_end_block;
+  SDCARD_erased_block = SDCARD_next_block;
+  while (sdcard_erase_due(&erase_end_block)) {
+    if (!sdcard_send_erase(erase_end_block) || !sdcard_wait_until_ready()) {
+      uwrite_print_buff_P(PSTR("Could not erase ahead of the log\r\n"));
+      SDCARD_erased_block = SDCARD_log_end_block;
+      break;
+    }
+  }
+
   // TODO: Set an external variable to indicate that the SD card is good to go
   SDCARD_enabled = 1;
 
   return;
 }
 
-uint8_t sdcard_is_enabled(void) {
-  return SDCARD_enabled;
-}
-
-/* Sends the specified byte on the SPI output.
-   Assumes that the target device was already selected.
-   Returns the byte received in exchange.
-*/
-static uint8_t spi_exchange_byte(uint8_t byte) {
-  SPDR = byte;
+uint8_t sdcard_open_log(uint32_t * first_block, uint32_t * log_first_block,
+                        uint32_t * end_block) {
+  if (!sdcard_init_card() || !sdcard_find_log_end()) {
+    return 0;
+  }
 
-  // Wait until byte exchange is complete. This is indicated when the SPIF
-  // flag is set.
-  while (!(SPSR & (1 << SPIF))) {}
+  *first_block = SDCARD_journal_first_block;
+  *log_first_block = SDCARD_log_first_block;
+  *end_block = SDCARD_next_block;
 
-  return SPDR;
+  return 1;
 }
 
-// Returns 0 if block is available, 1 if block is occupied, -1 otherwise
-static int8_t sdcard_check_block(uint32_t block_address) {
-  uint8_t response;
-  union {
-    uint8_t bytes[4];
-    uint32_t dword;
-  } block_data;
-
-  char msg[64];
-  snprintf(msg, 64, "Reading block %lu\r\n", block_address);
-  uwrite_print_buff(msg);
-
-  //----- DEBUG
-  uwrite_print_buff("Sending READ_SINGLE_BLOCK (CMD17) ... got ");
-  //----- DEBUG
+uint8_t sdcard_is_enabled(void) {
+  return SDCARD_enabled;
+}
 
+uint8_t sdcard_read_block_start(uint32_t block_address, void * buff,
+                                uint16_t length) {
   sdcard_send_command(SDCMD_READ_SINGLE_BLOCK,
                       block_address,
                       SDSFX_READ_SINGLE_BLOCK);
-  uint8_t read_block_response = sdcard_get_response();
-
-  //----- DEBUG
-  // Expecting 0x00
-  uwrite_print_byte(&read_block_response);
-  //----- DEBUG
+  if (sdcard_get_response() != 0x00) {
+    return 0;
+  }
 
+  uint8_t response;
   uint8_t poll_index;
   for (poll_index = 0; poll_index < 0xFF; poll_index++) {
-    response = spi_exchange_byte(JUNK_BYTE); 
+    response = spi_exchange_byte(JUNK_BYTE);
 
-    if (response == START_TOKEN) { 
-      uwrite_print_buff("DATA START_TOKEN received\r\n");
+    if (response == START_TOKEN) {
       break;
     }
   }
   if (response != START_TOKEN) {
-    uwrite_print_buff("DATA START_TOKEN timed out\r\n");
-    return -1;
+    return 0;
   }
 
-  // Read the first 32 bits of the block
-  block_data.bytes[0] = spi_exchange_byte(JUNK_BYTE);
-  block_data.bytes[1] = spi_exchange_byte(JUNK_BYTE); 
-  block_data.bytes[2] = spi_exchange_byte(JUNK_BYTE);
-  block_data.bytes[3] = spi_exchange_byte(JUNK_BYTE); 
-
-  //----- DEBUG
-  uwrite_print_long(block_data.bytes);
-  //----- DEBUG
+  uint16_t crc = CRC16_INIT;
+  uint16_t byte_index;
+  uint8_t * bytes = (uint8_t *) buff;
+  for (byte_index = 0; byte_index < length; byte_index++) {
+    bytes[byte_index] = spi_exchange_byte(JUNK_BYTE);
+  }
+#if SDCARD_CRC
+  crc = crc16_update(crc, bytes, length);
+#endif
 
-  // Ignore the remainder of the block
-  // ignore_index should go up to (512 - 4) bytes = 508 bytes
-  uint16_t ignore_index;
-  for (ignore_index = 0; ignore_index < 508; ignore_index++) {
+  // Skip the remainder of the block (though it's checked too, in CRC mode)
+  for (; byte_index < SDCARD_BYTES_PER_BLOCK; byte_index++) {
+#if SDCARD_CRC
+    uint8_t byte = spi_exchange_byte(JUNK_BYTE);
+    crc = crc16_update(crc, &byte, 1);
+#else
     spi_exchange_byte(JUNK_BYTE);
+#endif
   }
 
-  //----- DEBUG
-  uwrite_print_buff("Final ignored byte: ");
-  uwrite_print_byte(&ignore_index);
-  //----- DEBUG
+  return sdcard_receive_crc(crc);
+}
 
-  PORTD |= (1 << 4);
-  // Ignore the 16-bit CRC
-  spi_exchange_byte(JUNK_BYTE);
-  spi_exchange_byte(JUNK_BYTE);
+// Returns 0 if block is available, 1 if block is occupied, -1 otherwise
+static int8_t sdcard_check_block(uint32_t block_address) {
+  uint32_t prefix;
 
-  // Hardcoding the frame prefix for now
-  // TODO: Have this reference a #defined value
-  if (block_data.dword == 0xDADAFEED) {
+  if (!sdcard_read_block_start(block_address, &prefix, sizeof(prefix))) {
+    return -1;
+  }
+
+  // Blocks logged in the earlier formats aren't written over either
+  if (prefix == SDCARD_BLOCK_MAGIC || prefix == SDCARD_BLOCK_MAGIC_V1) {
     return 1;
   }
 
   return 0;
 }
-  
-// Returns 1 if successful; 0 otherwise.
-static uint8_t sdcard_find_available_block(void) {
-  int8_t check_block_result;   // this value can be -1
 
-  // Check the first block since it's likely to be available because we clear
-  // the SD card after every run.
-  check_block_result = sdcard_check_block(0);
-
-  // If the first block is available, then use it.
-  if (check_block_result == 0) {
-    SDCARD_next_block = 0;
+/* Sends length bytes of data to the block at the specified address,
+   filling the rest of the block with zeros, once the card is ready for
+   it, and leaves the card programming it. Must not be called during a
+   multi-block write. Returns 1 if the card accepted the block; 0
+   otherwise.
+*/
+static uint8_t sdcard_send_single_block(uint32_t block_address,
+                                        const void * data,
+                                        uint16_t length) {
+  if (!sdcard_wait_until_ready()) {
+    return 0;
+  }
 
-    return 1;
-  } else if (check_block_result == -1) {
+  sdcard_send_command(SDCMD_WRITE_BLOCK,
+                      block_address,
+                      SDSFX_WRITE_BLOCK);
+  if (sdcard_get_response() != 0x00) {
     return 0;
   }
 
-  // Since the first block isn't available, perform a binary search to find
-  // the first available block.
-  uint32_t min_addr;
-  uint32_t max_addr;
-  char msg[64];
+  spi_exchange_byte(START_TOKEN);
 
-  min_addr = 1;
-  max_addr = SDCARD_num_blocks - 1;
+  uint16_t byte_index;
+  for (byte_index = 0; byte_index < length; byte_index++) {
+    spi_exchange_byte(((const uint8_t *) data)[byte_index]);
+  }
+  for (; byte_index < SDCARD_BYTES_PER_BLOCK; byte_index++) {
+    spi_exchange_byte(0x00);
+  }
 
-  while (max_addr >= min_addr) {
-    uint32_t midpoint_addr = min_addr + (max_addr - min_addr) / 2;
-    uint32_t curr_block_check_result;
+#if SDCARD_CRC
+  uint8_t zero = 0x00;
+  uint16_t crc = crc16_update(CRC16_INIT, data, length);
 
-    snprintf(msg, sizeof(msg),
-      "Checking blocks using [min: %lu, max: %lu, mid: %lu]\r\n",
-      min_addr, max_addr, midpoint_addr);
-    uwrite_print_buff(msg);
+  for (byte_index = length; byte_index < SDCARD_BYTES_PER_BLOCK;
+       byte_index++) {
+    crc = crc16_update(crc, &zero, 1);
+  }
 
-    curr_block_check_result = sdcard_check_block(midpoint_addr);
+  spi_exchange_byte((uint8_t) (crc >> 8));
+  spi_exchange_byte((uint8_t) crc);
+#else
+  // Ignore the 16-bit CRC
+  spi_exchange_byte(JUNK_BYTE);
+  spi_exchange_byte(JUNK_BYTE);
+#endif
 
-    // OPTION 1: The current block is available
-    // Check whether the preceding block is occupied. If it is, then use
-    // the current block. If it isn't, then keep searching.
-    if (curr_block_check_result == 0) {
-      uint32_t prev_block_check_result;
+  uint8_t data_response = spi_exchange_byte(JUNK_BYTE);
 
-      prev_block_check_result = sdcard_check_block(midpoint_addr - 1); 
+  if ((data_response & SDRES_DATA_RESPONSE_MASK) !=
+      SDRES_DATA_RESPONSE(SDRES_DATA_ACCEPTED)) {
+    return 0;
+  }
 
-      // OPTION 1.A: The preceding block is occupied.
-      // So use the current block.
-      if (prev_block_check_result == 1) {
-        SDCARD_next_block = midpoint_addr;
+  sdcard_start_busy();
 
-        return 1;
-      }
+  return 1;
+}
 
-      // OPTION 1.B: The preceding block is also available.
-      // So search the first half of the search space.
-      else if (prev_block_check_result == 0) {
-        max_addr = midpoint_addr - 1;
+/* As sdcard_send_single_block(), then waits for the card to program the
+   block. Returns 1 if successful; 0 otherwise.
+*/
+static uint8_t sdcard_write_single_block(uint32_t block_address,
+                                         const void * data,
+                                         uint16_t length) {
+  return sdcard_send_single_block(block_address, data, length) &&
+         sdcard_wait_until_ready();
+}
 
-        continue;
-      }
+uint8_t sdcard_write_block(uint32_t block_address, const void * block_buff) {
+  return sdcard_write_single_block(block_address, block_buff,
+                                   SDCARD_BYTES_PER_BLOCK);
+}
 
-      // OPTION 1.C: There was an error checking the preceding block.
-      else {
-        return 0;
-      }
+/* Sends the journal entry for the blocks logged so far to the next block
+   of the journal, and leaves the card programming it. Must not be called
+   during a multi-block write. Returns 1 if successful; 0 otherwise.
+*/
+static uint8_t sdcard_send_journal(void) {
+  SDCARD_journal.magic = SDCARD_JOURNAL_MAGIC;
+  SDCARD_journal.sequence = SDCARD_journal.sequence + 1;
+  SDCARD_journal.next_block = SDCARD_next_block;
+  SDCARD_journal.check = ~SDCARD_journal.sequence;
+
+  return sdcard_send_single_block(SDCARD_journal_first_block +
+                                  SDCARD_journal.sequence %
+                                  SDCARD_JOURNAL_BLOCKS,
+                                  &SDCARD_journal, sizeof(sdcard_journal_t));
+}
+
+/* As sdcard_send_journal(), then waits for the card to program the entry.
+   Returns 1 if successful; 0 otherwise.
+*/
+static uint8_t sdcard_write_journal(void) {
+  return sdcard_send_journal() && sdcard_wait_until_ready();
+}
+
+/* Sets the size of the log file to cover the blocks logged so far. The
+   file is already allocated, so only its directory entry changes. Must not
+   be called during a multi-block write; uses the first frame of the pool,
+   so it must also be empty. Returns 1 if successful; 0 otherwise.
+*/
+static uint8_t sdcard_finalize_log_file(void) {
+#if SDCARD_FAT32
+  uint32_t size = (SDCARD_next_block - SDCARD_file.first_block) *
+                  SDCARD_BYTES_PER_BLOCK;
+
+  return fat32_set_file_size(&SDCARD_file, size, SDCARD_frames[0]);
+#else
+  return 1;
+#endif
+}
+
+/* Finds where the previous session stopped logging, from the newest entry
+   in the journal, and sets SDCARD_next_block to it. The entry can be up to
+   SDCARD_JOURNAL_INTERVAL blocks out of date (or more if power was lost
+   with frames queued), so the blocks after it are scanned for log frames,
+   up to SDCARD_RESUME_SCAN_LIMIT of them. Takes the same time whatever the
+   size of the card. Returns 1 if successful; 0 otherwise.
+*/
+static uint8_t sdcard_find_log_end(void) {
+  sdcard_journal_t entry;
+  uint8_t journal_index;
+
+  // A card without a journal starts logging after the journal blocks
+  memset(&SDCARD_journal, 0, sizeof(sdcard_journal_t));
+  SDCARD_journal.next_block = SDCARD_log_first_block;
+
+  for (journal_index = 0; journal_index < SDCARD_JOURNAL_BLOCKS;
+       journal_index++) {
+    if (!sdcard_read_block_start(SDCARD_journal_first_block + journal_index,
+                                 &entry, sizeof(entry))) {
+      return 0;
     }
 
-    // OPTION 2: The current block is occupied.
-    // So search the second half of the search space.
-    else if (curr_block_check_result == 1) {
-      min_addr = midpoint_addr + 1;
+    if (entry.magic == SDCARD_JOURNAL_MAGIC &&
+        entry.check == ~entry.sequence &&
+        entry.sequence > SDCARD_journal.sequence &&
+        entry.next_block >= SDCARD_log_first_block &&
+        entry.next_block <= SDCARD_log_end_block) {
+      SDCARD_journal = entry;
+    }
+  }
 
-      continue;
+  uint32_t block = SDCARD_journal.next_block;
+  uint16_t scanned;
+  for (scanned = 0; scanned < SDCARD_RESUME_SCAN_LIMIT; scanned++) {
+    if (block >= SDCARD_log_end_block) {
+      break;
     }
 
-    // OPTION 3: There was an error checking the current block.
-    else {
+    int8_t check_block_result = sdcard_check_block(block);
+
+    if (check_block_result == -1) {
       return 0;
+    } else if (check_block_result == 0) {
+      break;
     }
+
+    block = block + 1;
   }
-  // If we get this far, then we didn't find a free block. Either the card is
-  // full or the blocks are not continguous. So use the first block.
-  SDCARD_next_block = 0;
+
+  SDCARD_next_block = block;
 
   return 1;
 }
 
+/* Starts a new session where the previous one stopped logging (see
+   sdcard_find_log_end()). Returns 1 if successful; 0 otherwise.
+*/
+static uint8_t sdcard_resume_log(void) {
+  if (!sdcard_find_log_end()) {
+    return 0;
+  }
+
+  SDCARD_block_sequence = SDCARD_next_block - SDCARD_log_first_block;
+  SDCARD_journal.session = SDCARD_journal.session + 1;
+  SDCARD_journal.session_start = SDCARD_next_block;
+
+  memset(&SDCARD_summary, 0, sizeof(sdcard_session_summary_t));
+  SDCARD_summary.session = SDCARD_journal.session;
+  SDCARD_summary.first_sequence = SDCARD_block_sequence;
+  SDCARD_index.session = SDCARD_journal.session;
+  SDCARD_index.loop_counter = 0;
+  SDCARD_index.gps_time_ms = 0;
+  SDCARD_index.interval = SDCARD_INDEX_INTERVAL;
+  SDCARD_loop_marked = 0;
+
+  sdcard_start_frame();
+  log_delta_encoder_init(&SDCARD_delta, SDCARD_previous_statevars,
+                         sizeof(statevars_t));
+  SDCARD_schema_pending = 1;
+
+  // Record the start of the session
+  return sdcard_write_journal();
+}
+
 /* Sends the specified command to the SD card */
 static void sdcard_send_command(uint8_t command, uint32_t argument, uint8_t suffix) {
   // Send up to 8 high bytes until 0xFF is received
@@ -378,14 +648,23 @@ static void sdcard_send_command(uint8_t command, uint32_t argument, uint8_t suff
       break;
   }
 
-  // Send the command
-  spi_exchange_byte(SDCARD_CMD_MASK_HEAD | (command & SDCARD_CMD_MASK_TAIL));
+  // Send the command, then the argument
+  uint8_t bytes[5];
+  uint8_t byte_index;
+  bytes[0] = SDCARD_CMD_MASK_HEAD | (command & SDCARD_CMD_MASK_TAIL);
+  bytes[1] = (uint8_t) (argument >> 24);
+  bytes[2] = (uint8_t) (argument >> 16);
+  bytes[3] = (uint8_t) (argument >>  8);
+  bytes[4] = (uint8_t) argument;
+
+  for (byte_index = 0; byte_index < sizeof(bytes); byte_index++) {
+    spi_exchange_byte(bytes[byte_index]);
+  }
 
-  // Then send the argument
-  spi_exchange_byte((uint8_t) (argument >> 24));
-  spi_exchange_byte((uint8_t) (argument >> 16));
-  spi_exchange_byte((uint8_t) (argument >>  8));
-  spi_exchange_byte((uint8_t) argument);
+#if SDCARD_CRC
+  // The card checks the CRC of every command, not just CMD0 and CMD8
+  suffix = crc7_suffix(bytes, sizeof(bytes));
+#endif
 
   // Finally, send the suffix
   spi_exchange_byte(suffix);
@@ -417,29 +696,47 @@ static uint8_t sdcard_get_response(void) {
   return ERROR_BYTE;
 }
 
+/* Receives the 16-bit CRC that follows a data block and, in CRC mode,
+   checks it against crc, worked out from the block as it was received.
+   Returns 1 if they match (or it isn't checked); 0 otherwise.
+*/
+static uint8_t sdcard_receive_crc(uint16_t crc) {
+  uint16_t received = (uint16_t) spi_exchange_byte(JUNK_BYTE) << 8;
+  received |= spi_exchange_byte(JUNK_BYTE);
+
+#if SDCARD_CRC
+  if (received != crc) {
+    SDCARD_crc_errors = SDCARD_crc_errors + 1;
+    return 0;
+  }
+#endif
+
+  return 1;
+}
+
 // Returns 1 if successful; 0 otherwise
 uint8_t sdcard_read_block(uint32_t block_address, void * block_buff) {
   if (!SDCARD_enabled) {
-    uwrite_print_buff("SDcard not enabled!\r\n");
+    uwrite_print_buff_P(PSTR("SDcard not enabled!\r\n"));
     return 0;
   }
 
   if (block_address >= SDCARD_num_blocks) {
-    uwrite_print_buff("Invalid block address!\r\n");
+    uwrite_print_buff_P(PSTR("Invalid block address!\r\n"));
     return 0;
   }
 
   if (block_buff == NULL) {
-    uwrite_print_buff("Invalid block buffer!\r\n");
+    uwrite_print_buff_P(PSTR("Invalid block buffer!\r\n"));
     return 0;
   }
 
   char msg[64];
-  snprintf(msg, 64, "Reading block %lu\r\n", block_address);
+  snprintf_P(msg, 64, PSTR("Reading block %" PRIu32 "\r\n"), block_address);
   uwrite_print_buff(msg);
 
   //----- DEBUG
-  uwrite_print_buff("Sending READ_SINGLE_BLOCK (CMD17) ... got ");
+  uwrite_print_buff_P(PSTR("Sending READ_SINGLE_BLOCK (CMD17) ... got "));
   //----- DEBUG
 
   sdcard_send_command(SDCMD_READ_SINGLE_BLOCK,
@@ -458,7 +755,7 @@ uint8_t sdcard_read_block(uint32_t block_address, void * block_buff) {
     response = spi_exchange_byte(JUNK_BYTE); 
 
     if (response == START_TOKEN) { 
-      uwrite_print_buff("DATA START_TOKEN received\r\n");
+      uwrite_print_buff_P(PSTR("DATA START_TOKEN received\r\n"));
       break;
     }
   }
@@ -473,52 +770,92 @@ uint8_t sdcard_read_block(uint32_t block_address, void * block_buff) {
     read_bytes[read_index] = spi_exchange_byte(JUNK_BYTE); 
   }
 
-  // Ignore the 16-bit CRC
-  spi_exchange_byte(JUNK_BYTE);
-  spi_exchange_byte(JUNK_BYTE);
+  uint16_t crc = CRC16_INIT;
+#if SDCARD_CRC
+  crc = crc16_update(crc, read_bytes, SDCARD_BYTES_PER_BLOCK);
+#endif
+  if (!sdcard_receive_crc(crc)) {
+    uwrite_print_buff_P(PSTR("Bad CRC!\r\n"));
+    return 0;
+  }
 
   //----- DEBUG
-  snprintf(msg, 64, "Finished reading block %lu\r\n", block_address);
+  snprintf_P(msg, 64, PSTR("Finished reading block %" PRIu32 "\r\n"),
+             block_address);
   uwrite_print_buff(msg);
   //----- DEBUG
 
   return 1;
 }
 
-/* Reads the SD card's capacity. */
-static uint8_t sdcard_read_card_size(void) {
-  //----- DEBUG
-  uwrite_print_buff("\r\nReading card size\r\n");
-  uwrite_print_buff("Sending SEND_CSD          (CMD9) ... got ");
-  //----- DEBUG
+uint8_t sdcard_read_start(uint32_t block_address) {
+  if (SDCARD_writing || !sdcard_wait_until_ready()) {
+    return 0;
+  }
 
-  sdcard_send_command(SDCMD_SEND_CSD,
-                      SDARG_SEND_CSD,
-                      SDSFX_SEND_CSD);
-  uint8_t send_csd_response = sdcard_get_response();
+  sdcard_send_command(SDCMD_READ_MULTIPLE_BLOCK,
+                      block_address,
+                      SDSFX_READ_MULTIPLE_BLOCK);
 
-  //----- DEBUG
-  uwrite_print_byte(&send_csd_response);
-  //----- DEBUG
+  return sdcard_get_response() == 0x00;
+}
 
-  //----- DEBUG
-  uwrite_print_buff("Sending SEND_CSD (again)  (CMD9) ... got ");
-  //----- DEBUG
+uint8_t sdcard_read_next(void * block_buff, sdcard_read_callback_t on_byte) {
+  // The card may take a while to fetch each block; anything other than
+  // the start token or 0xFF is an error token
+  uint8_t response = JUNK_BYTE;
+  uint16_t poll_index;
+  for (poll_index = 0; poll_index < SDCARD_BUSY_POLL_LIMIT; poll_index++) {
+    response = spi_exchange_byte(JUNK_BYTE);
 
-  sdcard_send_command(SDCMD_SEND_CSD,
-                      SDARG_SEND_CSD,
-                      SDSFX_SEND_CSD);
-  send_csd_response = sdcard_get_response();
+    if (response != JUNK_BYTE) {
+      break;
+    }
+  }
+  if (response != START_TOKEN) {
+    return 0;
+  }
 
-  //----- DEBUG
-  uwrite_print_byte(&send_csd_response);
-  //----- DEBUG
+  uint16_t crc = CRC16_INIT;
+  uint16_t byte_index;
+  uint8_t * bytes = (uint8_t *) block_buff;
+  for (byte_index = 0; byte_index < SDCARD_BYTES_PER_BLOCK; byte_index++) {
+    uint8_t byte = spi_exchange_byte(JUNK_BYTE);
 
-  // Expecting 0x00 reponse
-  if (send_csd_response != 0x00) {
+    if (bytes != NULL) {
+      bytes[byte_index] = byte;
+    }
+    if (on_byte != NULL) {
+      on_byte(byte);
+    }
+#if SDCARD_CRC
+    crc = crc16_update(crc, &byte, 1);
+#endif
+  }
+
+  return sdcard_receive_crc(crc);
+}
+
+uint8_t sdcard_read_stop(void) {
+  sdcard_send_command(SDCMD_STOP_TRANSMISSION,
+                      SDARG_STOP_TRANSMISSION,
+                      SDSFX_STOP_TRANSMISSION);
+
+  // The byte after the command is still part of the read; then comes the
+  // R1 response, and the card is busy until it's stopped
+  spi_exchange_byte(JUNK_BYTE);
+  if (sdcard_get_response() != 0x00) {
     return 0;
   }
 
+  return sdcard_wait_until_ready();
+}
+
+/* Receives the CSD register that follows the response to SEND_CSD (CMD9),
+   and its CRC, into the 16 bytes at csd_register. Returns 1 if successful;
+   0 otherwise.
+*/
+static uint8_t sdcard_receive_csd(uint8_t * csd_register) {
   // Expecting start token (0xFE) + 16 bytes of data + 16-bit CRC
   uint16_t poll_index;
   uint8_t response;
@@ -529,7 +866,7 @@ static uint8_t sdcard_read_card_size(void) {
     response = spi_exchange_byte(JUNK_BYTE); 
 
     if (response == START_TOKEN) { 
-      uwrite_print_buff("CSD START_TOKEN received\r\n");
+      uwrite_print_buff_P(PSTR("CSD START_TOKEN received\r\n"));
       break;
     }
   }
@@ -537,118 +874,890 @@ static uint8_t sdcard_read_card_size(void) {
     return 0;
   }
 
-  uint8_t csd_register[16];
   uint8_t csd_byte_index;
 
   // Read the 16-byte CSD register
-  uwrite_print_buff("Reading CSD register...\r\n");
+  uwrite_print_buff_P(PSTR("Reading CSD register...\r\n"));
   for (csd_byte_index = 0; csd_byte_index < 16; csd_byte_index++) {
     csd_register[csd_byte_index] = spi_exchange_byte(JUNK_BYTE);    
   }
 
-  // Ignore 16-bit CRC
-  //spi_exchange_byte(JUNK_BYTE);
-  //spi_exchange_byte(JUNK_BYTE);
+  // Then its 16-bit CRC, so the card has sent all of it before the next
+  // command
+  uint16_t crc = CRC16_INIT;
+#if SDCARD_CRC
+  crc = crc16_update(crc, csd_register, 16);
+#endif
 
-  // Print the CSD register data
-  char msg[64];
-  snprintf(msg, 64,
-    "%02X %02X %02X %02X %02X %02X %02X %02X ",
-    csd_register[0], csd_register[1], csd_register[2], csd_register[3],
-    csd_register[4], csd_register[5], csd_register[6], csd_register[7]);
-  uwrite_print_buff(msg);
+  return sdcard_receive_crc(crc);
+}
 
-  snprintf(msg, 64,
-    "%02X %02X %02X %02X %02X %02X %02X %02X\r\n",
-    csd_register[8], csd_register[9], csd_register[10], csd_register[11],
-    csd_register[12], csd_register[13], csd_register[14], csd_register[15]);
-  uwrite_print_buff(msg);
+/* Reads the SD card's capacity. */
+static uint8_t sdcard_read_card_size(void) {
+  uint8_t csd_register[16];
 
-  // Extract the C_SIZE value and calculate the card's capacity
-  uint32_t csd_c_size;
-  uint32_t card_capacity;
+  //----- DEBUG
+  uwrite_print_buff_P(PSTR("\r\nReading card size\r\n"));
+  uwrite_print_buff_P(PSTR("Sending SEND_CSD          (CMD9) ... got "));
+  //----- DEBUG
 
-  // The most significant bits of CSD do not include bits 7 and 6
-  // See Table 5-16 in SD Card specs
-  csd_c_size = csd_register[7] & 0b00111111;
-  csd_c_size = csd_c_size << 8;
-  csd_c_size |= csd_register[8];
-  csd_c_size = csd_c_size << 8;
-  csd_c_size |= csd_register[9];
+  sdcard_send_command(SDCMD_SEND_CSD,
+                      SDARG_SEND_CSD,
+                      SDSFX_SEND_CSD);
+  uint8_t send_csd_response = sdcard_get_response();
 
-  // Card Capacity = (C_SIZE + 1) * 512 KByte
-  // See Section 5.3.3 (pg. 123) in SD Card specs
-  SDCARD_num_blocks = (csd_c_size + 1);
-  card_capacity = SDCARD_num_blocks * 512;
+  //----- DEBUG
+  uwrite_print_byte(&send_csd_response);
+  //----- DEBUG
 
-  snprintf(msg, 64,
-    "Card size: %lu KB\r\nNum blocks: %lu\r\n", card_capacity, SDCARD_num_blocks);
+  // Its CSD is read out, though only the second one is used
+  if (send_csd_response == 0x00) {
+    sdcard_receive_csd(csd_register);
+  }
+
+  //----- DEBUG
+  uwrite_print_buff_P(PSTR("Sending SEND_CSD (again)  (CMD9) ... got "));
+  //----- DEBUG
+
+  sdcard_send_command(SDCMD_SEND_CSD,
+                      SDARG_SEND_CSD,
+                      SDSFX_SEND_CSD);
+  send_csd_response = sdcard_get_response();
+
+  //----- DEBUG
+  uwrite_print_byte(&send_csd_response);
+  //----- DEBUG
+
+  // Expecting 0x00 reponse
+  if (send_csd_response != 0x00) {
+    return 0;
+  }
+
+  if (!sdcard_receive_csd(csd_register)) {
+    return 0;
+  }
+
+  // Print the CSD register data
+  char msg[64];
+  snprintf_P(msg, 64,
+    PSTR("%02X %02X %02X %02X %02X %02X %02X %02X "),
+    csd_register[0], csd_register[1], csd_register[2], csd_register[3],
+    csd_register[4], csd_register[5], csd_register[6], csd_register[7]);
+  uwrite_print_buff(msg);
+
+  snprintf_P(msg, 64,
+    PSTR("%02X %02X %02X %02X %02X %02X %02X %02X\r\n"),
+    csd_register[8], csd_register[9], csd_register[10], csd_register[11],
+    csd_register[12], csd_register[13], csd_register[14], csd_register[15]);
+  uwrite_print_buff(msg);
+
+  // Extract the C_SIZE value and calculate the card's capacity
+  uint32_t csd_c_size;
+  uint32_t card_capacity;
+
+  // The most significant bits of CSD do not include bits 7 and 6
+  // See Table 5-16 in SD Card specs
+  csd_c_size = csd_register[7] & 0b00111111;
+  csd_c_size = csd_c_size << 8;
+  csd_c_size |= csd_register[8];
+  csd_c_size = csd_c_size << 8;
+  csd_c_size |= csd_register[9];
+
+  // Card Capacity = (C_SIZE + 1) * 512 KByte = (C_SIZE + 1) * 1024 blocks
+  // See Section 5.3.3 (pg. 123) in SD Card specs
+  SDCARD_num_blocks = (csd_c_size + 1) * 1024;
+  card_capacity = (csd_c_size + 1) * 512;
+
+  snprintf_P(msg, 64,
+    PSTR("Card size: %" PRIu32 " KB\r\nNum blocks: %" PRIu32 "\r\n"),
+    card_capacity, SDCARD_num_blocks);
   uwrite_print_buff(msg);
 
   return 1;
 }
 
-/* Writes the next chunk of data to the SD card */
-void sdcard_write_data(void) {
-  if (!SDCARD_enabled) {
-    return;
+/* Waits until the card stops holding MISO low, which it does while it's
+   programming a block. Returns 1 when the card is ready; 0 on timeout.
+*/
+static uint8_t sdcard_wait_until_ready(void) {
+  uint16_t poll_index;
+  for (poll_index = 0; poll_index < SDCARD_BUSY_POLL_LIMIT; poll_index++) {
+    if (spi_exchange_byte(JUNK_BYTE) == 0xFF) {
+      SDCARD_card_busy = 0;
+      SDCARD_card_erasing = 0;
+      return 1;
+    }
   }
 
-  // If the SD card is full, disable logging
-  if (SDCARD_next_block >= SDCARD_num_blocks) {
-    SDCARD_enabled = 0;
-    return;
+  return 0;
+}
+
+/* Notes that the card has started programming a block */
+static void sdcard_start_busy(void) {
+  SDCARD_card_busy = 1;
+  SDCARD_busy_loops = 0;
+
+  return;
+}
+
+/* Polls the card once, without waiting, if it may still be programming a
+   block, and once it's done, records how many loops that took. Returns 1
+   if the card is ready; 0 if it's busy.
+*/
+static uint8_t sdcard_poll_ready(void) {
+  uint16_t loops;
+  uint8_t bucket = 0;
+
+  if (!SDCARD_card_busy) {
+    return 1;
+  }
+
+  if (spi_exchange_byte(JUNK_BYTE) != 0xFF) {
+    return 0;
+  }
+
+  SDCARD_card_busy = 0;
+
+  if (SDCARD_card_erasing) {
+    SDCARD_card_erasing = 0;
+    return 1;
+  }
+
+  // Buckets of powers of two
+  for (loops = SDCARD_busy_loops;
+       loops > 0 && bucket < SDCARD_BUSY_BUCKETS - 1; loops = loops >> 1) {
+    bucket = bucket + 1;
+  }
+  SDCARD_busy_histogram[bucket] = SDCARD_busy_histogram[bucket] + 1;
+
+  return 1;
+}
+
+/* Starts a multi-block write at SDCARD_next_block, first asking the card to
+   pre-erase the blocks we expect to write. Returns 1 if successful; 0
+   otherwise.
+*/
+static uint8_t sdcard_start_write_session(void) {
+  uint32_t pre_erase_blocks = SDCARD_log_end_block - SDCARD_next_block;
+
+  if (pre_erase_blocks > SDCARD_PRE_ERASE_BLOCKS) {
+    pre_erase_blocks = SDCARD_PRE_ERASE_BLOCKS;
+  }
+
+  // The pre-erase is only a hint, so the write goes ahead without it
+  if (pre_erase_blocks > 0) {
+    sdcard_send_command(SDCMD_APP_CMD,
+                        SDARG_APP_CMD,
+                        SDSFX_APP_CMD);
+    uint8_t app_response = sdcard_get_response();
+
+    if (app_response == 0x00) {
+      sdcard_send_command(SDCMD_SET_WR_BLK_ERASE_COUNT,
+                          pre_erase_blocks,
+                          SDSFX_SET_WR_BLK_ERASE_COUNT);
+      sdcard_get_response();
+    }
   }
 
   //----- DEBUG
-  uwrite_print_buff("Sending WRITE_BLOCK   (CMD18) ... got");
+  uwrite_print_buff_P(PSTR("Sending WRITE_MULTIPLE_BLOCK (CMD25) ... got "));
   //----- DEBUG
-  sdcard_send_command(SDCMD_WRITE_BLOCK,
+
+  sdcard_send_command(SDCMD_WRITE_MULTIPLE_BLOCK,
                       SDCARD_next_block,
-                      SDSFX_WRITE_BLOCK);
-  uint8_t write_block_response = sdcard_get_response();
+                      SDSFX_WRITE_MULTIPLE_BLOCK);
+  uint8_t write_response = sdcard_get_response();
 
   //----- DEBUG
-  uwrite_print_byte(&write_block_response);
+  uwrite_print_byte(&write_response);
   //----- DEBUG
 
-  if (write_block_response == ERROR_BYTE) {
+  if (write_response != 0x00) {
+    return 0;
+  }
+
+  SDCARD_writing = 1;
+
+  return 1;
+}
+
+/* Sends the stop-tran token that ends a multi-block write, once the card
+   is ready for it, and leaves the card programming the last block.
+   Returns 1 if successful; 0 otherwise.
+*/
+static uint8_t sdcard_end_write_session(void) {
+  SDCARD_writing = 0;
+
+  if (!sdcard_wait_until_ready()) {
+    return 0;
+  }
+
+  spi_exchange_byte(STOP_TRAN_TOKEN);
+
+  // The card starts signalling busy one byte after the token
+  spi_exchange_byte(JUNK_BYTE);
+  sdcard_start_busy();
+
+  return 1;
+}
+
+/* As sdcard_end_write_session(), then waits for the card to program the
+   last block. Returns 1 if successful; 0 otherwise.
+*/
+static uint8_t sdcard_stop_write_session(void) {
+  return sdcard_end_write_session() && sdcard_wait_until_ready();
+}
+
+/* Returns 1 if the log has come close enough to the blocks erased ahead of
+   it (see SDCARD_ERASE_AHEAD_BLOCKS) for the next chunk to be erased, and
+   sets end_block to the block after it; 0 otherwise.
+*/
+static uint8_t sdcard_erase_due(uint32_t * end_block) {
+  uint32_t ahead_end_block = SDCARD_log_end_block;
+
+  if (SDCARD_ERASE_AHEAD_BLOCKS == 0) {
+    return 0;
+  }
+
+  // The log may have overtaken the erase, if the card was never idle
+  if (SDCARD_erased_block < SDCARD_next_block) {
+    SDCARD_erased_block = SDCARD_next_block;
+  }
+
+  if (SDCARD_log_end_block - SDCARD_next_block > SDCARD_ERASE_AHEAD_BLOCKS) {
+    ahead_end_block = SDCARD_next_block + SDCARD_ERASE_AHEAD_BLOCKS;
+  }
+
+  *end_block = SDCARD_log_end_block;
+  if (SDCARD_log_end_block - SDCARD_erased_block > SDCARD_ERASE_CHUNK_BLOCKS) {
+    *end_block = SDCARD_erased_block + SDCARD_ERASE_CHUNK_BLOCKS;
+  }
+
+  return SDCARD_erased_block < *end_block && *end_block <= ahead_end_block;
+}
+
+/* Erases the blocks from SDCARD_erased_block up to end_block (CMD32, CMD33,
+   then CMD38), and leaves the card busy erasing them. Must not be called
+   during a multi-block write. Returns 1 if successful; 0 otherwise.
+*/
+static uint8_t sdcard_send_erase(uint32_t end_block) {
+  sdcard_send_command(SDCMD_ERASE_WR_BLK_START,
+                      SDCARD_erased_block,
+                      SDSFX_ERASE_WR_BLK_START);
+  if (sdcard_get_response() != 0x00) {
+    return 0;
+  }
+
+  sdcard_send_command(SDCMD_ERASE_WR_BLK_END,
+                      end_block - 1,
+                      SDSFX_ERASE_WR_BLK_END);
+  if (sdcard_get_response() != 0x00) {
+    return 0;
+  }
+
+  sdcard_send_command(SDCMD_ERASE,
+                      SDARG_ERASE,
+                      SDSFX_ERASE);
+  if (sdcard_get_response() != 0x00) {
+    return 0;
+  }
+
+  sdcard_start_busy();
+  SDCARD_card_erasing = 1;
+  SDCARD_erased_block = end_block;
+
+  return 1;
+}
+
+/* Erases the next chunk ahead of the log, if it's due, a step per call as
+   the journal is written: the session is closed on one call, and the
+   erase is sent on a later one. A card that won't erase is left to write
+   the log without it.
+*/
+static void sdcard_erase_ahead(void) {
+  uint32_t end_block;
+
+  if (!sdcard_erase_due(&end_block)) {
+    return;
+  }
+
+  if (SDCARD_writing) {
+    if (!sdcard_end_write_session()) {
+      SDCARD_enabled = 0;
+    }
+    return;
+  }
+
+  if (!sdcard_send_erase(end_block)) {
+    SDCARD_erased_block = SDCARD_log_end_block;
+  }
+
+  return;
+}
+
+/* Releases the frame at the tail of the queue. Called from the SPI ISR. */
+static void sdcard_release_frame(void) {
+  SDCARD_frames_tail = (SDCARD_frames_tail + 1) % SDCARD_POOL_FRAMES;
+  SDCARD_frames_queued = SDCARD_frames_queued - 1;
+
+  return;
+}
+
+/* Called from the SPI ISR once the data response for a block is in */
+static void sdcard_block_sent(uint8_t data_response) {
+  sdcard_start_busy();
+
+  if ((data_response & SDRES_DATA_RESPONSE_MASK) !=
+      SDRES_DATA_RESPONSE(SDRES_DATA_ACCEPTED)) {
+    // A rejected block (in CRC mode, perhaps corrupted on its way to the
+    // card) is kept to be sent again, once the write has been ended and
+    // restarted
+    if (SDCARD_write_retries < SDCARD_WRITE_RETRIES) {
+#if SDCARD_CRC
+      if ((data_response & SDRES_DATA_RESPONSE_MASK) ==
+          SDRES_DATA_RESPONSE(SDRES_DATA_REJECT_CRC)) {
+        SDCARD_crc_errors = SDCARD_crc_errors + 1;
+      }
+#endif
+      SDCARD_write_retries = SDCARD_write_retries + 1;
+      SDCARD_resend_pending = 1;
+      return;
+    }
+
+    // Then it ends the write for good; the card expects the stop token
+    SDCARD_records_dropped = SDCARD_records_dropped +
+                             SDCARD_frame_records[SDCARD_frames_tail];
+    sdcard_release_frame();
     SDCARD_enabled = 0;
+    SDCARD_stop_pending = 1;
     return;
   }
 
+  sdcard_release_frame();
+  SDCARD_write_retries = 0;
   SDCARD_next_block = SDCARD_next_block + 1;
-  spi_exchange_byte(0xFE);
 
-  //----- DEBUG
-  uwrite_print_buff("Writing data... \r\n");
-  //----- DEBUG
-  // Write the robot's data
-  uint16_t byte_index;
-  for (byte_index = 0; byte_index < sizeof(statevars_t); byte_index++) {
-    spi_exchange_byte(((uint8_t *)&statevars)[byte_index]);
+  // If the SD card (or log file) is full, close the session and disable
+  // logging
+  if (SDCARD_next_block >= SDCARD_log_end_block) {
+    SDCARD_enabled = 0;
+    SDCARD_stop_pending = 1;
   }
 
-  // Fill the remaining blocks with 0xAA
-  // This should never occur since the statevars_t is padded to 
-  // fill a block
-  for (; byte_index < SDCARD_BYTES_PER_BLOCK; byte_index++) {
-    spi_exchange_byte(PADDING_BYTE);
+  return;
+}
+
+/* Called from the SPI ISR if a block couldn't be sent */
+static void sdcard_block_failed(void) {
+  SDCARD_records_dropped = SDCARD_records_dropped +
+                           SDCARD_frame_records[SDCARD_frames_tail];
+  sdcard_release_frame();
+
+  SDCARD_enabled = 0;
+  SDCARD_stop_pending = 1;
+
+  return;
+}
+
+/* Empties the frame at the head of the queue */
+static void sdcard_clear_frame(void) {
+  SDCARD_frame_used = 0;
+  SDCARD_frame_crc = CRC32_INIT;
+  SDCARD_frame_records[SDCARD_frames_head] = 0;
+  SDCARD_frame_has_keyframe = 0;
+
+  return;
+}
+
+/* Starts filling the frame at the head of the queue with records; an
+   index record first, if the block is due one.
+*/
+static void sdcard_start_frame(void) {
+  sdcard_clear_frame();
+
+  if (SDCARD_block_sequence % SDCARD_INDEX_INTERVAL == 0 ||
+      SDCARD_block_sequence == SDCARD_summary.first_sequence) {
+    uint16_t available;
+
+    memcpy(sdcard_record_space(&available), &SDCARD_index,
+           sizeof(sdcard_index_t));
+    sdcard_commit_record(SDCARD_RECORD_INDEX, sizeof(sdcard_index_t));
+  }
+
+  return;
+}
+
+#if SDCARD_POOL_FRAMES == 1
+/* Waits for the only frame to be sent once it's queued, so that it can be
+   filled again; the card programs it while the main loop runs. Returns 1
+   if successful; 0 if logging was disabled meanwhile, or the card was busy
+   for too long.
+*/
+static uint8_t sdcard_wait_for_frame(void) {
+  uint16_t poll_index;
+
+  for (poll_index = 0; poll_index < SDCARD_BUSY_POLL_LIMIT; poll_index++) {
+    // The frame is clocked out by the SPI ISR
+    while (spi_transfer_is_busy()) {}
+
+    if (!SDCARD_enabled || SDCARD_frames_queued == 0) {
+      return SDCARD_enabled;
+    }
+
+    sdcard_flush();
+  }
+
+  SDCARD_enabled = 0;
+  SDCARD_stop_pending = 1;
+
+  return 0;
+}
+#endif
+
+/* Completes the block header of the frame being filled and queues the frame
+   to be written, then starts filling the next one. Returns 1 if successful;
+   0 if every other frame is still queued.
+*/
+static uint8_t sdcard_seal_frame(void) {
+  uint8_t queued = SDCARD_frames_queued;
+
+  // One frame is kept for records, unless there's only the one; it's
+  // waited for once it's queued instead
+  if (queued > 0 && queued >= SDCARD_POOL_FRAMES - 1) {
+    return 0;
   }
 
+  uint8_t * block = SDCARD_frames[SDCARD_frames_head];
+  sdcard_block_header_t header;
+
+  header.magic = SDCARD_BLOCK_MAGIC;
+  header.sequence = SDCARD_block_sequence;
+  header.used = SDCARD_frame_used;
+  header.crc = SDCARD_frame_crc;
+  SDCARD_block_sequence = SDCARD_block_sequence + 1;
+
+  // The records are already in place after the header; fill the remainder
+  // of the block with 0xAA
+  *block++ = WRITE_MULTIPLE_TOKEN;
+  memcpy(block, &header, sizeof(sdcard_block_header_t));
+  block += sizeof(sdcard_block_header_t) + SDCARD_frame_used;
+  memset(block, PADDING_BYTE, SDCARD_BLOCK_RECORDS_LENGTH - SDCARD_frame_used);
+  block += SDCARD_BLOCK_RECORDS_LENGTH - SDCARD_frame_used;
+
+#if SDCARD_CRC
+  uint16_t crc = crc16_update(CRC16_INIT, block - SDCARD_BYTES_PER_BLOCK,
+                              SDCARD_BYTES_PER_BLOCK);
+
+  *block++ = (uint8_t) (crc >> 8);
+  *block++ = (uint8_t) crc;
+#else
   // Ignore the 16-bit CRC
-  spi_exchange_byte(JUNK_BYTE);
-  spi_exchange_byte(JUNK_BYTE);
+  *block++ = JUNK_BYTE;
+  *block++ = JUNK_BYTE;
+#endif
+
+  // Then clock in the data response
+  *block = JUNK_BYTE;
+
+  SDCARD_frames_head = (SDCARD_frames_head + 1) % SDCARD_POOL_FRAMES;
+
+  // The ISR may release a frame at the same time
+  cli();
+  queued = SDCARD_frames_queued + 1;
+  SDCARD_frames_queued = queued;
+  sei();
+
+  if (queued > SDCARD_frames_high_water) {
+    SDCARD_frames_high_water = queued;
+  }
+
+#if SDCARD_POOL_FRAMES == 1
+  if (!sdcard_wait_for_frame()) {
+    // It may have been sent before logging was disabled (e.g. the card is
+    // full), so its records aren't dropped
+    if (SDCARD_frames_queued == 0) {
+      sdcard_clear_frame();
+    }
+    return 0;
+  }
+#endif
+
+  sdcard_start_frame();
+
+  return 1;
+}
+
+/* Drops the records waiting to be written, once nothing more will be, and
+   leaves the frame being filled empty; not even an index record goes in it
+*/
+static void sdcard_drop_queued_frames(void) {
+  // Only a single frame may be queued with none being filled
+  uint8_t filling = SDCARD_frames_queued < SDCARD_POOL_FRAMES;
+
+  while (SDCARD_frames_queued > 0) {
+    SDCARD_records_dropped = SDCARD_records_dropped +
+                             SDCARD_frame_records[SDCARD_frames_tail];
+    SDCARD_frames_tail = (SDCARD_frames_tail + 1) % SDCARD_POOL_FRAMES;
+    SDCARD_frames_queued = SDCARD_frames_queued - 1;
+  }
+
+  if (filling) {
+    SDCARD_records_dropped = SDCARD_records_dropped +
+                             SDCARD_frame_records[SDCARD_frames_head];
+  }
+  sdcard_clear_frame();
+
+  return;
+}
+
+/* Returns where the data of the next record goes in the frame being filled,
+   and sets available to how many bytes of data will fit there.
+*/
+static uint8_t * sdcard_record_space(uint16_t * available) {
+  uint16_t used = SDCARD_frame_used + sizeof(sdcard_record_header_t);
+
+  *available = (used < SDCARD_BLOCK_RECORDS_LENGTH) ?
+               SDCARD_BLOCK_RECORDS_LENGTH - used : 0;
+
+  return SDCARD_frames[SDCARD_frames_head] + 1 +
+         sizeof(sdcard_block_header_t) + used;
+}
+
+/* Adds the header of a record whose data is already in place to the frame
+   being filled, and adds the record to the block's CRC
+*/
+static void sdcard_commit_record(uint8_t type, uint8_t length) {
+  uint8_t * record = SDCARD_frames[SDCARD_frames_head] + 1 +
+                     sizeof(sdcard_block_header_t) + SDCARD_frame_used;
+  uint16_t record_length = sizeof(sdcard_record_header_t) + length;
+
+  record[0] = type;
+  record[1] = length;
+
+  SDCARD_frame_crc = crc32_update(SDCARD_frame_crc, record, record_length);
+  SDCARD_frame_used = SDCARD_frame_used + record_length;
+  SDCARD_frame_records[SDCARD_frames_head] =
+    SDCARD_frame_records[SDCARD_frames_head] + 1;
+
+  return;
+}
+
+/* Returns where the data of a record of length bytes goes, in the frame
+   being filled or, if it doesn't fit there, in the next one. Returns NULL
+   if the record was dropped.
+*/
+static uint8_t * sdcard_reserve_record(uint8_t length) {
+  uint16_t available;
+
+  // Records aren't split across blocks
+  sdcard_record_space(&available);
+  if (length > available && !sdcard_seal_frame()) {
+    SDCARD_records_dropped = SDCARD_records_dropped + 1;
+    return NULL;
+  }
 
-  if (spi_exchange_byte(JUNK_BYTE) != 0xE5) {
+  return sdcard_record_space(&available);
+}
+
+uint8_t sdcard_write_record(uint8_t type, const void * data, uint8_t length) {
+  uint8_t * space;
+
+  if (!SDCARD_enabled) {
+    return 0;
+  }
+
+  space = sdcard_reserve_record(length);
+  if (space == NULL) {
+    return 0;
+  }
+
+  memcpy(space, data, length);
+  sdcard_commit_record(type, length);
+
+  return 1;
+}
+
+/* Logs the statevars as a delta from the previous snapshot, or as a
+   keyframe at the start of each block so that every block can be decoded
+   on its own. Returns 1 if successful; 0 otherwise.
+*/
+static uint8_t sdcard_write_statevars(void) {
+  uint16_t available;
+  uint8_t * space = sdcard_record_space(&available);
+  uint8_t length = 0;
+  uint8_t kind;
+
+  if (!SDCARD_enabled) {
+    return 0;
+  }
+
+  if (SDCARD_frame_has_keyframe && available > 0) {
+    length = log_delta_encode(&SDCARD_delta, &statevars, 0, space,
+                              (available < 0xFF) ? available : 0xFF, &kind);
+  }
+
+  // Otherwise a keyframe, in a new block if it doesn't fit in this one
+  if (length == 0) {
+    if (available < sizeof(statevars_t)) {
+      if (!sdcard_seal_frame()) {
+        SDCARD_records_dropped = SDCARD_records_dropped + 1;
+        return 0;
+      }
+
+      space = sdcard_record_space(&available);
+    }
+
+    length = log_delta_encode(&SDCARD_delta, &statevars, 1, space,
+                              sizeof(statevars_t), &kind);
+  }
+
+  if (kind == LOG_DELTA_KEYFRAME) {
+    sdcard_commit_record(SDCARD_RECORD_STATEVARS, length);
+    SDCARD_frame_has_keyframe = 1;
+  } else {
+    sdcard_commit_record(SDCARD_RECORD_STATEVARS_DELTA, length);
+  }
+
+  return 1;
+}
+
+void sdcard_write_data(void) {
+  sdcard_write_statevars();
+
+  // Also sends a pending stop token once logging has been disabled
+  sdcard_flush();
+
+  return;
+}
+
+/* Logs the schema of every channel. Returns 1 if successful; 0 otherwise. */
+static uint8_t sdcard_write_schema(void) {
+  uint8_t id;
+
+  for (id = 0; id < log_channel_count(); id++) {
+    uint8_t length = log_channel_schema_length(log_channel_get(id));
+    uint8_t * space = sdcard_reserve_record(length);
+
+    if (space == NULL) {
+      return 0;
+    }
+
+    log_channel_encode_schema(id, space);
+    sdcard_commit_record(SDCARD_RECORD_SCHEMA, length);
+  }
+
+  return 1;
+}
+
+void sdcard_write_channels(void) {
+  uint8_t id;
+
+  // Until the schema is in the log, the channels' records couldn't be
+  // decoded; they're left to be logged with it next time
+  if (SDCARD_enabled && SDCARD_schema_pending) {
+    SDCARD_schema_pending = !sdcard_write_schema();
+  }
+
+  if (SDCARD_enabled && !SDCARD_schema_pending) {
+    for (id = 0; id < log_channel_count(); id++) {
+      if (!log_channel_take_published(id)) {
+        continue;
+      }
+
+      const log_channel_t * channel = log_channel_get(id);
+      uint8_t * space = sdcard_reserve_record(1 + channel->length);
+
+      if (space != NULL) {
+        *space = id;
+        memcpy(space + 1, channel->data, channel->length);
+        sdcard_commit_record(SDCARD_RECORD_CHANNEL, 1 + channel->length);
+      }
+    }
+  }
+
+  sdcard_flush();
+
+  return;
+}
+
+void sdcard_flush(void) {
+  // Only one block can be on its way at a time
+  if (spi_transfer_is_busy()) {
+    return;
+  }
+
+  if (SDCARD_stop_pending) {
+    SDCARD_stop_pending = 0;
+
+    // The stop token only ends a multi-block write; logging may have been
+    // disabled between sessions, e.g. during a journal step
+    if (!SDCARD_writing || sdcard_stop_write_session()) {
+      sdcard_write_journal();
+    }
+
+    // Nothing more will be written, so close the file
+    sdcard_drop_queued_frames();
+    sdcard_finalize_log_file();
+  }
+
+  // Once logging is disabled, records are dropped only the once
+  if (!SDCARD_enabled) {
+    if (SDCARD_frames_queued > 0 || SDCARD_frame_used > 0) {
+      sdcard_drop_queued_frames();
+    }
+    return;
+  }
+
+  // Nothing more is sent while the card is programming; try again later.
+  // It's polled even with nothing to send, to time how long it takes.
+  if (!sdcard_poll_ready()) {
+    return;
+  }
+
+  // With nothing to send, there's time to erase ahead of the log
+  if (SDCARD_frames_queued == 0) {
+    sdcard_erase_ahead();
+    return;
+  }
+
+  // The block at the tail was rejected; the write is ended on this call,
+  // and a new one started with it on the next
+  if (SDCARD_resend_pending) {
+    SDCARD_resend_pending = 0;
+
+    if (!sdcard_end_write_session()) {
+      SDCARD_enabled = 0;
+    }
+    return;
+  }
+
+  // Every so often the write is interrupted to bring the journal up to
+  // date. Each step leaves the card busy, so the session is closed on one
+  // call, the entry is written on a later one, and the next session is
+  // started on a later one still.
+  if (SDCARD_next_block - SDCARD_journal.next_block >=
+      SDCARD_JOURNAL_INTERVAL) {
+    if (SDCARD_writing ? !sdcard_end_write_session() :
+        !sdcard_send_journal()) {
+      SDCARD_enabled = 0;
+    }
+    return;
+  }
+
+  if (!SDCARD_writing && !sdcard_start_write_session()) {
     SDCARD_enabled = 0;
     return;
-  }  
+  }
 
-  //----- DEBUG
-  uwrite_print_buff("Done!\r\n");
-  //----- DEBUG
+  if (!spi_start_transfer(SDCARD_frames[SDCARD_frames_tail],
+                          SDCARD_BLOCK_FRAME_LENGTH,
+                          sdcard_block_sent, sdcard_block_failed)) {
+    SDCARD_enabled = 0;
+    SDCARD_stop_pending = 1;
+  }
+
+  return;
+}
+
+void sdcard_mark_loop(uint32_t loop_counter, uint32_t gps_time_ms) {
+  if (SDCARD_card_busy) {
+    SDCARD_busy_loops = SDCARD_busy_loops + 1;
+  }
+
+  SDCARD_index.loop_counter = loop_counter;
+  SDCARD_index.gps_time_ms = gps_time_ms;
+
+  if (!SDCARD_loop_marked) {
+    SDCARD_summary.first_loop_counter = loop_counter;
+    SDCARD_summary.first_gps_time_ms = gps_time_ms;
+    SDCARD_loop_marked = 1;
+  }
 
   return;
 }
 
+uint8_t sdcard_finish(void) {
+  // The card was never initialized
+  if (SDCARD_journal.magic != SDCARD_JOURNAL_MAGIC) {
+    return 0;
+  }
+
+  // Write out everything that's queued, including the records of the frame
+  // still being filled
+  while (SDCARD_enabled && SDCARD_frames_queued > 0) {
+    sdcard_flush();
+  }
+  if (SDCARD_enabled && SDCARD_frame_used > 0 && sdcard_seal_frame()) {
+    while (SDCARD_enabled && SDCARD_frames_queued > 0) {
+      sdcard_flush();
+    }
+  }
+
+  // Then the summary of the session, in a block of its own (after the
+  // index record, if the block has one)
+  if (SDCARD_enabled) {
+    SDCARD_summary.last_sequence = SDCARD_block_sequence;
+    SDCARD_summary.last_loop_counter = SDCARD_index.loop_counter;
+    SDCARD_summary.last_gps_time_ms = SDCARD_index.gps_time_ms;
+    SDCARD_summary.records_dropped = SDCARD_records_dropped;
+
+    if (sdcard_write_record(SDCARD_RECORD_SUMMARY, &SDCARD_summary,
+                            sizeof(sdcard_session_summary_t)) &&
+        sdcard_seal_frame()) {
+      while (SDCARD_enabled && SDCARD_frames_queued > 0) {
+        sdcard_flush();
+      }
+    }
+  }
+
+  // Let the block in progress finish first
+  while (spi_transfer_is_busy()) {}
+
+  SDCARD_stop_pending = 0;
+
+  // Whatever is still queued once logging was disabled won't be written,
+  // though no flush since may have dropped it
+  if (!SDCARD_enabled &&
+      (SDCARD_frames_queued > 0 || SDCARD_frame_used > 0)) {
+    sdcard_drop_queued_frames();
+  }
+
+  if (SDCARD_writing && !sdcard_stop_write_session()) {
+    return 0;
+  }
+
+  // Record where the next session should start, then close the file
+  if (!sdcard_write_journal()) {
+    return 0;
+  }
+
+  return sdcard_finalize_log_file();
+}
+
+uint8_t * sdcard_block_buffer(void) {
+  return SDCARD_frames[0];
+}
+
+uint8_t sdcard_frames_high_water(void) {
+  return SDCARD_frames_high_water;
+}
+
+uint32_t sdcard_records_dropped(void) {
+  return SDCARD_records_dropped;
+}
+
+uint32_t sdcard_crc_errors(void) {
+  return SDCARD_crc_errors;
+}
+
+uint32_t sdcard_erased_block(void) {
+  return SDCARD_erased_block;
+}
+
+uint32_t sdcard_busy_histogram(uint8_t bucket) {
+  if (bucket >= SDCARD_BUSY_BUCKETS) {
+    return 0;
+  }
+
+  return SDCARD_busy_histogram[bucket];
+}
@@ -43,6 +43,7 @@
 #define SDARG_READ_OCR            0x0
 #define SDSFX_READ_OCR            0x1 //CRC doesn't matter, just 0b1
 #define SDRES_READ_OCR            0x0
+#define SDRES_OCR_CCS             0x40 //of the OCR's top byte; high capacity
 
 #define SDCMD_SEND_CSD            0x9 //CMD9; gets R1 response (Table 7-3)
 #define SDARG_SEND_CSD            0X0
@@ -51,16 +52,50 @@
 #define SDCMD_READ_SINGLE_BLOCK   0x11 //CMD17; gets R1 response
 #define SDSFX_READ_SINGLE_BLOCK   0x0
 
+#define SDCMD_READ_MULTIPLE_BLOCK 0x12 //CMD18; gets R1 response
+#define SDSFX_READ_MULTIPLE_BLOCK 0x1 //CRC doesn't matter, just 0b1
+
+#define SDCMD_STOP_TRANSMISSION   0xC //CMD12; gets R1b response
+#define SDARG_STOP_TRANSMISSION   0x0
+#define SDSFX_STOP_TRANSMISSION   0x1 //CRC doesn't matter, just 0b1
+
 #define SDCMD_WRITE_BLOCK         0x18 //CMD24; gets R1 response
 #define SDSFX_WRITE_BLOCK         0x0
 
+#define SDCMD_WRITE_MULTIPLE_BLOCK  0x19 //CMD25; gets R1 response
+#define SDSFX_WRITE_MULTIPLE_BLOCK  0x1 //CRC doesn't matter, just 0b1
+
+#define SDCMD_SET_WR_BLK_ERASE_COUNT  0x17 //ACMD23; gets R1 response
+#define SDSFX_SET_WR_BLK_ERASE_COUNT  0x1 //CRC doesn't matter, just 0b1
+#define SDRES_SET_WR_BLK_ERASE_COUNT  0x0
+
+#define SDCMD_ERASE_WR_BLK_START  0x20 //CMD32; gets R1 response
+#define SDSFX_ERASE_WR_BLK_START  0x1 //CRC doesn't matter, just 0b1
+
+#define SDCMD_ERASE_WR_BLK_END    0x21 //CMD33; gets R1 response
+#define SDSFX_ERASE_WR_BLK_END    0x1 //CRC doesn't matter, just 0b1
+
+#define SDCMD_ERASE               0x26 //CMD38; gets R1b response
+#define SDARG_ERASE               0x0
+#define SDSFX_ERASE               0x1 //CRC doesn't matter, just 0b1
+
+#define SDCMD_CRC_ON_OFF          0x3B //CMD59; gets R1 response
+#define SDARG_CRC_ON_OFF          0x1 //bit 0 turns CRC checking on
+#define SDSFX_CRC_ON_OFF          0x83
+#define SDRES_CRC_ON_OFF          0x0
+
 #define SDCMD_SEND_STATUS         0xD //CMD13
 #define SDRES_DATA_ACCEPTED       0x2
 #define SDRES_DATA_REJECT_CRC     0x5
 #define SRES_DATA_REJECT_WRITE    0x6
+// The data response token is xxx0sss1, where sss is one of the above
+#define SDRES_DATA_RESPONSE_MASK  0x1F
+#define SDRES_DATA_RESPONSE(sss)  (((sss) << 1) | 0x1)
 ////////////////////////////////////////////////////////////////////////////////
 // Other Constants
 #define SDCARD_BYTES_PER_BLOCK    512
+#define SDCARD_BLOCK_FRAME_LENGTH (1 + SDCARD_BYTES_PER_BLOCK + 2 + 1)
+                                       // token, block, CRC, data response
 #define SDCARD_CMD_MASK_HEAD      0b01000000 // used to shape card commands
 #define SDCARD_CMD_MASK_TAIL      0b00111111
 #define HIGH_BYTE                 0xFF // used to force MOSI high during init
@@ -71,8 +106,157 @@
 #define MS_BIT                    0x80
 #define LS_BIT                    0x01
 #define START_TOKEN               0xFE
+#define WRITE_MULTIPLE_TOKEN      0xFC // starts each block of a CMD25 write
+#define STOP_TRAN_TOKEN           0xFD // ends a CMD25 write
+#define SDCARD_BUSY_POLL_LIMIT    0xFFFF // ~300 ms at 2 MHz; cards may take
+                                         // 250 ms to program a block
 #define PADDING_BYTE              0xAA // used to pad a block; just in case
 
+////////////////////////////////////////////////////////////////////////////////
+// Log Format
+// Each block of the log starts with a header, followed by records packed
+// back to back. A record is a type and length, then length bytes of data;
+// records aren't split across blocks. The rest of the block is padding.
+// The header's CRC-32 covers the records from when they were logged, so a
+// decoder can tell a block that was corrupted anywhere on the way.
+#define SDCARD_BLOCK_MAGIC        0xDADAC0DE // marks a block of the log
+// Starts the blocks of the earlier formats: the raw statevars snapshots
+// (whose prefix it is, as in cmps_log_demo and the other demos), and the
+// blocks of records whose header had a CRC-16. Resuming skips over these
+// as well, rather than log over them.
+#define SDCARD_BLOCK_MAGIC_V1     0xDADAFEED
+#define SDCARD_BLOCK_RECORDS_LENGTH \
+  (SDCARD_BYTES_PER_BLOCK - sizeof(sdcard_block_header_t))
+
+// Record types
+#define SDCARD_RECORD_STATEVARS   0x01 // a keyframe of the statevars
+#define SDCARD_RECORD_STATEVARS_DELTA 0x02 // see log_delta.h
+#define SDCARD_RECORD_SCHEMA      0x03 // see log_channel.h
+#define SDCARD_RECORD_CHANNEL     0x04 // the id, then the channel's data
+#define SDCARD_RECORD_INDEX       0x05 // sdcard_index_t
+#define SDCARD_RECORD_SUMMARY     0x06 // sdcard_session_summary_t
+
+// The blocks between those that start with an index record. The first
+// block of each session has one too, so a decoder can binary-search the
+// log for a loop or a GPS time without reading every block.
+#ifndef SDCARD_INDEX_INTERVAL
+#define SDCARD_INDEX_INTERVAL     16
+#endif
+
+typedef struct {
+  uint32_t magic;           // SDCARD_BLOCK_MAGIC
+  uint32_t sequence;        // the blocks logged before this one
+  uint16_t used;            // bytes of records that follow
+  uint32_t crc;             // CRC-32 (see crc.h) of them
+} sdcard_block_header_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t length;           // bytes of data that follow
+} sdcard_record_header_t;
+
+typedef struct {
+  uint32_t session;         // as in the journal
+  uint32_t loop_counter;    // as of the start of the block
+  uint32_t gps_time_ms;     // since midnight, UTC
+  uint16_t interval;        // SDCARD_INDEX_INTERVAL
+} sdcard_index_t;
+
+// Logged alone in the last block of a session by sdcard_finish()
+typedef struct {
+  uint32_t session;
+  uint32_t first_sequence;  // of the session's first block
+  uint32_t last_sequence;   // of this block
+  uint32_t first_loop_counter;
+  uint32_t last_loop_counter;
+  uint32_t first_gps_time_ms;
+  uint32_t last_gps_time_ms;
+  uint32_t records_dropped;
+} sdcard_session_summary_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Journal
+// The first blocks of the card (or of the log file in FAT32 mode) hold a
+// journal that says where logging should resume. Each entry is written to
+// the next of its blocks in turn, so the newest entry is the valid one with
+// the highest sequence number.
+#define SDCARD_JOURNAL_BLOCKS     8
+#define SDCARD_LOG_FIRST_BLOCK    SDCARD_JOURNAL_BLOCKS
+#define SDCARD_JOURNAL_MAGIC      0x4C4E524AUL // "JRNL"
+#define SDCARD_JOURNAL_INTERVAL   64   // blocks logged between entries
+#define SDCARD_RESUME_SCAN_LIMIT  (2 * SDCARD_JOURNAL_INTERVAL)
+
+typedef struct {
+  uint32_t magic;
+  uint32_t sequence;        // one more than the previous entry's
+  uint32_t next_block;      // the blocks before it hold log frames
+  uint32_t session;         // counts the times the card was initialized
+  uint32_t session_start;   // the first block of this session
+  uint32_t check;           // ~sequence; guards against a torn entry
+} sdcard_journal_t;
+
+// The number of blocks in RAM: one being filled with records, and the rest
+// waiting to be written while the card is busy programming. With only the
+// one, the main loop waits for each block to be sent once it's full.
+// Each costs SDCARD_BLOCK_FRAME_LENGTH (516) bytes of RAM, on top of the
+// copy of the statevars the deltas are taken from (sizeof(statevars_t)):
+//  atmega328p (2 KB):  1 frame,  516 bytes
+//  atmega2560 (8 KB):  4 frames, 2064 bytes
+#ifndef SDCARD_POOL_FRAMES
+#if defined(__AVR_ATmega2560__)
+#define SDCARD_POOL_FRAMES        4
+#else
+#define SDCARD_POOL_FRAMES        1
+#endif
+#endif
+
+// Set to 1 to log into a preallocated file (see fat32.h) on a FAT32 card,
+// rather than to the raw blocks from the start of the card
+#ifndef SDCARD_FAT32
+#define SDCARD_FAT32              0
+#endif
+
+// Set to 1 to have the card check the CRC of every command (CMD59) and
+// data block, rather than ignore them. Costs about 1.5 ms of CPU per
+// block, to work out its CRC when it's queued, and the same to check each
+// block read.
+#ifndef SDCARD_CRC
+#define SDCARD_CRC                0
+#endif
+
+// A block the card rejects (for its CRC, or a write error) is sent again,
+// in a new write session, up to this many times in a row before logging
+// is disabled
+#define SDCARD_WRITE_RETRIES      3
+
+// The number of blocks to ask the card to pre-erase (ACMD23) when a write
+// session starts; it's only a hint, and 0 skips it. Limited to the blocks
+// left on the card.
+#ifndef SDCARD_PRE_ERASE_BLOCKS
+#define SDCARD_PRE_ERASE_BLOCKS   0
+#endif
+
+// The number of blocks ahead of the log to keep erased (CMD32/33/38), so
+// the card doesn't have to erase them as they're written; 8192 is 4 MB,
+// and 0 turns it off. They're erased when the card is initialized, then
+// SDCARD_ERASE_CHUNK_BLOCKS at a time as the log catches up, whenever no
+// block is waiting to be written; the write is interrupted for it, as it
+// is for the journal. Limited to the blocks left on the card.
+#ifndef SDCARD_ERASE_AHEAD_BLOCKS
+#define SDCARD_ERASE_AHEAD_BLOCKS 0
+#endif
+#define SDCARD_ERASE_CHUNK_BLOCKS 128 // 64 KB, an SDHC card's erase sector
+
+// How long the card takes to program each block is counted in loops
+// marked (see sdcard_mark_loop()) before the main loop finds it ready, in
+// buckets of powers of two: 0, 1, 2-3, 4-7 ... with the last holding the
+// rest. A card that's always done by the next loop keeps up with the log;
+// counts beyond bucket 1 are loops that the log was held up by the card.
+#define SDCARD_BUSY_BUCKETS       8
+
+// Called with each byte of a block as it's read (see sdcard_read_next())
+typedef void (*sdcard_read_callback_t)(uint8_t byte);
+
 ////////////////////////////////////////////////////////////////////////////////
 // Functions
 
@@ -82,6 +266,16 @@ void spi_init(void);
 /* Initializes the SD card to run in SPI mode. */
 void sdcard_init(void);
 
+/* Initializes the SD card as sdcard_init() does, to read the log back
+   rather than to log: finds the end of the log without starting a session
+   or writing to the card (unless a FAT32 log file has to be made). Sets
+   first_block to the first block of the journal, log_first_block to the
+   first of the log, and end_block to the block after the last one logged.
+   Returns 1 if successful; 0 otherwise.
+*/
+uint8_t sdcard_open_log(uint32_t * first_block, uint32_t * log_first_block,
+                        uint32_t * end_block);
+
 /* Returns 1 if logging is enabled; 0 otherwise */
 uint8_t sdcard_is_enabled(void);
 
@@ -90,8 +284,113 @@ uint8_t sdcard_is_enabled(void);
 */
 uint8_t sdcard_read_block(uint32_t block_address, void * block_buff);
 
-/* Writes the next chunk of data to the SD card */
+/* Reads the first length bytes of the block at the specified address into
+   buff and skips the rest, quietly. Returns 1 if successful; 0 otherwise.
+*/
+uint8_t sdcard_read_block_start(uint32_t block_address, void * buff,
+                                uint16_t length);
+
+/* Starts reading the blocks from the specified address on, in a single
+   multi-block read (CMD18), so each block costs only the wait for its
+   data token rather than a command as well. Must not be used while
+   logging. Returns 1 if successful; 0 otherwise.
+*/
+uint8_t sdcard_read_start(uint32_t block_address);
+
+/* Receives the next block of the read started by sdcard_read_start(). Each
+   byte is stored in block_buff, and passed to on_byte as it arrives, so a
+   block can be streamed on without room for all of it; either may be
+   NULL. Returns 1 if successful; 0 if the card sent an error token or
+   none at all, or (in CRC mode) the block failed its CRC, after its bytes
+   were passed on. The read carries on with the next block in any case.
+*/
+uint8_t sdcard_read_next(void * block_buff, sdcard_read_callback_t on_byte);
+
+/* Ends the read started by sdcard_read_start() (CMD12) and waits for the
+   card to be ready. Returns 1 if successful; 0 otherwise.
+*/
+uint8_t sdcard_read_stop(void);
+
+/* Writes block_buff to the block at the specified address and waits for
+   the card to program it. Must not be used while logging. Returns 1 if
+   successful; 0 otherwise.
+*/
+uint8_t sdcard_write_block(uint32_t block_address, const void * block_buff);
+
+/* Adds a record of length bytes of data to the log. It's copied into the
+   block being filled, which is queued to be written once the next record
+   doesn't fit. Returns 1 if successful; 0 if logging is disabled or the
+   record was dropped because every block of the pool was queued.
+*/
+uint8_t sdcard_write_record(uint8_t type, const void * data, uint8_t length);
+
+/* Logs a snapshot of the statevars as a record, then calls sdcard_flush().
+   The first snapshot in each block is a keyframe, so that every block can
+   be decoded on its own; the rest are deltas from the one before.
+*/
 void sdcard_write_data(void);
 
+/* Logs a record of each channel (see log_channel.h) that has been
+   published since its last one, then calls sdcard_flush(). The schema of
+   every channel is logged first, once per session, so channels should be
+   registered before this is first called.
+*/
+void sdcard_write_channels(void);
+
+/* Notes the loop that's being logged and the time of the latest GPS fix,
+   in ms since midnight (UTC), for the index and the session summary, and
+   counts the loop towards the card's busy time. Call once per loop, before
+   logging its records.
+*/
+void sdcard_mark_loop(uint32_t loop_counter, uint32_t gps_time_ms);
+
+/* Starts sending the oldest queued block if the card is ready for it,
+   and returns without waiting. The first block starts a multi-block write
+   (CMD25) that stays open, so each block costs only its data token and
+   transfer; the block is clocked out by the SPI ISR and the card programs
+   it while the main loop runs. Whether it's done is checked with a single
+   poll, so a slow card holds up the log rather than the loop. The journal
+   is brought up to date in the same way, a step per call, and so are the
+   blocks ahead of the log erased, when nothing is waiting to be written.
+   May be called again while the main loop has time to spare, to catch up
+   after the card has been slow. The session is closed (and logging
+   disabled) when the card is full or keeps rejecting a block (see
+   SDCARD_WRITE_RETRIES).
+*/
+void sdcard_flush(void);
+
+/* Writes out the queued records and a block with the summary of the
+   session, closes the write session, if one is open, and waits for the
+   card to finish programming. Call before removing power. Returns 1 if
+   successful; 0 otherwise.
+*/
+uint8_t sdcard_finish(void);
+
+/* Returns a block of RAM to read into, once logging is done with
+   sdcard_finish(), rather than one on the stack
+*/
+uint8_t * sdcard_block_buffer(void);
+
+/* Returns the most full blocks that have been waiting to be written */
+uint8_t sdcard_frames_high_water(void);
+
+/* Returns the number of records that were never written */
+uint32_t sdcard_records_dropped(void);
+
+/* Returns the number of blocks that failed their CRC in CRC mode: those
+   read, and those the card rejected
+*/
+uint32_t sdcard_crc_errors(void);
+
+/* Returns the block after those erased ahead of the log so far (see
+   SDCARD_ERASE_AHEAD_BLOCKS)
+*/
+uint32_t sdcard_erased_block(void);
+
+/* Returns the number of blocks the card took as long as the specified
+   bucket (see SDCARD_BUSY_BUCKETS) to program
+*/
+uint32_t sdcard_busy_histogram(uint8_t bucket);
+
 #endif /* _SD_CARD_H_ */
 
@@ -0,0 +1,84 @@
+/*
+ * File: spi.c
+ */
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <stddef.h>
+#include "spi.h"
+
+static const uint8_t * volatile SPI_transfer_buff;
+static volatile uint16_t SPI_transfer_length;
+static volatile uint16_t SPI_transfer_index;
+static volatile uint8_t SPI_transfer_busy;
+static spi_done_callback_t SPI_on_done;
+static spi_error_callback_t SPI_on_error;
+
+/* Sends the next byte of the transfer each time an exchange completes */
+ISR(SPI_STC_vect) {
+  // Reading SPDR after SPSR clears the WCOL flag
+  uint8_t status = SPSR;
+  uint8_t received = SPDR;
+
+  if (status & (1 << WCOL)) {
+    SPCR &= ~(1 << SPIE);
+    SPI_transfer_busy = 0;
+
+    if (SPI_on_error != NULL) {
+      SPI_on_error();
+    }
+
+    return;
+  }
+
+  uint16_t index = SPI_transfer_index;
+
+  if (index < SPI_transfer_length) {
+    SPDR = SPI_transfer_buff[index];
+    SPI_transfer_index = index + 1;
+
+    return;
+  }
+
+  // The last byte has been exchanged
+  SPCR &= ~(1 << SPIE);
+  SPI_transfer_busy = 0;
+
+  if (SPI_on_done != NULL) {
+    SPI_on_done(received);
+  }
+}
+
+uint8_t spi_exchange_byte(uint8_t byte) {
+  SPDR = byte;
+
+  // Wait until byte exchange is complete. This is indicated when the SPIF
+  // flag is set.
+  while (!(SPSR & (1 << SPIF))) {}
+
+  return SPDR;
+}
+
+uint8_t spi_start_transfer(const uint8_t * buff, uint16_t length,
+                           spi_done_callback_t on_done,
+                           spi_error_callback_t on_error) {
+  if (SPI_transfer_busy || length == 0) {
+    return 0;
+  }
+
+  SPI_transfer_buff = buff;
+  SPI_transfer_length = length;
+  SPI_transfer_index = 1;
+  SPI_on_done = on_done;
+  SPI_on_error = on_error;
+  SPI_transfer_busy = 1;
+
+  // The first byte is sent here; the ISR sends the rest
+  SPDR = buff[0];
+  SPCR |= (1 << SPIE);
+
+  return 1;
+}
+
+uint8_t spi_transfer_is_busy(void) {
+  return SPI_transfer_busy;
+}
@@ -0,0 +1,42 @@
+/*
+ * File: spi.h
+ *
+ * Byte-at-a-time SPI exchanges, plus a transfer engine that clocks a whole
+ * buffer out in the background from the SPI Serial Transfer Complete
+ * interrupt. Only one transfer may be in progress, and spi_exchange_byte()
+ * must not be used until it has finished.
+ */
+#ifndef _SPI_H_
+#define _SPI_H_
+
+#include <stdint.h>
+
+/* Called from the ISR when the last byte has been exchanged. received is
+   the byte the device sent in exchange for it.
+*/
+typedef void (*spi_done_callback_t)(uint8_t received);
+
+/* Called from the ISR when a transfer is abandoned, because SPDR was
+   written mid-exchange (WCOL)
+*/
+typedef void (*spi_error_callback_t)(void);
+
+/* Sends the specified byte on the SPI output.
+   Assumes that the target device was already selected.
+   Returns the byte received in exchange.
+*/
+uint8_t spi_exchange_byte(uint8_t byte);
+
+/* Starts sending the length bytes at buff in the background. buff must not
+   change until one of the callbacks has been called. Either callback may
+   be NULL. Returns 1 if the transfer was started; 0 if one is already in
+   progress or length is 0.
+*/
+uint8_t spi_start_transfer(const uint8_t * buff, uint16_t length,
+                           spi_done_callback_t on_done,
+                           spi_error_callback_t on_error);
+
+/* Returns 1 while a transfer is in progress; 0 otherwise */
+uint8_t spi_transfer_is_busy(void);
+
+#endif /* _SPI_H_ */
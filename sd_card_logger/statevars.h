@@ -4,6 +4,14 @@
 #ifndef _STATEVARS_H_
 #define _STATEVARS_H_
 
+// avr-gcc's double is 4 bytes; host builds (sd_card_sim) use a float in its
+// place, so that the snapshots they log are laid out as the AVR's are
+#ifdef __AVR__
+typedef double statevars_double_t;
+#else
+typedef float statevars_double_t;
+#endif
+
 typedef struct {
     uint32_t prefix;
     uint32_t unsigned_long;
@@ -11,7 +19,7 @@ typedef struct {
     uint8_t  unsigned_byte;
     char     sentence[84];
     float    float_value;
-    double   double_value;
+    statevars_double_t double_value;
     int8_t   signed_byte;
     int16_t  signed_short;
     int32_t  signed_long;
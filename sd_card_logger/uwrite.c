@@ -1,5 +1,7 @@
 #include <avr/interrupt.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <inttypes.h>
 #include <stdio.h>
 
 #include "uwrite.h"
@@ -9,6 +11,23 @@
 static uint8_t uwrite_initialized;
 static char buffer[BUFF_SIZE];
 
+// Bytes received (once uwrite_init_fast() has enabled the receiver) that
+// haven't been read yet
+static volatile uint8_t rx_buffer[RX_BUFF_SIZE];
+static volatile uint8_t rx_head;
+static volatile uint8_t rx_tail;
+
+ISR(USART_RX_vect) {
+    uint8_t byte = UDR0;
+    uint8_t next_head = (rx_head + 1) & (RX_BUFF_SIZE - 1);
+
+    // A byte that doesn't fit is dropped
+    if (next_head != rx_tail) {
+        rx_buffer[rx_head] = byte;
+        rx_head = next_head;
+    }
+}
+
 // TODO: Verify that the registers are set the way you expect them to be
 // in case some other library decides to change them.
 /* Configures the hardware to enable USART transmission and a baud rate
@@ -38,6 +57,36 @@ void uwrite_init(void) {
     return;
 }
 
+/* Configures the hardware to enable USART transmission and reception at
+ * 1 Mbps, the fastest rate that's exact at 16 MHz and that the Uno's USB
+ * serial bridge keeps up with. Bytes received are buffered by the ISR.
+ */
+void uwrite_init_fast(void) {
+    // Disable interrupts before configuring USART
+    cli();
+
+    // Double the speed, so the rate is f_osc / (8 * (UBRRn + 1))
+    UCSR0A = (1 << U2X0);
+
+    // Enable transmitting, and receiving with an interrupt per byte
+    UCSR0B = (1 << TXEN0) | (1 << RXEN0) | (1 << RXCIE0);
+
+    // Set baud rate to 1000000
+    // f_osc / (8 * (UBRRn + 1)) == 1000000
+    UBRR0H = 0;
+    UBRR0L = 1;
+
+    rx_head = 0;
+    rx_tail = 0;
+
+    // Re-enable interrupts after USART configuration is complete
+    sei();
+
+    uwrite_initialized = 1;
+
+    return;
+}
+
 /*
  * Prints a character buffer to the USART port.
  * Assumes the character buffer is null-terminated.
@@ -59,6 +108,29 @@ void uwrite_print_buff(char * char_buff) {
     return; 
 }
 
+/*
+ * Prints a character buffer in program memory (e.g. PSTR("...")) to the
+ * USART port, so that the string doesn't have to be copied into RAM.
+ * Assumes the character buffer is null-terminated.
+ *
+ * char_buff: a null-terminated character buffer in program memory
+ */
+void uwrite_print_buff_P(const char * char_buff) {
+    if (uwrite_initialized) {
+        char c;
+
+        while ((c = pgm_read_byte(char_buff)) != 0) {
+            // Wait until the transmit data register is ready
+            while TX_REG_NOT_READY() {;}
+
+            UDR0 = c;
+            char_buff++;
+        }
+    }
+
+    return;
+}
+
 /*
  * Prints a byte to the USART port as a hex value with a leading '0x'
  * followed by a carriage return and newline.
@@ -69,7 +141,7 @@ void uwrite_print_byte(void * a_byte) {
     if (uwrite_initialized) {
         char * char_ptr = buffer;
 
-        snprintf(buffer, BUFF_SIZE, "0x%02X\r\n", *((char *) a_byte));
+        snprintf_P(buffer, BUFF_SIZE, PSTR("0x%02X\r\n"), *((char *) a_byte));
         
         while (*char_ptr != 0) {
             while TX_REG_NOT_READY() {;}
@@ -92,7 +164,8 @@ void uwrite_print_short(void * a_short) {
     if (uwrite_initialized) {
         char * char_ptr = buffer;
 
-        snprintf(buffer, BUFF_SIZE, "0x%02X\r\n", *((uint16_t *) a_short));
+        snprintf_P(buffer, BUFF_SIZE, PSTR("0x%02X\r\n"),
+                   *((uint16_t *) a_short));
 
         while (*char_ptr != 0) {
             while TX_REG_NOT_READY() {;}
@@ -115,7 +188,8 @@ void uwrite_print_long(void * a_long) {
     if (uwrite_initialized) {
         char * char_ptr = buffer;
 
-        snprintf(buffer, BUFF_SIZE, "0x%02lX\r\n", *((uint32_t *) a_long));
+        snprintf_P(buffer, BUFF_SIZE, PSTR("0x%02" PRIX32 "\r\n"),
+                   *((uint32_t *) a_long));
 
         while (*char_ptr != 0) {
             while TX_REG_NOT_READY() {;}
@@ -127,3 +201,35 @@ void uwrite_print_long(void * a_long) {
 
     return;
 }
+
+/*
+ * Sends a byte to the USART port as it is.
+ *
+ * byte: the byte to send
+ */
+void uwrite_send_byte(uint8_t byte) {
+    if (uwrite_initialized) {
+        while TX_REG_NOT_READY() {;}
+
+        UDR0 = byte;
+    }
+
+    return;
+}
+
+/*
+ * Takes the oldest byte received from the USART port, if there is one.
+ * Returns 1 if a byte was stored in byte; 0 otherwise.
+ *
+ * byte: where to store the byte
+ */
+uint8_t uwrite_receive_byte(uint8_t * byte) {
+    if (rx_tail == rx_head) {
+        return 0;
+    }
+
+    *byte = rx_buffer[rx_tail];
+    rx_tail = (rx_tail + 1) & (RX_BUFF_SIZE - 1);
+
+    return 1;
+}
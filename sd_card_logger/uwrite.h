@@ -1,12 +1,19 @@
 #ifndef _UWRITE_H_
 #define _UWRITE_H_
 
+#include <stdint.h>
+
 #define BUFF_SIZE 16
+#define RX_BUFF_SIZE 32 // a power of two
 
 void uwrite_init(void);
+void uwrite_init_fast(void);
 void uwrite_print_buff(char * char_buff);
+void uwrite_print_buff_P(const char * char_buff);
 void uwrite_print_byte(void * a_byte);
 void uwrite_print_short(void * a_short);
 void uwrite_print_long(void * a_long);
+void uwrite_send_byte(uint8_t byte);
+uint8_t uwrite_receive_byte(uint8_t * byte);
 
 #endif
@@ -0,0 +1,48 @@
+/*
+ * File: logger_sim.cpp
+ */
+#include "logger.h"
+#include "logger_sim.h"
+
+globals_t globals;
+
+uint8_t logger_sim_init(void) {
+  init_logger();
+
+  return logger_enabled;
+}
+
+void logger_sim_start_log(uint32_t loop_counter) {
+  globals.start_bytes = GLOBAL_START;
+  globals.loop_counter = loop_counter;
+  globals.compass_raw = loop_counter % 3600;
+  globals.compass_deg = globals.compass_raw / 10.0;
+  globals.stop_bytes = GLOBAL_STOP;
+  set_padding(&globals);
+
+  start_log();
+
+  return;
+}
+
+uint8_t logger_sim_finish_log(void) {
+  finish_log();
+
+  return logger_enabled;
+}
+
+uint32_t logger_sim_next_block(void) {
+  return logger_next_block;
+}
+
+uint32_t logger_sim_busy_histogram(uint8_t bucket) {
+  return (bucket < LOGGER_BUSY_BUCKETS) ? logger_busy_histogram[bucket] : 0;
+}
+
+uint32_t logger_sim_deferred(void) {
+  return logger_deferred;
+}
+
+uint32_t logger_sim_crc_errors(void) {
+  return logger_crc_errors;
+}
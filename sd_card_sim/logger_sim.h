@@ -0,0 +1,45 @@
+/*
+ * File: logger_sim.h
+ *
+ * The logger of rd_headingsteerlog_demo (logger.h), built as C++ as the
+ * sketch is, with SPDR exchanging bytes with the simulated card
+ */
+#ifndef _LOGGER_SIM_H_
+#define _LOGGER_SIM_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Initializes the card. Returns 1 if logging is enabled; 0 otherwise. */
+uint8_t logger_sim_init(void);
+
+/* Starts logging the globals for a loop, as the sketch's loop() does */
+void logger_sim_start_log(uint32_t loop_counter);
+
+/* Finishes the loop's logging, as the sketch's loop() does once its work
+   is done. Returns 1 if logging is still enabled; 0 otherwise.
+*/
+uint8_t logger_sim_finish_log(void);
+
+/* Returns the block the next globals will be logged to */
+uint32_t logger_sim_next_block(void);
+
+/* Returns the number of blocks the card took as long as the specified
+   bucket (see LOGGER_BUSY_BUCKETS) to program
+*/
+uint32_t logger_sim_busy_histogram(uint8_t bucket);
+
+/* Returns the number of loops that weren't logged as the card was busy */
+uint32_t logger_sim_deferred(void);
+
+/* Returns the number of blocks read or sent with a bad CRC */
+uint32_t logger_sim_crc_errors(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LOGGER_SIM_H_ */
@@ -0,0 +1,631 @@
+/*
+ * File: main.c
+ *
+ * Runs a logger against a simulated SD card (see sdsim.h) for a number of
+ * sessions, each from power up, and reports for each:
+ *   - whether the card initialized, and where logging resumed
+ *   - the blocks logged, and the records dropped
+ *   - the bytes clocked on the SPI bus to start up, per loop and per block
+ *     logged, and how long that takes at 2 MHz
+ *   - how many loops the card took to program each block
+ *   - anything the card wouldn't have accepted
+ * then checks the log on the image: that the journal found every session,
+ * and that every block is in sequence and intact (against the CRC-32 that
+ * each logger gives its blocks). The log of sd_card.c is then decoded with
+ * sd_log_dump, which must rebuild every snapshot.
+ *
+ * sd_card.c is built as it is, over spi_sim.c in place of spi.c. With -L
+ * the logger of rd_headingsteerlog_demo (logger.h) is run instead. Both
+ * are built in CRC mode with make CRC=1.
+ *
+ * With -o, the card is then powered up once more with offload.c running,
+ * as if the offload button were held, on a pseudo-terminal for
+ * sd_log_offload to pull the log from. Its name is printed, and it's
+ * served until sd_log_offload has closed it for a second, so that it can
+ * be stopped and run again to carry on.
+ *
+ * Each session runs in a child process, so the logger starts from zeroed
+ * variables as it would after a reset, and only the image carries over.
+ * Structs are packed as avr-gcc packs them, and the statevars' double is a
+ * float here as it is there (see statevars.h), so that sd_log_dump and
+ * sd_log_export can read the image.
+ *
+ * Usage: sd_card_sim [options] image
+ */
+#define _GNU_SOURCE // for the pseudo-terminal
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "crc.h"
+#include "logger_sim.h"
+#include "offload.h"
+#include "sd_card.h"
+#include "sdsim.h"
+#include "spi_sim.h"
+#include "statevars.h"
+#include "uwrite_sim.h"
+
+#define DEFAULT_BLOCKS        16384   // 8 MB
+#define DEFAULT_LOOPS         4000    // 100 s at 40 Hz
+#define DEFAULT_SESSIONS      2
+#define LOOP_BYTE_TIMES       6250    // 25 ms at 2 MHz
+#define WORK_BYTE_TIMES       2500    // of the loop, between logger.h's
+                                      // start_log() and finish_log()
+#define BYTE_TIME_US          4.0     // at 2 MHz
+#define GLOBALS_START         0xBABECAFEUL
+#define GLOBALS_CRC_OFFSET    504     // of globals_t's CRC-32 of the rest
+#define BUSY_BUCKETS          8       // as SDCARD_ and LOGGER_BUSY_BUCKETS
+
+typedef struct {
+  uint32_t blocks;
+  uint32_t loops;
+  uint32_t sessions;
+  uint8_t  logger_h;          // run logger.h rather than sd_card.c
+  uint8_t  offload;           // then serve the log as offload.c does
+  uint32_t corrupt_serial;    // flip a bit of every nth byte offloaded
+  sdsim_t  card;              // as configured
+} scenario_t;
+
+statevars_t statevars;
+
+static sdsim_t * offload_card;  // reported on when the offload ends
+
+static int run_session(scenario_t * scenario, const char * path,
+                       uint32_t session);
+static void update_statevars(uint32_t loop);
+static void print_commands(const sdsim_stats_t * stats);
+static void read_journal(sdsim_t * card, sdcard_journal_t * journal);
+static int check_log(scenario_t * scenario, const char * path);
+static int decode_log(const char * path, uint32_t logged);
+static int run_offload(scenario_t * scenario, const char * path);
+static void report_offload(void);
+static void usage(const char * name);
+
+int main(int argc, char * argv[]) {
+  scenario_t scenario;
+  uint8_t truncate = 0;
+  const char * path;
+  uint32_t session;
+  int option;
+
+  memset(&scenario, 0, sizeof(scenario));
+  scenario.blocks = DEFAULT_BLOCKS;
+  scenario.loops = DEFAULT_LOOPS;
+  scenario.sessions = DEFAULT_SESSIONS;
+  scenario.card.present = 1;
+  scenario.card.response_delay = SDSIM_RESPONSE_DELAY;
+  scenario.card.read_delay = SDSIM_READ_DELAY;
+  scenario.card.init_polls = SDSIM_INIT_POLLS;
+  scenario.card.busy_time = SDSIM_BUSY_TIME;
+  scenario.card.erase_time = SDSIM_ERASE_TIME;
+  scenario.card.reject_response = SDSIM_DATA_WRITE_ERROR;
+
+  while ((option = getopt(argc, argv, "Lfb:n:s:B:G:g:r:ce:i:xou:")) != -1) {
+    switch (option) {
+    case 'L':
+      scenario.logger_h = 1;
+      break;
+    case 'f':
+      truncate = 1;
+      break;
+    case 'b':
+      scenario.blocks = strtoul(optarg, NULL, 0);
+      break;
+    case 'n':
+      scenario.loops = strtoul(optarg, NULL, 0);
+      break;
+    case 's':
+      scenario.sessions = strtoul(optarg, NULL, 0);
+      break;
+    case 'B':
+      scenario.card.busy_time = strtoul(optarg, NULL, 0);
+      break;
+    case 'G':
+      scenario.card.long_busy_time = strtoul(optarg, NULL, 0);
+      break;
+    case 'g':
+      scenario.card.long_busy_interval = strtoul(optarg, NULL, 0);
+      break;
+    case 'r':
+      scenario.card.reject_write = strtoul(optarg, NULL, 0);
+      break;
+    case 'c':
+      scenario.card.reject_response = SDSIM_DATA_CRC_ERROR;
+      break;
+    case 'e':
+      scenario.card.corrupt_write = strtoul(optarg, NULL, 0);
+      break;
+    case 'i':
+      scenario.card.init_polls = strtoul(optarg, NULL, 0);
+      break;
+    case 'x':
+      scenario.card.present = 0;
+      break;
+    case 'o':
+      scenario.offload = 1;
+      break;
+    case 'u':
+      scenario.corrupt_serial = strtoul(optarg, NULL, 0);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  path = argv[optind];
+
+  // The card's size is a whole number of C_SIZE units
+  scenario.blocks = (scenario.blocks + SDSIM_BLOCKS_PER_C_SIZE - 1) /
+                    SDSIM_BLOCKS_PER_C_SIZE * SDSIM_BLOCKS_PER_C_SIZE;
+  if (scenario.blocks == 0) {
+    scenario.blocks = SDSIM_BLOCKS_PER_C_SIZE;
+  }
+
+  sdsim_t card;
+  if (!sdsim_open(&card, path, scenario.blocks, truncate)) {
+    perror(path);
+    return 1;
+  }
+  sdsim_close(&card);
+
+  for (session = 1; session <= scenario.sessions; session++) {
+    fflush(stdout);
+
+    pid_t child = fork();
+    if (child < 0) {
+      perror("fork");
+      return 1;
+    }
+    if (child == 0) {
+      exit(run_session(&scenario, path, session));
+    }
+
+    int status;
+    if (waitpid(child, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "session %u failed\n", session);
+      return 1;
+    }
+  }
+
+  if (check_log(&scenario, path) != 0) {
+    return 1;
+  }
+
+  if (scenario.offload) {
+    return run_offload(&scenario, path);
+  }
+
+  return 0;
+}
+
+/* Powers up the card and the logger, logs the loops and reports. Returns 0
+   if successful; 1 if the image couldn't be opened.
+*/
+static int run_session(scenario_t * scenario, const char * path,
+                       uint32_t session) {
+  sdsim_t card;
+  sdcard_journal_t journal;
+  uint64_t init_bytes;
+  uint64_t log_bytes;
+  uint32_t blocks;
+  uint32_t loop;
+  uint8_t enabled;
+
+  if (!sdsim_open(&card, path, scenario->blocks, 0)) {
+    perror(path);
+    return 1;
+  }
+
+  // Configure the card as the scenario says
+  int fd = card.fd;
+  card = scenario->card;
+  card.fd = fd;
+  card.num_blocks = scenario->blocks;
+  sdsim_power_cycle(&card);
+  spi_sim_attach(&card);
+
+  printf("session %u:\n", session);
+
+  if (scenario->logger_h) {
+    enabled = logger_sim_init();
+  } else {
+    spi_init();
+    sdcard_init();
+    enabled = sdcard_is_enabled();
+  }
+
+  init_bytes = card.stats.bytes;
+  printf("  init: %s after %llu bytes, %u ACMD41s\n",
+         enabled ? "enabled" : "FAILED",
+         (unsigned long long) init_bytes,
+         card.stats.app_commands[41]);
+
+  if (!enabled) {
+    print_commands(&card.stats);
+    sdsim_close(&card);
+    return 0;
+  }
+
+  // The newest journal entry says where the session started
+  read_journal(&card, &journal);
+  printf("  resumed at block %u, session %u\n", journal.session_start,
+         journal.session);
+
+  // Each loop logs its records, then the rest of the loop period passes
+  for (loop = 0; loop < scenario->loops; loop++) {
+    if (scenario->logger_h) {
+      logger_sim_start_log(loop);
+      sdsim_advance(&card, WORK_BYTE_TIMES);
+      enabled = logger_sim_finish_log();
+    } else {
+      update_statevars(loop);
+      sdcard_mark_loop(loop, loop * 25);
+      sdcard_write_data();
+      enabled = sdcard_is_enabled();
+    }
+
+    spi_sim_run();
+    sdsim_advance(&card, scenario->logger_h ?
+                  LOOP_BYTE_TIMES - WORK_BYTE_TIMES : LOOP_BYTE_TIMES);
+
+    if (!enabled) {
+      printf("  logging disabled at loop %u\n", loop);
+      break;
+    }
+  }
+
+  // Then the records still queued, and the end of the session
+  if (!scenario->logger_h) {
+    if (!sdcard_finish()) {
+      printf("  finish: FAILED\n");
+    }
+    printf("  frame pool high water %u, records dropped %u\n",
+           sdcard_frames_high_water(), sdcard_records_dropped());
+    printf("  erased ahead of the log up to block %u\n",
+           sdcard_erased_block());
+
+    read_journal(&card, &journal);
+    blocks = journal.next_block - journal.session_start;
+  } else {
+    printf("  loops not logged while the card was busy: %u\n",
+           logger_sim_deferred());
+    blocks = logger_sim_next_block() - journal.session_start;
+  }
+  printf("  blocks that failed their CRC: %u\n", scenario->logger_h ?
+         logger_sim_crc_errors() : sdcard_crc_errors());
+
+  log_bytes = card.stats.bytes - init_bytes;
+
+  printf("  logged %u loops in %u blocks\n", loop, blocks);
+  printf("  SPI bytes while logging: %llu (%.1f per loop, %.1f per block), "
+         "%.0f us per loop at 2 MHz\n",
+         (unsigned long long) log_bytes,
+         loop ? (double) log_bytes / loop : 0.0,
+         blocks ? (double) log_bytes / blocks : 0.0,
+         loop ? log_bytes * BYTE_TIME_US / loop : 0.0);
+  printf("  polled while the card was busy: %llu bytes\n",
+         (unsigned long long) card.stats.busy_bytes);
+
+  uint8_t bucket;
+  printf("  blocks by loops busy:");
+  for (bucket = 0; bucket < BUSY_BUCKETS; bucket++) {
+    uint32_t count = scenario->logger_h ? logger_sim_busy_histogram(bucket) :
+                     sdcard_busy_histogram(bucket);
+
+    if (bucket < 2) {
+      printf(" %u:%u", bucket, count);
+    } else if (bucket < BUSY_BUCKETS - 1) {
+      printf(" %u-%u:%u", 1 << (bucket - 1), (1 << bucket) - 1, count);
+    } else {
+      printf(" %u+:%u", 1 << (bucket - 1), count);
+    }
+  }
+  printf("\n");
+  print_commands(&card.stats);
+
+  sdsim_close(&card);
+
+  return 0;
+}
+
+/* Changes the statevars as a loop of the robot would: a counter every
+   loop, a few values now and then
+*/
+static void update_statevars(uint32_t loop) {
+  statevars.prefix = 0xCAFEBABE;
+  statevars.unsigned_long = loop;
+  statevars.unsigned_short = loop / 4;
+  statevars.unsigned_byte = loop / 40;
+  statevars.float_value = (loop % 200) * 0.5f;
+  statevars.double_value = loop / 40.0;
+  statevars.signed_byte = -(int8_t) (loop % 100);
+  statevars.signed_short = -(int16_t) (loop / 10);
+  statevars.signed_long = -(int32_t) loop;
+  statevars.suffix = 0xFFFFFFFF;
+
+  if (loop % 40 == 0) {
+    snprintf(statevars.sentence, sizeof(statevars.sentence),
+             "$GPRMC,%06u.00,A,3855.0000,N,07700.0000,W,0.5,90.0,010125,,,A",
+             loop / 40);
+  }
+
+  return;
+}
+
+/* Prints how many of each command the card received, and what it didn't
+   accept
+*/
+static void print_commands(const sdsim_stats_t * stats) {
+  uint8_t app;
+  uint8_t index;
+
+  printf("  commands:");
+  for (app = 0; app <= 1; app++) {
+    for (index = 0; index < 64; index++) {
+      uint32_t count = app ? stats->app_commands[index] :
+                       stats->commands[index];
+
+      if (count > 0) {
+        printf(" %s x%u", sdsim_command_name(app, index), count);
+      }
+    }
+  }
+  printf("\n");
+
+  printf("  blocks read %u, written %u, rejected %u, erased %u\n",
+         stats->blocks_read, stats->blocks_written, stats->writes_rejected,
+         stats->blocks_erased);
+
+  if (stats->crc_errors > 0 || stats->data_crc_errors > 0 ||
+      stats->responses_cut_short > 0 || stats->protocol_errors > 0) {
+    printf("  CRC errors %u (commands) %u (blocks), responses cut short %u, "
+           "protocol errors %u\n", stats->crc_errors, stats->data_crc_errors,
+           stats->responses_cut_short, stats->protocol_errors);
+  }
+
+  return;
+}
+
+/* Finds the newest entry in the journal; it's zeroed if there isn't one.
+   Both loggers lay the journal out in the same way.
+*/
+static void read_journal(sdsim_t * card, sdcard_journal_t * journal) {
+  uint32_t address;
+
+  memset(journal, 0, sizeof(sdcard_journal_t));
+
+  for (address = 0; address < SDCARD_JOURNAL_BLOCKS; address++) {
+    uint8_t block[SDSIM_BLOCK_LENGTH];
+    sdcard_journal_t entry;
+
+    sdsim_read_image(card, address, block);
+    memcpy(&entry, block, sizeof(entry));
+
+    if (entry.magic == SDCARD_JOURNAL_MAGIC &&
+        entry.check == ~entry.sequence &&
+        entry.sequence > journal->sequence) {
+      *journal = entry;
+    }
+  }
+
+  return;
+}
+
+/* Checks the journal and every block of the log. Returns 0 if the log is
+   whole; 1 otherwise.
+*/
+static int check_log(scenario_t * scenario, const char * path) {
+  sdsim_t card;
+  uint8_t block[SDSIM_BLOCK_LENGTH];
+  sdcard_journal_t journal;
+  uint32_t address;
+  uint32_t logged = 0;
+  uint32_t bad = 0;
+  uint32_t end = SDCARD_LOG_FIRST_BLOCK;
+
+  if (!sdsim_open(&card, path, scenario->blocks, 0)) {
+    perror(path);
+    return 1;
+  }
+
+  read_journal(&card, &journal);
+
+  // The log runs up to the first block that isn't part of it
+  for (address = SDCARD_LOG_FIRST_BLOCK; address < card.num_blocks;
+       address++) {
+    uint32_t magic;
+
+    sdsim_read_image(&card, address, block);
+    memcpy(&magic, block, sizeof(magic));
+
+    if (scenario->logger_h) {
+      uint32_t crc;
+
+      if (magic != GLOBALS_START) {
+        break;
+      }
+
+      memcpy(&crc, block + GLOBALS_CRC_OFFSET, sizeof(crc));
+      if (crc != crc32_update(CRC32_INIT, block, GLOBALS_CRC_OFFSET)) {
+        bad = bad + 1;
+      }
+    } else {
+      sdcard_block_header_t header;
+
+      if (magic != SDCARD_BLOCK_MAGIC) {
+        break;
+      }
+
+      memcpy(&header, block, sizeof(header));
+      if (header.sequence != address - SDCARD_LOG_FIRST_BLOCK ||
+          header.used > SDCARD_BLOCK_RECORDS_LENGTH ||
+          header.crc != crc32_update(CRC32_INIT, block + sizeof(header),
+                                     header.used)) {
+        bad = bad + 1;
+      }
+    }
+
+    logged = logged + 1;
+    end = address + 1;
+  }
+
+  printf("log: %u blocks, %u bad; journal: session %u, next block %u\n",
+         logged, bad, journal.session, journal.next_block);
+
+  sdsim_close(&card);
+
+  // A session that failed to start leaves the journal behind
+  if (bad > 0 || journal.next_block > end ||
+      (scenario->card.present && journal.session != scenario->sessions)) {
+    printf("log check FAILED\n");
+    return 1;
+  }
+
+  if (!scenario->logger_h && decode_log(path, logged) != 0) {
+    printf("log check FAILED\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Decodes the log of sd_card.c on the image with sd_log_dump, and reports
+   what it made of the snapshots. Returns 0 if every one was rebuilt;
+   1 otherwise.
+*/
+static int decode_log(const char * path, uint32_t logged) {
+  char command[1024];
+  char line[128];
+  unsigned int keyframes = 0;
+  unsigned int deltas = 0;
+  unsigned int undecodable = 0;
+
+  // Only its report on stderr is read
+  snprintf(command, sizeof(command), "'%s' '%s' 2>&1 >/dev/null",
+           SD_LOG_DUMP, path);
+
+  FILE * dump = popen(command, "r");
+  if (dump == NULL) {
+    perror(SD_LOG_DUMP);
+    return 1;
+  }
+
+  while (fgets(line, sizeof(line), dump) != NULL) {
+    sscanf(line, "keyframes: %u", &keyframes);
+    sscanf(line, "deltas: %u", &deltas);
+    sscanf(line, "undecodable: %u", &undecodable);
+  }
+
+  if (pclose(dump) != 0) {
+    printf("decoded: sd_log_dump failed\n");
+    return 1;
+  }
+
+  printf("decoded: %u keyframes, %u deltas, %u undecodable\n",
+         keyframes, deltas, undecodable);
+
+  if (undecodable > 0 || (logged > 0 && keyframes == 0)) {
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Powers up the card with offload.c running, on a new pseudo-terminal,
+   in a child process that exits once the terminal has been opened, then
+   closed for a second. Returns 0 if successful; 1 otherwise.
+*/
+static int run_offload(scenario_t * scenario, const char * path) {
+  int port = posix_openpt(O_RDWR | O_NOCTTY);
+  if (port < 0 || grantpt(port) != 0 || unlockpt(port) != 0) {
+    perror("pseudo-terminal");
+    return 1;
+  }
+
+  printf("offload: serving the log on %s\n", ptsname(port));
+  fflush(stdout);
+
+  pid_t child = fork();
+  if (child < 0) {
+    perror("fork");
+    return 1;
+  }
+
+  if (child == 0) {
+    sdsim_t card;
+
+    if (!sdsim_open(&card, path, scenario->blocks, 0)) {
+      perror(path);
+      exit(1);
+    }
+
+    int fd = card.fd;
+    card = scenario->card;
+    card.fd = fd;
+    card.num_blocks = scenario->blocks;
+    sdsim_power_cycle(&card);
+    spi_sim_attach(&card);
+
+    offload_card = &card;
+    atexit(report_offload);
+    uwrite_sim_attach(port, scenario->corrupt_serial);
+
+    spi_init();
+    offload_run();
+  }
+
+  int status;
+  close(port);
+  if (waitpid(child, &status, 0) < 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "offload failed\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Prints what the card did during the offload, as the child exits */
+static void report_offload(void) {
+  printf("offload: done\n");
+  print_commands(&offload_card->stats);
+  fflush(stdout);
+
+  return;
+}
+
+static void usage(const char * name) {
+  fprintf(stderr,
+          "Usage: %s [options] image\n"
+          "  -L          run rd_headingsteerlog_demo/logger.h, not sd_card.c\n"
+          "  -f          start with a blank image\n"
+          "  -b blocks   the card's size (default %u)\n"
+          "  -n loops    loops logged per session (default %u)\n"
+          "  -s sessions power ups (default %u)\n"
+          "  -B time     byte times the card is busy per block (default %u)\n"
+          "  -g n -G time  every nth block, busy for time instead, unless\n"
+          "              it was erased beforehand\n"
+          "  -r n        reject the nth block written in each session\n"
+          "              (-c: with a CRC error)\n"
+          "  -e n        flip a bit of the nth block written in each session,\n"
+          "              on its way to the card\n"
+          "  -i polls    ACMD41s before the card is ready (default %u)\n"
+          "  -x          no card in the socket\n"
+          "  -o          then offload the log over a pseudo-terminal, until\n"
+          "              it's been closed for a second\n"
+          "  -u n        flip a bit of every nth byte offloaded\n",
+          name, DEFAULT_BLOCKS, DEFAULT_LOOPS, DEFAULT_SESSIONS,
+          SDSIM_BUSY_TIME, SDSIM_INIT_POLLS);
+
+  return;
+}
@@ -0,0 +1,662 @@
+/*
+ * File: sdsim.c
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sdsim.h"
+
+// Commands
+#define CMD_GO_IDLE_STATE         0
+#define CMD_SEND_IF_COND          8
+#define CMD_SEND_CSD              9
+#define CMD_STOP_TRANSMISSION     12
+#define CMD_SEND_STATUS           13
+#define CMD_READ_SINGLE_BLOCK     17
+#define CMD_READ_MULTIPLE_BLOCK   18
+#define CMD_WRITE_BLOCK           24
+#define CMD_WRITE_MULTIPLE_BLOCK  25
+#define CMD_ERASE_WR_BLK_START    32
+#define CMD_ERASE_WR_BLK_END      33
+#define CMD_ERASE                 38
+#define CMD_APP_CMD               55
+#define CMD_READ_OCR              58
+#define CMD_CRC_ON_OFF            59
+#define ACMD_SET_WR_BLK_ERASE_COUNT 23
+#define ACMD_SD_SEND_OP_COND      41
+
+#define OCR_POWER_UP              0x80 // of the top byte
+#define OCR_CCS                   0x40 // a high capacity card
+
+static uint8_t sdsim_crc7(const uint8_t * bytes, uint8_t length);
+static uint16_t sdsim_crc16(const uint8_t * bytes, uint16_t length);
+static void sdsim_queue(sdsim_t * card, uint8_t byte);
+static void sdsim_queue_r1(sdsim_t * card, uint8_t r1);
+static void sdsim_queue_data(sdsim_t * card, const uint8_t * data,
+                             uint16_t length);
+static void sdsim_queue_next_block(sdsim_t * card);
+static void sdsim_execute(sdsim_t * card);
+static void sdsim_receive_block(sdsim_t * card);
+static uint32_t sdsim_erase(sdsim_t * card);
+static void sdsim_make_csd(const sdsim_t * card, uint8_t * csd);
+
+uint8_t sdsim_open(sdsim_t * card, const char * path, uint32_t num_blocks,
+                   uint8_t truncate) {
+  memset(card, 0, sizeof(sdsim_t));
+
+  card->num_blocks = num_blocks;
+  card->present = 1;
+  card->response_delay = SDSIM_RESPONSE_DELAY;
+  card->read_delay = SDSIM_READ_DELAY;
+  card->init_polls = SDSIM_INIT_POLLS;
+  card->busy_time = SDSIM_BUSY_TIME;
+  card->erase_time = SDSIM_ERASE_TIME;
+  card->reject_response = SDSIM_DATA_WRITE_ERROR;
+
+  card->fd = open(path, O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+  if (card->fd < 0) {
+    return 0;
+  }
+
+  // Only the blocks that are written take up space
+  off_t size = (off_t) num_blocks * SDSIM_BLOCK_LENGTH;
+  if (lseek(card->fd, 0, SEEK_END) < size && ftruncate(card->fd, size) != 0) {
+    close(card->fd);
+    return 0;
+  }
+
+  sdsim_power_cycle(card);
+
+  return 1;
+}
+
+void sdsim_close(sdsim_t * card) {
+  close(card->fd);
+  card->fd = -1;
+
+  return;
+}
+
+void sdsim_power_cycle(sdsim_t * card) {
+  card->busy_until = card->clock;
+  card->state = SDSIM_IDLE;
+  card->idle = 1;
+  card->app_command = 0;
+  card->crc_on = 0;
+  card->reading = 0;
+  card->erase_set = 0;
+  card->init_polls_seen = 0;
+  card->received = 0;
+  card->queue_head = 0;
+  card->queue_length = 0;
+
+  return;
+}
+
+uint8_t sdsim_is_busy(const sdsim_t * card) {
+  return card->clock < card->busy_until;
+}
+
+void sdsim_advance(sdsim_t * card, uint32_t byte_times) {
+  card->clock = card->clock + byte_times;
+
+  return;
+}
+
+uint8_t sdsim_exchange(sdsim_t * card, uint8_t byte) {
+  uint8_t out;
+
+  card->stats.bytes = card->stats.bytes + 1;
+
+  if (!card->present) {
+    card->clock = card->clock + 1;
+    return 0xFF;
+  }
+
+  // What goes out was decided before this byte came in
+  if (card->queue_length > 0) {
+    out = card->queue[card->queue_head];
+    card->queue_head = (card->queue_head + 1) % SDSIM_MAX_QUEUED;
+    card->queue_length = card->queue_length - 1;
+  } else if (sdsim_is_busy(card)) {
+    out = 0x00;
+    card->stats.busy_bytes = card->stats.busy_bytes + 1;
+  } else {
+    out = 0xFF;
+  }
+
+  card->clock = card->clock + 1;
+
+  // A multiple block read sends one block after another until it's stopped
+  if (card->reading && card->queue_length == 0) {
+    sdsim_queue_next_block(card);
+  }
+
+  switch (card->state) {
+  case SDSIM_IDLE:
+    // A command starts with a 0 then a 1 bit; anything else is filler.
+    // The blocks of a read keep coming while CMD12 is sent to stop it.
+    if ((byte & 0xC0) == 0x40) {
+      if (card->queue_length > 0 && !card->reading) {
+        card->stats.responses_cut_short = card->stats.responses_cut_short + 1;
+        card->queue_length = 0;
+      }
+      if (sdsim_is_busy(card)) {
+        card->stats.protocol_errors = card->stats.protocol_errors + 1;
+      }
+
+      card->command[0] = byte;
+      card->received = 1;
+      card->state = SDSIM_COMMAND;
+    } else if (byte != 0xFF) {
+      card->stats.protocol_errors = card->stats.protocol_errors + 1;
+    }
+    break;
+
+  case SDSIM_COMMAND:
+    card->command[card->received] = byte;
+    card->received = card->received + 1;
+
+    if (card->received == sizeof(card->command)) {
+      card->state = SDSIM_IDLE;
+      sdsim_execute(card);
+    }
+    break;
+
+  case SDSIM_WRITE_TOKEN:
+    if (byte == SDSIM_START_TOKEN) {
+      card->received = 0;
+      card->multiple = 0;
+      card->state = SDSIM_DATA;
+    } else if (byte != 0xFF) {
+      card->stats.protocol_errors = card->stats.protocol_errors + 1;
+    }
+    break;
+
+  case SDSIM_MULTIPLE_TOKEN_WAIT:
+    if (byte == 0xFF) {
+      break;
+    }
+
+    // A token sent while the card is still programming is lost
+    if (sdsim_is_busy(card)) {
+      card->stats.protocol_errors = card->stats.protocol_errors + 1;
+    } else if (byte == SDSIM_MULTIPLE_TOKEN) {
+      card->received = 0;
+      card->multiple = 1;
+      card->state = SDSIM_DATA;
+    } else if (byte == SDSIM_STOP_TRAN_TOKEN) {
+      // Busy starts one byte after the token, while the card finishes
+      sdsim_queue(card, 0xFF);
+      card->busy_until = card->clock + 1 + card->busy_time;
+      card->state = SDSIM_IDLE;
+    } else {
+      card->stats.protocol_errors = card->stats.protocol_errors + 1;
+    }
+    break;
+
+  case SDSIM_DATA:
+    card->block[card->received] = byte;
+    card->received = card->received + 1;
+
+    if (card->received == sizeof(card->block)) {
+      sdsim_receive_block(card);
+    }
+    break;
+  }
+
+  return out;
+}
+
+uint8_t sdsim_read_image(sdsim_t * card, uint32_t block, void * buff) {
+  off_t offset = (off_t) block * SDSIM_BLOCK_LENGTH;
+  ssize_t length = pread(card->fd, buff, SDSIM_BLOCK_LENGTH, offset);
+
+  if (length < 0) {
+    return 0;
+  }
+
+  // The image may end before the card does
+  memset((uint8_t *) buff + length, 0, SDSIM_BLOCK_LENGTH - length);
+
+  return 1;
+}
+
+const char * sdsim_command_name(uint8_t app, uint8_t index) {
+  static char name[8];
+
+  snprintf(name, sizeof(name), "%sCMD%u", app ? "A" : "", index & 0x3F);
+
+  return name;
+}
+
+/* Carries out the command that's been received and queues its response */
+static void sdsim_execute(sdsim_t * card) {
+  uint8_t index = card->command[0] & 0x3F;
+  uint32_t argument = ((uint32_t) card->command[1] << 24) |
+                      ((uint32_t) card->command[2] << 16) |
+                      ((uint32_t) card->command[3] << 8) |
+                      card->command[4];
+  uint8_t app = card->app_command;
+  uint8_t r1 = card->idle ? SDSIM_R1_IDLE : 0x00;
+  uint8_t data[SDSIM_BLOCK_LENGTH];
+
+  card->app_command = 0;
+
+  if (app) {
+    card->stats.app_commands[index] = card->stats.app_commands[index] + 1;
+  } else {
+    card->stats.commands[index] = card->stats.commands[index] + 1;
+  }
+
+  // CRCs are off in SPI mode until CMD59, except for CMD0 and CMD8, which
+  // are sent before the card knows it's in SPI mode
+  if ((card->crc_on ||
+       (!app && (index == CMD_GO_IDLE_STATE || index == CMD_SEND_IF_COND))) &&
+      card->command[5] != ((sdsim_crc7(card->command, 5) << 1) | 0x01)) {
+    card->stats.crc_errors = card->stats.crc_errors + 1;
+    sdsim_queue_r1(card, r1 | SDSIM_R1_COM_CRC_ERROR);
+    return;
+  }
+
+  // Only CMD12 is accepted during a read; the card carries on with it
+  if (card->reading) {
+    if (app || index != CMD_STOP_TRANSMISSION) {
+      card->stats.protocol_errors = card->stats.protocol_errors + 1;
+      return;
+    }
+
+    // What was left of the block is cut off by a stuff byte, then R1b
+    card->reading = 0;
+    card->queue_length = 0;
+    sdsim_queue(card, 0xFF);
+    sdsim_queue_r1(card, r1);
+    card->busy_until = card->clock + 2 + card->response_delay +
+                       SDSIM_STOP_BUSY_TIME;
+    return;
+  }
+
+  if (app) {
+    switch (index) {
+    case ACMD_SD_SEND_OP_COND:
+      if (card->idle) {
+        card->init_polls_seen = card->init_polls_seen + 1;
+        if (card->init_polls_seen >= card->init_polls) {
+          card->idle = 0;
+        }
+      }
+      sdsim_queue_r1(card, card->idle ? SDSIM_R1_IDLE : 0x00);
+      return;
+
+    case ACMD_SET_WR_BLK_ERASE_COUNT:
+      sdsim_queue_r1(card, card->idle ? r1 | SDSIM_R1_ILLEGAL_COMMAND : r1);
+      return;
+    }
+
+    // Other application commands are treated as ordinary ones
+  }
+
+  switch (index) {
+  case CMD_GO_IDLE_STATE:
+    sdsim_power_cycle(card);
+    sdsim_queue_r1(card, SDSIM_R1_IDLE);
+    return;
+
+  case CMD_SEND_IF_COND:
+    // R7: the voltage range is accepted, and the check pattern echoed
+    sdsim_queue_r1(card, r1);
+    sdsim_queue(card, 0x00);
+    sdsim_queue(card, 0x00);
+    sdsim_queue(card, card->command[3] & 0x0F);
+    sdsim_queue(card, card->command[4]);
+    return;
+
+  case CMD_APP_CMD:
+    card->app_command = 1;
+    sdsim_queue_r1(card, r1);
+    return;
+
+  case CMD_READ_OCR:
+    // R3: the power up bit is set once the card is ready
+    sdsim_queue_r1(card, r1);
+    sdsim_queue(card, card->idle ? OCR_CCS : OCR_POWER_UP | OCR_CCS);
+    sdsim_queue(card, 0xFF);
+    sdsim_queue(card, 0x80);
+    sdsim_queue(card, 0x00);
+    return;
+
+  case CMD_CRC_ON_OFF:
+    card->crc_on = argument & 0x01;
+    sdsim_queue_r1(card, r1);
+    return;
+  }
+
+  // The rest are only accepted once the card has left the idle state
+  if (card->idle) {
+    sdsim_queue_r1(card, r1 | SDSIM_R1_ILLEGAL_COMMAND);
+    return;
+  }
+
+  switch (index) {
+  case CMD_SEND_CSD:
+    sdsim_queue_r1(card, r1);
+    sdsim_make_csd(card, data);
+    sdsim_queue_data(card, data, SDSIM_CSD_LENGTH);
+    return;
+
+  case CMD_SEND_STATUS:
+    sdsim_queue_r1(card, r1);
+    sdsim_queue(card, 0x00);
+    return;
+
+  case CMD_READ_SINGLE_BLOCK:
+    if (argument >= card->num_blocks) {
+      sdsim_queue_r1(card, r1 | SDSIM_R1_ADDRESS_ERROR);
+      return;
+    }
+
+    sdsim_read_image(card, argument, data);
+    sdsim_queue_r1(card, r1);
+    sdsim_queue_data(card, data, SDSIM_BLOCK_LENGTH);
+    card->stats.blocks_read = card->stats.blocks_read + 1;
+    return;
+
+  case CMD_READ_MULTIPLE_BLOCK:
+    if (argument >= card->num_blocks) {
+      sdsim_queue_r1(card, r1 | SDSIM_R1_ADDRESS_ERROR);
+      return;
+    }
+
+    sdsim_queue_r1(card, r1);
+    card->read_address = argument;
+    card->reading = 1;
+    sdsim_queue_next_block(card);
+    return;
+
+  case CMD_STOP_TRANSMISSION:
+    // Nothing to stop
+    sdsim_queue(card, 0xFF);
+    sdsim_queue_r1(card, r1);
+    return;
+
+  case CMD_WRITE_BLOCK:
+  case CMD_WRITE_MULTIPLE_BLOCK:
+    if (argument >= card->num_blocks) {
+      sdsim_queue_r1(card, r1 | SDSIM_R1_ADDRESS_ERROR);
+      return;
+    }
+
+    card->address = argument;
+    card->state = (index == CMD_WRITE_BLOCK) ? SDSIM_WRITE_TOKEN :
+                  SDSIM_MULTIPLE_TOKEN_WAIT;
+    sdsim_queue_r1(card, r1);
+    return;
+
+  case CMD_ERASE_WR_BLK_START:
+  case CMD_ERASE_WR_BLK_END:
+    if (argument >= card->num_blocks) {
+      card->erase_set = 0;
+      sdsim_queue_r1(card, r1 | SDSIM_R1_ADDRESS_ERROR);
+      return;
+    }
+
+    if (index == CMD_ERASE_WR_BLK_START) {
+      card->erase_first = argument;
+      card->erase_set = 0x01;
+    } else if (card->erase_set & 0x01) {
+      card->erase_last = argument;
+      card->erase_set = 0x03;
+    } else {
+      sdsim_queue_r1(card, r1 | SDSIM_R1_ERASE_SEQ_ERROR);
+      return;
+    }
+    sdsim_queue_r1(card, r1);
+    return;
+
+  case CMD_ERASE: {
+    // R1b: the card is busy from the byte after R1 until it's done
+    uint32_t sectors = sdsim_erase(card);
+
+    if (sectors == 0) {
+      sdsim_queue_r1(card, r1 | SDSIM_R1_ERASE_SEQ_ERROR);
+      return;
+    }
+
+    sdsim_queue_r1(card, r1);
+    card->busy_until = card->clock + 1 + card->response_delay +
+                       sectors * card->erase_time;
+    return;
+  }
+  }
+
+  sdsim_queue_r1(card, r1 | SDSIM_R1_ILLEGAL_COMMAND);
+
+  return;
+}
+
+/* Zeroes the blocks in the range set by CMD32 and CMD33, and notes that
+   they're erased. Returns the number of erase sectors the range covers; 0
+   if it wasn't set, or ends before it starts.
+*/
+static uint32_t sdsim_erase(sdsim_t * card) {
+  static const uint8_t zeroes[SDSIM_BLOCK_LENGTH];
+  uint32_t block;
+
+  if (card->erase_set != 0x03 || card->erase_last < card->erase_first) {
+    card->erase_set = 0;
+    return 0;
+  }
+  card->erase_set = 0;
+
+  for (block = card->erase_first; block <= card->erase_last; block++) {
+    if (pwrite(card->fd, zeroes, SDSIM_BLOCK_LENGTH,
+               (off_t) block * SDSIM_BLOCK_LENGTH) != SDSIM_BLOCK_LENGTH) {
+      break;
+    }
+  }
+
+  // An erase that carries on from the last one extends its range
+  if (card->erase_first < card->erased_first ||
+      card->erase_first > card->erased_end) {
+    card->erased_first = card->erase_first;
+  }
+  card->erased_end = block;
+  card->stats.blocks_erased = card->stats.blocks_erased +
+                              (block - card->erase_first);
+
+  return card->erase_last / SDSIM_ERASE_SECTOR_BLOCKS -
+         card->erase_first / SDSIM_ERASE_SECTOR_BLOCKS + 1;
+}
+
+/* Queues the next block of a multiple block read, or the error token if
+   it's run off the end of the card
+*/
+static void sdsim_queue_next_block(sdsim_t * card) {
+  uint8_t data[SDSIM_BLOCK_LENGTH];
+  uint8_t delay_index;
+
+  if (card->read_address >= card->num_blocks) {
+    for (delay_index = 0; delay_index < card->read_delay; delay_index++) {
+      sdsim_queue(card, 0xFF);
+    }
+    sdsim_queue(card, SDSIM_ERROR_OUT_OF_RANGE);
+    card->reading = 0;
+    return;
+  }
+
+  sdsim_read_image(card, card->read_address, data);
+  sdsim_queue_data(card, data, SDSIM_BLOCK_LENGTH);
+  card->read_address = card->read_address + 1;
+  card->stats.blocks_read = card->stats.blocks_read + 1;
+
+  return;
+}
+
+/* Programs the block that's been received (unless it's to be rejected, or
+   fails its CRC while checking is on), queues the data response and starts
+   the busy period
+*/
+static void sdsim_receive_block(sdsim_t * card) {
+  uint8_t response = SDSIM_DATA_ACCEPTED;
+  uint32_t busy_time = card->busy_time;
+
+  card->writes = card->writes + 1;
+
+  if (card->writes == card->corrupt_write) {
+    card->block[SDSIM_BLOCK_LENGTH / 2] ^= 0x10;
+  }
+
+  if (card->writes == card->reject_write) {
+    response = card->reject_response;
+  } else if (card->crc_on &&
+             sdsim_crc16(card->block, SDSIM_BLOCK_LENGTH) !=
+             (((uint16_t) card->block[SDSIM_BLOCK_LENGTH] << 8) |
+              card->block[SDSIM_BLOCK_LENGTH + 1])) {
+    response = SDSIM_DATA_CRC_ERROR;
+    card->stats.data_crc_errors = card->stats.data_crc_errors + 1;
+  } else if (card->address >= card->num_blocks) {
+    // A multiple block write that ran off the end of the card
+    response = SDSIM_DATA_WRITE_ERROR;
+  } else if (pwrite(card->fd, card->block, SDSIM_BLOCK_LENGTH,
+                    (off_t) card->address * SDSIM_BLOCK_LENGTH) !=
+             SDSIM_BLOCK_LENGTH) {
+    response = SDSIM_DATA_WRITE_ERROR;
+  }
+
+  if (response == SDSIM_DATA_ACCEPTED) {
+    card->stats.blocks_written = card->stats.blocks_written + 1;
+  } else {
+    card->stats.writes_rejected = card->stats.writes_rejected + 1;
+  }
+
+  // A block that was erased beforehand is programmed without waiting for
+  // an erase; once written, it isn't erased any more
+  if (card->address >= card->erased_first &&
+      card->address < card->erased_end) {
+    card->erased_first = card->address + 1;
+  } else if (card->long_busy_interval > 0 &&
+             card->writes % card->long_busy_interval == 0) {
+    busy_time = card->long_busy_time;
+  }
+
+  // The response goes out in exchange for the next byte, then the card is
+  // busy; a multiple block write carries on until the stop token, even
+  // after a block is rejected
+  sdsim_queue(card, response);
+  card->busy_until = card->clock + 1 + busy_time;
+  card->address = card->address + 1;
+  card->state = card->multiple ? SDSIM_MULTIPLE_TOKEN_WAIT : SDSIM_IDLE;
+
+  return;
+}
+
+/* Builds a version 2.0 (SDHC) CSD for the size of the card */
+static void sdsim_make_csd(const sdsim_t * card, uint8_t * csd) {
+  uint32_t c_size = card->num_blocks / SDSIM_BLOCKS_PER_C_SIZE - 1;
+
+  csd[0] = 0x40;              // CSD_STRUCTURE 1
+  csd[1] = 0x0E;              // TAAC
+  csd[2] = 0x00;              // NSAC
+  csd[3] = 0x32;              // TRAN_SPEED: 25 MHz
+  csd[4] = 0x5B;              // CCC
+  csd[5] = 0x59;              // CCC, READ_BL_LEN 9
+  csd[6] = 0x00;
+  csd[7] = (c_size >> 16) & 0x3F;
+  csd[8] = c_size >> 8;
+  csd[9] = c_size;
+  csd[10] = 0x7F;             // ERASE_BLK_EN, SECTOR_SIZE
+  csd[11] = 0x80;
+  csd[12] = 0x0A;             // R2W_FACTOR, WRITE_BL_LEN 9
+  csd[13] = 0x40;
+  csd[14] = 0x00;
+  csd[15] = (sdsim_crc7(csd, 15) << 1) | 0x01;
+
+  return;
+}
+
+static void sdsim_queue(sdsim_t * card, uint8_t byte) {
+  if (card->queue_length < SDSIM_MAX_QUEUED) {
+    card->queue[(card->queue_head + card->queue_length) % SDSIM_MAX_QUEUED] =
+      byte;
+    card->queue_length = card->queue_length + 1;
+  }
+
+  return;
+}
+
+/* Queues an R1 response after the card's response delay */
+static void sdsim_queue_r1(sdsim_t * card, uint8_t r1) {
+  uint8_t delay_index;
+
+  for (delay_index = 0; delay_index < card->response_delay; delay_index++) {
+    sdsim_queue(card, 0xFF);
+  }
+
+  sdsim_queue(card, r1);
+
+  return;
+}
+
+/* Queues a data block: the access delay, the start token, the data and its
+   CRC
+*/
+static void sdsim_queue_data(sdsim_t * card, const uint8_t * data,
+                             uint16_t length) {
+  uint16_t crc = sdsim_crc16(data, length);
+  uint16_t byte_index;
+
+  for (byte_index = 0; byte_index < card->read_delay; byte_index++) {
+    sdsim_queue(card, 0xFF);
+  }
+
+  sdsim_queue(card, SDSIM_START_TOKEN);
+
+  for (byte_index = 0; byte_index < length; byte_index++) {
+    sdsim_queue(card, data[byte_index]);
+  }
+
+  sdsim_queue(card, crc >> 8);
+  sdsim_queue(card, crc);
+
+  return;
+}
+
+/* The CRC7 of commands and the CSD: x^7 + x^3 + 1 */
+static uint8_t sdsim_crc7(const uint8_t * bytes, uint8_t length) {
+  uint8_t crc = 0;
+  uint8_t byte_index;
+  uint8_t bit_index;
+
+  for (byte_index = 0; byte_index < length; byte_index++) {
+    uint8_t byte = bytes[byte_index];
+
+    for (bit_index = 0; bit_index < 8; bit_index++) {
+      crc = crc << 1;
+      if ((byte ^ crc) & 0x80) {
+        crc = crc ^ 0x09;
+      }
+      byte = byte << 1;
+    }
+  }
+
+  return crc & 0x7F;
+}
+
+/* The CRC16 of data blocks: CRC-CCITT (x^16 + x^12 + x^5 + 1) from 0 */
+static uint16_t sdsim_crc16(const uint8_t * bytes, uint16_t length) {
+  uint16_t crc = 0;
+  uint16_t byte_index;
+  uint8_t bit_index;
+
+  for (byte_index = 0; byte_index < length; byte_index++) {
+    crc = crc ^ ((uint16_t) bytes[byte_index] << 8);
+
+    for (bit_index = 0; bit_index < 8; bit_index++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+
+  return crc;
+}
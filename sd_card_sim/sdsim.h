@@ -0,0 +1,176 @@
+/*
+ * File: sdsim.h
+ *
+ * A simulated SDHC card on the SPI bus, a byte at a time. It implements the
+ * SPI mode command state machine that the loggers use:
+ *   CMD0, CMD8 (R7), CMD9 (the CSD), CMD12, CMD13 (R2), CMD17, CMD18,
+ *   CMD24, CMD25, CMD32, CMD33, CMD38, CMD55, CMD58 (R3), CMD59, ACMD23
+ *   and ACMD41
+ * with the response delays, data tokens and busy periods of a real card,
+ * and backed by a sparse image file of its blocks.
+ *
+ * Time is counted in byte times (4 us at 2 MHz): each exchange takes one,
+ * and sdsim_advance() stands in for the time the host spends on other
+ * work. The card holds MISO low (busy) for a set time after each block is
+ * written, so polling it while the host works doesn't make it finish
+ * sooner.
+ *
+ * An erase (CMD38) zeroes its blocks, and keeps the card busy for a set
+ * time per erase sector. The card remembers the range erased last (with
+ * any it carries on from), less the blocks written since, and the long busy periods that stand in for a
+ * card erasing as it goes (see long_busy_time) skip the blocks in it. The
+ * range isn't kept in the image, so it's forgotten when the card is opened
+ * again.
+ *
+ * Only CMD0 and CMD8 need a good CRC until CMD59 turns CRC checking on;
+ * then every command and block written does, and a block that fails its
+ * CRC is rejected (without being written) as a real card would.
+ *
+ * Faults can be injected: a written block can be rejected, or corrupted on
+ * its way to the card, and the card can be left out of the socket, or be
+ * slow to leave the idle state. Anything the host does that a real card wouldn't accept (a command sent while the
+ * previous response is still coming out, a data token while busy) is
+ * counted rather than ignored silently.
+ */
+#ifndef _SDSIM_H_
+#define _SDSIM_H_
+
+#include <stdint.h>
+
+#define SDSIM_BLOCK_LENGTH        512
+#define SDSIM_CSD_LENGTH          16
+#define SDSIM_BLOCKS_PER_C_SIZE   1024 // C_SIZE counts 512 KB units
+#define SDSIM_MAX_QUEUED          (2 + SDSIM_BLOCK_LENGTH + 2 + 64)
+
+// R1 bits
+#define SDSIM_R1_IDLE             0x01
+#define SDSIM_R1_ILLEGAL_COMMAND  0x04
+#define SDSIM_R1_COM_CRC_ERROR    0x08
+#define SDSIM_R1_ERASE_SEQ_ERROR  0x10
+#define SDSIM_R1_ADDRESS_ERROR    0x20
+
+// Tokens, and the data responses a real card sends (the top 3 bits are
+// undefined; cards commonly send 1s)
+#define SDSIM_START_TOKEN         0xFE
+#define SDSIM_MULTIPLE_TOKEN      0xFC
+#define SDSIM_STOP_TRAN_TOKEN     0xFD
+#define SDSIM_DATA_ACCEPTED       0xE5
+#define SDSIM_DATA_CRC_ERROR      0xEB
+#define SDSIM_DATA_WRITE_ERROR    0xED
+#define SDSIM_ERROR_OUT_OF_RANGE  0x08 // error token of a read
+
+// Defaults
+#define SDSIM_RESPONSE_DELAY      1    // bytes before R1 (NCR)
+#define SDSIM_READ_DELAY          8    // bytes before a data token (NAC)
+#define SDSIM_BUSY_TIME           250  // byte times to program a block
+#define SDSIM_INIT_POLLS          3    // ACMD41s until the card is ready
+#define SDSIM_STOP_BUSY_TIME      8    // byte times to stop a read (CMD12)
+#define SDSIM_ERASE_TIME          250  // byte times per erase sector
+#define SDSIM_ERASE_SECTOR_BLOCKS 128  // 64 KB, as SDHC cards report
+
+typedef enum {
+  SDSIM_IDLE,           // waiting for a command
+  SDSIM_COMMAND,        // receiving the 6 bytes of a command
+  SDSIM_WRITE_TOKEN,    // CMD24: waiting for the start token
+  SDSIM_MULTIPLE_TOKEN_WAIT, // CMD25: waiting for a block or the stop token
+  SDSIM_DATA            // receiving a block and its CRC
+} sdsim_state_t;
+
+typedef struct {
+  uint64_t bytes;               // exchanged
+  uint64_t busy_bytes;          // exchanged while the card was busy
+  uint32_t commands[64];        // received, by index
+  uint32_t app_commands[64];
+  uint32_t blocks_read;
+  uint32_t blocks_written;
+  uint32_t blocks_erased;
+  uint32_t writes_rejected;
+  uint32_t crc_errors;          // commands that failed their CRC check
+  uint32_t data_crc_errors;     // blocks written that failed theirs
+  uint32_t responses_cut_short; // a command came while one was going out
+  uint32_t protocol_errors;     // bytes the card wouldn't have accepted
+} sdsim_stats_t;
+
+typedef struct {
+  // Configuration; set before the first exchange
+  uint32_t num_blocks;          // a multiple of SDSIM_BLOCKS_PER_C_SIZE
+  uint8_t  present;             // 0 leaves MISO high, as with no card
+  uint8_t  response_delay;
+  uint8_t  read_delay;
+  uint16_t init_polls;
+  uint32_t busy_time;           // after each block written
+  uint32_t erase_time;          // per erase sector (CMD38)
+  uint32_t long_busy_time;      // instead, every long_busy_interval blocks
+                                // that weren't erased beforehand
+  uint32_t long_busy_interval;  // 0 never takes long
+  uint32_t reject_write;        // the nth block written is rejected; 0 none
+  uint8_t  reject_response;     // SDSIM_DATA_CRC_ERROR or _WRITE_ERROR
+  uint32_t corrupt_write;       // the nth block written has a bit flipped
+                                // on its way in; 0 none
+
+  // State
+  int      fd;                  // of the image
+  uint64_t clock;               // in byte times
+  uint64_t busy_until;
+  sdsim_state_t state;
+  uint8_t  idle;                // ACMD41 hasn't completed yet
+  uint8_t  app_command;         // the previous command was CMD55
+  uint8_t  crc_on;              // CMD59 turned CRC checking on
+  uint16_t init_polls_seen;
+  uint8_t  command[6];
+  uint16_t received;            // bytes of the command or block so far
+  uint8_t  multiple;            // the block being received is of a CMD25
+  uint32_t address;             // of the block being written
+  uint8_t  reading;             // a CMD18 read is going on
+  uint32_t read_address;        // of the next block it sends
+  uint32_t writes;              // blocks received since the card was made
+  uint8_t  erase_set;           // CMD32 (bit 0) and CMD33 (bit 1) were sent
+  uint32_t erase_first;         // as they set the range to erase
+  uint32_t erase_last;
+  uint32_t erased_first;        // the blocks erased last, and not written
+  uint32_t erased_end;          // since
+  uint8_t  block[SDSIM_BLOCK_LENGTH + 2];
+
+  // The bytes waiting to be sent, after which MISO is high (or low while
+  // the card is busy)
+  uint8_t  queue[SDSIM_MAX_QUEUED];
+  uint16_t queue_head;
+  uint16_t queue_length;
+
+  sdsim_stats_t stats;
+} sdsim_t;
+
+/* Sets the card up with the default configuration, backed by the image at
+   path, which is created (sparse) or extended to num_blocks blocks. A blank
+   image is started if truncate is set. Returns 1 if successful; 0 if the
+   image couldn't be opened.
+*/
+uint8_t sdsim_open(sdsim_t * card, const char * path, uint32_t num_blocks,
+                   uint8_t truncate);
+
+/* Closes the image */
+void sdsim_close(sdsim_t * card);
+
+/* Powers the card up again: it's back in the idle state, and anything it
+   was doing is forgotten. The image and the statistics are kept.
+*/
+void sdsim_power_cycle(sdsim_t * card);
+
+/* Clocks byte in and returns the byte the card sent in exchange */
+uint8_t sdsim_exchange(sdsim_t * card, uint8_t byte);
+
+/* Lets byte_times pass without the bus being clocked */
+void sdsim_advance(sdsim_t * card, uint32_t byte_times);
+
+/* Returns 1 while the card is programming a block; 0 otherwise */
+uint8_t sdsim_is_busy(const sdsim_t * card);
+
+/* Reads a block of the image into buff. Returns 1 if successful; 0
+   otherwise.
+*/
+uint8_t sdsim_read_image(sdsim_t * card, uint32_t block, void * buff);
+
+/* Returns the name of a command, e.g. "CMD17" or "ACMD41" */
+const char * sdsim_command_name(uint8_t app, uint8_t index);
+
+#endif /* _SDSIM_H_ */
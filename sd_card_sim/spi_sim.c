@@ -0,0 +1,76 @@
+/*
+ * File: spi_sim.c
+ */
+#include <stddef.h>
+
+#include "spi.h"
+#include "spi_sim.h"
+
+sdsim_t * SPI_SIM_card;
+
+// The transfer in progress
+const uint8_t * SPI_SIM_buff;
+uint16_t SPI_SIM_length;
+spi_done_callback_t SPI_SIM_on_done;
+uint8_t SPI_SIM_busy;
+uint8_t SPI_SIM_polled;   // since it started
+
+void spi_sim_attach(sdsim_t * card) {
+  SPI_SIM_card = card;
+  SPI_SIM_busy = 0;
+
+  return;
+}
+
+void spi_sim_run(void) {
+  uint8_t received = 0xFF;
+  uint16_t byte_index;
+
+  if (!SPI_SIM_busy) {
+    return;
+  }
+
+  for (byte_index = 0; byte_index < SPI_SIM_length; byte_index++) {
+    received = sdsim_exchange(SPI_SIM_card, SPI_SIM_buff[byte_index]);
+  }
+
+  SPI_SIM_busy = 0;
+
+  if (SPI_SIM_on_done != NULL) {
+    SPI_SIM_on_done(received);
+  }
+
+  return;
+}
+
+uint8_t spi_exchange_byte(uint8_t byte) {
+  spi_sim_run();
+
+  return sdsim_exchange(SPI_SIM_card, byte);
+}
+
+uint8_t spi_start_transfer(const uint8_t * buff, uint16_t length,
+                           spi_done_callback_t on_done,
+                           spi_error_callback_t on_error) {
+  if (SPI_SIM_busy || length == 0) {
+    return 0;
+  }
+
+  SPI_SIM_buff = buff;
+  SPI_SIM_length = length;
+  SPI_SIM_on_done = on_done;
+  SPI_SIM_polled = 0;
+  SPI_SIM_busy = 1;
+
+  return 1;
+}
+
+uint8_t spi_transfer_is_busy(void) {
+  if (SPI_SIM_busy && SPI_SIM_polled) {
+    spi_sim_run();
+  }
+
+  SPI_SIM_polled = 1;
+
+  return SPI_SIM_busy;
+}
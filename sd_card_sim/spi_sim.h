@@ -0,0 +1,24 @@
+/*
+ * File: spi_sim.h
+ *
+ * Implements spi.h on the host, over a simulated card (see sdsim.h), so
+ * that sd_card.c runs unchanged. A transfer started with
+ * spi_start_transfer() is still in progress the first time
+ * spi_transfer_is_busy() is asked, as it would be just after it started;
+ * it finishes, calling its callback as the ISR would, when it's asked
+ * again, when the bus is next used or when spi_sim_run() is called.
+ */
+#ifndef _SPI_SIM_H_
+#define _SPI_SIM_H_
+
+#include <stdint.h>
+
+#include "sdsim.h"
+
+/* Puts card on the bus */
+void spi_sim_attach(sdsim_t * card);
+
+/* Finishes the transfer in progress, if there is one */
+void spi_sim_run(void);
+
+#endif /* _SPI_SIM_H_ */
@@ -0,0 +1,16 @@
+/*
+ * File: interrupt.h
+ *
+ * Host stand-in: there are no interrupts to enable or disable. The SPI
+ * transfer engine is simulated by spi_sim.c rather than by spi.c's ISR.
+ */
+#ifndef _STUB_AVR_INTERRUPT_H_
+#define _STUB_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define ISR(vector)     void vector(void)
+#define cli()
+#define sei()
+
+#endif /* _STUB_AVR_INTERRUPT_H_ */
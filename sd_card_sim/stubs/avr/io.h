@@ -0,0 +1,62 @@
+/*
+ * File: io.h
+ *
+ * Host stand-ins for the ATmega registers used by sd_card_logger and by
+ * rd_headingsteerlog_demo/logger.h. The registers are plain variables (see
+ * registers.c) except:
+ *   - UCSR0A, which always reports that the transmitter is ready
+ *   - SPDR, in C++ only, which exchanges a byte with the simulated card
+ *     when it's written and sets SPIF in SPSR, as the SPI would
+ */
+#ifndef _STUB_AVR_IO_H_
+#define _STUB_AVR_IO_H_
+
+#include <stdint.h>
+
+extern volatile uint8_t PORTB;
+extern volatile uint8_t DDRB;
+extern volatile uint8_t PINB;
+extern volatile uint8_t SPCR;
+extern volatile uint8_t SPSR;
+extern volatile uint8_t UDR0;
+extern volatile uint8_t stub_ucsr0a;
+
+#define UCSR0A  (*(stub_ucsr0a |= (1 << UDRE0) | (1 << TXC0), &stub_ucsr0a))
+
+#ifdef __cplusplus
+struct stub_spdr_t {
+  uint8_t received;
+
+  stub_spdr_t & operator=(uint8_t byte);
+  operator uint8_t();
+};
+
+extern stub_spdr_t stub_spdr;
+
+#define SPDR    stub_spdr
+#endif
+
+#define PB0     0
+#define PB1     1
+#define PB2     2
+#define PB3     3
+#define PB4     4
+#define PB5     5
+
+#define SPIE    7
+#define SPE     6
+#define DORD    5
+#define MSTR    4
+#define CPOL    3
+#define CPHA    2
+#define SPR1    1
+#define SPR0    0
+
+#define SPIF    7
+#define WCOL    6
+#define SPI2X   0
+
+#define TXC0    6
+#define UDRE0   5
+
+#endif /* _STUB_AVR_IO_H_ */
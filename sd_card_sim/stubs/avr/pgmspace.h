@@ -0,0 +1,20 @@
+/*
+ * File: pgmspace.h
+ *
+ * Host stand-in: program memory is ordinary memory.
+ */
+#ifndef _STUB_AVR_PGMSPACE_H_
+#define _STUB_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(address)  (*(const uint8_t *) (address))
+#define pgm_read_word(address)  (*(const uint16_t *) (address))
+#define pgm_read_dword(address) (*(const uint32_t *) (address))
+
+#define PGM_P                   const char *
+#define PSTR(s)                 (s)
+#define snprintf_P              snprintf
+
+#endif /* _STUB_AVR_PGMSPACE_H_ */
@@ -0,0 +1,14 @@
+/*
+ * File: registers.c
+ *
+ * Storage for the stand-in registers declared in stubs/avr/io.h
+ */
+#include <avr/io.h>
+
+volatile uint8_t PORTB;
+volatile uint8_t DDRB;
+volatile uint8_t PINB;
+volatile uint8_t SPCR;
+volatile uint8_t SPSR;
+volatile uint8_t UDR0;
+volatile uint8_t stub_ucsr0a;
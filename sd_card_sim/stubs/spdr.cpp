@@ -0,0 +1,26 @@
+/*
+ * File: spdr.cpp
+ *
+ * The stand-in SPI data register for C++ code that drives the SPI a byte
+ * at a time (see stubs/avr/io.h)
+ */
+#include <avr/io.h>
+
+extern "C" {
+#include "spi.h"
+}
+
+stub_spdr_t stub_spdr;
+
+stub_spdr_t & stub_spdr_t::operator=(uint8_t byte) {
+  received = spi_exchange_byte(byte);
+  SPSR |= (1 << SPIF);
+
+  return *this;
+}
+
+stub_spdr_t::operator uint8_t() {
+  SPSR &= ~(1 << SPIF);
+
+  return received;
+}
@@ -0,0 +1,122 @@
+/*
+ * File: uwrite_sim.c
+ *
+ * Host stand-in for uwrite.c: the logger's debug output is discarded, and
+ * the bytes of the offload (see offload.h) go over the serial port given
+ * to uwrite_sim_attach(), if there is one.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uwrite.h"
+#include "uwrite_sim.h"
+
+#define UWRITE_SIM_SEND_TIMEOUT_MS  100
+#define UWRITE_SIM_CLOSED_MS        1000 // before the process exits
+
+static int uwrite_sim_fd = -1;
+static uint32_t uwrite_sim_corrupt_interval;
+static uint64_t uwrite_sim_sent;
+static uint8_t uwrite_sim_opened;     // the other end has sent something
+static uint64_t uwrite_sim_closed_at; // in ms; 0 while it's open
+
+static uint64_t uwrite_sim_now_ms(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void uwrite_sim_attach(int fd, uint32_t corrupt_interval) {
+  uwrite_sim_fd = fd;
+  uwrite_sim_corrupt_interval = corrupt_interval;
+
+  return;
+}
+
+void uwrite_init(void) {
+  return;
+}
+
+void uwrite_init_fast(void) {
+  return;
+}
+
+void uwrite_print_buff(char * char_buff) {
+  return;
+}
+
+void uwrite_print_buff_P(const char * char_buff) {
+  return;
+}
+
+void uwrite_print_byte(void * a_byte) {
+  return;
+}
+
+void uwrite_print_short(void * a_short) {
+  return;
+}
+
+void uwrite_print_long(void * a_long) {
+  return;
+}
+
+void uwrite_send_byte(uint8_t byte) {
+  if (uwrite_sim_fd < 0) {
+    return;
+  }
+
+  uwrite_sim_sent = uwrite_sim_sent + 1;
+  if (uwrite_sim_corrupt_interval > 0 &&
+      uwrite_sim_sent % uwrite_sim_corrupt_interval == 0) {
+    byte = byte ^ 0x01;
+  }
+
+  // A byte that the other end isn't there to take is lost, as it would be
+  struct pollfd port = { uwrite_sim_fd, POLLOUT, 0 };
+  if (poll(&port, 1, UWRITE_SIM_SEND_TIMEOUT_MS) <= 0 ||
+      (port.revents & POLLHUP)) {
+    return;
+  }
+
+  while (write(uwrite_sim_fd, &byte, 1) != 1) {
+    if (errno != EINTR && errno != EAGAIN) {
+      break;
+    }
+  }
+
+  return;
+}
+
+uint8_t uwrite_receive_byte(uint8_t * byte) {
+  struct pollfd port = { uwrite_sim_fd, POLLIN, 0 };
+
+  if (uwrite_sim_fd < 0 || poll(&port, 1, 0) <= 0) {
+    return 0;
+  }
+
+  if (read(uwrite_sim_fd, byte, 1) == 1) {
+    uwrite_sim_opened = 1;
+    uwrite_sim_closed_at = 0;
+    return 1;
+  }
+
+  // The port has been closed; sd_log_offload may be run again to carry on
+  if (uwrite_sim_opened) {
+    uint64_t now = uwrite_sim_now_ms();
+
+    if (uwrite_sim_closed_at == 0) {
+      uwrite_sim_closed_at = now;
+    } else if (now - uwrite_sim_closed_at >= UWRITE_SIM_CLOSED_MS) {
+      exit(0);
+    }
+  }
+  usleep(10000);
+
+  return 0;
+}
@@ -0,0 +1,19 @@
+/*
+ * File: uwrite_sim.h
+ *
+ * Connects the host stand-in for uwrite.c to a serial port: the master of
+ * a pseudo-terminal that sd_log_offload opens as it would the Arduino's.
+ */
+#ifndef _UWRITE_SIM_H_
+#define _UWRITE_SIM_H_
+
+#include <stdint.h>
+
+/* Sends the bytes that uwrite_send_byte() is given to fd, and reads the
+   ones uwrite_receive_byte() returns from it. Every corrupt_interval-th
+   byte sent has a bit flipped (0 for none). The process exits once the
+   other end has opened the port, then left it closed for a second.
+*/
+void uwrite_sim_attach(int fd, uint32_t corrupt_interval);
+
+#endif /* _UWRITE_SIM_H_ */
@@ -0,0 +1,737 @@
+/*
+ * File: main.c
+ *
+ * Decodes the log that sd_card_logger writes, from an image of the card or
+ * from LOG.DAT in FAT32 mode, and prints the statevars snapshots as CSV, one
+ * row per snapshot. Each block is found by its magic number and checked
+ * against its CRC-32; blocks that fail are reported on stderr and skipped.
+ * Keyframes and deltas are rebuilt into whole snapshots with log_delta.c.
+ *
+ * With -c, the records of the named channel (see log_channel.h) are printed
+ * instead, one row per record, with the columns given by the channel's
+ * schema in the log. Elements of a numeric array are separated by spaces.
+ *
+ * With -s and -l (or -t), only part of a session is printed: the blocks
+ * that hold the loops (or the GPS times, as hh:mm:ss.sss) in the range.
+ * They're found by a binary search of the index records that start every
+ * SDCARD_INDEX_INTERVAL blocks, so a second from the middle of a long log
+ * takes a few dozen reads rather than a scan of the whole image. The rows
+ * start at the last index block at or before the start of the range.
+ *
+ * The summary that ends each session is reported on stderr.
+ *
+ * The log holds the statevars as laid out by avr-gcc: packed, with 4-byte
+ * doubles. They're read field by field at those offsets, so this doesn't
+ * depend on the host's layout of statevars_t.
+ *
+ * Usage: sd_log_dump [-c channel] [-s session (-l first[-last] |
+ *                    -t hh:mm:ss[.sss][-hh:mm:ss[.sss]])] image
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crc.h"
+#include "log_channel.h"
+#include "log_delta.h"
+
+// As in sd_card.h
+#define BYTES_PER_BLOCK         512
+#define BLOCK_MAGIC             0xDADAC0DEUL
+#define BLOCK_HEADER_LENGTH     14
+#define BLOCK_CRC               10      // offset of the header's CRC-32
+#define RECORD_HEADER_LENGTH    2
+#define RECORD_STATEVARS        0x01
+#define RECORD_STATEVARS_DELTA  0x02
+#define RECORD_SCHEMA           0x03
+#define RECORD_CHANNEL          0x04
+#define RECORD_INDEX            0x05
+#define RECORD_SUMMARY          0x06
+
+// Lengths of sdcard_index_t and sdcard_session_summary_t on the AVR
+#define INDEX_LENGTH            14
+#define SUMMARY_LENGTH          32
+
+// Offsets of the fields of statevars_t on the AVR
+#define STATEVARS_PREFIX          0
+#define STATEVARS_UNSIGNED_LONG   4
+#define STATEVARS_UNSIGNED_SHORT  8
+#define STATEVARS_UNSIGNED_BYTE   10
+#define STATEVARS_SENTENCE        11
+#define STATEVARS_SENTENCE_LENGTH 84
+#define STATEVARS_FLOAT_VALUE     95
+#define STATEVARS_DOUBLE_VALUE    99
+#define STATEVARS_SIGNED_BYTE     103
+#define STATEVARS_SIGNED_SHORT    104
+#define STATEVARS_SIGNED_LONG     106
+#define STATEVARS_SUFFIX          110
+#define STATEVARS_LENGTH          114
+
+typedef struct {
+  uint32_t blocks;
+  uint32_t bad_crc;
+  uint32_t keyframes;
+  uint32_t deltas;
+  uint32_t undecodable;   // malformed, or a delta with no keyframe before it
+  uint32_t schemas;
+  uint32_t channel_records;
+  uint32_t other_records;
+} dump_stats_t;
+
+// An index record
+typedef struct {
+  uint32_t session;
+  uint32_t loop_counter;
+  uint32_t gps_time_ms;
+  uint16_t interval;
+} log_index_t;
+
+// Part of a session to print
+typedef struct {
+  uint32_t session;
+  uint8_t  by_time;         // the range is of GPS times, not loops
+  uint32_t first;
+  uint32_t last;
+} seek_range_t;
+
+// The most fields that fit in a schema record
+#define MAX_FIELDS \
+  ((LOG_CHANNEL_MAX_SCHEMA_LENGTH - LOG_CHANNEL_SCHEMA_HEADER_LENGTH) / \
+   LOG_CHANNEL_FIELD_HEADER_LENGTH)
+
+// A channel's schema, as read from the log
+typedef struct {
+  char name[LOG_CHANNEL_MAX_SCHEMA_LENGTH + 1];
+  uint8_t length;
+  uint8_t num_fields;
+  uint8_t types[MAX_FIELDS];
+  uint8_t offsets[MAX_FIELDS];
+  uint8_t counts[MAX_FIELDS];
+  char field_names[MAX_FIELDS][LOG_CHANNEL_MAX_SCHEMA_LENGTH + 1];
+  uint8_t known;
+} schema_t;
+
+static schema_t schemas[LOG_CHANNEL_MAX_CHANNELS];
+static const char * selected_channel;   // NULL to print the statevars
+static uint8_t header_printed;
+static uint8_t quiet;                   // decode without printing rows
+
+static uint32_t get_u32(const uint8_t * bytes);
+static uint16_t get_u16(const uint8_t * bytes);
+static float get_float(const uint8_t * bytes);
+static uint8_t check_block(const uint8_t * block);
+static uint8_t get_index(const uint8_t * block, log_index_t * index);
+static void dump_block(const uint8_t * block, dump_stats_t * stats);
+static void print_summary(const uint8_t * data);
+static const char * parse_key(const char * text, uint8_t by_time,
+                              uint32_t * key);
+static uint8_t parse_range(const char * text, uint8_t by_time,
+                           seek_range_t * range);
+static uint8_t read_block(FILE * image, uint64_t address, uint8_t * block);
+static int64_t last_slot_before(FILE * image, uint64_t base, uint16_t interval,
+                                uint64_t num_slots, uint32_t session,
+                                uint8_t by_time, uint32_t key);
+static int seek_and_dump(FILE * image, const seek_range_t * range,
+                         dump_stats_t * stats);
+static void usage(const char * name);
+static void print_statevars(uint32_t sequence, const uint8_t * frame);
+static uint8_t get_name(char * name, const uint8_t * data, uint16_t left);
+static uint8_t parse_schema(const uint8_t * data, uint8_t length);
+static void print_element(uint8_t type, const uint8_t * bytes);
+static void print_channel(uint32_t sequence, const uint8_t * data,
+                          uint8_t length);
+
+int main(int argc, char ** argv) {
+  seek_range_t range;
+  const char * range_text = NULL;
+  uint8_t seeking = 0;
+  int opt;
+
+  memset(&range, 0, sizeof(range));
+
+  while ((opt = getopt(argc, argv, "c:s:l:t:")) != -1) {
+    switch (opt) {
+      case 'c':
+        selected_channel = optarg;
+        break;
+      case 's':
+        range.session = strtoul(optarg, NULL, 10);
+        seeking |= 1;
+        break;
+      case 'l':
+      case 't':
+        range.by_time = (opt == 't');
+        range_text = optarg;
+        seeking |= 2;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  // A session and a range go together
+  if (optind + 1 != argc || seeking == 1 || seeking == 2 ||
+      (seeking && !parse_range(range_text, range.by_time, &range))) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  FILE * image = fopen(argv[optind], "rb");
+  if (image == NULL) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  dump_stats_t stats;
+  uint8_t block[BYTES_PER_BLOCK];
+  int status = 0;
+  memset(&stats, 0, sizeof(stats));
+
+  if (selected_channel == NULL) {
+    printf("sequence,prefix,unsigned_long,unsigned_short,unsigned_byte,"
+           "sentence,float_value,double_value,signed_byte,signed_short,"
+           "signed_long,suffix\n");
+  }
+
+  if (seeking) {
+    status = seek_and_dump(image, &range, &stats);
+  } else {
+    while (fread(block, 1, BYTES_PER_BLOCK, image) == BYTES_PER_BLOCK) {
+      if (get_u32(block) == BLOCK_MAGIC) {
+        dump_block(block, &stats);
+      }
+    }
+  }
+
+  fclose(image);
+
+  fprintf(stderr, "blocks:       %u\n", stats.blocks);
+  fprintf(stderr, "  bad CRC:    %u\n", stats.bad_crc);
+  fprintf(stderr, "keyframes:    %u\n", stats.keyframes);
+  fprintf(stderr, "deltas:       %u\n", stats.deltas);
+  fprintf(stderr, "undecodable:  %u\n", stats.undecodable);
+  fprintf(stderr, "schemas:      %u\n", stats.schemas);
+  fprintf(stderr, "channel records: %u\n", stats.channel_records);
+  fprintf(stderr, "other records: %u\n", stats.other_records);
+
+  return status;
+}
+
+static uint32_t get_u32(const uint8_t * bytes) {
+  return (uint32_t) bytes[0] | ((uint32_t) bytes[1] << 8) |
+         ((uint32_t) bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+}
+
+static uint16_t get_u16(const uint8_t * bytes) {
+  return (uint16_t) (bytes[0] | (bytes[1] << 8));
+}
+
+static float get_float(const uint8_t * bytes) {
+  uint32_t bits = get_u32(bytes);
+  float value;
+
+  memcpy(&value, &bits, sizeof(value));
+
+  return value;
+}
+
+/* Returns 1 if the block is a block of the log, with a good CRC; 0
+   otherwise
+*/
+static uint8_t check_block(const uint8_t * block) {
+  uint16_t used = get_u16(block + 8);
+
+  if (get_u32(block) != BLOCK_MAGIC ||
+      used > BYTES_PER_BLOCK - BLOCK_HEADER_LENGTH) {
+    return 0;
+  }
+
+  return crc32_update(CRC32_INIT, block + BLOCK_HEADER_LENGTH, used) ==
+         get_u32(block + BLOCK_CRC);
+}
+
+/* Reads the index record that starts a block. Returns 1 if there's one; 0
+   otherwise.
+*/
+static uint8_t get_index(const uint8_t * block, log_index_t * index) {
+  const uint8_t * record = block + BLOCK_HEADER_LENGTH;
+
+  if (!check_block(block) ||
+      get_u16(block + 8) < RECORD_HEADER_LENGTH + INDEX_LENGTH ||
+      record[0] != RECORD_INDEX || record[1] != INDEX_LENGTH) {
+    return 0;
+  }
+
+  record = record + RECORD_HEADER_LENGTH;
+  index->session = get_u32(record);
+  index->loop_counter = get_u32(record + 4);
+  index->gps_time_ms = get_u32(record + 8);
+  index->interval = get_u16(record + 12);
+
+  return 1;
+}
+
+/* Checks a block of the log and prints the snapshots in it. Every block
+   starts decoding afresh, since its first snapshot is a keyframe.
+*/
+static void dump_block(const uint8_t * block, dump_stats_t * stats) {
+  uint32_t sequence = get_u32(block + 4);
+  uint16_t used = get_u16(block + 8);
+  const uint8_t * records = block + BLOCK_HEADER_LENGTH;
+  uint16_t i;
+
+  stats->blocks++;
+
+  if (!check_block(block)) {
+    fprintf(stderr, "block %u: bad CRC\n", sequence);
+    stats->bad_crc++;
+    return;
+  }
+
+  uint8_t frame[STATEVARS_LENGTH];
+  log_delta_decoder_t decoder;
+  log_delta_decoder_init(&decoder, frame, sizeof(frame));
+
+  for (i = 0; i + RECORD_HEADER_LENGTH <= used; ) {
+    uint8_t type = records[i];
+    uint8_t length = records[i + 1];
+    const uint8_t * data = records + i + RECORD_HEADER_LENGTH;
+
+    i = i + RECORD_HEADER_LENGTH + length;
+    if (i > used) {
+      stats->undecodable++;
+      break;
+    }
+
+    if (type == RECORD_STATEVARS || type == RECORD_STATEVARS_DELTA) {
+      uint8_t kind = (type == RECORD_STATEVARS) ? LOG_DELTA_KEYFRAME :
+                                                  LOG_DELTA_DELTA;
+
+      if (!log_delta_decode(&decoder, kind, data, length)) {
+        stats->undecodable++;
+        continue;
+      }
+
+      if (kind == LOG_DELTA_KEYFRAME) {
+        stats->keyframes++;
+      } else {
+        stats->deltas++;
+      }
+
+      if (selected_channel == NULL && !quiet) {
+        print_statevars(sequence, frame);
+      }
+    } else if (type == RECORD_SCHEMA) {
+      if (!parse_schema(data, length)) {
+        stats->undecodable++;
+        continue;
+      }
+
+      stats->schemas++;
+    } else if (type == RECORD_CHANNEL) {
+      stats->channel_records++;
+
+      if (selected_channel != NULL && !quiet) {
+        print_channel(sequence, data, length);
+      }
+    } else if (type == RECORD_SUMMARY && length == SUMMARY_LENGTH) {
+      if (!quiet) {
+        print_summary(data);
+      }
+    } else if (type != RECORD_INDEX) {
+      stats->other_records++;
+    }
+  }
+
+  return;
+}
+
+static void print_statevars(uint32_t sequence, const uint8_t * frame) {
+  char sentence[STATEVARS_SENTENCE_LENGTH + 1];
+  char * c;
+
+  // Quoted, so commas can't split it; quotes and line breaks become spaces
+  memcpy(sentence, frame + STATEVARS_SENTENCE, STATEVARS_SENTENCE_LENGTH);
+  sentence[STATEVARS_SENTENCE_LENGTH] = '\0';
+  for (c = sentence; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\r' || *c == '\n') {
+      *c = ' ';
+    }
+  }
+
+  printf("%u,0x%08X,%u,%u,%u,\"%s\",%g,%g,%d,%d,%d,0x%08X\n", sequence,
+         get_u32(frame + STATEVARS_PREFIX),
+         get_u32(frame + STATEVARS_UNSIGNED_LONG),
+         get_u16(frame + STATEVARS_UNSIGNED_SHORT),
+         frame[STATEVARS_UNSIGNED_BYTE], sentence,
+         get_float(frame + STATEVARS_FLOAT_VALUE),
+         get_float(frame + STATEVARS_DOUBLE_VALUE),
+         (int8_t) frame[STATEVARS_SIGNED_BYTE],
+         (int16_t) get_u16(frame + STATEVARS_SIGNED_SHORT),
+         (int32_t) get_u32(frame + STATEVARS_SIGNED_LONG),
+         get_u32(frame + STATEVARS_SUFFIX));
+
+  return;
+}
+
+/* Reads a name, after its length. Returns the bytes read, or 0 if it
+   runs past the end of the record.
+*/
+static uint8_t get_name(char * name, const uint8_t * data, uint16_t left) {
+  if (left < 1 || data[0] + 1 > left) {
+    return 0;
+  }
+
+  memcpy(name, data + 1, data[0]);
+  name[data[0]] = '\0';
+
+  return data[0] + 1;
+}
+
+/* Stores the schema of a channel. A schema logged at the start of a later
+   session replaces the one before. Returns 1 if successful; 0 if it's
+   malformed.
+*/
+static uint8_t parse_schema(const uint8_t * data, uint8_t length) {
+  schema_t schema;
+  uint16_t used = LOG_CHANNEL_SCHEMA_HEADER_LENGTH - 1;
+  uint8_t name_length;
+  uint8_t field_index;
+
+  if (length < used || data[0] >= LOG_CHANNEL_MAX_CHANNELS ||
+      data[4] > MAX_FIELDS) {
+    return 0;
+  }
+
+  memset(&schema, 0, sizeof(schema));
+  schema.length = data[3];
+  schema.num_fields = data[4];
+
+  name_length = get_name(schema.name, data + used, length - used);
+  if (name_length == 0) {
+    return 0;
+  }
+  used = used + name_length;
+
+  for (field_index = 0; field_index < schema.num_fields; field_index++) {
+    if (used + LOG_CHANNEL_FIELD_HEADER_LENGTH - 1 > length) {
+      return 0;
+    }
+
+    schema.types[field_index] = data[used];
+    schema.offsets[field_index] = data[used + 1];
+    schema.counts[field_index] = data[used + 2];
+    used = used + LOG_CHANNEL_FIELD_HEADER_LENGTH - 1;
+
+    name_length = get_name(schema.field_names[field_index], data + used,
+                           length - used);
+    if (name_length == 0) {
+      return 0;
+    }
+    used = used + name_length;
+
+    if (schema.offsets[field_index] +
+        schema.counts[field_index] * LOG_FIELD_SIZE(schema.types[field_index])
+        > schema.length) {
+      return 0;
+    }
+  }
+
+  schema.known = 1;
+  schemas[data[0]] = schema;
+
+  return 1;
+}
+
+/* Prints an element of a field */
+static void print_element(uint8_t type, const uint8_t * bytes) {
+  switch (type) {
+    case LOG_FIELD_U8:
+      printf("%u", bytes[0]);
+      break;
+    case LOG_FIELD_I8:
+      printf("%d", (int8_t) bytes[0]);
+      break;
+    case LOG_FIELD_U16:
+      printf("%u", get_u16(bytes));
+      break;
+    case LOG_FIELD_I16:
+      printf("%d", (int16_t) get_u16(bytes));
+      break;
+    case LOG_FIELD_U32:
+      printf("%u", get_u32(bytes));
+      break;
+    case LOG_FIELD_I32:
+      printf("%d", (int32_t) get_u32(bytes));
+      break;
+    case LOG_FIELD_FLOAT:
+      printf("%g", get_float(bytes));
+      break;
+    default:
+      printf("?");
+      break;
+  }
+
+  return;
+}
+
+/* Prints a record of a channel, if it's the selected one */
+static void print_channel(uint32_t sequence, const uint8_t * data,
+                          uint8_t length) {
+  const schema_t * schema;
+  uint8_t field_index;
+  uint8_t element;
+
+  if (length < 1 || data[0] >= LOG_CHANNEL_MAX_CHANNELS) {
+    return;
+  }
+
+  schema = &schemas[data[0]];
+  if (!schema->known || strcmp(schema->name, selected_channel) != 0 ||
+      length - 1 != schema->length) {
+    return;
+  }
+
+  data = data + 1;
+
+  if (!header_printed) {
+    printf("sequence");
+    for (field_index = 0; field_index < schema->num_fields; field_index++) {
+      printf(",%s", schema->field_names[field_index]);
+    }
+    printf("\n");
+    header_printed = 1;
+  }
+
+  printf("%u", sequence);
+
+  for (field_index = 0; field_index < schema->num_fields; field_index++) {
+    uint8_t type = schema->types[field_index];
+    const uint8_t * field = data + schema->offsets[field_index];
+    uint8_t count = schema->counts[field_index];
+
+    printf(",");
+
+    if (type == LOG_FIELD_CHAR) {
+      printf("\"");
+      for (element = 0; element < count && field[element] != '\0';
+           element++) {
+        // Quotes and line breaks become spaces, as in the statevars
+        char c = field[element];
+        putchar((c == '"' || c == '\r' || c == '\n') ? ' ' : c);
+      }
+      printf("\"");
+      continue;
+    }
+
+    for (element = 0; element < count; element++) {
+      if (element > 0) {
+        printf(" ");
+      }
+      print_element(type, field + element * LOG_FIELD_SIZE(type));
+    }
+  }
+
+  printf("\n");
+
+  return;
+}
+
+/* Reports the summary of a session */
+static void print_summary(const uint8_t * data) {
+  uint32_t first_time = get_u32(data + 20);
+  uint32_t last_time = get_u32(data + 24);
+
+  fprintf(stderr, "session %u: blocks %u-%u, loops %u-%u, "
+          "GPS time %02u:%02u:%02u.%03u-%02u:%02u:%02u.%03u, "
+          "%u records dropped\n",
+          get_u32(data), get_u32(data + 4), get_u32(data + 8),
+          get_u32(data + 12), get_u32(data + 16),
+          first_time / 3600000, first_time / 60000 % 60,
+          first_time / 1000 % 60, first_time % 1000,
+          last_time / 3600000, last_time / 60000 % 60,
+          last_time / 1000 % 60, last_time % 1000, get_u32(data + 28));
+
+  return;
+}
+
+/* Parses a loop counter, or a GPS time as hh:mm:ss[.sss] into ms since
+   midnight. Returns the text after it, or NULL if it's malformed.
+*/
+static const char * parse_key(const char * text, uint8_t by_time,
+                              uint32_t * key) {
+  char * end;
+
+  if (!by_time) {
+    *key = strtoul(text, &end, 10);
+    return (end == text) ? NULL : end;
+  }
+
+  unsigned hours;
+  unsigned minutes;
+  unsigned seconds;
+  unsigned ms = 0;
+  int length = 0;
+
+  if (sscanf(text, "%u:%u:%u%n", &hours, &minutes, &seconds, &length) != 3) {
+    return NULL;
+  }
+  text = text + length;
+
+  // Up to three digits of a fraction of a second
+  if (*text == '.') {
+    unsigned scale = 100;
+
+    for (text++; *text >= '0' && *text <= '9'; text++) {
+      ms = ms + (*text - '0') * scale;
+      scale = scale / 10;
+    }
+  }
+
+  *key = ((hours * 60 + minutes) * 60 + seconds) * 1000 + ms;
+
+  return text;
+}
+
+/* Parses first[-last] into the range. Returns 1 if successful; 0 otherwise.
+*/
+static uint8_t parse_range(const char * text, uint8_t by_time,
+                           seek_range_t * range) {
+  text = parse_key(text, by_time, &range->first);
+  if (text == NULL) {
+    return 0;
+  }
+
+  range->last = range->first;
+  if (*text == '-') {
+    text = parse_key(text + 1, by_time, &range->last);
+  }
+
+  return text != NULL && *text == '\0' && range->first <= range->last;
+}
+
+/* Reads the block at the specified address of the image. Returns 1 if
+   successful; 0 otherwise.
+*/
+static uint8_t read_block(FILE * image, uint64_t address, uint8_t * block) {
+  return fseeko(image, (off_t) (address * BYTES_PER_BLOCK), SEEK_SET) == 0 &&
+         fread(block, 1, BYTES_PER_BLOCK, image) == BYTES_PER_BLOCK;
+}
+
+/* Returns the last slot (a block that should start with an index record)
+   whose index is before the key in the session, or at it; -1 if there's
+   none. A slot without an index, such as one past the end of the log, is
+   taken to be after every key.
+*/
+static int64_t last_slot_before(FILE * image, uint64_t base, uint16_t interval,
+                                uint64_t num_slots, uint32_t session,
+                                uint8_t by_time, uint32_t key) {
+  uint8_t block[BYTES_PER_BLOCK];
+  int64_t low = -1;                // known to be before or at the key
+  int64_t high = num_slots;        // known to be after it
+
+  while (high - low > 1) {
+    int64_t middle = low + (high - low) / 2;
+    log_index_t index;
+
+    if (read_block(image, base + middle * interval, block) &&
+        get_index(block, &index) &&
+        (index.session < session ||
+         (index.session == session &&
+          (by_time ? index.gps_time_ms : index.loop_counter) <= key))) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+
+  return low;
+}
+
+/* Prints the part of a session in the range. Returns 0 if successful; 1
+   otherwise.
+*/
+static int seek_and_dump(FILE * image, const seek_range_t * range,
+                         dump_stats_t * stats) {
+  uint8_t block[BYTES_PER_BLOCK];
+  uint64_t num_blocks;
+  uint64_t address;
+  log_index_t index;
+
+  if (fseeko(image, 0, SEEK_END) != 0) {
+    return 1;
+  }
+  num_blocks = ftello(image) / BYTES_PER_BLOCK;
+
+  // The sequence of any block of the log gives where the log starts, and
+  // its first block has an index
+  for (address = 0; address < num_blocks; address++) {
+    if (read_block(image, address, block) && check_block(block) &&
+        get_u32(block + 4) <= address) {
+      break;
+    }
+  }
+
+  uint64_t base = address - get_u32(block + 4);
+  if (address >= num_blocks || !read_block(image, base, block) ||
+      !get_index(block, &index) || index.interval == 0) {
+    fprintf(stderr, "no index found\n");
+    return 1;
+  }
+
+  uint16_t interval = index.interval;
+  uint64_t num_slots = (num_blocks - base + interval - 1) / interval;
+
+  // The channels' schema is at the start of the session
+  if (selected_channel != NULL) {
+    int64_t slot = last_slot_before(image, base, interval, num_slots,
+                                    range->session - 1, 1, UINT32_MAX);
+
+    for (address = base + (slot < 0 ? 0 : slot) * interval;
+         address < num_blocks && read_block(image, address, block) &&
+         check_block(block); address++) {
+      if (get_index(block, &index) && index.session == range->session) {
+        quiet = 1;
+        dump_block(block, stats);
+        quiet = 0;
+        break;
+      }
+    }
+  }
+
+  int64_t slot = last_slot_before(image, base, interval, num_slots,
+                                  range->session, range->by_time,
+                                  range->first);
+  uint32_t session = 0;
+
+  for (address = base + (slot < 0 ? 0 : slot) * interval;
+       address < num_blocks && read_block(image, address, block) &&
+       check_block(block); address++) {
+    if (get_index(block, &index)) {
+      uint32_t key = range->by_time ? index.gps_time_ms : index.loop_counter;
+
+      if (index.session > range->session ||
+          (index.session == range->session && key > range->last)) {
+        break;
+      }
+
+      session = index.session;
+    }
+
+    if (session == range->session) {
+      dump_block(block, stats);
+    }
+  }
+
+  return 0;
+}
+
+static void usage(const char * name) {
+  fprintf(stderr, "Usage: %s [-c channel] [-s session (-l first[-last] | "
+          "-t hh:mm:ss[.sss][-hh:mm:ss[.sss]])] image\n", name);
+
+  return;
+}
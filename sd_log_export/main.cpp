@@ -0,0 +1,648 @@
+/*
+ * File: main.cpp
+ *
+ * Exports everything the loggers have written to a raw image of an SD card
+ * (or a dd dump of one) as CSV and as a columnar binary file. It's meant for
+ * multi-gigabyte images from long runs: the image is memory-mapped and read
+ * in batches, and the blocks of each batch are decoded by as many threads
+ * as there are cores.
+ *
+ * Each block is recognized by its markers and decoded by the layout that
+ * avr-gcc gives the struct that was logged (packed, with 4-byte doubles):
+ *   - globals:        globals_t of rd_headingsteerlog_demo, from start_log();
+ *                     GLOBAL_START at the start, GLOBAL_STOP at the end,
+ *                     checked against the CRC-32 before it. Blocks written
+ *                     before there was one (0xDEADBEEF at the end) are read
+ *                     unchecked.
+ *   - cmps_statevars: statevars_t of cmps_log_demo; 0xDADAFEED at the start,
+ *                     0xCAFEBABE at the end
+ *   - statevars:      statevars_t of sd_card_logger, from
+ *                     sdcard_write_data(); blocks of records (see sd_card.h),
+ *                     checked against their CRC-32, with the snapshots
+ *                     rebuilt from keyframes and deltas by log_delta.c.
+ *                     Blocks written before the header had a CRC-32 (with
+ *                     a CRC-16, after 0xDADAFEED) and before the records
+ *                     were packed (0xCAFEBABE right after the struct) are
+ *                     read too.
+ * Every block of the log can be decoded on its own, so the threads don't
+ * depend on each other.
+ *
+ * The rows of each kind go to <prefix>_<kind>.csv and <prefix>_<kind>.col,
+ * in the order of the blocks on the card, with the address of the block as
+ * the first column. The columnar file is:
+ *   "SDLC" <version: 2> <num_columns: 2>
+ *   for each column: <type: 1> <width: 2> <name_length: 1> <name>
+ *   then row groups, one per batch, until the end of the file:
+ *     <rows: 4> then for each column, <rows * width> bytes
+ * Multi-byte values are little-endian, and a column of chars is width
+ * chars per row, not always terminated.
+ *
+ * Usage: sd_log_export [-j threads] [-o prefix] image
+ */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "crc.h"
+#include "log_delta.h"
+
+#define BYTES_PER_BLOCK           512
+#define BATCH_BLOCKS_PER_THREAD   16384   // 8 MiB
+#define DEFAULT_PREFIX            "log"
+
+// As in rd_headingsteerlog_demo/globals.h
+#define GLOBAL_START              0xBABECAFEUL
+#define GLOBAL_STOP               0xDEADC0DEUL
+#define GLOBAL_STOP_NO_CRC        0xDEADBEEFUL
+#define GLOBAL_CRC_OFFSET         504
+#define GLOBAL_STOP_OFFSET        508
+
+#define STATEVARS_PREFIX          0xDADAFEEDUL
+#define STATEVARS_SUFFIX          0xCAFEBABEUL
+#define CMPS_STATEVARS_SUFFIX_OFFSET 508
+#define STATEVARS_SUFFIX_OFFSET   110
+#define STATEVARS_LENGTH          114
+
+// As in sd_card.h
+#define BLOCK_MAGIC               0xDADAC0DEUL
+#define BLOCK_HEADER_LENGTH       14
+#define BLOCK_CRC                 10      // offset of the header's CRC-32
+#define BLOCK_MAGIC_V1            0xDADAFEEDUL  // also STATEVARS_PREFIX
+#define BLOCK_HEADER_LENGTH_CRC16 12
+#define CCITT_INIT                0xFFFF  // of the CRC-16
+#define RECORD_HEADER_LENGTH      2
+#define RECORD_STATEVARS          0x01
+#define RECORD_STATEVARS_DELTA    0x02
+
+#define COLUMNAR_MAGIC            "SDLC"
+#define COLUMNAR_VERSION          1
+
+// Types of columns, as in log_channel.h
+#define FIELD_U8                  0x01
+#define FIELD_I8                  0x02
+#define FIELD_U16                 0x03
+#define FIELD_I16                 0x04
+#define FIELD_U32                 0x05
+#define FIELD_I32                 0x06
+#define FIELD_FLOAT               0x07
+#define FIELD_CHAR                0x08
+
+struct field_t {
+  const char * name;
+  uint8_t  type;
+  uint16_t offset;          // in the logged struct
+  uint16_t width;           // bytes
+};
+
+struct format_t {
+  const char * name;
+  const field_t * fields;
+  size_t   num_fields;
+};
+
+static const field_t globals_fields[] = {
+  {"loop_counter",        FIELD_U32,    4, 4},
+  {"status_bits",         FIELD_U32,    8, 4},
+  {"button_press_count",  FIELD_U8,    12, 1},
+  {"heading_set",         FIELD_U8,    13, 1},
+  {"mission_started",     FIELD_U8,    14, 1},
+  {"compass_raw",         FIELD_U16,   15, 2},
+  {"compass_deg",         FIELD_FLOAT, 17, 4},
+  {"compass_rad",         FIELD_FLOAT, 21, 4},
+  {"target_heading_deg",  FIELD_FLOAT, 25, 4},
+  {"heading_error_deg",   FIELD_FLOAT, 29, 4},
+  {"steering_servo_us",   FIELD_U16,   33, 2},
+  {"gasbrake_servo_us",   FIELD_U16,   35, 2},
+};
+
+static const field_t cmps_statevars_fields[] = {
+  {"main_loop_counter",   FIELD_U32,    4, 4},
+  {"mission_started",     FIELD_U8,     8, 1},
+  {"heading_raw",         FIELD_U16,    9, 2},
+  {"heading_deg",         FIELD_FLOAT, 11, 4},
+  {"pitch_deg",           FIELD_U8,    15, 1},
+  {"roll_deg",            FIELD_U8,    16, 1},
+};
+
+static const field_t statevars_fields[] = {
+  {"unsigned_long",       FIELD_U32,    4, 4},
+  {"unsigned_short",      FIELD_U16,    8, 2},
+  {"unsigned_byte",       FIELD_U8,    10, 1},
+  {"sentence",            FIELD_CHAR,  11, 84},
+  {"float_value",         FIELD_FLOAT, 95, 4},
+  {"double_value",        FIELD_FLOAT, 99, 4},
+  {"signed_byte",         FIELD_I8,   103, 1},
+  {"signed_short",        FIELD_I16,  104, 2},
+  {"signed_long",         FIELD_I32,  106, 4},
+};
+
+#define NUM_FIELDS(fields) (sizeof(fields) / sizeof(field_t))
+
+enum { FORMAT_GLOBALS, FORMAT_CMPS_STATEVARS, FORMAT_STATEVARS, NUM_FORMATS };
+
+static const format_t formats[NUM_FORMATS] = {
+  {"globals", globals_fields, NUM_FIELDS(globals_fields)},
+  {"cmps_statevars", cmps_statevars_fields, NUM_FIELDS(cmps_statevars_fields)},
+  {"statevars", statevars_fields, NUM_FIELDS(statevars_fields)},
+};
+
+// The rows of one kind that a thread decoded from its share of a batch
+struct table_t {
+  uint32_t rows = 0;
+  std::vector<std::vector<uint8_t>> columns;  // the block, then each field
+  std::string csv;
+};
+
+struct counts_t {
+  uint64_t blocks[NUM_FORMATS] = {};
+  uint64_t rows[NUM_FORMATS] = {};
+  uint64_t bad_crc = 0;
+  uint64_t undecodable = 0;
+};
+
+// What a thread decodes from its share of a batch
+struct worker_t {
+  table_t tables[NUM_FORMATS];
+  counts_t counts;
+};
+
+// The output files of one kind, opened when its first row is found
+struct output_t {
+  FILE * csv = NULL;
+  FILE * columnar = NULL;
+};
+
+static uint16_t crc_ccitt_update(uint16_t crc, uint8_t data);
+static uint32_t get_u32(const uint8_t * bytes);
+static uint16_t get_u16(const uint8_t * bytes);
+static void append_value(std::string & csv, const field_t & field,
+                         const uint8_t * value);
+static void add_row(table_t & table, const format_t & format, uint32_t block,
+                    const uint8_t * frame);
+static void decode_records(const uint8_t * block, uint16_t header_length,
+                           uint32_t address, worker_t & worker);
+static void decode_block(const uint8_t * block, uint32_t address,
+                         worker_t & worker);
+static void decode_range(const uint8_t * image, uint64_t first,
+                         uint64_t last, worker_t * worker);
+static uint8_t open_output(output_t & output, const format_t & format,
+                           const std::string & prefix);
+static uint8_t write_table(output_t & output, const table_t & table);
+static void usage(const char * name);
+
+int main(int argc, char ** argv) {
+  unsigned num_threads = std::thread::hardware_concurrency();
+  std::string prefix = DEFAULT_PREFIX;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "j:o:")) != -1) {
+    switch (opt) {
+      case 'j':
+        num_threads = atoi(optarg);
+        break;
+      case 'o':
+        prefix = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (optind + 1 != argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (num_threads < 1) {
+    num_threads = 1;
+  }
+
+  int fd = open(argv[optind], O_RDONLY);
+  struct stat image_stat;
+  if (fd < 0 || fstat(fd, &image_stat) != 0) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  uint64_t num_blocks = image_stat.st_size / BYTES_PER_BLOCK;
+  const uint8_t * image = NULL;
+
+  if (num_blocks > 0) {
+    void * mapped = mmap(NULL, num_blocks * BYTES_PER_BLOCK, PROT_READ,
+                         MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+      perror("mmap");
+      close(fd);
+      return 1;
+    }
+
+    madvise(mapped, num_blocks * BYTES_PER_BLOCK, MADV_SEQUENTIAL);
+    image = (const uint8_t *) mapped;
+  }
+
+  output_t outputs[NUM_FORMATS];
+  counts_t counts;
+  std::vector<worker_t> workers(num_threads);
+  uint64_t batch_blocks = (uint64_t) BATCH_BLOCKS_PER_THREAD * num_threads;
+  uint64_t batch_start;
+  int status = 0;
+
+  for (batch_start = 0; batch_start < num_blocks && status == 0;
+       batch_start += batch_blocks) {
+    uint64_t batch_end = batch_start + batch_blocks;
+    if (batch_end > num_blocks) {
+      batch_end = num_blocks;
+    }
+
+    // Each thread takes a contiguous share of the batch, so that their
+    // rows are in order when written one thread after another
+    uint64_t share = (batch_end - batch_start + num_threads - 1) /
+                     num_threads;
+    std::vector<std::thread> threads;
+    unsigned t;
+
+    for (t = 0; t < num_threads; t++) {
+      uint64_t first = batch_start + t * share;
+      uint64_t last = first + share;
+
+      workers[t] = worker_t();
+      if (first >= batch_end) {
+        continue;
+      }
+      if (last > batch_end) {
+        last = batch_end;
+      }
+
+      threads.emplace_back(decode_range, image, first, last, &workers[t]);
+    }
+
+    for (std::thread & thread : threads) {
+      thread.join();
+    }
+
+    for (t = 0; t < num_threads && status == 0; t++) {
+      const worker_t & worker = workers[t];
+      int f;
+
+      for (f = 0; f < NUM_FORMATS; f++) {
+        counts.blocks[f] += worker.counts.blocks[f];
+        counts.rows[f] += worker.counts.rows[f];
+
+        if (worker.tables[f].rows == 0) {
+          continue;
+        }
+
+        if ((outputs[f].csv == NULL &&
+             !open_output(outputs[f], formats[f], prefix)) ||
+            !write_table(outputs[f], worker.tables[f])) {
+          perror(prefix.c_str());
+          status = 1;
+          break;
+        }
+      }
+
+      counts.bad_crc += worker.counts.bad_crc;
+      counts.undecodable += worker.counts.undecodable;
+    }
+  }
+
+  int f;
+  for (f = 0; f < NUM_FORMATS; f++) {
+    if (outputs[f].csv != NULL &&
+        (fclose(outputs[f].csv) != 0 || fclose(outputs[f].columnar) != 0)) {
+      perror(prefix.c_str());
+      status = 1;
+    }
+  }
+
+  if (image != NULL) {
+    munmap((void *) image, num_blocks * BYTES_PER_BLOCK);
+  }
+  close(fd);
+
+  fprintf(stderr, "blocks scanned: %llu\n", (unsigned long long) num_blocks);
+  for (f = 0; f < NUM_FORMATS; f++) {
+    fprintf(stderr, "  %-15s %llu blocks, %llu rows\n", formats[f].name,
+            (unsigned long long) counts.blocks[f],
+            (unsigned long long) counts.rows[f]);
+  }
+  fprintf(stderr, "  bad CRC:        %llu\n",
+          (unsigned long long) counts.bad_crc);
+  fprintf(stderr, "  undecodable:    %llu\n",
+          (unsigned long long) counts.undecodable);
+
+  return status;
+}
+
+/* Same as _crc_ccitt_update() in avr-libc's util/crc16.h */
+static uint16_t crc_ccitt_update(uint16_t crc, uint8_t data) {
+  data ^= crc & 0xFF;
+  data ^= data << 4;
+
+  return ((((uint16_t) data << 8) | (crc >> 8)) ^ (uint8_t) (data >> 4) ^
+          ((uint16_t) data << 3));
+}
+
+static uint32_t get_u32(const uint8_t * bytes) {
+  return (uint32_t) bytes[0] | ((uint32_t) bytes[1] << 8) |
+         ((uint32_t) bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+}
+
+static uint16_t get_u16(const uint8_t * bytes) {
+  return (uint16_t) (bytes[0] | (bytes[1] << 8));
+}
+
+/* Appends a field to a row of CSV. Chars are quoted, so commas can't split
+   them; quotes and line breaks become spaces.
+*/
+static void append_value(std::string & csv, const field_t & field,
+                         const uint8_t * value) {
+  char text[32];
+  std::to_chars_result result;
+  uint32_t bits;
+  float real;
+
+  switch (field.type) {
+    case FIELD_U8:
+      result = std::to_chars(text, text + sizeof(text), value[0]);
+      break;
+    case FIELD_I8:
+      result = std::to_chars(text, text + sizeof(text), (int8_t) value[0]);
+      break;
+    case FIELD_U16:
+      result = std::to_chars(text, text + sizeof(text), get_u16(value));
+      break;
+    case FIELD_I16:
+      result = std::to_chars(text, text + sizeof(text),
+                             (int16_t) get_u16(value));
+      break;
+    case FIELD_U32:
+      result = std::to_chars(text, text + sizeof(text), get_u32(value));
+      break;
+    case FIELD_I32:
+      result = std::to_chars(text, text + sizeof(text),
+                             (int32_t) get_u32(value));
+      break;
+    case FIELD_FLOAT:
+      bits = get_u32(value);
+      memcpy(&real, &bits, sizeof(real));
+      result = std::to_chars(text, text + sizeof(text), real);
+      break;
+    default: {
+      uint16_t i;
+
+      csv += '"';
+      for (i = 0; i < field.width && value[i] != '\0'; i++) {
+        char c = value[i];
+        csv += (c == '"' || c == '\r' || c == '\n') ? ' ' : c;
+      }
+      csv += '"';
+
+      return;
+    }
+  }
+
+  csv.append(text, result.ptr);
+
+  return;
+}
+
+/* Adds a row, decoded from frame, to the table */
+static void add_row(table_t & table, const format_t & format, uint32_t block,
+                    const uint8_t * frame) {
+  char text[16];
+  size_t f;
+
+  if (table.columns.empty()) {
+    table.columns.resize(1 + format.num_fields);
+  }
+
+  const uint8_t * address = (const uint8_t *) &block;
+  table.columns[0].insert(table.columns[0].end(), address, address + 4);
+  table.csv.append(text, std::to_chars(text, text + sizeof(text), block).ptr);
+
+  for (f = 0; f < format.num_fields; f++) {
+    const field_t & field = format.fields[f];
+    const uint8_t * value = frame + field.offset;
+
+    table.columns[1 + f].insert(table.columns[1 + f].end(), value,
+                                value + field.width);
+    table.csv += ',';
+    append_value(table.csv, field, value);
+  }
+
+  table.csv += '\n';
+  table.rows++;
+
+  return;
+}
+
+/* Decodes the statevars snapshots in a block of records. Its first
+   snapshot is a keyframe, so it needs nothing from the blocks before it.
+*/
+static void decode_records(const uint8_t * block, uint16_t header_length,
+                           uint32_t address, worker_t & worker) {
+  const uint8_t * records = block + header_length;
+  uint16_t used = get_u16(block + 8);
+  uint8_t frame[STATEVARS_LENGTH];
+  log_delta_decoder_t decoder;
+  uint16_t i;
+
+  worker.counts.blocks[FORMAT_STATEVARS]++;
+  log_delta_decoder_init(&decoder, frame, sizeof(frame));
+
+  for (i = 0; i + RECORD_HEADER_LENGTH <= used; ) {
+    uint8_t type = records[i];
+    uint8_t length = records[i + 1];
+    const uint8_t * data = records + i + RECORD_HEADER_LENGTH;
+
+    i = i + RECORD_HEADER_LENGTH + length;
+    if (i > used) {
+      worker.counts.undecodable++;
+      break;
+    }
+
+    if (type != RECORD_STATEVARS && type != RECORD_STATEVARS_DELTA) {
+      continue;
+    }
+
+    uint8_t kind = (type == RECORD_STATEVARS) ? LOG_DELTA_KEYFRAME :
+                                                LOG_DELTA_DELTA;
+    if (!log_delta_decode(&decoder, kind, data, length)) {
+      worker.counts.undecodable++;
+      continue;
+    }
+
+    add_row(worker.tables[FORMAT_STATEVARS], formats[FORMAT_STATEVARS],
+            address, frame);
+    worker.counts.rows[FORMAT_STATEVARS]++;
+  }
+
+  return;
+}
+
+/* Recognizes a block by its markers and decodes it */
+static void decode_block(const uint8_t * block, uint32_t address,
+                         worker_t & worker) {
+  uint32_t start = get_u32(block);
+  int format = -1;
+
+  if (start == GLOBAL_START) {
+    uint32_t stop = get_u32(block + GLOBAL_STOP_OFFSET);
+
+    if (stop == GLOBAL_STOP &&
+        crc32_update(CRC32_INIT, block, GLOBAL_CRC_OFFSET) !=
+        get_u32(block + GLOBAL_CRC_OFFSET)) {
+      worker.counts.bad_crc++;
+      return;
+    } else if (stop != GLOBAL_STOP && stop != GLOBAL_STOP_NO_CRC) {
+      return;
+    }
+
+    format = FORMAT_GLOBALS;
+  } else if (start == BLOCK_MAGIC) {
+    uint16_t used = get_u16(block + 8);
+
+    if (used <= BYTES_PER_BLOCK - BLOCK_HEADER_LENGTH &&
+        crc32_update(CRC32_INIT, block + BLOCK_HEADER_LENGTH, used) ==
+        get_u32(block + BLOCK_CRC)) {
+      decode_records(block, BLOCK_HEADER_LENGTH, address, worker);
+    } else {
+      worker.counts.bad_crc++;
+    }
+    return;
+  } else if (start == BLOCK_MAGIC_V1) {
+    uint16_t used = get_u16(block + 8);
+
+    if (used <= BYTES_PER_BLOCK - BLOCK_HEADER_LENGTH_CRC16) {
+      uint16_t crc = CCITT_INIT;
+      uint16_t i;
+
+      for (i = 0; i < used; i++) {
+        crc = crc_ccitt_update(crc, block[BLOCK_HEADER_LENGTH_CRC16 + i]);
+      }
+
+      if (crc == get_u16(block + 10)) {
+        decode_records(block, BLOCK_HEADER_LENGTH_CRC16, address, worker);
+        return;
+      }
+    }
+
+    // Blocks that held a whole struct share the magic number
+    if (get_u32(block + CMPS_STATEVARS_SUFFIX_OFFSET) == STATEVARS_SUFFIX) {
+      format = FORMAT_CMPS_STATEVARS;
+    } else if (get_u32(block + STATEVARS_SUFFIX_OFFSET) == STATEVARS_SUFFIX) {
+      format = FORMAT_STATEVARS;
+    } else {
+      worker.counts.bad_crc++;
+      return;
+    }
+  } else {
+    return;
+  }
+
+  add_row(worker.tables[format], formats[format], address, block);
+  worker.counts.blocks[format]++;
+  worker.counts.rows[format]++;
+
+  return;
+}
+
+/* Decodes the blocks from first up to last; run by each thread */
+static void decode_range(const uint8_t * image, uint64_t first,
+                         uint64_t last, worker_t * worker) {
+  uint64_t address;
+
+  for (address = first; address < last; address++) {
+    decode_block(image + address * BYTES_PER_BLOCK, (uint32_t) address,
+                 *worker);
+  }
+
+  return;
+}
+
+/* Opens the files for a kind of row, and writes their headers. Returns 1
+   if successful; 0 otherwise.
+*/
+static uint8_t open_output(output_t & output, const format_t & format,
+                           const std::string & prefix) {
+  std::string base = prefix + "_" + format.name;
+  size_t f;
+
+  output.csv = fopen((base + ".csv").c_str(), "w");
+  output.columnar = fopen((base + ".col").c_str(), "wb");
+  if (output.csv == NULL || output.columnar == NULL) {
+    return 0;
+  }
+
+  fputs("block", output.csv);
+  for (f = 0; f < format.num_fields; f++) {
+    fprintf(output.csv, ",%s", format.fields[f].name);
+  }
+  fputs("\n", output.csv);
+
+  std::string header = COLUMNAR_MAGIC;
+  uint16_t version = COLUMNAR_VERSION;
+  uint16_t num_columns = 1 + format.num_fields;
+  header.append((const char *) &version, 2);
+  header.append((const char *) &num_columns, 2);
+
+  // The block, then each field
+  header += (char) FIELD_U32;
+  header.append("\x04\x00\x05" "block", 8);
+  for (f = 0; f < format.num_fields; f++) {
+    const field_t & field = format.fields[f];
+    uint8_t name_length = strlen(field.name);
+
+    header += (char) field.type;
+    header.append((const char *) &field.width, 2);
+    header += (char) name_length;
+    header += field.name;
+  }
+
+  return fwrite(header.data(), 1, header.size(), output.columnar) ==
+         header.size();
+}
+
+/* Appends a table to the files: its CSV rows, and a row group. Returns 1
+   if successful; 0 otherwise.
+*/
+static uint8_t write_table(output_t & output, const table_t & table) {
+  if (fwrite(table.csv.data(), 1, table.csv.size(), output.csv) !=
+      table.csv.size()) {
+    return 0;
+  }
+
+  if (fwrite(&table.rows, sizeof(table.rows), 1, output.columnar) != 1) {
+    return 0;
+  }
+
+  for (const std::vector<uint8_t> & column : table.columns) {
+    if (fwrite(column.data(), 1, column.size(), output.columnar) !=
+        column.size()) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static void usage(const char * name) {
+  fprintf(stderr, "Usage: %s [-j threads] [-o prefix] image\n", name);
+  fprintf(stderr, "  -j  threads to decode with (default: one per core)\n");
+  fprintf(stderr, "  -o  prefix of the output files (default: %s)\n",
+          DEFAULT_PREFIX);
+
+  return;
+}
@@ -0,0 +1,438 @@
+/*
+ * File: main.c
+ *
+ * Pulls the log off the logger over its serial port, as offload.c sends
+ * it when the offload button is held at power up, and rebuilds the image
+ * of the blocks that the journal and the log take up. In raw mode that's
+ * an image of the card from block 0; in FAT32 mode, LOG.DAT. Either way
+ * sd_log_dump and sd_log_export read it as they would one taken from the
+ * card.
+ *
+ * The blocks are asked for in one request, and arrive one frame each (see
+ * offload.h). A frame that fails its CRC is skipped, so a block that's
+ * lost or corrupted shows up as the next frame being for the wrong block,
+ * or as no frame at all within REPLY_TIMEOUT_MS; either way the rest are
+ * asked for again, from that block, under a new sequence number.
+ *
+ * The image is written in order, so it always holds whole blocks up to
+ * where it stopped. An image that's already there is carried on from its
+ * last whole block, since the blocks of the log don't change once they've
+ * been written. The journal's blocks do, so they're always fetched again.
+ * -f starts over, as it should for an image of another card.
+ *
+ * Opening the port resets an Uno, so the button should be held down as
+ * this starts. The logger is asked where its log is every
+ * REPLY_TIMEOUT_MS until it answers, for up to CONNECT_TIMEOUT_MS.
+ *
+ * Usage: sd_log_offload [-f] port image
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc.h"
+#include "offload.h"
+
+#define PORT_SPEED            B1000000  // as uwrite_init_fast()
+#define REPLY_TIMEOUT_MS      500
+#define CONNECT_TIMEOUT_MS    10000
+#define MAX_RETRIES           20        // requests in a row for a block
+#define PROGRESS_INTERVAL     1024      // blocks between progress reports
+
+typedef struct {
+  int      port;
+  uint32_t sequence;          // of the latest request
+  uint8_t  buffer[2 * OFFLOAD_BLOCK_FRAME_LENGTH]; // received, not parsed
+  size_t   length;
+
+  uint32_t requests;
+  uint32_t frames;
+  uint32_t bad_crc;           // frames that failed their CRC
+  uint32_t stale;             // frames for an earlier request
+} link_t;
+
+// A frame that's been received whole: a block frame, or the info frame
+typedef struct {
+  uint32_t magic;
+  union {
+    offload_info_t info;
+    uint8_t block_frame[OFFLOAD_BLOCK_FRAME_LENGTH];
+  } u;
+} frame_t;
+
+static int open_port(const char * path);
+static uint64_t now_ms(void);
+static uint8_t send_request(link_t * link, uint32_t first_block,
+                            uint32_t count);
+static uint8_t receive_frame(link_t * link, uint32_t timeout_ms,
+                             frame_t * frame);
+static uint8_t parse_frame(link_t * link, frame_t * frame);
+static uint8_t fetch_info(link_t * link, offload_info_t * info);
+static uint8_t fetch_range(link_t * link, int image,
+                           const offload_info_t * info, uint32_t first_block,
+                           uint32_t end_block);
+static void usage(const char * name);
+
+int main(int argc, char ** argv) {
+  uint8_t fresh = 0;
+  int option;
+
+  while ((option = getopt(argc, argv, "f")) != -1) {
+    switch (option) {
+    case 'f':
+      fresh = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (optind != argc - 2) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  link_t link;
+  memset(&link, 0, sizeof(link));
+  link.port = open_port(argv[optind]);
+  if (link.port < 0) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  int image = open(argv[optind + 1], O_RDWR | O_CREAT | (fresh ? O_TRUNC : 0),
+                   0644);
+  if (image < 0) {
+    perror(argv[optind + 1]);
+    return 1;
+  }
+
+  offload_info_t info;
+  if (!fetch_info(&link, &info)) {
+    fprintf(stderr, "The logger didn't answer; was the button held down?\n");
+    return 1;
+  }
+
+  if (info.end_block <= info.first_block ||
+      info.log_first_block < info.first_block ||
+      info.log_first_block > info.end_block) {
+    fprintf(stderr, "Nothing to offload: the logger couldn't read its card\n");
+    return 1;
+  }
+
+  fprintf(stderr, "Log: blocks %u to %u (the journal to %u)\n",
+          info.first_block, info.end_block - 1, info.log_first_block - 1);
+
+  // Carry on after the whole blocks of the image, unless it holds more of
+  // them than there are, when it can't have come from this log
+  uint32_t blocks = info.end_block - info.first_block;
+  uint32_t resume = info.first_block +
+                    (uint32_t) (lseek(image, 0, SEEK_END) /
+                                OFFLOAD_BLOCK_LENGTH);
+
+  if (resume > info.end_block) {
+    fprintf(stderr, "The image is bigger than the log; starting over\n");
+    resume = info.first_block;
+  }
+  if (resume < info.log_first_block) {
+    resume = info.log_first_block;
+  } else if (resume > info.log_first_block) {
+    fprintf(stderr, "Resuming at block %u\n", resume);
+  }
+
+  uint64_t start_ms = now_ms();
+  if (!fetch_range(&link, image, &info, info.first_block,
+                   info.log_first_block) ||
+      !fetch_range(&link, image, &info, resume, info.end_block)) {
+    return 1;
+  }
+
+  if (ftruncate(image, (off_t) blocks * OFFLOAD_BLOCK_LENGTH) != 0) {
+    perror(argv[optind + 1]);
+    return 1;
+  }
+  close(image);
+
+  uint32_t fetched = (info.log_first_block - info.first_block) +
+                     (info.end_block - resume);
+  double seconds = (now_ms() - start_ms) / 1000.0;
+
+  fprintf(stderr, "Offloaded %u blocks in %.1f s (%.1f KB/s)\n", fetched,
+          seconds, seconds > 0 ? fetched * 0.5 / seconds : 0.0);
+  fprintf(stderr, "Requests %u, frames %u, failed their CRC %u, "
+          "stale %u\n", link.requests, link.frames, link.bad_crc,
+          link.stale);
+
+  return 0;
+}
+
+/* Opens the serial port raw, at the offload's speed. Returns its file
+   descriptor; -1 on failure.
+*/
+static int open_port(const char * path) {
+  struct termios settings;
+  int port = open(path, O_RDWR | O_NOCTTY);
+
+  if (port < 0) {
+    return -1;
+  }
+
+  if (tcgetattr(port, &settings) != 0) {
+    close(port);
+    return -1;
+  }
+
+  cfmakeraw(&settings);
+  cfsetispeed(&settings, PORT_SPEED);
+  cfsetospeed(&settings, PORT_SPEED);
+  settings.c_cflag |= CLOCAL | CREAD;
+  settings.c_cc[VMIN] = 0;
+  settings.c_cc[VTIME] = 0;
+
+  if (tcsetattr(port, TCSANOW, &settings) != 0) {
+    close(port);
+    return -1;
+  }
+
+  // Anything from before the offload started (the logger's debug output)
+  // is of no use
+  tcflush(port, TCIOFLUSH);
+
+  return port;
+}
+
+static uint64_t now_ms(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* Asks for count blocks from first_block on (or the info frame, if count
+   is 0), under a new sequence number. Returns 1 if the request was sent;
+   0 otherwise.
+*/
+static uint8_t send_request(link_t * link, uint32_t first_block,
+                            uint32_t count) {
+  offload_request_t request;
+  const uint8_t * bytes = (const uint8_t *) &request;
+  size_t sent = 0;
+
+  link->sequence = link->sequence + 1;
+  link->requests = link->requests + 1;
+
+  request.magic = OFFLOAD_REQUEST_MAGIC;
+  request.sequence = link->sequence;
+  request.first_block = first_block;
+  request.count = count;
+  request.crc = crc32_update(CRC32_INIT, &request,
+                             offsetof(offload_request_t, crc));
+
+  while (sent < sizeof(request)) {
+    ssize_t length = write(link->port, bytes + sent, sizeof(request) - sent);
+
+    if (length < 0 && errno != EINTR) {
+      perror("write");
+      return 0;
+    }
+    if (length > 0) {
+      sent = sent + length;
+    }
+  }
+
+  return 1;
+}
+
+/* Waits up to timeout_ms for a whole frame that answers the latest
+   request. Returns 1 if one came, and copies it to frame; 0 otherwise.
+*/
+static uint8_t receive_frame(link_t * link, uint32_t timeout_ms,
+                             frame_t * frame) {
+  uint64_t deadline = now_ms() + timeout_ms;
+
+  for (;;) {
+    if (parse_frame(link, frame)) {
+      return 1;
+    }
+
+    uint64_t now = now_ms();
+    if (now >= deadline) {
+      return 0;
+    }
+
+    struct pollfd port = { link->port, POLLIN, 0 };
+    if (poll(&port, 1, (int) (deadline - now)) <= 0) {
+      continue;
+    }
+
+    ssize_t length = read(link->port, link->buffer + link->length,
+                          sizeof(link->buffer) - link->length);
+    if (length > 0) {
+      link->length = link->length + length;
+    } else if (length == 0 || errno != EINTR) {
+      // The port's gone; wait out the timeout rather than spin
+      usleep(10000);
+    }
+  }
+}
+
+/* Looks for a whole frame at the start of the bytes received, skipping a
+   byte at a time over anything that isn't one. Returns 1 if one that
+   answers the latest request was found, and copies it to frame; 0 if more
+   bytes are needed.
+*/
+static uint8_t parse_frame(link_t * link, frame_t * frame) {
+  while (link->length >= sizeof(uint32_t)) {
+    uint32_t magic;
+    size_t frame_length;
+
+    memcpy(&magic, link->buffer, sizeof(magic));
+    if (magic == OFFLOAD_INFO_MAGIC) {
+      frame_length = sizeof(offload_info_t);
+    } else if (magic == OFFLOAD_BLOCK_MAGIC) {
+      frame_length = OFFLOAD_BLOCK_FRAME_LENGTH;
+    } else {
+      frame_length = 0;
+    }
+
+    if (frame_length > 0 && link->length < frame_length) {
+      return 0;
+    }
+
+    uint32_t crc = 0;
+    uint32_t sequence = 0;
+    if (frame_length > 0) {
+      memcpy(&crc, link->buffer + frame_length - sizeof(crc), sizeof(crc));
+      memcpy(&sequence, link->buffer + sizeof(magic), sizeof(sequence));
+    }
+
+    if (frame_length == 0 ||
+        crc != crc32_update(CRC32_INIT, link->buffer,
+                            frame_length - sizeof(crc))) {
+      if (frame_length > 0) {
+        link->bad_crc = link->bad_crc + 1;
+      }
+
+      link->length = link->length - 1;
+      memmove(link->buffer, link->buffer + 1, link->length);
+      continue;
+    }
+
+    uint8_t current = (sequence == link->sequence);
+    if (current) {
+      frame->magic = magic;
+      memcpy(&frame->u, link->buffer, frame_length);
+      link->frames = link->frames + 1;
+    } else {
+      link->stale = link->stale + 1;
+    }
+
+    link->length = link->length - frame_length;
+    memmove(link->buffer, link->buffer + frame_length, link->length);
+
+    if (current) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* Asks for the info frame until it comes, or CONNECT_TIMEOUT_MS has
+   passed. Returns 1 if it came, and copies it to info; 0 otherwise.
+*/
+static uint8_t fetch_info(link_t * link, offload_info_t * info) {
+  uint64_t deadline = now_ms() + CONNECT_TIMEOUT_MS;
+  frame_t frame;
+
+  while (now_ms() < deadline) {
+    if (!send_request(link, 0, 0)) {
+      return 0;
+    }
+
+    if (receive_frame(link, REPLY_TIMEOUT_MS, &frame) &&
+        frame.magic == OFFLOAD_INFO_MAGIC) {
+      *info = frame.u.info;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* Fetches the blocks from first_block up to end_block into the image, in
+   order, asking again from a block that doesn't come. Returns 1 if they
+   all came; 0 otherwise.
+*/
+static uint8_t fetch_range(link_t * link, int image,
+                           const offload_info_t * info, uint32_t first_block,
+                           uint32_t end_block) {
+  uint32_t block = first_block;
+  uint32_t retries = 0;
+  frame_t frame;
+
+  if (block < end_block && !send_request(link, block, end_block - block)) {
+    return 0;
+  }
+
+  while (block < end_block) {
+    offload_block_header_t header;
+    uint8_t received = receive_frame(link, REPLY_TIMEOUT_MS, &frame);
+
+    if (received && frame.magic == OFFLOAD_BLOCK_MAGIC) {
+      memcpy(&header, frame.u.block_frame, sizeof(header));
+    }
+
+    if (!received || frame.magic != OFFLOAD_BLOCK_MAGIC ||
+        header.block != block) {
+      retries = retries + 1;
+      if (retries > MAX_RETRIES) {
+        fprintf(stderr, "Block %u didn't come after %u requests\n", block,
+                MAX_RETRIES);
+        return 0;
+      }
+
+      if (!send_request(link, block, end_block - block)) {
+        return 0;
+      }
+      continue;
+    }
+
+    off_t offset = (off_t) (block - info->first_block) *
+                   OFFLOAD_BLOCK_LENGTH;
+    if (pwrite(image, frame.u.block_frame + sizeof(header),
+               OFFLOAD_BLOCK_LENGTH, offset) != OFFLOAD_BLOCK_LENGTH) {
+      perror("image");
+      return 0;
+    }
+
+    block = block + 1;
+    retries = 0;
+
+    if ((block - info->first_block) % PROGRESS_INTERVAL == 0) {
+      fprintf(stderr, "  %u of %u blocks\n", block - info->first_block,
+              info->end_block - info->first_block);
+    }
+  }
+
+  return 1;
+}
+
+static void usage(const char * name) {
+  fprintf(stderr,
+          "Usage: %s [-f] port image\n"
+          "  -f          start over, rather than carry on with the image\n",
+          name);
+
+  return;
+}